@@ -43,6 +43,9 @@
 #include "aws_iot_json_utils.h"
 #include "aws_iot_version.h"
 #include "aws_iot_jobs_interface.h"
+#include "aws_iot_jobs_json.h"
+#include "aws_iot_mqtt_client_dispatch.h"
+#include "aws_iot_thing_topics.h"
 #include "fs_utils.h"
 #include "wifi_utils.h"
 
@@ -50,8 +53,6 @@
 #define INPUT_PARAMETER_AWS_PORT "aws_port"
 #define INPUT_PARAMETER_AWS_THING_NAME "thing_name"
 
-#define AWS_IOT_MY_THING_NAME os_get_boot_arg_str(INPUT_PARAMETER_AWS_THING_NAME)
-
 static struct wcm_handle *h = NULL;
 static bool ap_link_up = false;
 static bool ap_got_ip = false;
@@ -60,6 +61,10 @@ OS_APPINFO {.stack_size=4096};
 
 static int init_platform();
 static AWS_IoT_Client *pmqttClient;
+static AWS_IoT_Dispatcher_t *pDispatcher;
+
+/* the thing name and the jobs topics of the thing, built once from bootArg thing_name */
+static AWS_IoT_Thing_Topics_t thingTopics;
 
 char *aws_root_ca;
 char *aws_device_pkey;
@@ -69,6 +74,24 @@ static jsmn_parser jsonParser;
 static jsmntok_t jsonTokenStruct[MAX_JSON_TOKEN_EXPECTED];
 static int32_t tokenCount;
 
+/* jobs requests are published to the topics of thingTopics, without formatting them again */
+static IoT_Error_t publish_job_request(AWS_IoT_Client *pClient, const char *pTopic, uint16_t topicLen,
+									   char *pPayload, int payloadLen, size_t payloadSize) {
+	IoT_Publish_Message_Params publishParams;
+
+	if(0 > payloadLen || payloadSize <= (size_t) payloadLen) {
+		return LIMIT_EXCEEDED_ERROR;
+	}
+
+	publishParams.qos = QOS0;
+	publishParams.isRetained = 0;
+	publishParams.isDup = 0;
+	publishParams.id = 0;
+	publishParams.payload = pPayload;
+	publishParams.payloadLen = (size_t) payloadLen;
+	return aws_iot_mqtt_publish(pClient, pTopic, topicLen, &publishParams);
+}
+
 static void iot_get_pending_callback_handler(AWS_IoT_Client *pClient, char *topicName, uint16_t topicNameLen,
 									IoT_Publish_Message_Params *params, void *pData) {
 	IOT_UNUSED(pData);
@@ -110,6 +133,7 @@ static void iot_get_pending_callback_handler(AWS_IoT_Client *pClient, char *topi
 static void iot_next_job_callback_handler(AWS_IoT_Client *pClient, char *topicName, uint16_t topicNameLen,
 									IoT_Publish_Message_Params *params, void *pData) {
 	char topicToPublishUpdate[MAX_JOB_TOPIC_LENGTH_BYTES];
+	uint16_t topicToPublishUpdateLen;
 	char messageBuffer[200];
 
 	IOT_UNUSED(pData);
@@ -179,10 +203,15 @@ static void iot_next_job_callback_handler(AWS_IoT_Client *pClient, char *topicNa
 			updateRequest.includeJobDocument = false;
 			updateRequest.clientToken = NULL;
 
-			rc = aws_iot_jobs_send_update(pClient, QOS0, AWS_IOT_MY_THING_NAME, jobId, &updateRequest,
-					topicToPublishUpdate, sizeof(topicToPublishUpdate), messageBuffer, sizeof(messageBuffer));
+			rc = aws_iot_thing_topics_job(&thingTopics, jobId, "update", topicToPublishUpdate,
+					sizeof(topicToPublishUpdate), &topicToPublishUpdateLen);
+			if(SUCCESS == rc) {
+				rc = publish_job_request(pClient, topicToPublishUpdate, topicToPublishUpdateLen, messageBuffer,
+						aws_iot_jobs_json_serialize_update_job_execution_request(messageBuffer, sizeof(messageBuffer),
+								&updateRequest), sizeof(messageBuffer));
+			}
 			if(SUCCESS != rc) {
-				IOT_ERROR("aws_iot_jobs_send_update returned error : %d ", rc);
+				IOT_ERROR("Job update returned error : %d ", rc);
 				return;
 			}
 		}
@@ -270,14 +299,25 @@ int main(int argc, char **argv) {
 		return rc;
 	}
 
+	pDispatcher = os_alloc(sizeof(AWS_IoT_Dispatcher_t));
+	if(NULL == pDispatcher) {
+		IOT_ERROR("Dispatcher allocation failed");
+		return FAILURE;
+	}
+	rc = aws_iot_mqtt_dispatch_init(pDispatcher, pmqttClient);
+	if(SUCCESS != rc) {
+		IOT_ERROR("aws_iot_mqtt_dispatch_init returned error : %d ", rc);
+		return rc;
+	}
+
 	IoT_Client_Connect_Params *connectParams = os_alloc(sizeof(IoT_Client_Connect_Params));
 
 	connectParams->keepAliveIntervalInSec = 600;
 	connectParams->isCleanSession = true;
 	connectParams->MQTTVersion = MQTT_3_1_1;
 	/* we use thing-name as client-id, just to have a unique name */
-	connectParams->pClientID = (char *)AWS_IOT_MY_THING_NAME;
-	connectParams->clientIDLen = (uint16_t) strlen(AWS_IOT_MY_THING_NAME);
+	connectParams->pClientID = thingTopics.thingName;
+	connectParams->clientIDLen = thingTopics.thingNameLen;
 	connectParams->isWillMsgPresent = false;
 	connectParams->usernameLen = 0;
 	connectParams->passwordLen = 0;
@@ -303,85 +343,61 @@ int main(int argc, char **argv) {
 	}
 
 	/* jobs-sample specific logic */
-	char *topicToSubscribeGetPending = os_alloc(MAX_JOB_TOPIC_LENGTH_BYTES);
-	char *topicToSubscribeNotifyNext = os_alloc(MAX_JOB_TOPIC_LENGTH_BYTES);
-	char *topicToSubscribeGetNext = os_alloc(MAX_JOB_TOPIC_LENGTH_BYTES);
-	char *topicToSubscribeUpdateAccepted = os_alloc(MAX_JOB_TOPIC_LENGTH_BYTES);
-	char *topicToSubscribeUpdateRejected = os_alloc(MAX_JOB_TOPIC_LENGTH_BYTES);
-
-	char *topicToPublishGetPending = os_alloc(MAX_JOB_TOPIC_LENGTH_BYTES);
-	char *topicToPublishGetNext = os_alloc(MAX_JOB_TOPIC_LENGTH_BYTES);
-
-	rc = aws_iot_jobs_subscribe_to_job_messages(
-		pmqttClient, QOS0, AWS_IOT_MY_THING_NAME, NULL, JOB_GET_PENDING_TOPIC, JOB_WILDCARD_REPLY_TYPE,
-		iot_get_pending_callback_handler, NULL, topicToSubscribeGetPending, MAX_JOB_TOPIC_LENGTH_BYTES);
-
-	if(SUCCESS != rc) {
-		IOT_ERROR("Error subscribing JOB_GET_PENDING_TOPIC: %d ", rc);
-		return rc;
+	const IoT_Thing_Topic_t *topics = thingTopics.topics;
+	char messageBuffer[100];
+
+	/* the five job topics are subscribed in a single SUBSCRIBE */
+	IoT_Dispatch_Filter_t jobFilters[] = {
+		{topics[IOT_THING_TOPIC_JOBS_GET_ALL].pTopic, topics[IOT_THING_TOPIC_JOBS_GET_ALL].topicLen, QOS0,
+		 iot_get_pending_callback_handler, NULL},
+		{topics[IOT_THING_TOPIC_JOBS_NOTIFY_NEXT].pTopic, topics[IOT_THING_TOPIC_JOBS_NOTIFY_NEXT].topicLen, QOS0,
+		 iot_next_job_callback_handler, NULL},
+		{topics[IOT_THING_TOPIC_JOBS_DESCRIBE_NEXT_ALL].pTopic, topics[IOT_THING_TOPIC_JOBS_DESCRIBE_NEXT_ALL].topicLen,
+		 QOS0, iot_next_job_callback_handler, NULL},
+		{topics[IOT_THING_TOPIC_JOBS_UPDATE_ACCEPTED_ALL].pTopic,
+		 topics[IOT_THING_TOPIC_JOBS_UPDATE_ACCEPTED_ALL].topicLen, QOS0, iot_update_accepted_callback_handler, NULL},
+		{topics[IOT_THING_TOPIC_JOBS_UPDATE_REJECTED_ALL].pTopic,
+		 topics[IOT_THING_TOPIC_JOBS_UPDATE_REJECTED_ALL].topicLen, QOS0, iot_update_rejected_callback_handler, NULL},
+	};
+
+	rc = aws_iot_mqtt_dispatch_subscribe_batch(pDispatcher, jobFilters, 5, mqttInitParams->mqttCommandTimeout_ms);
+	for(int i = 0; i < 5; i++) {
+		os_printf("%.*s: granted %d\n", jobFilters[i].topicFilterLen, jobFilters[i].pTopicFilter,
+				  jobFilters[i].grantedQos);
 	}
-	os_printf("Success subscribing JOB_GET_PENDING_TOPIC: %d\n", rc);
-
-	rc = aws_iot_jobs_subscribe_to_job_messages(
-		pmqttClient, QOS0, AWS_IOT_MY_THING_NAME, NULL, JOB_NOTIFY_NEXT_TOPIC, JOB_REQUEST_TYPE,
-		iot_next_job_callback_handler, NULL, topicToSubscribeNotifyNext, MAX_JOB_TOPIC_LENGTH_BYTES);
-
 	if(SUCCESS != rc) {
-		IOT_ERROR("Error subscribing JOB_NOTIFY_NEXT_TOPIC: %d ", rc);
+		IOT_ERROR("Error subscribing job topics: %d ", rc);
 		return rc;
 	}
-	os_printf("Success subscribing JOB_NOTIFY_NEXT_TOPIC: %d\n", rc);
-
-	rc = aws_iot_jobs_subscribe_to_job_messages(
-		pmqttClient, QOS0, AWS_IOT_MY_THING_NAME, JOB_ID_NEXT, JOB_DESCRIBE_TOPIC, JOB_WILDCARD_REPLY_TYPE,
-		iot_next_job_callback_handler, NULL, topicToSubscribeGetNext, MAX_JOB_TOPIC_LENGTH_BYTES);
-
-	if(SUCCESS != rc) {
-		IOT_ERROR("Error subscribing JOB_DESCRIBE_TOPIC ($next): %d ", rc);
-		return rc;
-	}
-	os_printf("Success subscribing JOB_DESCRIBE_TOPIC ($next): %d\n", rc);
-
-	rc = aws_iot_jobs_subscribe_to_job_messages(
-		pmqttClient, QOS0, AWS_IOT_MY_THING_NAME, JOB_ID_WILDCARD, JOB_UPDATE_TOPIC, JOB_ACCEPTED_REPLY_TYPE,
-		iot_update_accepted_callback_handler, NULL, topicToSubscribeUpdateAccepted, MAX_JOB_TOPIC_LENGTH_BYTES);
+	os_printf("Success subscribing job topics: %d\n", rc);
 
+	rc = publish_job_request(pmqttClient, topics[IOT_THING_TOPIC_JOBS_GET].pTopic, topics[IOT_THING_TOPIC_JOBS_GET].topicLen,
+							 messageBuffer, aws_iot_jobs_json_serialize_client_token_only_request(messageBuffer,
+									 sizeof(messageBuffer), NULL), sizeof(messageBuffer));
 	if(SUCCESS != rc) {
-		IOT_ERROR("Error subscribing JOB_UPDATE_TOPIC/accepted: %d ", rc);
+		IOT_ERROR("Error publishing the pending jobs query: %d ", rc);
 		return rc;
 	}
-	os_printf("Success subscribing JOB_UPDATE_TOPIC/accepted: %d\n", rc);
-
-	rc = aws_iot_jobs_subscribe_to_job_messages(
-		pmqttClient, QOS0, AWS_IOT_MY_THING_NAME, JOB_ID_WILDCARD, JOB_UPDATE_TOPIC, JOB_REJECTED_REPLY_TYPE,
-		iot_update_rejected_callback_handler, NULL, topicToSubscribeUpdateRejected, MAX_JOB_TOPIC_LENGTH_BYTES);
-
-	if(SUCCESS != rc) {
-		IOT_ERROR("Error subscribing JOB_UPDATE_TOPIC/rejected: %d ", rc);
-		return rc;
-	}
-	os_printf("Success subscribing JOB_UPDATE_TOPIC/rejected: %d\n", rc);
-
-	rc = aws_iot_jobs_send_query(pmqttClient, QOS0, AWS_IOT_MY_THING_NAME, NULL, NULL, topicToPublishGetPending,
-									MAX_JOB_TOPIC_LENGTH_BYTES, NULL, 0, JOB_GET_PENDING_TOPIC);
-	if(SUCCESS != rc) {
-		IOT_ERROR("Error calling aws_iot_jobs_send_query: %d ", rc);
-		return rc;
-	}
-	os_printf("Success calling aws_iot_jobs_send_query: %d\n", rc);
+	os_printf("Success publishing the pending jobs query: %d\n", rc);
 
 	AwsIotDescribeJobExecutionRequest *describeRequest = os_alloc(sizeof(AwsIotDescribeJobExecutionRequest));
 	describeRequest->executionNumber = 0;
 	describeRequest->includeJobDocument = true;
 	describeRequest->clientToken = NULL;
 
-	rc = aws_iot_jobs_describe(pmqttClient, QOS0, AWS_IOT_MY_THING_NAME, JOB_ID_NEXT, describeRequest,
-								topicToPublishGetNext, MAX_JOB_TOPIC_LENGTH_BYTES, NULL, 0);
-	os_printf("Success aws_iot_jobs_describe: %d\n", rc);
+	rc = publish_job_request(pmqttClient, topics[IOT_THING_TOPIC_JOBS_DESCRIBE_NEXT].pTopic,
+							 topics[IOT_THING_TOPIC_JOBS_DESCRIBE_NEXT].topicLen, messageBuffer,
+							 aws_iot_jobs_json_serialize_describe_job_execution_request(messageBuffer,
+									 sizeof(messageBuffer), describeRequest), sizeof(messageBuffer));
+	os_printf("Describe next job: %d\n", rc);
 
 	while(SUCCESS == rc) {
 		//Max time the yield function will wait for read messages
 		rc = aws_iot_mqtt_yield(pmqttClient, 50000);
+		if(SUCCESS == rc) {
+			/* resubscribes after a reconnect without session */
+			rc = aws_iot_mqtt_dispatch_poll(pDispatcher);
+		}
 		os_printf("aws_iot_mqtt_yield: %d\n", rc);
 	}
 
@@ -578,6 +594,12 @@ int init_platform() {
 		return rc;
 	}
 
+	rc = aws_iot_thing_topics_init(&thingTopics, os_get_boot_arg_str(INPUT_PARAMETER_AWS_THING_NAME), NULL);
+	if (SUCCESS != rc) {
+		os_printf("[%s] is not a valid thing name. ret:%d\n", INPUT_PARAMETER_AWS_THING_NAME, rc);
+		return rc;
+	}
+
     rc = wifi_main();
     if(rc != 0) {
         os_printf("main -- WiFi Connection Failed due to WCM returning error \n");
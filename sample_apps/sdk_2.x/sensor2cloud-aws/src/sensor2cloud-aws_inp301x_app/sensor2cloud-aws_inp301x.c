@@ -28,6 +28,15 @@
 #include "aws_iot_mqtt_client_interface.h"
 #include "aws_iot_shadow_interface.h"
 #include "aws_iot_json_utils.h"
+#include "aws_iot_mqtt_client_outbox.h"
+#include "aws_iot_mqtt_client_dispatch.h"
+#include "aws_iot_mqtt_client_session.h"
+#include "aws_iot_shadow_demux.h"
+#include "aws_iot_shadow_batch.h"
+#include "aws_iot_shadow_report.h"
+#include "aws_iot_shadow_mirror.h"
+#include "aws_iot_mqtt_client_scheduler.h"
+#include "aws_iot_thing_topics.h"
 
 /* WIFI INTERFACE*/
 #include "wifi/wifi.h"
@@ -204,27 +213,57 @@ static int validate_inputs();
 static AWS_IoT_Client *gpclient;
 
 static bool attemptingReconnect = false;
-static bool shadowUpdateInProgress = false;
 static bool sensorSwitch_delta_callback_recieved = false;
 static bool sensorPollInterval_delta_callback_recieved = false;
 
 sensor_reading_t readings;
 
-inp301x_aws_shadow_params_t inp301x_shadow_params;
-char JsonDocumentBuffer[MAX_LENGTH_OF_UPDATE_JSON_BUFFER];
+/* the thing name and the shadow topics of the thing, built once from boot arg 'thing_name' */
+static AWS_IoT_Thing_Topics_t thing_topics;
 
-static void process_shadow_delta_callback(const char *pJsonString, uint32_t JsonStringDataLen, jsonStruct_t *pContext);
+/* store-and-forward of sensor readings, enabled with boot arg 'outbox' */
+static bool outbox_enabled = false;
+static AWS_IoT_Outbox_t telemetry_outbox;
+static AWS_IoT_Async_Publisher_t telemetry_publisher;
+static char TelemetryBuffer[MAX_LENGTH_OF_UPDATE_JSON_BUFFER];
 
-/* array of shadow attributes used in this Application */
-jsonStruct_t inp301x_shadow_attributes[AWS_SHADOW_ATTRIBUTES_MAX_COUNT] = {
-    /* pKey                     pData                                           dataLength          type                    cb (callback) */
-    {"temperature",             &(inp301x_shadow_params.temperature),           sizeof(float),      SHADOW_JSON_FLOAT,                               NULL},
-    {"pressure",                &(inp301x_shadow_params.pressure),              sizeof(float),      SHADOW_JSON_FLOAT,                               NULL},
-    {"humidity",                &(inp301x_shadow_params.humidity),              sizeof(float),      SHADOW_JSON_FLOAT,                               NULL},
-    {"opticalPower",            &(inp301x_shadow_params.opticalPower),          sizeof(float),      SHADOW_JSON_FLOAT,                               NULL},
-    {"sensorPollInterval",      &(inp301x_shadow_params.sensorPollInterval),    sizeof(uint32_t),   SHADOW_JSON_UINT32,     process_shadow_delta_callback},
-    {"sensorSwitch",            &(inp301x_shadow_params.sensorOn),              sizeof(bool),       SHADOW_JSON_BOOL,       process_shadow_delta_callback},
-};
+/* persistent MQTT session, enabled with boot arg 'persistent_session'. Set up again at each
+ * connect, the SDK shadow deltas are used on a connection where that failed.
+ */
+static bool persistent_session_requested = false;
+static bool persistent_session_enabled = false;
+static AWS_IoT_Dispatcher_t shadow_dispatcher;
+static AWS_IoT_Shadow_Demux_t shadow_demux;
+static AWS_IoT_Session_t mqtt_session;
+
+/* shadow attributes marked dirty are sent together, one update document per coalescing window */
+static AWS_IoT_Shadow_Batch_t shadow_batch;
+
+/* sensor values reported to a named shadow of their own, enabled with boot arg 'telemetry_shadow'
+ * (shadow name) together with 'persistent_session'. The settings stay in the classic shadow.
+ * Set up again at each connect, the sensor values go to the classic shadow on a connection where that failed.
+ */
+static const char *telemetry_shadow_name = NULL;
+static bool telemetry_ready = false;
+static AWS_IoT_Thing_Topics_t telemetry_topics;
+static AWS_IoT_Shadow_Demux_t telemetry_demux;
+static AWS_IoT_Shadow_Batch_t telemetry_batch;
+
+/* change-driven sensor reports, enabled with boot arg 'report_heartbeat' (longest silence in seconds) */
+static uint32_t report_heartbeat = 0;
+static AWS_IoT_Shadow_Reporter_t sensor_reporter;
+
+/* local mirror of the shadow settings, enabled with boot arg 'shadow_mirror', kept in the file system */
+static bool shadow_mirror_enabled = false;
+static bool shadow_mirror_sync_pending = false;
+static AWS_IoT_Shadow_Mirror_t shadow_mirror;
+
+/* publish pacing, enabled with boot arg 'publish_rate' (publishes per second) */
+static uint32_t publish_rate = 0;
+static AWS_IoT_Scheduler_t publish_scheduler;
+
+static void process_shadow_delta(const char *pJsonString, uint32_t JsonStringDataLen, jsonStruct_t *pContext,
+        uint8_t attribute, void *pData);
 
 static struct i2c_bus* init_i2c(void)
 {
@@ -247,6 +286,10 @@ static void ShadowUpdateStatusCallback(const char *pThingName,
         ShadowActions_t action, Shadow_Ack_Status_t status,
         const char *pReceivedJsonDocument, void *pContextData) {
 
+    if (shadow_mirror_enabled) {
+        aws_iot_shadow_mirror_on_response(&shadow_mirror, action, status, pReceivedJsonDocument);
+    }
+
     if (SHADOW_ACK_TIMEOUT == status) {
         os_printf("Update Timeout--\n");
     }
@@ -259,7 +302,53 @@ static void ShadowUpdateStatusCallback(const char *pThingName,
         os_printf("Update Accepted !!\n");
     }
 
-    shadowUpdateInProgress = false;
+    /* the reporter took the values as reported when it selected them */
+    if (SHADOW_ACK_ACCEPTED != status && 0 < report_heartbeat) {
+        (void) aws_iot_shadow_report_force(&sensor_reporter, NULL);
+    }
+}
+
+/**
+ * The callback of the updates of the telemetry shadow, which the shadow mirror does not track
+ */
+static void TelemetryUpdateStatusCallback(const char *pThingName,
+        ShadowActions_t action, Shadow_Ack_Status_t status,
+        const char *pReceivedJsonDocument, void *pContextData) {
+
+    if (SHADOW_ACK_TIMEOUT == status) {
+        os_printf("Telemetry update Timeout--\n");
+    }
+
+    else if (SHADOW_ACK_REJECTED == status) {
+        os_printf("Telemetry update Rejected\n");
+    }
+
+    if (SHADOW_ACK_ACCEPTED != status && 0 < report_heartbeat) {
+        (void) aws_iot_shadow_report_force(&sensor_reporter, NULL);
+    }
+}
+
+/**
+ * The callback of the shadow get sent by the shadow mirror. The desired values of the
+ * document that differ from the current ones are applied through the delta callbacks.
+ */
+static void ShadowGetStatusCallback(const char *pThingName,
+        ShadowActions_t action, Shadow_Ack_Status_t status,
+        const char *pReceivedJsonDocument, void *pContextData) {
+
+    if (SHADOW_ACK_TIMEOUT == status) {
+        os_printf("Get Timeout--\n");
+    }
+
+    else if (SHADOW_ACK_REJECTED == status) {
+        os_printf("Get Rejected\n");
+    }
+
+    else if (SHADOW_ACK_ACCEPTED == status) {
+        os_printf("Get Accepted !!\n");
+    }
+
+    aws_iot_shadow_mirror_on_response(&shadow_mirror, action, status, pReceivedJsonDocument);
 }
 
 /**
@@ -267,12 +356,34 @@ static void ShadowUpdateStatusCallback(const char *pThingName,
  * aws_iot_shadow_register_delta(). Any time a delta is published by AWS IoT Shadow
  * service, the Json document will be delivered via this callback.
  */
-static void process_shadow_delta_callback(const char *pJsonString, uint32_t JsonStringDataLen, jsonStruct_t *pContext) 
+void process_shadow_delta_callback(const char *pJsonString, uint32_t JsonStringDataLen, jsonStruct_t *pContext)
+{
+    if (pContext != NULL) {
+        /* pContext is always an entry of inp301x_shadow_attributes */
+        process_shadow_delta(pJsonString, JsonStringDataLen, pContext,
+                (uint8_t) (pContext - inp301x_shadow_attributes), NULL);
+    }
+}
+
+/**
+ * Handles the delta of a shadow attribute. Registered with
+ * aws_iot_shadow_demux_register_delta_table() in persistent session mode, which
+ * looks the delta keys up in its key index and gives the attribute index.
+ * @param attribute index of the attribute in inp301x_shadow_attributes
+ */
+static void process_shadow_delta(const char *pJsonString, uint32_t JsonStringDataLen, jsonStruct_t *pContext,
+        uint8_t attribute, void *pData)
 {
 
     os_printf("Recieved Delta Callback for shadow attribute: %s, ", pContext->pKey);
 
     if (pContext != NULL) {
+        if (shadow_mirror_enabled) {
+            /* the demultiplexer knows the version of the delta, the SDK shadow does not */
+            aws_iot_shadow_mirror_on_delta(&shadow_mirror, pContext,
+                    persistent_session_enabled ? shadow_demux.deltaVersion : 0);
+        }
+
         /* this is for debug prints, and limited. It can be populated for other valid shadow JsonPrimitiveTypes */
         if (pContext->type == SHADOW_JSON_INT32) {
             os_printf("with desired state: %i\n", *(int32_t *) (pContext->pData));
@@ -300,132 +411,50 @@ static void process_shadow_delta_callback(const char *pJsonString, uint32_t Json
 
         }
 
-        /* check for attribute with pkey 'sensorSwitch' */
-        if (strncmp(pContext->pKey, inp301x_shadow_attributes[AWS_SHADOW_ATTRIBUTE_SENSOR_SWITCH].pKey,
-                        strlen(inp301x_shadow_attributes[AWS_SHADOW_ATTRIBUTE_SENSOR_SWITCH].pKey)) == 0)
-        {
-            /* set a flag to indicate a 'reported' JSON to be sent on this delta recieved / accepted */
+        /* set a flag to indicate a 'reported' JSON to be sent on this delta recieved / accepted */
+        switch (attribute) {
+        case AWS_SHADOW_ATTRIBUTE_SENSOR_SWITCH:
             sensorSwitch_delta_callback_recieved = true;
-        }
-
-        /* check for attribute with pkey 'sensorPollInterval' */
-        else if (strncmp(pContext->pKey, inp301x_shadow_attributes[AWS_SHADOW_ATTRIBUTE_SENSOR_POLL_INTERVAL].pKey,
-                    strlen(inp301x_shadow_attributes[AWS_SHADOW_ATTRIBUTE_SENSOR_POLL_INTERVAL].pKey)) == 0)
-        {
-            /* set a flag to indicate a 'reported' JSON to be sent on this delta recieved / accepted */
+            break;
+        case AWS_SHADOW_ATTRIBUTE_SENSOR_POLL_INTERVAL:
             sensorPollInterval_delta_callback_recieved = true;
+            break;
+        default:
+            break;
         }
     }
 }
 
 /**
- * Calls AWS IoT Shadow service APIs to prepare the JSON document and
- * perform an Update action to a Thing Shadow's sensorSwitch attribute
- * @param shadow_update_type desired or reported
- * @return An IoT Error Type defining successful/failed update action
+ * Yields the client to process the incoming messages and sends the coalesced shadow update
+ * once its window is over. In persistent session mode, also delivers the shadow responses
+ * and reports the session state after a reconnect.
+ * @param timeout_ms time to yield
+ * @return An IoT Error Type, as returned by aws_iot_shadow_yield()
  */
-static IoT_Error_t UpdateSensorSwitchShadowStatus(enum shadow_update_type update_type){
-    int ret;
+static IoT_Error_t YieldShadow(uint32_t timeout_ms){
+    IoT_Error_t ret = aws_iot_shadow_yield(gpclient, timeout_ms);
 
-    /* lets wait for ongoing shadow updates to conclude (if any) by yielding, before sending next update */
-    while(shadowUpdateInProgress){
-        ret = aws_iot_shadow_yield(gpclient, 500);
+    if (persistent_session_enabled) {
+        aws_iot_mqtt_dispatch_poll(&shadow_dispatcher);
+        aws_iot_shadow_demux_poll(&shadow_demux);
+        aws_iot_mqtt_session_poll(&mqtt_session);
     }
-
-    ret = aws_iot_shadow_init_json_document(JsonDocumentBuffer,
-            MAX_LENGTH_OF_UPDATE_JSON_BUFFER);
-    if (SUCCESS == ret) {
-        if (update_type == AWS_SHADOW_UPDATE_REPORTED) {
-            ret = aws_iot_shadow_add_reported(JsonDocumentBuffer,
-                    MAX_LENGTH_OF_UPDATE_JSON_BUFFER, 1, &(inp301x_shadow_attributes[AWS_SHADOW_ATTRIBUTE_SENSOR_SWITCH]));
-        }
-        else if (update_type == AWS_SHADOW_UPDATE_DESIRED) {
-            ret = aws_iot_shadow_add_desired(JsonDocumentBuffer,
-                    MAX_LENGTH_OF_UPDATE_JSON_BUFFER, 1, &(inp301x_shadow_attributes[AWS_SHADOW_ATTRIBUTE_SENSOR_SWITCH]));
-        }
-
-        if (SUCCESS == ret) {
-            ret = aws_iot_finalize_json_document(JsonDocumentBuffer,
-                    MAX_LENGTH_OF_UPDATE_JSON_BUFFER);
-            if (SUCCESS == ret) {
-                os_printf("Update Shadow: %s\n", JsonDocumentBuffer);
-                ret = aws_iot_shadow_update(gpclient, AWS_IOT_MY_THING_NAME,
-                        JsonDocumentBuffer, ShadowUpdateStatusCallback,
-                        NULL, AWS_IOT_SHADOW_ACTION_ACK_TIMEOUT_IN_SEC, true);
-
-                if (shadowUpdateInProgress == true) {
-                    /* print just for debug. this situation should not occur! */
-                    os_printf("SHADOW_ACK of previous update has not yet arrived..\n");
-                }
-
-                shadowUpdateInProgress = true;
-            }
-        }
+    aws_iot_shadow_batch_poll(&shadow_batch);
+    if (telemetry_ready) {
+        aws_iot_shadow_demux_poll(&telemetry_demux);
+        aws_iot_shadow_batch_poll(&telemetry_batch);
     }
-    return ret;
-}
-
-/**
- * Calls AWS IoT Shadow service APIs to prepare the JSON document and
- * perform an Update action to a Thing Shadow's sensorPollInterval attribute
- * @param shadow_update_type desired or reported
- * @return An IoT Error Type defining successful/failed update action
- */
-static IoT_Error_t UpdateSensorPollIntervalShadowStatus(enum shadow_update_type update_type){
-    int ret;
-
-    /* lets wait for ongoing shadow updates to conclude (if any) by yielding, before sending next update */
-    while(shadowUpdateInProgress){
-        ret = aws_iot_shadow_yield(gpclient, 500);
-    }
-
-    ret = aws_iot_shadow_init_json_document(JsonDocumentBuffer,
-            MAX_LENGTH_OF_UPDATE_JSON_BUFFER);
-    if (SUCCESS == ret) {
-
-        if (update_type == AWS_SHADOW_UPDATE_REPORTED) {
-            ret = aws_iot_shadow_add_reported(JsonDocumentBuffer,
-                    MAX_LENGTH_OF_UPDATE_JSON_BUFFER, 1, &(inp301x_shadow_attributes[AWS_SHADOW_ATTRIBUTE_SENSOR_POLL_INTERVAL]));
-        }
-        else if (update_type == AWS_SHADOW_UPDATE_DESIRED) {
-            ret = aws_iot_shadow_add_desired(JsonDocumentBuffer,
-                    MAX_LENGTH_OF_UPDATE_JSON_BUFFER, 1, &(inp301x_shadow_attributes[AWS_SHADOW_ATTRIBUTE_SENSOR_POLL_INTERVAL]));
-        }
-
-        if (SUCCESS == ret) {
-            ret = aws_iot_finalize_json_document(JsonDocumentBuffer,
-                    MAX_LENGTH_OF_UPDATE_JSON_BUFFER);
-            if (SUCCESS == ret) {
-                os_printf("Update Shadow: %s\n", JsonDocumentBuffer);
-                ret = aws_iot_shadow_update(gpclient, AWS_IOT_MY_THING_NAME,
-                        JsonDocumentBuffer, ShadowUpdateStatusCallback,
-                        NULL, AWS_IOT_SHADOW_ACTION_ACK_TIMEOUT_IN_SEC, true);
-
-                if (shadowUpdateInProgress == true) {
-                    /* print just for debug. this situation should not occur! */
-                    os_printf("SHADOW_ACK of previous update has not yet arrived..\n");
-                }
-
-                shadowUpdateInProgress = true;
-            }
-        }
+    if (shadow_mirror_enabled) {
+        aws_iot_shadow_mirror_poll(&shadow_mirror);
     }
     return ret;
 }
 
 /**
- * Calls AWS IoT Shadow service APIs to prepare the JSON document and
- * perform an Update 'reported' action to a Thing Shadow's sensor attributes
- * @return An IoT Error Type defining successful/failed update action
+ * Polls the sensors and copies the readings to the shadow attributes
  */
-static IoT_Error_t UpdateSensorValuesShadowStatus(){
-    int ret;
-
-    /* lets wait for ongoing shadow updates to conclude (if any) by yielding, before sending next update */
-    while(shadowUpdateInProgress){
-        ret = aws_iot_shadow_yield(gpclient, 500);
-    }
-
+static void read_sensor_values(){
     /* poll in the loop and print for now */
     poll_sensors(&readings);
     
@@ -442,37 +471,185 @@ static IoT_Error_t UpdateSensorValuesShadowStatus(){
 
     /* humidity */
     inp301x_shadow_params.humidity = readings.humidity;
+}
 
-    ret = aws_iot_shadow_init_json_document(JsonDocumentBuffer,
-            MAX_LENGTH_OF_UPDATE_JSON_BUFFER);
-    if (SUCCESS == ret) {
-        ret = aws_iot_shadow_add_reported(JsonDocumentBuffer,
-                MAX_LENGTH_OF_UPDATE_JSON_BUFFER, 4,
-                &(inp301x_shadow_attributes[AWS_SHADOW_ATTRIBUTE_TEMPERATURE]),
-                &(inp301x_shadow_attributes[AWS_SHADOW_ATTRIBUTE_PRESSURE]),
-                &(inp301x_shadow_attributes[AWS_SHADOW_ATTRIBUTE_OPTICAL_POWER]),
-                &(inp301x_shadow_attributes[AWS_SHADOW_ATTRIBUTE_HUMIDITY]));
-        if (SUCCESS == ret) {
-            ret = aws_iot_finalize_json_document(JsonDocumentBuffer,
-                    MAX_LENGTH_OF_UPDATE_JSON_BUFFER);
-            if (SUCCESS == ret) {
-                os_printf("Update Shadow: %s\n", JsonDocumentBuffer);
-                ret = aws_iot_shadow_update(gpclient, AWS_IOT_MY_THING_NAME,
-                        JsonDocumentBuffer, ShadowUpdateStatusCallback,
-                        NULL, AWS_IOT_SHADOW_ACTION_ACK_TIMEOUT_IN_SEC, true);
-
-                if (shadowUpdateInProgress == true) {
-                    /* print just for debug. this situation should not occur! */
-                    os_printf("SHADOW_ACK of previous update has not yet arrived..\n");
-                }
+/**
+ * Stores the current sensor values in the persistent outbox as a QoS1 telemetry message.
+ * The message is published as soon as the connection allows it, even after a reboot.
+ * @return An IoT Error Type defining successful/failed store action
+ */
+static IoT_Error_t StoreSensorValuesTelemetry(){
+    IoT_Publish_Message_Params params;
+    const char *topic = os_get_boot_arg_str(INPUT_PARAMETER_TELEMETRY_TOPIC)?: DEFAULT_TELEMETRY_TOPIC;
+    int len;
+
+    read_sensor_values();
+
+    len = snprintf(TelemetryBuffer, sizeof(TelemetryBuffer),
+            "{\"temperature\":%f,\"pressure\":%f,\"humidity\":%f,\"opticalPower\":%f}",
+            inp301x_shadow_params.temperature, inp301x_shadow_params.pressure,
+            inp301x_shadow_params.humidity, inp301x_shadow_params.opticalPower);
+    if(len < 0 || (size_t) len >= sizeof(TelemetryBuffer)) {
+        return SHADOW_JSON_BUFFER_TRUNCATED;
+    }
 
-                shadowUpdateInProgress = true;
-            }
+    params.qos = QOS1;
+    params.isRetained = 0;
+    params.isDup = 0;
+    params.payload = TelemetryBuffer;
+    params.payloadLen = (size_t) len;
+
+    return aws_iot_mqtt_outbox_publish(&telemetry_outbox, topic, (uint16_t) strlen(topic), &params);
+}
+
+/**
+ * Writes a section of the coalesced update document with the serializer generated
+ * from sensor2cloud-aws_inp301x_shadow.json, each attribute with its own format
+ * @param section reported or desired
+ * @param pList attributes to write, entries of inp301x_shadow_attributes
+ * @return An IoT Error Type defining successful/failed write
+ */
+static IoT_Error_t WriteShadowSection(char *pJsonDocument, size_t maxSizeOfJsonDocument,
+        IoT_Shadow_Batch_Section_t section, jsonStruct_t **pList, uint8_t count){
+    uint32_t attributes = 0;
+
+    for (uint8_t i = 0; i < count; i++) {
+        attributes |= INP301X_SHADOW_BIT(pList[i] - inp301x_shadow_attributes);
+    }
+    if (IOT_SHADOW_BATCH_DESIRED == section) {
+        return inp301x_shadow_add_desired(pJsonDocument, maxSizeOfJsonDocument, attributes);
+    }
+    return inp301x_shadow_add_reported(pJsonDocument, maxSizeOfJsonDocument, attributes);
+}
+
+/**
+ * Marks a shadow attribute for the next coalesced update document
+ * @param attribute index of the attribute in inp301x_shadow_attributes
+ * @param update_type desired or reported
+ * @return An IoT Error Type defining successful/failed mark
+ */
+static IoT_Error_t MarkShadowAttribute(e_inp301x_aws_shadow_attributes_t attribute, enum shadow_update_type update_type){
+    return aws_iot_shadow_batch_mark(&shadow_batch, &(inp301x_shadow_attributes[attribute]),
+            (update_type == AWS_SHADOW_UPDATE_DESIRED) ? IOT_SHADOW_BATCH_DESIRED : IOT_SHADOW_BATCH_REPORTED);
+}
+
+/**
+ * Tracks the sensor attributes in the reporter, each with its deadband and the heartbeat
+ * @param heartbeat_s longest time without report of a sensor value
+ * @return An IoT Error Type defining successful/failed initialization
+ */
+static IoT_Error_t InitSensorReporter(uint32_t heartbeat_s){
+    static const float deadbands[][2] = {
+        /* absolute, relative */
+        [AWS_SHADOW_ATTRIBUTE_TEMPERATURE] = {REPORT_DEADBAND_TEMPERATURE, 0.0f},
+        [AWS_SHADOW_ATTRIBUTE_PRESSURE] = {0.0f, REPORT_DEADBAND_PRESSURE},
+        [AWS_SHADOW_ATTRIBUTE_OPTICAL_POWER] = {0.0f, REPORT_DEADBAND_OPTICAL_POWER},
+        [AWS_SHADOW_ATTRIBUTE_HUMIDITY] = {REPORT_DEADBAND_HUMIDITY, 0.0f},
+    };
+    IoT_Shadow_Report_Policy_t policy = iotShadowReportPolicyDefault;
+    int ret;
+
+    ret = aws_iot_shadow_report_init(&sensor_reporter);
+
+    policy.maxSilence_ms = heartbeat_s * 1000;
+    for (int i = AWS_SHADOW_ATTRIBUTE_TEMPERATURE; i <= AWS_SHADOW_ATTRIBUTE_HUMIDITY && SUCCESS == ret; i++) {
+        policy.absoluteDeadband = deadbands[i][0];
+        policy.relativeDeadband = deadbands[i][1];
+        ret = aws_iot_shadow_report_add(&sensor_reporter, &(inp301x_shadow_attributes[i]), &policy);
+    }
+    return ret;
+}
+
+/**
+ * Reads the sensors and marks their values for the next coalesced 'reported' update.
+ * With boot arg 'report_heartbeat', only the values that moved by their deadband or
+ * were not reported for the heartbeat are marked.
+ * With boot arg 'telemetry_shadow', the values go to the telemetry shadow.
+ * @return An IoT Error Type defining successful/failed mark
+ */
+static IoT_Error_t MarkSensorValues(){
+    AWS_IoT_Shadow_Batch_t *batch = telemetry_ready ? &telemetry_batch : &shadow_batch;
+    jsonStruct_t *selected[AWS_SHADOW_ATTRIBUTE_HUMIDITY + 1];
+    uint8_t count;
+    int ret = SUCCESS;
+
+    read_sensor_values();
+
+    if (0 < report_heartbeat) {
+        count = aws_iot_shadow_report_select(&sensor_reporter, selected, sizeof(selected) / sizeof(selected[0]));
+        for (uint8_t i = 0; i < count && SUCCESS == ret; i++) {
+            ret = aws_iot_shadow_batch_mark(batch, selected[i], IOT_SHADOW_BATCH_REPORTED);
         }
+        if (SUCCESS != ret) {
+            /* not marked, the selected values are reported again */
+            (void) aws_iot_shadow_report_force(&sensor_reporter, NULL);
+        }
+        return ret;
+    }
+
+    for (int i = AWS_SHADOW_ATTRIBUTE_TEMPERATURE; i <= AWS_SHADOW_ATTRIBUTE_HUMIDITY && SUCCESS == ret; i++) {
+        ret = aws_iot_shadow_batch_mark(batch, &(inp301x_shadow_attributes[i]), IOT_SHADOW_BATCH_REPORTED);
     }
     return ret;
 }
 
+/**
+ * Tracks the shadow settings in the mirror, restored from the file system if saved before
+ * @return An IoT Error Type defining successful/failed initialization
+ */
+static IoT_Error_t InitShadowMirror(){
+    IoT_Shadow_Mirror_Params_t mirror_params = iotShadowMirrorParamsDefault;
+    int ret;
+
+    mirror_params.pFilePath = MOUNT_PATH "aws_shadow_mirror";
+    ret = aws_iot_shadow_mirror_init(&shadow_mirror, &mirror_params);
+    if (SUCCESS == ret) {
+        ret = aws_iot_shadow_mirror_add(&shadow_mirror, &(inp301x_shadow_attributes[AWS_SHADOW_ATTRIBUTE_SENSOR_POLL_INTERVAL]));
+    }
+    if (SUCCESS == ret) {
+        ret = aws_iot_shadow_mirror_add(&shadow_mirror, &(inp301x_shadow_attributes[AWS_SHADOW_ATTRIBUTE_SENSOR_SWITCH]));
+    }
+    return ret;
+}
+
+/**
+ * Sends what the shadow mirror needs to be in sync with the shadow after a connect: the
+ * settings whose value changed, one setting whose response tells whether the shadow
+ * changed while offline, or a get of the whole shadow document.
+ * @return true while the sync is not over
+ */
+static bool SyncShadowMirror(){
+    jsonStruct_t *selected[AWS_SHADOW_ATTRIBUTES_MAX_COUNT];
+    uint8_t count = 0;
+    int ret;
+
+    switch (aws_iot_shadow_mirror_sync(&shadow_mirror, selected, AWS_SHADOW_ATTRIBUTES_MAX_COUNT, &count)) {
+    case IOT_SHADOW_MIRROR_SYNC_GET:
+        os_printf("Shadow mirror out of date, getting the shadow\n");
+        if (persistent_session_enabled) {
+            ret = aws_iot_shadow_demux_get(&shadow_demux, ShadowGetStatusCallback, NULL,
+                    AWS_IOT_SHADOW_ACTION_ACK_TIMEOUT_IN_SEC);
+        } else {
+            ret = aws_iot_shadow_get(gpclient, thing_topics.thingName, ShadowGetStatusCallback, NULL,
+                    AWS_IOT_SHADOW_ACTION_ACK_TIMEOUT_IN_SEC, true);
+        }
+        if (SUCCESS != ret) {
+            os_printf("Shadow get failed. ret:%d\n", ret);
+            aws_iot_shadow_mirror_on_response(&shadow_mirror, SHADOW_GET, SHADOW_ACK_TIMEOUT, NULL);
+        }
+        return true;
+    case IOT_SHADOW_MIRROR_SYNC_UPDATE:
+        for (uint8_t i = 0; i < count; i++) {
+            (void) aws_iot_shadow_batch_mark(&shadow_batch, selected[i], IOT_SHADOW_BATCH_REPORTED);
+        }
+        return true;
+    case IOT_SHADOW_MIRROR_SYNC_WAIT:
+        return true;
+    default:
+        return false;
+    }
+}
+
 /* AWS Thing Certs from file system */
 char *aws_root_ca;
 char *aws_device_pkey;
@@ -535,6 +712,41 @@ int main() {
 
     os_printf("read_certs() success\n");
 
+    /* readings not yet delivered before the last reboot are still in the outbox, and sent after connecting */
+    outbox_enabled = os_get_boot_arg_int(INPUT_PARAMETER_OUTBOX, 0) != 0;
+    if (outbox_enabled) {
+        rc = aws_iot_mqtt_outbox_init(&telemetry_outbox, NULL);
+        if (SUCCESS != rc) {
+            os_printf("Outbox init failed. ret:%d, readings will not be stored\n", rc);
+            outbox_enabled = false;
+        }
+    }
+
+    persistent_session_requested = os_get_boot_arg_int(INPUT_PARAMETER_PERSISTENT_SESSION, 0) != 0;
+    if (persistent_session_requested) {
+        telemetry_shadow_name = os_get_boot_arg_str(INPUT_PARAMETER_TELEMETRY_SHADOW);
+    }
+    publish_rate = os_get_boot_arg_int(INPUT_PARAMETER_PUBLISH_RATE, 0);
+
+    report_heartbeat = os_get_boot_arg_int(INPUT_PARAMETER_REPORT_HEARTBEAT, 0);
+    if (0 < report_heartbeat) {
+        rc = InitSensorReporter(report_heartbeat);
+        if (SUCCESS != rc) {
+            os_printf("Sensor reporter init failed. ret:%d, every reading will be reported\n", rc);
+            report_heartbeat = 0;
+        }
+    }
+
+    /* the shadow version and settings seen before the last reboot are restored from the file system */
+    shadow_mirror_enabled = os_get_boot_arg_int(INPUT_PARAMETER_SHADOW_MIRROR, 0) != 0;
+    if (shadow_mirror_enabled) {
+        rc = InitShadowMirror();
+        if (SUCCESS != rc) {
+            os_printf("Shadow mirror init failed. ret:%d, shadow resync will report the settings\n", rc);
+            shadow_mirror_enabled = false;
+        }
+    }
+
     struct i2c_bus *bus = NULL;
     sensor_id_t ids = {};
 
@@ -547,6 +759,12 @@ int main() {
         return rc;
     }
 
+    rc = aws_iot_thing_topics_init(&thing_topics, os_get_boot_arg_str(INPUT_PARAMETER_AWS_THING_NAME), NULL);
+    if (SUCCESS != rc) {
+        os_printf("[%s] is not a valid thing name. ret:%d\n", INPUT_PARAMETER_AWS_THING_NAME, rc);
+        return rc;
+    }
+
     /* Initializing the sensors */
 
     /* Initialize i2c */
@@ -611,6 +829,104 @@ int main() {
             continue;
         }
 
+        if (outbox_enabled) {
+            rc = aws_iot_mqtt_async_publish_init(&telemetry_publisher, gpclient, NULL);
+            if (SUCCESS == rc) {
+                aws_iot_mqtt_outbox_set_publisher(&telemetry_outbox, &telemetry_publisher);
+            } else {
+                os_printf("Telemetry publisher init failed. ret:%d\n", rc);
+            }
+        }
+
+        /* the outbox sends the readings on the bulk lane, with the tokens the shadow updates leave */
+        if (0 < publish_rate) {
+            IoT_Scheduler_Params_t scheduler_params = iotSchedulerParamsDefault;
+
+            scheduler_params.publishRate = publish_rate;
+            scheduler_params.publishBurst = publish_rate + scheduler_params.controlReserve;
+            rc = aws_iot_mqtt_scheduler_init(&publish_scheduler, gpclient, &scheduler_params);
+            if (SUCCESS == rc) {
+                if (outbox_enabled) {
+                    aws_iot_mqtt_outbox_set_scheduler(&telemetry_outbox, &publish_scheduler);
+                }
+            } else {
+                os_printf("Publish scheduler init failed. ret:%d\n", rc);
+            }
+        }
+
+        /* the shadow topics are subscribed once with QoS1, the reconnects resume the session
+         * and the broker keeps the subscription and the deltas sent while offline
+         */
+        persistent_session_enabled = persistent_session_requested;
+        if (persistent_session_enabled) {
+            IoT_Session_Params_t session_params = iotSessionParamsDefault;
+            IoT_Shadow_Demux_Params_t demux_params = iotShadowDemuxParamsDefault;
+
+            session_params.isPersistent = true;
+            demux_params.qos = QOS1;
+
+            rc = aws_iot_mqtt_dispatch_init(&shadow_dispatcher, gpclient);
+            if (SUCCESS == rc) {
+                rc = aws_iot_mqtt_session_init(&mqtt_session, gpclient, &session_params);
+                if (SUCCESS == rc) {
+                    rc = aws_iot_shadow_demux_init(&shadow_demux, &shadow_dispatcher, &thing_topics, &demux_params);
+                    if (SUCCESS != rc && MQTT_REQUEST_TIMEOUT_ERROR != rc) {
+                        aws_iot_mqtt_session_deinit(&mqtt_session);
+                    }
+                }
+                if (SUCCESS != rc && MQTT_REQUEST_TIMEOUT_ERROR != rc) {
+                    aws_iot_mqtt_dispatch_deinit(&shadow_dispatcher);
+                }
+            }
+            if (MQTT_REQUEST_TIMEOUT_ERROR == rc) {
+                /* on timeout, the dispatcher keeps retrying the subscription */
+                os_printf("Shadow subscription not acknowledged yet, retrying\n");
+                rc = SUCCESS;
+            }
+            if (SUCCESS != rc) {
+                os_printf("Persistent session init failed. ret:%d, using the shadow client deltas\n", rc);
+                persistent_session_enabled = false;
+            }
+        }
+
+        /* a second shadow on the same connection, with its own responses and its own documents */
+        telemetry_ready = false;
+        if (persistent_session_enabled && NULL != telemetry_shadow_name) {
+            IoT_Shadow_Demux_Params_t demux_params = iotShadowDemuxParamsDefault;
+            IoT_Shadow_Batch_Params_t batch_params = iotShadowBatchParamsDefault;
+
+            rc = aws_iot_thing_topics_init(&telemetry_topics, thing_topics.thingName, telemetry_shadow_name);
+            if (SUCCESS == rc) {
+                rc = aws_iot_shadow_demux_init(&telemetry_demux, &shadow_dispatcher, &telemetry_topics, &demux_params);
+            }
+            if (SUCCESS == rc || MQTT_REQUEST_TIMEOUT_ERROR == rc) {
+                batch_params.timeout_seconds = AWS_IOT_SHADOW_ACTION_ACK_TIMEOUT_IN_SEC;
+                batch_params.callback = TelemetryUpdateStatusCallback;
+                batch_params.pDemux = &telemetry_demux;
+                batch_params.writer = WriteShadowSection;
+                rc = aws_iot_shadow_batch_init(&telemetry_batch, gpclient, telemetry_topics.thingName, &batch_params);
+                if (SUCCESS != rc) {
+                    aws_iot_shadow_demux_deinit(&telemetry_demux);
+                }
+            }
+            if (SUCCESS == rc) {
+                telemetry_ready = true;
+            } else {
+                os_printf("Telemetry shadow init failed. ret:%d, sensor values go to the classic shadow\n", rc);
+            }
+        }
+
+        IoT_Shadow_Batch_Params_t batch_params = iotShadowBatchParamsDefault;
+
+        batch_params.timeout_seconds = AWS_IOT_SHADOW_ACTION_ACK_TIMEOUT_IN_SEC;
+        batch_params.callback = ShadowUpdateStatusCallback;
+        batch_params.pDemux = persistent_session_enabled ? &shadow_demux : NULL;
+        batch_params.writer = WriteShadowSection;
+        rc = aws_iot_shadow_batch_init(&shadow_batch, gpclient, thing_topics.thingName, &batch_params);
+        if (SUCCESS != rc) {
+            os_printf("Shadow batch init failed. ret:%d\n", rc);
+        }
+
         /* In this app, force 'sensorSwitch' and 'sensorPollInterval' values as 'desired' after connect.
          *
          * In some other usecases (eg passive listening devices), at connect, after registering for delta
@@ -629,8 +945,11 @@ int main() {
          * In runtime, T2 will recieve the delta changes done to these shadow attributes
          * if execution comes here after 'error in loop', then will retain previous values!
          */
-        rc = UpdateSensorSwitchShadowStatus(AWS_SHADOW_UPDATE_DESIRED);
-        rc = UpdateSensorPollIntervalShadowStatus(AWS_SHADOW_UPDATE_DESIRED);
+        rc = MarkShadowAttribute(AWS_SHADOW_ATTRIBUTE_SENSOR_SWITCH, AWS_SHADOW_UPDATE_DESIRED);
+        rc = MarkShadowAttribute(AWS_SHADOW_ATTRIBUTE_SENSOR_POLL_INTERVAL, AWS_SHADOW_UPDATE_DESIRED);
+
+        /* both in one document, sent now rather than at the end of the window */
+        rc = aws_iot_shadow_batch_flush(&shadow_batch);
 
         /* Register for delta callbacks only after setting the desired values, to avoid some unwanted corner cases */
         for (int i = 0; i < AWS_SHADOW_ATTRIBUTES_MAX_COUNT; i++)
@@ -638,18 +957,36 @@ int main() {
             /* register shadow delta callbacks only for the shadows attributes which have valid callbacks defined */
             if(inp301x_shadow_attributes[i].cb != NULL) {
                 os_printf("Registering for Delta callbacks on shadow attributes :%s\n", inp301x_shadow_attributes[i].pKey);
-                rc = aws_iot_shadow_register_delta(gpclient, &(inp301x_shadow_attributes[i]));
-                if (SUCCESS != rc) {
-                    os_printf("Shadow Register Delta Error ret:%d\n", rc);
+                if (!persistent_session_enabled) {
+                    rc = aws_iot_shadow_register_delta(gpclient, &(inp301x_shadow_attributes[i]));
+                    if (SUCCESS != rc) {
+                        os_printf("Shadow Register Delta Error ret:%d\n", rc);
+                    }
                 }
             }
         }
 
+        /* the same attributes in one key index, the callback is given the attribute index */
+        if (persistent_session_enabled) {
+            rc = aws_iot_shadow_demux_register_delta_table(&shadow_demux, inp301x_shadow_attributes,
+                    inp301x_shadow_parsers, AWS_SHADOW_ATTRIBUTES_MAX_COUNT, process_shadow_delta, NULL);
+            if (SUCCESS != rc) {
+                os_printf("Shadow Register Delta Error ret:%d\n", rc);
+            }
+        }
+
+        /* the mirror tells whether the shadow changed since it was last seen */
+        if (shadow_mirror_enabled) {
+            aws_iot_shadow_mirror_connected(&shadow_mirror,
+                    persistent_session_enabled && aws_iot_mqtt_session_is_resumed(&mqtt_session));
+            shadow_mirror_sync_pending = true;
+        }
+
         /* send the first sensor value (if sensorOn true), and also start timer with 'sensorPollInterval',
          * so that we can use 'has_timer_expired()' to send sensor values in expected interval in future.
          */
         if (inp301x_shadow_params.sensorOn) {
-            rc = UpdateSensorValuesShadowStatus();
+            rc = MarkSensorValues();
         }
         countdown_ms(&timer, (inp301x_shadow_params.sensorPollInterval)*1000);
 
@@ -658,11 +995,22 @@ int main() {
                 || SUCCESS == rc) {
 
             /* lets have main loop yield and sleep as 500 ms each */
-            rc = aws_iot_shadow_yield(gpclient, 500);
+            rc = YieldShadow(500);
+
+            if (outbox_enabled) {
+                aws_iot_mqtt_outbox_poll(&telemetry_outbox);
+            }
+
             if (NETWORK_ATTEMPTING_RECONNECT == rc) {
                 os_sleep_us(100000, OS_TIMEOUT_NO_WAKEUP);
                 attemptingReconnect = true;
 
+                /* while offline, readings keep being stored in the outbox */
+                if (outbox_enabled && inp301x_shadow_params.sensorOn && has_timer_expired(&timer)) {
+                    StoreSensorValuesTelemetry();
+                    countdown_ms(&timer, (inp301x_shadow_params.sensorPollInterval)*1000);
+                }
+
                 /* If the client is attempting to reconnect, we will skip the rest of the loop */
                 continue;
             }
@@ -678,17 +1026,36 @@ int main() {
                  */
 
                 attemptingReconnect = false;
-                rc = UpdateSensorSwitchShadowStatus(AWS_SHADOW_UPDATE_REPORTED);
-                rc = UpdateSensorPollIntervalShadowStatus(AWS_SHADOW_UPDATE_REPORTED);
+                if (shadow_mirror_enabled) {
+                    /* only what the shadow may have missed is sent, see SyncShadowMirror() */
+                    aws_iot_shadow_mirror_connected(&shadow_mirror,
+                            persistent_session_enabled && aws_iot_mqtt_session_is_resumed(&mqtt_session));
+                    shadow_mirror_sync_pending = true;
+                } else if (persistent_session_enabled && aws_iot_mqtt_session_is_resumed(&mqtt_session)) {
+                    /* nothing was lost: the deltas sent while offline are delivered by the broker */
+                    os_printf("Session resumed, shadow resync skipped\n");
+                } else {
+                    rc = MarkShadowAttribute(AWS_SHADOW_ATTRIBUTE_SENSOR_SWITCH, AWS_SHADOW_UPDATE_REPORTED);
+                    rc = MarkShadowAttribute(AWS_SHADOW_ATTRIBUTE_SENSOR_POLL_INTERVAL, AWS_SHADOW_UPDATE_REPORTED);
+                }
+            }
+
+            /* one step per response, the next one once the batch is idle */
+            if (shadow_mirror_sync_pending && aws_iot_shadow_batch_is_idle(&shadow_batch)) {
+                shadow_mirror_sync_pending = SyncShadowMirror();
             }
 
             if (sensorSwitch_delta_callback_recieved) {
-                rc = UpdateSensorSwitchShadowStatus(AWS_SHADOW_UPDATE_REPORTED);
+                rc = MarkShadowAttribute(AWS_SHADOW_ATTRIBUTE_SENSOR_SWITCH, AWS_SHADOW_UPDATE_REPORTED);
+                if (0 < report_heartbeat && inp301x_shadow_params.sensorOn) {
+                    /* the values in the shadow are as old as the switch off, report them all again */
+                    (void) aws_iot_shadow_report_force(&sensor_reporter, NULL);
+                }
                 sensorSwitch_delta_callback_recieved = false;
             }
 
             if (sensorPollInterval_delta_callback_recieved) {
-                rc = UpdateSensorPollIntervalShadowStatus(AWS_SHADOW_UPDATE_REPORTED);
+                rc = MarkShadowAttribute(AWS_SHADOW_ATTRIBUTE_SENSOR_POLL_INTERVAL, AWS_SHADOW_UPDATE_REPORTED);
 
                 /* restart the timer with the new 'sensorPollInterval' value recieved */
                 countdown_ms(&timer, (inp301x_shadow_params.sensorPollInterval)*1000);
@@ -705,7 +1072,10 @@ int main() {
 
                 /* 'sensorPollInterval' has been elasped, send sensor values if sensorSwitch is ON */
                 if (inp301x_shadow_params.sensorOn) {
-                    rc = UpdateSensorValuesShadowStatus();
+                    rc = MarkSensorValues();
+                    if (outbox_enabled) {
+                        StoreSensorValuesTelemetry();
+                    }
                 }
 
                 /* restart the timer with 'sensorPollInterval', irrespective of sensor values sent or not! */
@@ -725,6 +1095,43 @@ int main() {
             os_printf("An error occurred in the loop %d\n", rc);
         }
 
+        IoT_Shadow_Batch_Stats_t batch_stats;
+
+        aws_iot_shadow_batch_get_stats(&shadow_batch, &batch_stats);
+        os_printf("Shadow updates: %u attributes marked, %u documents sent\n",
+                (unsigned) batch_stats.marks, (unsigned) batch_stats.documents);
+
+        if (0 < report_heartbeat) {
+            IoT_Shadow_Report_Stats_t report_stats;
+
+            aws_iot_shadow_report_get_stats(&sensor_reporter, &report_stats);
+            os_printf("Sensor values: %u read, %u changed, %u heartbeats, %u within deadband\n",
+                    (unsigned) report_stats.checked, (unsigned) report_stats.changed,
+                    (unsigned) report_stats.heartbeats, (unsigned) report_stats.suppressed);
+        }
+
+        if (shadow_mirror_enabled) {
+            IoT_Shadow_Mirror_Stats_t mirror_stats;
+
+            aws_iot_shadow_mirror_get_stats(&shadow_mirror, &mirror_stats);
+            os_printf("Shadow mirror: %u gets, %u updates, %u version checks, %u versions missed\n",
+                    (unsigned) mirror_stats.gets, (unsigned) mirror_stats.updates,
+                    (unsigned) mirror_stats.probes, (unsigned) mirror_stats.gaps);
+            aws_iot_shadow_mirror_save(&shadow_mirror);
+        }
+
+        if (telemetry_ready) {
+            aws_iot_shadow_batch_get_stats(&telemetry_batch, &batch_stats);
+            os_printf("Telemetry shadow updates: %u attributes marked, %u documents sent\n",
+                    (unsigned) batch_stats.marks, (unsigned) batch_stats.documents);
+            aws_iot_shadow_demux_deinit(&telemetry_demux);
+            telemetry_ready = false;
+        }
+
+        if (persistent_session_enabled) {
+            aws_iot_shadow_demux_deinit(&shadow_demux);
+        }
+
         os_printf("Disconnecting\n");
         rc = aws_iot_shadow_disconnect(gpclient);
 
@@ -733,9 +1140,37 @@ int main() {
         }
 
         attemptingReconnect = false;
-        shadowUpdateInProgress = false;
         sensorSwitch_delta_callback_recieved = false;
         sensorPollInterval_delta_callback_recieved = false;
+        shadow_mirror_sync_pending = false;
+
+        if (0 < publish_rate) {
+            IoT_Scheduler_Stats_t scheduler_stats;
+
+            aws_iot_mqtt_scheduler_get_stats(&publish_scheduler, &scheduler_stats);
+            os_printf("Publishes: %u on the wire, telemetry deferred %u times\n",
+                    (unsigned) scheduler_stats.charged,
+                    (unsigned) scheduler_stats.lanes[IOT_SCHEDULER_LANE_BULK].deferred);
+            if (outbox_enabled) {
+                aws_iot_mqtt_outbox_set_scheduler(&telemetry_outbox, NULL);
+            }
+            aws_iot_mqtt_scheduler_deinit(&publish_scheduler);
+        }
+
+        if (outbox_enabled) {
+            /* the outbox keeps the undelivered readings until the next connection */
+            aws_iot_mqtt_outbox_set_publisher(&telemetry_outbox, NULL);
+            aws_iot_mqtt_async_publish_deinit(&telemetry_publisher);
+        }
+
+        if (persistent_session_enabled) {
+            aws_iot_mqtt_session_deinit(&mqtt_session);
+            aws_iot_mqtt_dispatch_deinit(&shadow_dispatcher);
+        }
+
+        if (outbox_enabled || persistent_session_requested || 0 < publish_rate) {
+            aws_iot_mqtt_tap_detach(gpclient);
+        }
 
         /* free 'gpclient' as it will be allocated again when init_and_connect_aws_iot() is called */
         os_free(gpclient);
@@ -817,9 +1252,9 @@ static int init_and_connect_aws_iot() {
         return FAILURE;
     }
 
-    scp->pMyThingName = (char *)AWS_IOT_MY_THING_NAME;
-    scp->pMqttClientId = (char *)AWS_IOT_MY_THING_NAME;
-    scp->mqttClientIdLen = (uint16_t) strlen(AWS_IOT_MY_THING_NAME);
+    scp->pMyThingName = thing_topics.thingName;
+    scp->pMqttClientId = thing_topics.thingName;
+    scp->mqttClientIdLen = thing_topics.thingNameLen;
 
     os_printf("Shadow Connect\n");
     rc = aws_iot_shadow_connect(gpclient, scp);
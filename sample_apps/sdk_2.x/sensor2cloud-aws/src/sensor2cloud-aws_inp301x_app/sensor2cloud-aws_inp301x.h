@@ -29,37 +29,31 @@
 #define INPUT_PARAMETER_AWS_URL "aws_host"
 #define INPUT_PARAMETER_AWS_PORT "aws_port"
 #define INPUT_PARAMETER_AWS_THING_NAME "thing_name"
+#define INPUT_PARAMETER_OUTBOX "outbox"
+#define INPUT_PARAMETER_TELEMETRY_TOPIC "telemetry_topic"
+#define INPUT_PARAMETER_PERSISTENT_SESSION "persistent_session"
+#define INPUT_PARAMETER_PUBLISH_RATE "publish_rate"
+#define INPUT_PARAMETER_REPORT_HEARTBEAT "report_heartbeat"
+#define INPUT_PARAMETER_SHADOW_MIRROR "shadow_mirror"
+#define INPUT_PARAMETER_TELEMETRY_SHADOW "telemetry_shadow"
 
-#define AWS_IOT_MY_THING_NAME os_get_boot_arg_str(INPUT_PARAMETER_AWS_THING_NAME)
+#define DEFAULT_TELEMETRY_TOPIC "inp301x/telemetry"
 
 #define MAX_LENGTH_OF_UPDATE_JSON_BUFFER 256
 
 #define AWS_IOT_SHADOW_ACTION_ACK_TIMEOUT_IN_SEC 10
 
+/* smallest changes of the sensor values reported with boot arg 'report_heartbeat' */
+#define REPORT_DEADBAND_TEMPERATURE 0.5f        /* degrees */
+#define REPORT_DEADBAND_PRESSURE 0.001f         /* fraction of the last value */
+#define REPORT_DEADBAND_HUMIDITY 1.0f           /* percent */
+#define REPORT_DEADBAND_OPTICAL_POWER 0.1f      /* fraction of the last value */
+
 #define SDA_PIN (3)                     /* I2C data pin */
 #define SCL_PIN (4)                     /* I2C clock pin */
 
-typedef enum 
-{
-    AWS_SHADOW_ATTRIBUTE_TEMPERATURE,
-    AWS_SHADOW_ATTRIBUTE_PRESSURE,
-    AWS_SHADOW_ATTRIBUTE_OPTICAL_POWER,
-    AWS_SHADOW_ATTRIBUTE_HUMIDITY,
-    AWS_SHADOW_ATTRIBUTE_SENSOR_POLL_INTERVAL,
-    AWS_SHADOW_ATTRIBUTE_SENSOR_SWITCH,
-    AWS_SHADOW_ATTRIBUTES_MAX_COUNT,
-} e_inp301x_aws_shadow_attributes_t;
-
-
-typedef struct 
-{
-    float       temperature;
-    float       pressure;
-    float       humidity;
-    float       opticalPower;
-    uint32_t    sensorPollInterval;
-    bool        sensorOn;
-} inp301x_aws_shadow_params_t;
+/* shadow attribute enum, values and table, generated from sensor2cloud-aws_inp301x_shadow.json */
+#include "sensor2cloud-aws_inp301x_shadow.h"
 
 enum shadow_update_type
 {
@@ -90,6 +90,13 @@
  *
  * The application takes in the host name, port and thing name as must provide bootArgs and
  * suspend as optional bootArgs.
+ * With the optional bootArg shadow_wildcard=1 the shadow responses and deltas come through a
+ * single wildcard subscription made right after connect, see aws_iot_shadow_demux.h.
+ * Updates are sent through a pipeline, see aws_iot_shadow_pipeline.h: a report does not wait
+ * for the response of the previous one.
+ * With the optional bootArg report_heartbeat=<seconds>, only the values that changed are
+ * reported, temperature by at least REPORT_DEADBAND_TEMPERATURE, and both at least once per
+ * heartbeat, see aws_iot_shadow_report.h.
  * Certs and keys are stored in file system and read from app specific paths defined in the
  * sample code.
  */
@@ -102,6 +109,11 @@
 #include "aws_iot_shadow_interface.h"
 #include "aws_iot_json_utils.h"
 #include "aws_iot_version.h"
+#include "aws_iot_shadow_demux.h"
+#include "aws_iot_shadow_pipeline.h"
+#include "aws_iot_shadow_diff.h"
+#include "aws_iot_shadow_report.h"
+#include "aws_iot_thing_topics.h"
 #include "fs_utils.h"
 #include "wifi_utils.h"
 
@@ -114,17 +126,27 @@
 #define INPUT_PARAMETER_AWS_URL "aws_host"
 #define INPUT_PARAMETER_AWS_PORT "aws_port"
 #define INPUT_PARAMETER_AWS_THING_NAME "thing_name"
+#define INPUT_PARAMETER_SHADOW_WILDCARD "shadow_wildcard"
+#define INPUT_PARAMETER_REPORT_HEARTBEAT "report_heartbeat"
 
-#define AWS_IOT_MY_THING_NAME os_get_boot_arg_str(INPUT_PARAMETER_AWS_THING_NAME)
+/* smallest temperature change reported with bootArg report_heartbeat */
+#define REPORT_DEADBAND_TEMPERATURE 1.0f
 
 static struct wcm_handle *h = NULL;
 static bool ap_link_up = false;
 static bool ap_got_ip = false;
 
+/* the thing name and the shadow topics of the thing, built once from bootArg thing_name */
+static AWS_IoT_Thing_Topics_t thingTopics;
+
 OS_APPINFO {.stack_size=4096};
 
 static int init_platform();
 static AWS_IoT_Client *pmqttClient;
+static AWS_IoT_Dispatcher_t *pDispatcher;
+static AWS_IoT_Shadow_Demux_t *pShadowDemux;
+static AWS_IoT_Shadow_Pipeline_t *pShadowPipeline;
+static AWS_IoT_Shadow_Reporter_t *pReporter;
 
 char *aws_root_ca;
 char *aws_device_pkey;
@@ -156,6 +178,11 @@ static void ShadowUpdateStatusCallback(const char *pThingName, ShadowActions_t a
 	} else if(SHADOW_ACK_ACCEPTED == status) {
 		os_printf("Update Accepted !!\n");
 	}
+
+	/* the reporter took the values as reported when it selected them */
+	if(SHADOW_ACK_ACCEPTED != status && NULL != pReporter) {
+		(void) aws_iot_shadow_report_force(pReporter, NULL);
+	}
 }
 
 static void windowActuate_Callback(const char *pJsonString, uint32_t JsonStringDataLen, jsonStruct_t *pContext) {
@@ -174,6 +201,10 @@ int main() {
 	size_t sizeOfJsonDocumentBuffer = MAX_LENGTH_OF_UPDATE_JSON_BUFFER;
 
 	float temperature = 0.0;
+	bool isShadowWildcard = (0 != os_get_boot_arg_int(INPUT_PARAMETER_SHADOW_WILDCARD, 0));
+	uint32_t reportHeartbeat = os_get_boot_arg_int(INPUT_PARAMETER_REPORT_HEARTBEAT, 0);
+	jsonStruct_t *reportedHandlers[2];
+	uint8_t reportedCount;
 
 	bool windowOpen = false;
 	jsonStruct_t *windowActuator = os_zalloc(sizeof(jsonStruct_t));
@@ -192,6 +223,10 @@ int main() {
 
 	os_printf("\nAWS IoT SDK Version %d.%d.%d-%s\n", VERSION_MAJOR, VERSION_MINOR, VERSION_PATCH, VERSION_TAG);
 
+#ifdef AWS_IOT_SHADOW_DIFF_BENCHMARK
+	aws_iot_shadow_diff_benchmark(1000);
+#endif
+
 	/* takes care of platform specific initializations
 	 * either returns error or blocks until we get ip from AP
 	 */
@@ -220,11 +255,24 @@ int main() {
 		return rc;
 	}
 
+	if(isShadowWildcard) {
+		pDispatcher = os_alloc(sizeof(AWS_IoT_Dispatcher_t));
+		if(NULL == pDispatcher) {
+			IOT_ERROR("Dispatcher allocation failed");
+			return FAILURE;
+		}
+		rc = aws_iot_mqtt_dispatch_init(pDispatcher, pmqttClient);
+		if(SUCCESS != rc) {
+			IOT_ERROR("Dispatcher init error %d", rc);
+			return rc;
+		}
+	}
+
 	ShadowConnectParameters_t *scp = os_zalloc(sizeof(ShadowConnectParameters_t));
-	scp->pMyThingName = (char *)AWS_IOT_MY_THING_NAME;
+	scp->pMyThingName = thingTopics.thingName;
 	/* we use thing-name as client-id, just to have a unique name */
-	scp->pMqttClientId = (char *)AWS_IOT_MY_THING_NAME;
-	scp->mqttClientIdLen = (uint16_t) strlen(AWS_IOT_MY_THING_NAME);
+	scp->pMqttClientId = thingTopics.thingName;
+	scp->mqttClientIdLen = thingTopics.thingNameLen;
 
 	os_printf("Shadow Connect");
 	rc = aws_iot_shadow_connect(pmqttClient, scp);
@@ -244,12 +292,65 @@ int main() {
 		return rc;
 	}
 
-	rc = aws_iot_shadow_register_delta(pmqttClient, windowActuator);
+	if(isShadowWildcard) {
+		/* subscribed once here, the first update does not wait for a SUBSCRIBE */
+		pShadowDemux = os_alloc(sizeof(AWS_IoT_Shadow_Demux_t));
+		if(NULL == pShadowDemux) {
+			IOT_ERROR("Shadow demultiplexer allocation failed");
+			return FAILURE;
+		}
+		rc = aws_iot_shadow_demux_init(pShadowDemux, pDispatcher, &thingTopics, NULL);
+		if(SUCCESS != rc) {
+			IOT_ERROR("Shadow wildcard subscription error %d", rc);
+			return rc;
+		}
+		rc = aws_iot_shadow_demux_register_delta(pShadowDemux, windowActuator);
+	} else {
+		rc = aws_iot_shadow_register_delta(pmqttClient, windowActuator);
+	}
 
 	if(SUCCESS != rc) {
 		IOT_ERROR("Shadow Register Delta Error");
 	}
 
+	IoT_Shadow_Pipeline_Params_t pipelineParams = iotShadowPipelineParamsDefault;
+
+	pipelineParams.pDemux = pShadowDemux;
+	pShadowPipeline = os_alloc(sizeof(AWS_IoT_Shadow_Pipeline_t));
+	if(NULL == pShadowPipeline) {
+		IOT_ERROR("Shadow pipeline allocation failed");
+		return FAILURE;
+	}
+	rc = aws_iot_shadow_pipeline_init(pShadowPipeline, pmqttClient, thingTopics.thingName, &pipelineParams);
+	if(SUCCESS != rc) {
+		IOT_ERROR("Shadow pipeline init error %d", rc);
+		return rc;
+	}
+
+	if(0 < reportHeartbeat) {
+		IoT_Shadow_Report_Policy_t policy = iotShadowReportPolicyDefault;
+
+		pReporter = os_alloc(sizeof(AWS_IoT_Shadow_Reporter_t));
+		if(NULL == pReporter) {
+			IOT_ERROR("Shadow reporter allocation failed");
+			return FAILURE;
+		}
+		rc = aws_iot_shadow_report_init(pReporter);
+		policy.maxSilence_ms = reportHeartbeat * 1000;
+		if(SUCCESS == rc) {
+			/* any change of the window state is reported */
+			rc = aws_iot_shadow_report_add(pReporter, windowActuator, &policy);
+		}
+		policy.absoluteDeadband = REPORT_DEADBAND_TEMPERATURE;
+		if(SUCCESS == rc) {
+			rc = aws_iot_shadow_report_add(pReporter, temperatureHandler, &policy);
+		}
+		if(SUCCESS != rc) {
+			IOT_ERROR("Shadow reporter init error %d", rc);
+			return rc;
+		}
+	}
+
 	temperature = STARTING_ROOMTEMPERATURE;
 
 	// loop and publish a change in temperature
@@ -261,21 +362,52 @@ int main() {
 			continue;
 		}
 
+		if(isShadowWildcard) {
+			(void) aws_iot_mqtt_dispatch_poll(pDispatcher);
+			(void) aws_iot_shadow_demux_poll(pShadowDemux);
+		}
+		(void) aws_iot_shadow_pipeline_poll(pShadowPipeline);
+
 		os_printf("\nOn Device: window state %s\n", windowOpen ? "true" : "false");
 		simulateRoomTemperature(&temperature);
 
-		rc = aws_iot_shadow_init_json_document(JsonDocumentBuffer, sizeOfJsonDocumentBuffer);
-		if(SUCCESS == rc) {
-			rc = aws_iot_shadow_add_reported(JsonDocumentBuffer, sizeOfJsonDocumentBuffer, 2, temperatureHandler,
-											 windowActuator);
+		if(0 < reportHeartbeat) {
+			reportedCount = aws_iot_shadow_report_select(pReporter, reportedHandlers, 2);
+		} else {
+			reportedHandlers[0] = temperatureHandler;
+			reportedHandlers[1] = windowActuator;
+			reportedCount = 2;
+		}
+
+		if(0 == reportedCount) {
+			os_printf("No change to report\n");
+		} else {
+			rc = aws_iot_shadow_init_json_document(JsonDocumentBuffer, sizeOfJsonDocumentBuffer);
+		}
+		if(0 < reportedCount && SUCCESS == rc) {
+			rc = aws_iot_shadow_add_reported(JsonDocumentBuffer, sizeOfJsonDocumentBuffer, reportedCount,
+											 reportedHandlers[0], reportedHandlers[1]);
 			if(SUCCESS == rc) {
 				rc = aws_iot_finalize_json_document(JsonDocumentBuffer, sizeOfJsonDocumentBuffer);
 				if(SUCCESS == rc) {
-					os_printf("Update Shadow: %s\n", JsonDocumentBuffer);
-					rc = aws_iot_shadow_update(pmqttClient, AWS_IOT_MY_THING_NAME, JsonDocumentBuffer,
-											   ShadowUpdateStatusCallback, NULL, 10, true);
+					os_printf("Update Shadow: %s (%u in flight)\n", JsonDocumentBuffer,
+							  (unsigned) aws_iot_shadow_pipeline_in_flight(pShadowPipeline));
+					rc = aws_iot_shadow_pipeline_update(pShadowPipeline, JsonDocumentBuffer,
+														ShadowUpdateStatusCallback, NULL, 10);
+					if(SHADOW_PIPELINE_FULL_ERROR == rc) {
+						/* the next report carries the newer values anyway */
+						os_printf("Update skipped, pipeline full\n");
+						if(0 < reportHeartbeat) {
+							(void) aws_iot_shadow_report_force(pReporter, NULL);
+						}
+						rc = SUCCESS;
+					}
 				}
 			}
+			if(SUCCESS != rc && 0 < reportHeartbeat) {
+				/* not sent, the selected values are reported again */
+				(void) aws_iot_shadow_report_force(pReporter, NULL);
+			}
 		}
 
 		os_sleep_us(3000000, OS_TIMEOUT_NO_WAKEUP);
@@ -285,6 +417,12 @@ int main() {
 		IOT_ERROR("An error occurred in the loop %d", rc);
 	}
 
+	(void) aws_iot_shadow_pipeline_deinit(pShadowPipeline);
+
+	if(isShadowWildcard) {
+		(void) aws_iot_shadow_demux_deinit(pShadowDemux);
+	}
+
 	os_printf("Disconnecting\n");
 	rc = aws_iot_shadow_disconnect(pmqttClient);
 
@@ -488,6 +626,12 @@ int init_platform() {
 		return rc;
 	}
 
+	rc = aws_iot_thing_topics_init(&thingTopics, os_get_boot_arg_str(INPUT_PARAMETER_AWS_THING_NAME), NULL);
+	if (SUCCESS != rc) {
+		os_printf("[%s] is not a valid thing name. ret:%d\n", INPUT_PARAMETER_AWS_THING_NAME, rc);
+		return rc;
+	}
+
     rc = wifi_main();
     if(rc != 0) {
         os_printf("main -- WiFi Connection Failed due to WCM returning error \n");
@@ -43,8 +43,32 @@
  }
  *------------------------------------
 
+ * With the optional bootArg 'rx_task=1', socket reads are owned by a dedicated receive task
+ * and the received messages are drained from its queue by the main loop, instead of being
+ * handled inline in aws_iot_mqtt_yield().
+ *
+ * With the optional bootArg 'async_publish=1', QoS1 messages are published without waiting
+ * for their PUBACK. The acks are reported later by a completion callback. The publish topic
+ * is serialized once for QoS0 and QoS1, and each message only adds its payload to it.
+ * With 'adaptive_rto=1' as well, unacknowledged messages are retransmitted after a timeout
+ * derived from the measured PUBACK and SUBACK round-trip times instead of a fixed interval.
+ *
+ * With the optional bootArg 'mqtt5=1', the client talks MQTT 5 to the broker. Each publish
+ * topic is sent once per connection and replaced by a two byte topic alias afterwards, and
+ * QoS1 messages are skipped while the broker's receive maximum is reached.
+ *
+ * With the optional bootArg 'jitter_reconnect=1', a lost connection is restored by a reconnect
+ * state machine instead of the auto-reconnect of aws_iot_mqtt_yield(): attempts run on their
+ * own thread after a randomized backoff, wait for the Wi-Fi link while it is down, and are made
+ * right away when it comes back. The main loop keeps running during the outage.
+ *
+ * With the optional bootArg 'adaptive_keepalive=1', PINGREQs are only sent after an idle
+ * period learned from the connection, and are aligned to the wake period given by the
+ * optional bootArg 'wake_period_ms'.
+ *
  * The application takes in the host name, port and thing name (as client-id) as must
- * provide bootArgs and publish_topic, subscribe_topic and suspend as optional bootArgs.
+ * provide bootArgs and publish_topic, subscribe_topic, rx_task, async_publish, adaptive_rto,
+ * mqtt5, jitter_reconnect, adaptive_keepalive, wake_period_ms and suspend as optional bootArgs.
  * Certs and keys are stored in file system and read from app specific paths defined in the
  * sample code.
  */
@@ -55,6 +79,12 @@
 #include "aws_iot_log.h"
 #include "aws_iot_config.h"
 #include "aws_iot_mqtt_client_interface.h"
+#include "aws_iot_mqtt_client_async_publish.h"
+#include "aws_iot_mqtt_client_keepalive.h"
+#include "aws_iot_mqtt_client_reconnect.h"
+#include "aws_iot_mqtt_client_rx_task.h"
+#include "aws_iot_mqtt_client_rtt.h"
+#include "aws_iot_mqtt_client_v5.h"
 #include "aws_iot_version.h"
 #include "aws_iot_json_utils.h"
 #include "fs_utils.h"
@@ -67,6 +97,13 @@
 #define INPUT_PARAMETER_AWS_THING_NAME "thing_name"
 #define INPUT_PARAMETER_AWS_PUBLISH_TOPIC "publish_topic"
 #define INPUT_PARAMETER_AWS_SUBSCRIBE_TOPIC "subscribe_topic"
+#define INPUT_PARAMETER_RX_TASK "rx_task"
+#define INPUT_PARAMETER_ASYNC_PUBLISH "async_publish"
+#define INPUT_PARAMETER_ADAPTIVE_RTO "adaptive_rto"
+#define INPUT_PARAMETER_MQTT5 "mqtt5"
+#define INPUT_PARAMETER_JITTER_RECONNECT "jitter_reconnect"
+#define INPUT_PARAMETER_ADAPTIVE_KEEPALIVE "adaptive_keepalive"
+#define INPUT_PARAMETER_WAKE_PERIOD "wake_period_ms"
 
 #define AWS_IOT_MY_THING_NAME os_get_boot_arg_str(INPUT_PARAMETER_AWS_THING_NAME)
 
@@ -78,6 +115,14 @@ OS_APPINFO {.stack_size=4096};
 
 static int init_platform();
 static AWS_IoT_Client *pmqttClient;
+static AWS_IoT_Rx_Task_t *pRxTask = NULL;
+static AWS_IoT_Async_Publisher_t *pAsyncPublisher = NULL;
+static AWS_IoT_Rtt_t *pRtt = NULL;
+static IoT_Prepared_Publish_t *pPreparedQOS0 = NULL;
+static IoT_Prepared_Publish_t *pPreparedQOS1 = NULL;
+static AWS_IoT_Keepalive_t *pKeepalive = NULL;
+static AWS_IoT_Mqtt5_t *pMqtt5 = NULL;
+static AWS_IoT_Reconnect_t *pReconnect = NULL;
 
 char *aws_root_ca;
 char *aws_device_pkey;
@@ -102,6 +147,54 @@ static void iot_subscribe_callback_handler(AWS_IoT_Client *pClient, char *topicN
 	os_free(msg_received);
 }
 
+/**
+ * Drains the messages queued by the receive task. Runs on the main loop, so
+ * the processing time of a message never delays the socket reads.
+ */
+static void process_rx_task_messages(void) {
+	IoT_Rx_Message_t *msg;
+
+	while(NULL != (msg = aws_iot_mqtt_rx_task_peek(pRxTask))) {
+		os_printf("\n<--- Message Received on Subscribed Topic [%.*s]%s\n", msg->topicNameLen, msg->topicName,
+				msg->isTruncated ? " (truncated)" : "");
+		parse_received_message((char *) msg->payload, msg->payloadLen);
+		aws_iot_mqtt_rx_task_release(pRxTask);
+	}
+}
+
+static void async_publish_complete_handler(AWS_IoT_Client *pClient, uint16_t packetId,
+									IoT_Async_Publish_Status_t status, void *pData) {
+	IOT_UNUSED(pClient);
+	IOT_UNUSED(pData);
+	os_printf("\nQoS1 Message packet id %u %s\n", packetId,
+			IOT_ASYNC_PUBLISH_ACKED == status ? "acknowledged" : "not acknowledged");
+}
+
+static IoT_Error_t publish_message(const char *topic, IoT_Publish_Message_Params *params,
+		const IoT_Prepared_Publish_t *pPrepared) {
+	IoT_Error_t rc;
+
+	if(NULL != pRxTask) {
+		// a QoS1 message waiting for room in the queue holds the client until it is drained
+		while(SUCCESS != aws_iot_mqtt_rx_task_lock(pRxTask)) {
+			process_rx_task_messages();
+		}
+	}
+	if(NULL != pAsyncPublisher && NULL != pPrepared) {
+		rc = aws_iot_mqtt_async_publish_prepared(pAsyncPublisher, pPrepared, params->payload, params->payloadLen,
+				async_publish_complete_handler, NULL, NULL);
+	} else if(NULL != pAsyncPublisher && QOS1 == params->qos) {
+		rc = aws_iot_mqtt_async_publish(pAsyncPublisher, topic, strlen(topic), params,
+				async_publish_complete_handler, NULL, NULL);
+	} else {
+		rc = aws_iot_mqtt_publish(pmqttClient, topic, strlen(topic), params);
+	}
+	if(NULL != pRxTask) {
+		aws_iot_mqtt_rx_task_unlock(pRxTask);
+	}
+	return rc;
+}
+
 static void disconnectCallbackHandler(AWS_IoT_Client *pClient, void *data) {
 	os_printf("MQTT Disconnect\n");
 	IoT_Error_t rc = FAILURE;
@@ -112,6 +205,11 @@ static void disconnectCallbackHandler(AWS_IoT_Client *pClient, void *data) {
 
 	IOT_UNUSED(data);
 
+	if(NULL != pReconnect) {
+		os_printf("Reconnect state machine will restore the connection\n");
+		return;
+	}
+
 	if(aws_iot_is_autoreconnect_enabled(pClient)) {
 		os_printf("Auto Reconnect is enabled, Reconnecting attempt will start now\n");
 	} else {
@@ -125,6 +223,15 @@ static void disconnectCallbackHandler(AWS_IoT_Client *pClient, void *data) {
 	}
 }
 
+static void reconnectAttemptHandler(AWS_IoT_Client *pClient, const IoT_Reconnect_Attempt_t *pAttempt, void *data) {
+	IOT_UNUSED(pClient);
+	IOT_UNUSED(data);
+
+	os_printf("Reconnect attempt %u %s (%d) after %u ms backoff%s, took %u ms, outage %u ms\n",
+			(unsigned) pAttempt->number, (SUCCESS == pAttempt->rc) ? "Successful" : "Failed", pAttempt->rc,
+			(unsigned) pAttempt->backoff_ms, pAttempt->isLinkTriggered ? " (link up)" : "",
+			(unsigned) pAttempt->duration_ms, (unsigned) pAttempt->outage_ms);
+}
 
 int main(int argc, char **argv) {
 	bool infinitePublishFlag = true;
@@ -167,6 +274,20 @@ int main(int argc, char **argv) {
 		return rc;
 	}
 
+	/* before the connect, and below the extensions initialized after it */
+	if (os_get_boot_arg_int(INPUT_PARAMETER_MQTT5, 0) != 0) {
+		pMqtt5 = os_alloc(sizeof(AWS_IoT_Mqtt5_t));
+		if(NULL == pMqtt5) {
+			IOT_ERROR("MQTT 5 adapter allocation failed");
+			return FAILURE;
+		}
+		rc = aws_iot_mqtt_v5_attach(pMqtt5, pmqttClient, NULL);
+		if(SUCCESS != rc) {
+			IOT_ERROR("Unable to attach the MQTT 5 adapter - %d", rc);
+			return rc;
+		}
+	}
+
 	IoT_Client_Connect_Params *connectParams = os_alloc(sizeof(IoT_Client_Connect_Params));
 
 	connectParams->keepAliveIntervalInSec = 600;
@@ -189,15 +310,32 @@ int main(int argc, char **argv) {
 		return rc;
 	}
 
-	/*
-	 * Enable Auto Reconnect functionality. Minimum and Maximum time of Exponential backoff are set in aws_iot_config.h
-	 *  #AWS_IOT_MQTT_MIN_RECONNECT_WAIT_INTERVAL
-	 *  #AWS_IOT_MQTT_MAX_RECONNECT_WAIT_INTERVAL
-	 */
-	rc = aws_iot_mqtt_autoreconnect_set_status(pmqttClient, true);
-	if(SUCCESS != rc) {
-		IOT_ERROR("Unable to set Auto Reconnect to true - %d", rc);
-		return rc;
+	if (os_get_boot_arg_int(INPUT_PARAMETER_JITTER_RECONNECT, 0) != 0) {
+		IoT_Reconnect_Params_t reconnectParams = iotReconnectParamsDefault;
+
+		reconnectParams.isAttemptInThread = true;
+		reconnectParams.handler = reconnectAttemptHandler;
+		pReconnect = os_alloc(sizeof(AWS_IoT_Reconnect_t));
+		if(NULL == pReconnect) {
+			IOT_ERROR("Reconnect state machine allocation failed");
+			return FAILURE;
+		}
+		rc = aws_iot_mqtt_reconnect_init(pReconnect, pmqttClient, &reconnectParams);
+		if(SUCCESS != rc) {
+			IOT_ERROR("Unable to init the reconnect state machine - %d", rc);
+			return rc;
+		}
+	} else {
+		/*
+		 * Enable Auto Reconnect functionality. Minimum and Maximum time of Exponential backoff are set in aws_iot_config.h
+		 *  #AWS_IOT_MQTT_MIN_RECONNECT_WAIT_INTERVAL
+		 *  #AWS_IOT_MQTT_MAX_RECONNECT_WAIT_INTERVAL
+		 */
+		rc = aws_iot_mqtt_autoreconnect_set_status(pmqttClient, true);
+		if(SUCCESS != rc) {
+			IOT_ERROR("Unable to set Auto Reconnect to true - %d", rc);
+			return rc;
+		}
 	}
 
 	/* subscribe-publish-sample specific logic */
@@ -206,14 +344,82 @@ int main(int argc, char **argv) {
 		subscribe_topic = "inno_test/ctrl";
 	}
 
+	if (os_get_boot_arg_int(INPUT_PARAMETER_RX_TASK, 0) != 0) {
+		pRxTask = os_alloc(sizeof(AWS_IoT_Rx_Task_t));
+		if(NULL == pRxTask) {
+			IOT_ERROR("Receive task allocation failed");
+			return FAILURE;
+		}
+		rc = aws_iot_mqtt_rx_task_init(pRxTask, pmqttClient, NULL);
+		if(SUCCESS != rc) {
+			IOT_ERROR("Unable to init the receive task - %d", rc);
+			return rc;
+		}
+	}
+
+	if (os_get_boot_arg_int(INPUT_PARAMETER_ASYNC_PUBLISH, 0) != 0) {
+		pAsyncPublisher = os_alloc(sizeof(AWS_IoT_Async_Publisher_t));
+		if(NULL == pAsyncPublisher) {
+			IOT_ERROR("Async publisher allocation failed");
+			return FAILURE;
+		}
+		rc = aws_iot_mqtt_async_publish_init(pAsyncPublisher, pmqttClient, NULL);
+		if(SUCCESS != rc) {
+			IOT_ERROR("Unable to init the async publisher - %d", rc);
+			return rc;
+		}
+
+		if (os_get_boot_arg_int(INPUT_PARAMETER_ADAPTIVE_RTO, 0) != 0) {
+			pRtt = os_alloc(sizeof(AWS_IoT_Rtt_t));
+			if(NULL == pRtt) {
+				IOT_ERROR("RTT estimator allocation failed");
+				return FAILURE;
+			}
+			rc = aws_iot_mqtt_rtt_init(pRtt, pmqttClient, NULL);
+			if(SUCCESS != rc) {
+				IOT_ERROR("Unable to init the RTT estimator - %d", rc);
+				return rc;
+			}
+			aws_iot_mqtt_async_publish_set_rtt(pAsyncPublisher, pRtt);
+		}
+	}
+
+	if (os_get_boot_arg_int(INPUT_PARAMETER_ADAPTIVE_KEEPALIVE, 0) != 0) {
+		pKeepalive = os_alloc(sizeof(AWS_IoT_Keepalive_t));
+		if(NULL == pKeepalive) {
+			IOT_ERROR("Adaptive keepalive allocation failed");
+			return FAILURE;
+		}
+		rc = aws_iot_mqtt_keepalive_init(pKeepalive, pmqttClient, NULL);
+		if(SUCCESS != rc) {
+			IOT_ERROR("Unable to init the adaptive keepalive - %d", rc);
+			return rc;
+		}
+		aws_iot_mqtt_keepalive_set_wake_schedule(pKeepalive, aws_iot_mqtt_tap_now_ms(),
+				os_get_boot_arg_int(INPUT_PARAMETER_WAKE_PERIOD, 0));
+	}
+
 	os_printf("Subscribing...\n");
-	rc = aws_iot_mqtt_subscribe(pmqttClient, subscribe_topic,
-			strlen(subscribe_topic), QOS0, iot_subscribe_callback_handler, NULL);
+	if (NULL != pRxTask) {
+		rc = aws_iot_mqtt_rx_task_subscribe(pRxTask, subscribe_topic, strlen(subscribe_topic), QOS0);
+	} else {
+		rc = aws_iot_mqtt_subscribe(pmqttClient, subscribe_topic,
+				strlen(subscribe_topic), QOS0, iot_subscribe_callback_handler, NULL);
+	}
 	if(SUCCESS != rc) {
 		IOT_ERROR("Error subscribing : %d ", rc);
 		return rc;
 	}
 
+	if (NULL != pRxTask) {
+		rc = aws_iot_mqtt_rx_task_start(pRxTask);
+		if(SUCCESS != rc) {
+			IOT_ERROR("Unable to start the receive task - %d", rc);
+			return rc;
+		}
+		os_printf("Receive task started\n");
+	}
+
 	os_printf("Subscribed to topic [%s] ret[%d] qos[%d]\n", subscribe_topic, rc, QOS0);
 
 	int message_id = 0;
@@ -234,11 +440,63 @@ int main(int argc, char **argv) {
 		infinitePublishFlag = false;
 	}
 
+	if(NULL != pAsyncPublisher) {
+		pPreparedQOS0 = os_alloc(sizeof(IoT_Prepared_Publish_t));
+		pPreparedQOS1 = os_alloc(sizeof(IoT_Prepared_Publish_t));
+		if(NULL == pPreparedQOS0 || NULL == pPreparedQOS1 ||
+		   SUCCESS != aws_iot_mqtt_publish_prepare(pPreparedQOS0, publish_topic, strlen(publish_topic), QOS0, false) ||
+		   SUCCESS != aws_iot_mqtt_publish_prepare(pPreparedQOS1, publish_topic, strlen(publish_topic), QOS1, false)) {
+			// out of memory or topic too long to be prepared, published as is
+			if(NULL != pPreparedQOS0) {
+				os_free(pPreparedQOS0);
+			}
+			if(NULL != pPreparedQOS1) {
+				os_free(pPreparedQOS1);
+			}
+			pPreparedQOS0 = NULL;
+			pPreparedQOS1 = NULL;
+		}
+	}
+
 	while((NETWORK_ATTEMPTING_RECONNECT == rc || NETWORK_RECONNECTED == rc || SUCCESS == rc)
 		  && (publishCount > 0 || infinitePublishFlag)) {
 
-		//Max time the yield function will wait for read messages
-		rc = aws_iot_mqtt_yield(pmqttClient, 100);
+		if(NULL != pReconnect) {
+			rc = aws_iot_mqtt_reconnect_poll(pReconnect);
+			if(NETWORK_ATTEMPTING_RECONNECT == rc) {
+				// attempts run on their own thread, the loop is free for local work meanwhile
+				os_sleep_us(100000, OS_TIMEOUT_NO_WAKEUP);
+				continue;
+			}
+		}
+
+		if(NULL != pRxTask) {
+			process_rx_task_messages();
+			rc = aws_iot_mqtt_rx_task_get_status(pRxTask);
+		} else {
+			//Max time the yield function will wait for read messages
+			rc = aws_iot_mqtt_yield(pmqttClient, 100);
+		}
+		if(NULL != pReconnect && NETWORK_DISCONNECTED_ERROR == rc) {
+			// picked up by the next aws_iot_mqtt_reconnect_poll()
+			continue;
+		}
+		if(NULL != pAsyncPublisher || NULL != pKeepalive) {
+			if(NULL != pRxTask) {
+				while(SUCCESS != aws_iot_mqtt_rx_task_lock(pRxTask)) {
+					process_rx_task_messages();
+				}
+			}
+			if(NULL != pAsyncPublisher) {
+				aws_iot_mqtt_async_publish_poll(pAsyncPublisher);
+			}
+			if(NULL != pKeepalive) {
+				aws_iot_mqtt_keepalive_poll(pKeepalive);
+			}
+			if(NULL != pRxTask) {
+				aws_iot_mqtt_rx_task_unlock(pRxTask);
+			}
+		}
 		if(NETWORK_ATTEMPTING_RECONNECT == rc) {
 			os_sleep_us(100000, OS_TIMEOUT_NO_WAKEUP);
 			// If the client is attempting to reconnect we will skip the rest of the loop.
@@ -254,7 +512,7 @@ int main(int argc, char **argv) {
 
 		os_printf("\n---> Publishing with 'Message QoS0' to Topic [%s]\n", publish_topic);
 		os_printf("msg[%s]\n", cPayload);
-		rc = aws_iot_mqtt_publish(pmqttClient, publish_topic, strlen(publish_topic), &paramsQOS0);
+		rc = publish_message(publish_topic, &paramsQOS0, pPreparedQOS0);
 
 		os_printf("\nQoS0 Message Publish %s for \"msg_id\":%d. Return Status [%d]\n",
 						rc ? "Failure" : "Successful", message_id, rc);
@@ -273,10 +531,20 @@ int main(int argc, char **argv) {
 
 		os_printf("\n---> Publishing with 'Message QoS1' to Topic [%s]\n", publish_topic);
 		os_printf("msg[%s]\n", cPayload);
-		rc = aws_iot_mqtt_publish(pmqttClient, publish_topic, strlen(publish_topic), &paramsQOS1);
+		if (NULL != pMqtt5 && !aws_iot_mqtt_v5_can_publish(pMqtt5)) {
+			// the broker takes no more QoS1 messages until it acks the ones in flight
+			rc = MQTT_ASYNC_PUBLISH_WINDOW_FULL_ERROR;
+		} else {
+			rc = publish_message(publish_topic, &paramsQOS1, pPreparedQOS1);
+		}
 
 		os_printf("\nQoS1 Message Publish %s for \"msg_id\":%d. Return Status [%d]\n",
 						rc ? "Failure" : "Successful", message_id, rc);
+		if (rc == MQTT_ASYNC_PUBLISH_WINDOW_FULL_ERROR && (NULL != pAsyncPublisher || NULL != pMqtt5)) {
+			// all the slots are waiting for a PUBACK, the message is skipped rather than blocking the loop
+			os_printf("QOS1 publish window full. \n");
+			rc = SUCCESS;
+		}
 		if (rc == MQTT_REQUEST_TIMEOUT_ERROR) {
 			// if PUBACK is not recieved for a QOS1 msg before a timeout, the stack will re-publish it again. 
 			// so, lets not treat 'MQTT_REQUEST_TIMEOUT_ERROR' as a critical error which breaks the loop.
@@ -290,7 +558,47 @@ int main(int argc, char **argv) {
 	}
 
 	// Wait for all the messages to be received
-	aws_iot_mqtt_yield(pmqttClient, 100);
+	if(NULL != pRxTask) {
+		while(SUCCESS != aws_iot_mqtt_rx_task_stop(pRxTask)) {
+			process_rx_task_messages();
+		}
+		process_rx_task_messages();
+	} else {
+		aws_iot_mqtt_yield(pmqttClient, 100);
+	}
+	if(NULL != pAsyncPublisher) {
+		aws_iot_mqtt_async_publish_poll(pAsyncPublisher);
+		aws_iot_mqtt_async_publish_deinit(pAsyncPublisher);
+	}
+	if(NULL != pRtt) {
+		IoT_Rtt_Stats_t rttStats;
+
+		aws_iot_mqtt_rtt_get_stats(pRtt, &rttStats);
+		os_printf("RTT: %u samples, srtt %u ms, rttvar %u ms, min %u ms, max %u ms, rto %u ms\n",
+				(unsigned) rttStats.samples, (unsigned) rttStats.srtt_ms, (unsigned) rttStats.rttvar_ms,
+				(unsigned) rttStats.minRtt_ms, (unsigned) rttStats.maxRtt_ms, (unsigned) rttStats.rto_ms);
+		aws_iot_mqtt_rtt_deinit(pRtt);
+	}
+	if(NULL != pKeepalive) {
+		aws_iot_mqtt_keepalive_deinit(pKeepalive);
+	}
+	if(NULL != pReconnect) {
+		IoT_Reconnect_Stats_t reconnectStats;
+
+		aws_iot_mqtt_reconnect_get_stats(pReconnect, &reconnectStats);
+		os_printf("Reconnect: %u disconnects, %u attempts, %u successes, longest outage %u ms\n",
+				(unsigned) reconnectStats.disconnects, (unsigned) reconnectStats.attempts,
+				(unsigned) reconnectStats.successes, (unsigned) reconnectStats.longestOutage_ms);
+		aws_iot_mqtt_reconnect_deinit(pReconnect);
+	}
+	if(NULL != pMqtt5) {
+		IoT_Mqtt5_Stats_t mqtt5Stats;
+
+		aws_iot_mqtt_v5_get_stats(pMqtt5, &mqtt5Stats);
+		os_printf("MQTT 5: %u aliased publishes, %u topic bytes saved, %u reason codes, %u disconnects\n",
+				(unsigned) mqtt5Stats.aliasedPublishes, (unsigned) mqtt5Stats.aliasBytesSaved,
+				(unsigned) mqtt5Stats.reasonErrors, (unsigned) mqtt5Stats.serverDisconnects);
+	}
 
 	if(SUCCESS != rc) {
 		IOT_ERROR("An error occurred in the loop %d", rc);
@@ -355,6 +663,7 @@ static void wcm_notify_callback(void *ctx, struct os_msg *msg)
             os_printf("wcm_notify_cb to App Layer - WCM_NOTIFY_MSG_LINK_DOWN\n");
             ap_link_up = false;
             ap_got_ip = false;
+            aws_iot_mqtt_reconnect_set_link(pReconnect, false);
             break;
 
         case(WCM_NOTIFY_MSG_ADDRESS):
@@ -369,6 +678,7 @@ static void wcm_notify_callback(void *ctx, struct os_msg *msg)
 
         case(WCM_NOTIFY_MSG_CONNECTED):
             os_printf("wcm_notify_cb to App Layer - WCM_NOTIFY_MSG_CONNECTED\n");
+            aws_iot_mqtt_reconnect_set_link(pReconnect, true);
             break;
 
         default:
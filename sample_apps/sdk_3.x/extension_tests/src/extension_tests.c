@@ -0,0 +1,53 @@
+/**
+  *****************************************************************************
+  * @file   extension_tests.c
+  *
+  *****************************************************************************
+  * @attention
+  *
+  *
+  *  Copyright (c) 2022, InnoPhase, Inc.
+  *
+  *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  *  POSSIBILITY OF SUCH DAMAGE.
+  *
+  *****************************************************************************
+  */
+
+/**
+ * Runs the self-contained checks and benchmarks of the talaria_two_ext extensions.
+ * None of them uses the network, so no bootArgs, certs or keys are needed.
+ *
+ * - The dispatch benchmark compares the topic-filter trie of the dispatcher with a
+ *   linear scan of the same filters, and prints the time per match of both.
+ * - The MQTT 5 loopback runs a client with the MQTT 5 adapter attached against a scripted
+ *   broker in memory, and prints whether each exchange translated as expected.
+ */
+#include <kernel/os.h>
+#include "aws_iot_log.h"
+#include "aws_iot_config.h"
+#include "aws_iot_mqtt_client_dispatch.h"
+#include "aws_iot_mqtt_client_v5.h"
+#include "aws_iot_version.h"
+
+int main(int argc, char **argv) {
+	uint32_t failures;
+
+	os_printf("\nAWS IoT SDK Version %d.%d.%d-%s\n", VERSION_MAJOR, VERSION_MINOR, VERSION_PATCH, VERSION_TAG);
+
+	aws_iot_mqtt_dispatch_benchmark(1000);
+
+	failures = aws_iot_mqtt_v5_loopback_check();
+
+	os_printf("\nextension tests done, %u failed checks\n", (unsigned) failures);
+	return (0 == failures) ? 0 : -1;
+}
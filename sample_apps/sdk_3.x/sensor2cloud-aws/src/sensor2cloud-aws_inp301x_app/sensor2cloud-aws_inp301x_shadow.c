@@ -0,0 +1,172 @@
+/**
+  *****************************************************************************
+  * @file   sensor2cloud-aws_inp301x_shadow.c
+  *
+  *****************************************************************************
+  * @attention
+  *
+  *
+  *  Copyright (c) 2022, InnoPhase, Inc.
+  *
+  *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  *  POSSIBILITY OF SUCH DAMAGE.
+  *
+  *****************************************************************************
+  */
+
+/* Generated by talaria_two_ext/tools/aws_iot_shadow_schema.py from sensor2cloud-aws_inp301x_shadow.json, do not edit. */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "sensor2cloud-aws_inp301x_shadow.h"
+
+inp301x_aws_shadow_params_t inp301x_shadow_params;
+
+jsonStruct_t inp301x_shadow_attributes[AWS_SHADOW_ATTRIBUTES_MAX_COUNT] = {
+    [AWS_SHADOW_ATTRIBUTE_TEMPERATURE] = {"temperature", &(inp301x_shadow_params.temperature), sizeof(inp301x_shadow_params.temperature), SHADOW_JSON_FLOAT, NULL},
+    [AWS_SHADOW_ATTRIBUTE_PRESSURE] = {"pressure", &(inp301x_shadow_params.pressure), sizeof(inp301x_shadow_params.pressure), SHADOW_JSON_FLOAT, NULL},
+    [AWS_SHADOW_ATTRIBUTE_HUMIDITY] = {"humidity", &(inp301x_shadow_params.humidity), sizeof(inp301x_shadow_params.humidity), SHADOW_JSON_FLOAT, NULL},
+    [AWS_SHADOW_ATTRIBUTE_OPTICAL_POWER] = {"opticalPower", &(inp301x_shadow_params.opticalPower), sizeof(inp301x_shadow_params.opticalPower), SHADOW_JSON_FLOAT, NULL},
+    [AWS_SHADOW_ATTRIBUTE_SENSOR_POLL_INTERVAL] = {"sensorPollInterval", &(inp301x_shadow_params.sensorPollInterval), sizeof(inp301x_shadow_params.sensorPollInterval), SHADOW_JSON_UINT32, process_shadow_delta_callback},
+    [AWS_SHADOW_ATTRIBUTE_SENSOR_SWITCH] = {"sensorSwitch", &(inp301x_shadow_params.sensorOn), sizeof(inp301x_shadow_params.sensorOn), SHADOW_JSON_BOOL, process_shadow_delta_callback},
+};
+
+static IoT_Error_t inp301x_shadow_parse_temperature(const char *pJsonString, jsmntok_t *pToken)
+{
+    return parseFloatValue(&(inp301x_shadow_params.temperature), pJsonString, pToken);
+}
+
+static IoT_Error_t inp301x_shadow_parse_pressure(const char *pJsonString, jsmntok_t *pToken)
+{
+    return parseFloatValue(&(inp301x_shadow_params.pressure), pJsonString, pToken);
+}
+
+static IoT_Error_t inp301x_shadow_parse_humidity(const char *pJsonString, jsmntok_t *pToken)
+{
+    return parseFloatValue(&(inp301x_shadow_params.humidity), pJsonString, pToken);
+}
+
+static IoT_Error_t inp301x_shadow_parse_opticalPower(const char *pJsonString, jsmntok_t *pToken)
+{
+    return parseFloatValue(&(inp301x_shadow_params.opticalPower), pJsonString, pToken);
+}
+
+static IoT_Error_t inp301x_shadow_parse_sensorPollInterval(const char *pJsonString, jsmntok_t *pToken)
+{
+    return parseUnsignedInteger32Value(&(inp301x_shadow_params.sensorPollInterval), pJsonString, pToken);
+}
+
+static IoT_Error_t inp301x_shadow_parse_sensorSwitch(const char *pJsonString, jsmntok_t *pToken)
+{
+    return parseBooleanValue(&(inp301x_shadow_params.sensorOn), pJsonString, pToken);
+}
+
+const inp301x_shadow_parser_t inp301x_shadow_parsers[AWS_SHADOW_ATTRIBUTES_MAX_COUNT] = {
+    [AWS_SHADOW_ATTRIBUTE_TEMPERATURE] = inp301x_shadow_parse_temperature,
+    [AWS_SHADOW_ATTRIBUTE_PRESSURE] = inp301x_shadow_parse_pressure,
+    [AWS_SHADOW_ATTRIBUTE_HUMIDITY] = inp301x_shadow_parse_humidity,
+    [AWS_SHADOW_ATTRIBUTE_OPTICAL_POWER] = inp301x_shadow_parse_opticalPower,
+    [AWS_SHADOW_ATTRIBUTE_SENSOR_POLL_INTERVAL] = inp301x_shadow_parse_sensorPollInterval,
+    [AWS_SHADOW_ATTRIBUTE_SENSOR_SWITCH] = inp301x_shadow_parse_sensorSwitch,
+};
+
+/* Writes the attributes of a set, each followed by a comma, closes the section with the last one */
+static IoT_Error_t inp301x_shadow_add_section(char *pJsonDocument, size_t maxSizeOfJsonDocument,
+        const char *pSection, uint32_t attributes)
+{
+    size_t start = strlen(pJsonDocument);
+    size_t len = start;
+    int written;
+
+    attributes &= 0x3FUL;
+    if (0 == attributes) {
+        return SUCCESS;
+    }
+
+    written = snprintf(&(pJsonDocument[len]), maxSizeOfJsonDocument - len, "\"%s\":{", pSection);
+    if (0 > written || maxSizeOfJsonDocument - len <= (size_t) written) {
+        goto truncated;
+    }
+    len += (size_t) written;
+
+    if (0 != (attributes & INP301X_SHADOW_BIT(AWS_SHADOW_ATTRIBUTE_TEMPERATURE))) {
+        written = snprintf(&(pJsonDocument[len]), maxSizeOfJsonDocument - len,
+                "\"temperature\":%f,", (double) inp301x_shadow_params.temperature);
+        if (0 > written || maxSizeOfJsonDocument - len <= (size_t) written) {
+            goto truncated;
+        }
+        len += (size_t) written;
+    }
+    if (0 != (attributes & INP301X_SHADOW_BIT(AWS_SHADOW_ATTRIBUTE_PRESSURE))) {
+        written = snprintf(&(pJsonDocument[len]), maxSizeOfJsonDocument - len,
+                "\"pressure\":%f,", (double) inp301x_shadow_params.pressure);
+        if (0 > written || maxSizeOfJsonDocument - len <= (size_t) written) {
+            goto truncated;
+        }
+        len += (size_t) written;
+    }
+    if (0 != (attributes & INP301X_SHADOW_BIT(AWS_SHADOW_ATTRIBUTE_HUMIDITY))) {
+        written = snprintf(&(pJsonDocument[len]), maxSizeOfJsonDocument - len,
+                "\"humidity\":%f,", (double) inp301x_shadow_params.humidity);
+        if (0 > written || maxSizeOfJsonDocument - len <= (size_t) written) {
+            goto truncated;
+        }
+        len += (size_t) written;
+    }
+    if (0 != (attributes & INP301X_SHADOW_BIT(AWS_SHADOW_ATTRIBUTE_OPTICAL_POWER))) {
+        written = snprintf(&(pJsonDocument[len]), maxSizeOfJsonDocument - len,
+                "\"opticalPower\":%f,", (double) inp301x_shadow_params.opticalPower);
+        if (0 > written || maxSizeOfJsonDocument - len <= (size_t) written) {
+            goto truncated;
+        }
+        len += (size_t) written;
+    }
+    if (0 != (attributes & INP301X_SHADOW_BIT(AWS_SHADOW_ATTRIBUTE_SENSOR_POLL_INTERVAL))) {
+        written = snprintf(&(pJsonDocument[len]), maxSizeOfJsonDocument - len,
+                "\"sensorPollInterval\":%u,", (unsigned) inp301x_shadow_params.sensorPollInterval);
+        if (0 > written || maxSizeOfJsonDocument - len <= (size_t) written) {
+            goto truncated;
+        }
+        len += (size_t) written;
+    }
+    if (0 != (attributes & INP301X_SHADOW_BIT(AWS_SHADOW_ATTRIBUTE_SENSOR_SWITCH))) {
+        written = snprintf(&(pJsonDocument[len]), maxSizeOfJsonDocument - len,
+                "\"sensorSwitch\":%s,", inp301x_shadow_params.sensorOn ? "true" : "false");
+        if (0 > written || maxSizeOfJsonDocument - len <= (size_t) written) {
+            goto truncated;
+        }
+        len += (size_t) written;
+    }
+
+    if (maxSizeOfJsonDocument - len <= 1) {
+        goto truncated;
+    }
+    pJsonDocument[len - 1] = '}';
+    pJsonDocument[len] = ',';
+    pJsonDocument[len + 1] = '\0';
+    return SUCCESS;
+
+truncated:
+    pJsonDocument[start] = '\0';
+    return SHADOW_JSON_BUFFER_TRUNCATED;
+}
+
+IoT_Error_t inp301x_shadow_add_reported(char *pJsonDocument, size_t maxSizeOfJsonDocument, uint32_t attributes)
+{
+    return inp301x_shadow_add_section(pJsonDocument, maxSizeOfJsonDocument, "reported", attributes);
+}
+
+IoT_Error_t inp301x_shadow_add_desired(char *pJsonDocument, size_t maxSizeOfJsonDocument, uint32_t attributes)
+{
+    return inp301x_shadow_add_section(pJsonDocument, maxSizeOfJsonDocument, "desired", attributes);
+}
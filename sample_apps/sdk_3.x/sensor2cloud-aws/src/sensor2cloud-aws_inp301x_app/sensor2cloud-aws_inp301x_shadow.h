@@ -0,0 +1,88 @@
+/**
+  *****************************************************************************
+  * @file   sensor2cloud-aws_inp301x_shadow.h
+  *
+  *****************************************************************************
+  * @attention
+  *
+  *
+  *  Copyright (c) 2022, InnoPhase, Inc.
+  *
+  *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  *  POSSIBILITY OF SUCH DAMAGE.
+  *
+  *****************************************************************************
+  */
+
+/* Generated by talaria_two_ext/tools/aws_iot_shadow_schema.py from sensor2cloud-aws_inp301x_shadow.json, do not edit. */
+
+#ifndef SENSOR2CLOUD_AWS_INP301X_SHADOW_H
+#define SENSOR2CLOUD_AWS_INP301X_SHADOW_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "aws_iot_error.h"
+#include "aws_iot_json_utils.h"
+#include "aws_iot_shadow_json_data.h"
+
+typedef enum
+{
+    AWS_SHADOW_ATTRIBUTE_TEMPERATURE,
+    AWS_SHADOW_ATTRIBUTE_PRESSURE,
+    AWS_SHADOW_ATTRIBUTE_HUMIDITY,
+    AWS_SHADOW_ATTRIBUTE_OPTICAL_POWER,
+    AWS_SHADOW_ATTRIBUTE_SENSOR_POLL_INTERVAL,
+    AWS_SHADOW_ATTRIBUTE_SENSOR_SWITCH,
+    AWS_SHADOW_ATTRIBUTES_MAX_COUNT,
+} e_inp301x_aws_shadow_attributes_t;
+
+/* bit of an attribute in the attribute sets of inp301x_shadow_add_reported() and inp301x_shadow_add_desired() */
+#define INP301X_SHADOW_BIT(attribute) (1UL << (attribute))
+
+typedef struct
+{
+    float    temperature;
+    float    pressure;
+    float    humidity;
+    float    opticalPower;
+    uint32_t sensorPollInterval;
+    bool     sensorOn;
+} inp301x_aws_shadow_params_t;
+
+/* parses the value at pToken into its field of inp301x_shadow_params */
+typedef IoT_Error_t (*inp301x_shadow_parser_t)(const char *pJsonString, jsmntok_t *pToken);
+
+extern inp301x_aws_shadow_params_t inp301x_shadow_params;
+extern jsonStruct_t inp301x_shadow_attributes[AWS_SHADOW_ATTRIBUTES_MAX_COUNT];
+extern const inp301x_shadow_parser_t inp301x_shadow_parsers[AWS_SHADOW_ATTRIBUTES_MAX_COUNT];
+
+void process_shadow_delta_callback(const char *pJsonString, uint32_t JsonStringDataLen, jsonStruct_t *pContext);
+
+/**
+ * Writes the attributes of a set into the 'reported' section of a shadow document,
+ * like aws_iot_shadow_add_reported()
+ * @param attributes INP301X_SHADOW_BIT() of each attribute
+ * @return SUCCESS, or SHADOW_JSON_BUFFER_TRUNCATED with the document left as it was
+ */
+IoT_Error_t inp301x_shadow_add_reported(char *pJsonDocument, size_t maxSizeOfJsonDocument, uint32_t attributes);
+
+/**
+ * Writes the attributes of a set into the 'desired' section of a shadow document,
+ * like aws_iot_shadow_add_desired()
+ * @param attributes INP301X_SHADOW_BIT() of each attribute
+ * @return SUCCESS, or SHADOW_JSON_BUFFER_TRUNCATED with the document left as it was
+ */
+IoT_Error_t inp301x_shadow_add_desired(char *pJsonDocument, size_t maxSizeOfJsonDocument, uint32_t attributes);
+
+#endif
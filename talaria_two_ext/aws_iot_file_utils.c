@@ -0,0 +1,218 @@
+/**
+  *****************************************************************************
+  * @file   aws_iot_file_utils.c
+  *
+  *****************************************************************************
+  * @attention
+  *
+  *
+  *  Copyright (c) 2022, InnoPhase, Inc.
+  *
+  *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  *  POSSIBILITY OF SUCH DAMAGE.
+  *
+  *****************************************************************************
+  */
+
+/**
+ * @file aws_iot_file_utils.c
+ * @brief Writes to the Talaria file system for the persistent extensions
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "aws_iot_file_utils.h"
+#include "aws_iot_log.h"
+
+/* Path of a copy next to the file, false if it does not fit */
+static bool _aws_iot_file_sibling(char *pBuffer, size_t size, const char *pPath, const char *pSuffix) {
+	int len = snprintf(pBuffer, size, "%s%s", pPath, pSuffix);
+
+	return 0 < len && (size_t) len < size;
+}
+
+static bool _aws_iot_file_exists(const char *pPath) {
+	int fd = open(pPath, O_RDONLY);
+
+	if(0 > fd) {
+		return false;
+	}
+	close(fd);
+	return true;
+}
+
+static IoT_Error_t _aws_iot_file_write_all(int fd, const void *pData, size_t len) {
+	const unsigned char *p = (const unsigned char *) pData;
+	int written;
+
+	while(0 < len) {
+		written = write(fd, p, len);
+		if(0 >= written) {
+			return FAILURE;
+		}
+		p += written;
+		len -= (size_t) written;
+	}
+	return SUCCESS;
+}
+
+IoT_Error_t aws_iot_file_append(const char *pPath, const void *pData, size_t len) {
+	IoT_Error_t rc;
+	int fd;
+
+	fd = open(pPath, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if(0 > fd) {
+		IOT_ERROR("file: cannot open %s", pPath);
+		return FAILURE;
+	}
+
+	rc = _aws_iot_file_write_all(fd, pData, len);
+	close(fd);
+
+	if(SUCCESS != rc) {
+		IOT_ERROR("file: write to %s failed", pPath);
+	}
+	return rc;
+}
+
+IoT_Error_t aws_iot_file_open(const char *pPath, int *pFd) {
+	*pFd = open(pPath, O_RDONLY);
+	return (0 > *pFd) ? FAILURE : SUCCESS;
+}
+
+IoT_Error_t aws_iot_file_read_at(int fd, uint32_t offset, void *pBuffer, size_t len) {
+	if((off_t) offset != lseek(fd, (off_t) offset, SEEK_SET) || (int) len != read(fd, pBuffer, len)) {
+		return FAILURE;
+	}
+	return SUCCESS;
+}
+
+void aws_iot_file_close(int fd) {
+	close(fd);
+}
+
+IoT_Error_t aws_iot_file_replace_begin(IoT_File_Replace_t *pReplace, const char *pPath) {
+	pReplace->pPath = pPath;
+	pReplace->fd = -1;
+	if(!_aws_iot_file_sibling(pReplace->tmpPath, sizeof(pReplace->tmpPath), pPath, ".tmp")) {
+		return MAX_SIZE_ERROR;
+	}
+
+	/* a swap left half done would have its complete copy overwritten */
+	aws_iot_file_recover(pPath);
+
+	pReplace->fd = open(pReplace->tmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(0 > pReplace->fd) {
+		IOT_ERROR("file: cannot open %s", pReplace->tmpPath);
+		return FAILURE;
+	}
+	return SUCCESS;
+}
+
+IoT_Error_t aws_iot_file_replace_write(IoT_File_Replace_t *pReplace, const void *pData, size_t len) {
+	return _aws_iot_file_write_all(pReplace->fd, pData, len);
+}
+
+IoT_Error_t aws_iot_file_replace_commit(IoT_File_Replace_t *pReplace) {
+	char bakPath[AWS_IOT_FILE_MAX_PATH_LEN + 5];
+
+	close(pReplace->fd);
+	pReplace->fd = -1;
+
+	if(0 == rename(pReplace->tmpPath, pReplace->pPath)) {
+		return SUCCESS;
+	}
+
+	/* not replaced in place: the live file is moved aside, never deleted before the new one is in */
+	if(!_aws_iot_file_sibling(bakPath, sizeof(bakPath), pReplace->pPath, ".bak")) {
+		(void) unlink(pReplace->tmpPath);
+		return MAX_SIZE_ERROR;
+	}
+	(void) unlink(bakPath);
+	if(0 != rename(pReplace->pPath, bakPath)) {
+		/* the live file is untouched */
+		(void) unlink(pReplace->tmpPath);
+		IOT_ERROR("file: cannot replace %s", pReplace->pPath);
+		return FAILURE;
+	}
+	if(0 != rename(pReplace->tmpPath, pReplace->pPath)) {
+		/* both copies are kept until the live file is back */
+		if(0 == rename(bakPath, pReplace->pPath)) {
+			(void) unlink(pReplace->tmpPath);
+		}
+		IOT_ERROR("file: cannot replace %s", pReplace->pPath);
+		return FAILURE;
+	}
+	(void) unlink(bakPath);
+
+	return SUCCESS;
+}
+
+void aws_iot_file_replace_abort(IoT_File_Replace_t *pReplace) {
+	if(0 <= pReplace->fd) {
+		close(pReplace->fd);
+		pReplace->fd = -1;
+	}
+	(void) unlink(pReplace->tmpPath);
+}
+
+IoT_Error_t aws_iot_file_replace(const char *pPath, const void *pData, size_t len) {
+	IoT_File_Replace_t replace;
+	IoT_Error_t rc;
+
+	rc = aws_iot_file_replace_begin(&replace, pPath);
+	if(SUCCESS == rc) {
+		rc = aws_iot_file_replace_write(&replace, pData, len);
+	}
+	if(SUCCESS != rc) {
+		aws_iot_file_replace_abort(&replace);
+		return rc;
+	}
+	return aws_iot_file_replace_commit(&replace);
+}
+
+void aws_iot_file_recover(const char *pPath) {
+	char tmpPath[AWS_IOT_FILE_MAX_PATH_LEN + 5];
+	char bakPath[AWS_IOT_FILE_MAX_PATH_LEN + 5];
+
+	if(!_aws_iot_file_sibling(tmpPath, sizeof(tmpPath), pPath, ".tmp") ||
+	   !_aws_iot_file_sibling(bakPath, sizeof(bakPath), pPath, ".bak")) {
+		return;
+	}
+
+	if(!_aws_iot_file_exists(pPath)) {
+		/* The backup is only made once the replacement is complete, which then wins. A replacement alone
+		 * is the first version of the file, its reader checks the content. */
+		if(_aws_iot_file_exists(tmpPath) && 0 == rename(tmpPath, pPath)) {
+			IOT_WARN("file: %s recovered from its replacement", pPath);
+		} else if(_aws_iot_file_exists(bakPath) && 0 == rename(bakPath, pPath)) {
+			IOT_WARN("file: %s recovered from its backup", pPath);
+		}
+	}
+
+	if(_aws_iot_file_exists(pPath)) {
+		(void) unlink(tmpPath);
+		(void) unlink(bakPath);
+	}
+}
+
+#ifdef __cplusplus
+}
+#endif
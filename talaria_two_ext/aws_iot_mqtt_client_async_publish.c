@@ -0,0 +1,618 @@
+/**
+  *****************************************************************************
+  * @file   aws_iot_mqtt_client_async_publish.c
+  *
+  *****************************************************************************
+  * @attention
+  *
+  *
+  *  Copyright (c) 2022, InnoPhase, Inc.
+  *
+  *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  *  POSSIBILITY OF SUCH DAMAGE.
+  *
+  *****************************************************************************
+  */
+
+/**
+ * @file aws_iot_mqtt_client_async_publish.c
+ * @brief Non-blocking QoS1 publish with several messages in flight
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <string.h>
+
+#include "aws_iot_log.h"
+#include "aws_iot_mqtt_client_async_publish.h"
+#include "aws_iot_mqtt_client_common_internal.h"
+
+#define ASYNC_PUBLISH_DUP_FLAG 0x08
+
+const IoT_Async_Publish_Params_t iotAsyncPublishParamsDefault = {AWS_IOT_MQTT_ASYNC_PUBLISH_MAX_WINDOW,
+																 AWS_IOT_MQTT_ASYNC_PUBLISH_RETRY_MS,
+																 AWS_IOT_MQTT_ASYNC_PUBLISH_MAX_RETRIES,
+																 AWS_IOT_MQTT_ASYNC_PUBLISH_RETRY_MS};
+
+typedef struct {
+	iot_async_publish_complete_handler handler;
+	void *pHandlerData;
+	uint16_t packetId;
+	IoT_Async_Publish_Status_t status;
+} _IoT_Async_Publish_Completion_t;
+
+static void _aws_iot_mqtt_async_publish_lock(AWS_IoT_Async_Publisher_t *pPublisher) {
+#ifdef _ENABLE_THREAD_SUPPORT_
+	(void) aws_iot_thread_mutex_lock(&(pPublisher->lock));
+#else
+	IOT_UNUSED(pPublisher);
+#endif
+}
+
+static void _aws_iot_mqtt_async_publish_unlock(AWS_IoT_Async_Publisher_t *pPublisher) {
+#ifdef _ENABLE_THREAD_SUPPORT_
+	(void) aws_iot_thread_mutex_unlock(&(pPublisher->lock));
+#else
+	IOT_UNUSED(pPublisher);
+#endif
+}
+
+static bool _aws_iot_mqtt_async_publish_is_id_in_use(const AWS_IoT_Async_Publisher_t *pPublisher, uint16_t packetId) {
+	uint8_t i;
+
+	for(i = 0; i < pPublisher->params.windowSize; i++) {
+		if(packetId == pPublisher->packetIds[i]) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Frees a slot and records its completion so the handler can run once the lock is released */
+static void _aws_iot_mqtt_async_publish_complete(AWS_IoT_Async_Publisher_t *pPublisher, uint8_t idx,
+												 IoT_Async_Publish_Status_t status,
+												 _IoT_Async_Publish_Completion_t *pCompletion) {
+	IoT_Async_Publish_Slot_t *pSlot = &(pPublisher->slots[idx]);
+
+	pCompletion->handler = pSlot->handler;
+	pCompletion->pHandlerData = pSlot->pHandlerData;
+	pCompletion->packetId = pSlot->packetId;
+	pCompletion->status = status;
+
+	if(IOT_ASYNC_PUBLISH_ACKED == status) {
+		pPublisher->stats.acked++;
+	} else if(IOT_ASYNC_PUBLISH_TIMEOUT == status) {
+		pPublisher->stats.timedOut++;
+	}
+
+	pPublisher->packetIds[idx] = 0;
+	pSlot->state = IOT_ASYNC_PUBLISH_SLOT_FREE;
+}
+
+static void _aws_iot_mqtt_async_publish_run_completions(AWS_IoT_Async_Publisher_t *pPublisher,
+														const _IoT_Async_Publish_Completion_t *pCompletions,
+														uint8_t count) {
+	uint8_t i;
+
+	for(i = 0; i < count; i++) {
+		if(NULL != pCompletions[i].handler) {
+			pCompletions[i].handler(pPublisher->pClient, pCompletions[i].packetId, pCompletions[i].status,
+									pCompletions[i].pHandlerData);
+		}
+	}
+}
+
+static IoT_Error_t _aws_iot_mqtt_async_publish_send(AWS_IoT_Async_Publisher_t *pPublisher,
+													IoT_Async_Publish_Slot_t *pSlot) {
+	const unsigned char *bufs[1 + AWS_IOT_MQTT_ASYNC_PUBLISH_MAX_FRAGMENTS];
+	size_t lens[1 + AWS_IOT_MQTT_ASYNC_PUBLISH_MAX_FRAGMENTS];
+	uint8_t i;
+
+	bufs[0] = pSlot->packet;
+	lens[0] = pSlot->packetLen;
+	for(i = 0; i < pSlot->fragmentCount; i++) {
+		bufs[i + 1] = (const unsigned char *) pSlot->fragments[i].pData;
+		lens[i + 1] = pSlot->fragments[i].len;
+	}
+
+	pSlot->sentAt_ms = aws_iot_mqtt_tap_now_ms();
+	return aws_iot_mqtt_tap_writev(pPublisher->pClient, bufs, lens, (uint8_t) (1 + pSlot->fragmentCount),
+								   pPublisher->params.writeTimeout_ms);
+}
+
+/* Time the slot waits for its PUBACK before the next retransmission */
+static uint32_t _aws_iot_mqtt_async_publish_retry_ms(AWS_IoT_Async_Publisher_t *pPublisher,
+													 const IoT_Async_Publish_Slot_t *pSlot) {
+	if(NULL == pPublisher->pRtt) {
+		return pPublisher->params.retry_ms;
+	}
+	return aws_iot_mqtt_rtt_backoff_ms(pPublisher->pRtt, pSlot->retries);
+}
+
+/* Runs in the thread reading the socket */
+static void _aws_iot_mqtt_async_publish_on_packet(AWS_IoT_Client *pClient, const IoT_Tap_Event_t *pEvent, void *pData) {
+	AWS_IoT_Async_Publisher_t *pPublisher = (AWS_IoT_Async_Publisher_t *) pData;
+	uint16_t packetId;
+	uint8_t i;
+
+	IOT_UNUSED(pClient);
+
+	if(IOT_TAP_INBOUND != pEvent->direction || IOT_TAP_EVENT_PACKET_END != pEvent->type || 2 > pEvent->dataLen) {
+		return;
+	}
+
+	switch(IOT_TAP_PACKET_TYPE(pEvent->header)) {
+		case IOT_TAP_PUBACK:
+			packetId = (uint16_t) ((pEvent->pData[0] << 8) | pEvent->pData[1]);
+			_aws_iot_mqtt_async_publish_lock(pPublisher);
+			for(i = 0; i < pPublisher->params.windowSize; i++) {
+				if(packetId == pPublisher->packetIds[i]) {
+					pPublisher->packetIds[i] = 0;
+					pPublisher->slots[i].status = IOT_ASYNC_PUBLISH_ACKED;
+					pPublisher->slots[i].state = IOT_ASYNC_PUBLISH_SLOT_DONE;
+					break;
+				}
+			}
+			_aws_iot_mqtt_async_publish_unlock(pPublisher);
+			break;
+
+		case IOT_TAP_CONNACK:
+			if(0 != pEvent->pData[1]) {
+				break;
+			}
+			/* New connection: whatever was not acked on the old one goes out again */
+			_aws_iot_mqtt_async_publish_lock(pPublisher);
+			for(i = 0; i < pPublisher->params.windowSize; i++) {
+				if(IOT_ASYNC_PUBLISH_SLOT_IN_FLIGHT == pPublisher->slots[i].state) {
+					pPublisher->slots[i].state = IOT_ASYNC_PUBLISH_SLOT_RESEND;
+				}
+			}
+			_aws_iot_mqtt_async_publish_unlock(pPublisher);
+			break;
+
+		default:
+			break;
+	}
+}
+
+IoT_Error_t aws_iot_mqtt_async_publish_init(AWS_IoT_Async_Publisher_t *pPublisher, AWS_IoT_Client *pClient,
+											const IoT_Async_Publish_Params_t *pParams) {
+	IoT_Error_t rc;
+
+	FUNC_ENTRY;
+
+	if(NULL == pPublisher || NULL == pClient) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	if(NULL == pParams) {
+		pParams = &iotAsyncPublishParamsDefault;
+	}
+
+	if(0 == pParams->windowSize || AWS_IOT_MQTT_ASYNC_PUBLISH_MAX_WINDOW < pParams->windowSize) {
+		IOT_ERROR("async publish: window size must be 1 to %d", AWS_IOT_MQTT_ASYNC_PUBLISH_MAX_WINDOW);
+		FUNC_EXIT_RC(FAILURE);
+	}
+
+	memset(pPublisher, 0, sizeof(AWS_IoT_Async_Publisher_t));
+	pPublisher->pClient = pClient;
+	pPublisher->params = *pParams;
+
+#ifdef _ENABLE_THREAD_SUPPORT_
+	rc = aws_iot_thread_mutex_init(&(pPublisher->lock));
+	if(SUCCESS != rc) {
+		FUNC_EXIT_RC(rc);
+	}
+#endif
+
+	pPublisher->observer.handler = _aws_iot_mqtt_async_publish_on_packet;
+	pPublisher->observer.pHandlerData = pPublisher;
+	rc = aws_iot_mqtt_tap_add_observer(pClient, &(pPublisher->observer));
+
+	FUNC_EXIT_RC(rc);
+}
+
+IoT_Error_t aws_iot_mqtt_async_publish_deinit(AWS_IoT_Async_Publisher_t *pPublisher) {
+	FUNC_ENTRY;
+
+	if(NULL == pPublisher || NULL == pPublisher->pClient) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	aws_iot_mqtt_async_publish_abort_all(pPublisher);
+	(void) aws_iot_mqtt_tap_remove_observer(pPublisher->pClient, &(pPublisher->observer));
+#ifdef _ENABLE_THREAD_SUPPORT_
+	(void) aws_iot_thread_mutex_destroy(&(pPublisher->lock));
+#endif
+	pPublisher->pClient = NULL;
+
+	FUNC_EXIT_RC(SUCCESS);
+}
+
+/* Takes a slot and sends the message. With pFragments the payload stays in the caller's buffers.
+ * With pPrepared the header and topic are copied from it, and pTopicName is not used. */
+static IoT_Error_t _aws_iot_mqtt_async_publish_enqueue(AWS_IoT_Async_Publisher_t *pPublisher,
+													   const IoT_Prepared_Publish_t *pPrepared, const char *pTopicName,
+													   uint16_t topicNameLen, IoT_Publish_Message_Params *pParams,
+													   const IoT_Publish_Fragment_t *pFragments,
+													   uint8_t fragmentCount, size_t payloadLen,
+													   iot_async_publish_complete_handler handler,
+													   void *pHandlerData, uint16_t *pPacketId) {
+	IoT_Async_Publish_Slot_t *pSlot = NULL;
+	unsigned char *ptr;
+	uint32_t remainingLength;
+	uint16_t packetId;
+	uint8_t idx;
+	IoT_Error_t rc;
+
+	remainingLength = ((NULL != pPrepared) ? pPrepared->topicLen : 2 + (uint32_t) topicNameLen) + 2 +
+					  (uint32_t) payloadLen;
+	if(aws_iot_mqtt_internal_get_final_packet_length_from_remaining_length(remainingLength) -
+	   ((NULL != pFragments) ? payloadLen : 0) > AWS_IOT_MQTT_ASYNC_PUBLISH_MAX_PACKET_LEN) {
+		return MQTT_TX_BUFFER_TOO_SHORT_ERROR;
+	}
+
+	_aws_iot_mqtt_async_publish_lock(pPublisher);
+
+	for(idx = 0; idx < pPublisher->params.windowSize; idx++) {
+		if(IOT_ASYNC_PUBLISH_SLOT_FREE == pPublisher->slots[idx].state) {
+			pSlot = &(pPublisher->slots[idx]);
+			break;
+		}
+	}
+
+	if(NULL == pSlot) {
+		pPublisher->stats.windowFull++;
+		_aws_iot_mqtt_async_publish_unlock(pPublisher);
+		return MQTT_ASYNC_PUBLISH_WINDOW_FULL_ERROR;
+	}
+
+	do {
+		packetId = aws_iot_mqtt_get_next_packet_id(pPublisher->pClient);
+	} while(_aws_iot_mqtt_async_publish_is_id_in_use(pPublisher, packetId));
+
+	ptr = pSlot->packet;
+	if(NULL != pPrepared) {
+		*ptr++ = pPrepared->header;
+		ptr += aws_iot_mqtt_internal_write_len_to_buffer(ptr, remainingLength);
+		memcpy(ptr, pPrepared->topic, pPrepared->topicLen);
+		ptr += pPrepared->topicLen;
+	} else {
+		*ptr++ = (unsigned char) (0x30 | (QOS1 << 1) | (pParams->isRetained ? 1 : 0));
+		ptr += aws_iot_mqtt_internal_write_len_to_buffer(ptr, remainingLength);
+		aws_iot_mqtt_internal_write_utf8_string(&ptr, pTopicName, topicNameLen);
+	}
+	aws_iot_mqtt_internal_write_uint_16(&ptr, packetId);
+	pSlot->fragmentCount = fragmentCount;
+	if(NULL != pFragments) {
+		memcpy(pSlot->fragments, pFragments, fragmentCount * sizeof(IoT_Publish_Fragment_t));
+	} else if(0 < payloadLen) {
+		memcpy(ptr, pParams->payload, payloadLen);
+		ptr += payloadLen;
+	}
+
+	pSlot->packetLen = (size_t) (ptr - pSlot->packet);
+	pSlot->packetId = packetId;
+	pSlot->handler = handler;
+	pSlot->pHandlerData = pHandlerData;
+	pSlot->retries = 0;
+	pSlot->state = IOT_ASYNC_PUBLISH_SLOT_IN_FLIGHT;
+	/* Registered before the write, the PUBACK may be read by another thread as soon as the packet is out */
+	pPublisher->packetIds[idx] = packetId;
+
+	rc = _aws_iot_mqtt_async_publish_send(pPublisher, pSlot);
+	if(SUCCESS != rc) {
+		pPublisher->packetIds[idx] = 0;
+		pSlot->state = IOT_ASYNC_PUBLISH_SLOT_FREE;
+	} else {
+		pPublisher->stats.published++;
+		if(NULL != pPacketId) {
+			*pPacketId = packetId;
+		}
+	}
+
+	_aws_iot_mqtt_async_publish_unlock(pPublisher);
+
+	return rc;
+}
+
+IoT_Error_t aws_iot_mqtt_async_publish(AWS_IoT_Async_Publisher_t *pPublisher, const char *pTopicName,
+									   uint16_t topicNameLen, IoT_Publish_Message_Params *pParams,
+									   iot_async_publish_complete_handler handler, void *pHandlerData,
+									   uint16_t *pPacketId) {
+	IoT_Error_t rc;
+
+	FUNC_ENTRY;
+
+	if(NULL == pPublisher || NULL == pPublisher->pClient || NULL == pTopicName || 0 == topicNameLen ||
+	   NULL == pParams || (NULL == pParams->payload && 0 != pParams->payloadLen)) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	if(!aws_iot_mqtt_is_client_connected(pPublisher->pClient)) {
+		FUNC_EXIT_RC(NETWORK_DISCONNECTED_ERROR);
+	}
+
+	rc = _aws_iot_mqtt_async_publish_enqueue(pPublisher, NULL, pTopicName, topicNameLen, pParams, NULL, 0,
+											 pParams->payloadLen, handler, pHandlerData, pPacketId);
+
+	FUNC_EXIT_RC(rc);
+}
+
+IoT_Error_t aws_iot_mqtt_async_publish_fragments(AWS_IoT_Async_Publisher_t *pPublisher, const char *pTopicName,
+												 uint16_t topicNameLen, IoT_Publish_Message_Params *pParams,
+												 const IoT_Publish_Fragment_t *pFragments, uint8_t fragmentCount,
+												 iot_async_publish_complete_handler handler, void *pHandlerData,
+												 uint16_t *pPacketId) {
+	const unsigned char *bufs[2 + AWS_IOT_MQTT_ASYNC_PUBLISH_MAX_FRAGMENTS];
+	size_t lens[2 + AWS_IOT_MQTT_ASYNC_PUBLISH_MAX_FRAGMENTS];
+	unsigned char header[1 + 4 + 2];
+	unsigned char *ptr = header;
+	size_t payloadLen = 0;
+	IoT_Error_t rc;
+	uint8_t i;
+
+	FUNC_ENTRY;
+
+	if(NULL == pPublisher || NULL == pPublisher->pClient || NULL == pTopicName || 0 == topicNameLen ||
+	   NULL == pParams || (NULL == pFragments && 0 != fragmentCount)) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	if(AWS_IOT_MQTT_ASYNC_PUBLISH_MAX_FRAGMENTS < fragmentCount) {
+		FUNC_EXIT_RC(MAX_SIZE_ERROR);
+	}
+
+	for(i = 0; i < fragmentCount; i++) {
+		if(NULL == pFragments[i].pData && 0 != pFragments[i].len) {
+			FUNC_EXIT_RC(NULL_VALUE_ERROR);
+		}
+		payloadLen += pFragments[i].len;
+	}
+
+	/* largest remaining length an MQTT packet can carry */
+	if((size_t) (268435455 - 2 - topicNameLen - 2) < payloadLen) {
+		FUNC_EXIT_RC(MAX_SIZE_ERROR);
+	}
+
+	if(!aws_iot_mqtt_is_client_connected(pPublisher->pClient)) {
+		FUNC_EXIT_RC(NETWORK_DISCONNECTED_ERROR);
+	}
+
+	if(QOS0 != pParams->qos) {
+		rc = _aws_iot_mqtt_async_publish_enqueue(pPublisher, NULL, pTopicName, topicNameLen, pParams, pFragments,
+												 fragmentCount, payloadLen, handler, pHandlerData, pPacketId);
+		FUNC_EXIT_RC(rc);
+	}
+
+	/* QoS0 is written once, the topic goes out from the caller's buffer as well */
+	*ptr++ = (unsigned char) (0x30 | (pParams->isRetained ? 1 : 0));
+	ptr += aws_iot_mqtt_internal_write_len_to_buffer(ptr, (uint32_t) (2 + topicNameLen + payloadLen));
+	aws_iot_mqtt_internal_write_uint_16(&ptr, topicNameLen);
+
+	bufs[0] = header;
+	lens[0] = (size_t) (ptr - header);
+	bufs[1] = (const unsigned char *) pTopicName;
+	lens[1] = topicNameLen;
+	for(i = 0; i < fragmentCount; i++) {
+		bufs[i + 2] = (const unsigned char *) pFragments[i].pData;
+		lens[i + 2] = pFragments[i].len;
+	}
+
+	rc = aws_iot_mqtt_tap_writev(pPublisher->pClient, bufs, lens, (uint8_t) (2 + fragmentCount),
+								 pPublisher->params.writeTimeout_ms);
+
+	FUNC_EXIT_RC(rc);
+}
+
+IoT_Error_t aws_iot_mqtt_publish_prepare(IoT_Prepared_Publish_t *pPrepared, const char *pTopicName,
+										 uint16_t topicNameLen, QoS qos, bool isRetained) {
+	unsigned char *ptr;
+
+	FUNC_ENTRY;
+
+	if(NULL == pPrepared || NULL == pTopicName || 0 == topicNameLen) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	if(AWS_IOT_MQTT_PREPARED_PUBLISH_MAX_TOPIC_LEN < topicNameLen || (QOS0 != qos && QOS1 != qos)) {
+		FUNC_EXIT_RC(MAX_SIZE_ERROR);
+	}
+
+	pPrepared->header = (unsigned char) (0x30 | (qos << 1) | (isRetained ? 1 : 0));
+	pPrepared->qos = qos;
+	pPrepared->topicNameLen = topicNameLen;
+	ptr = pPrepared->topic;
+	aws_iot_mqtt_internal_write_utf8_string(&ptr, pTopicName, topicNameLen);
+	pPrepared->topicLen = (uint16_t) (ptr - pPrepared->topic);
+
+	FUNC_EXIT_RC(SUCCESS);
+}
+
+IoT_Error_t aws_iot_mqtt_async_publish_prepared(AWS_IoT_Async_Publisher_t *pPublisher,
+												const IoT_Prepared_Publish_t *pPrepared, const void *pPayload,
+												size_t payloadLen, iot_async_publish_complete_handler handler,
+												void *pHandlerData, uint16_t *pPacketId) {
+	IoT_Publish_Message_Params params;
+	const unsigned char *bufs[3];
+	size_t lens[3];
+	unsigned char header[1 + 4];
+	IoT_Error_t rc;
+
+	FUNC_ENTRY;
+
+	if(NULL == pPublisher || NULL == pPublisher->pClient || NULL == pPrepared ||
+	   (NULL == pPayload && 0 != payloadLen)) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	if((size_t) (268435455 - pPrepared->topicLen - 2) < payloadLen) {
+		FUNC_EXIT_RC(MAX_SIZE_ERROR);
+	}
+
+	if(!aws_iot_mqtt_is_client_connected(pPublisher->pClient)) {
+		FUNC_EXIT_RC(NETWORK_DISCONNECTED_ERROR);
+	}
+
+	if(QOS0 != pPrepared->qos) {
+		memset(&params, 0, sizeof(IoT_Publish_Message_Params));
+		params.qos = QOS1;
+		params.payload = (void *) pPayload;
+		params.payloadLen = payloadLen;
+		rc = _aws_iot_mqtt_async_publish_enqueue(pPublisher, pPrepared, NULL, 0, &params, NULL, 0, payloadLen,
+												 handler, pHandlerData, pPacketId);
+		FUNC_EXIT_RC(rc);
+	}
+
+	header[0] = pPrepared->header;
+	bufs[0] = header;
+	lens[0] = 1 + aws_iot_mqtt_internal_write_len_to_buffer(&header[1],
+															 (uint32_t) (pPrepared->topicLen + payloadLen));
+	bufs[1] = pPrepared->topic;
+	lens[1] = pPrepared->topicLen;
+	bufs[2] = (const unsigned char *) pPayload;
+	lens[2] = payloadLen;
+
+	rc = aws_iot_mqtt_tap_writev(pPublisher->pClient, bufs, lens, 3, pPublisher->params.writeTimeout_ms);
+
+	FUNC_EXIT_RC(rc);
+}
+
+void aws_iot_mqtt_async_publish_set_rtt(AWS_IoT_Async_Publisher_t *pPublisher, AWS_IoT_Rtt_t *pRtt) {
+	_aws_iot_mqtt_async_publish_lock(pPublisher);
+	pPublisher->pRtt = pRtt;
+	_aws_iot_mqtt_async_publish_unlock(pPublisher);
+}
+
+IoT_Error_t aws_iot_mqtt_async_publish_poll(AWS_IoT_Async_Publisher_t *pPublisher) {
+	_IoT_Async_Publish_Completion_t completions[AWS_IOT_MQTT_ASYNC_PUBLISH_MAX_WINDOW];
+	IoT_Async_Publish_Slot_t *pSlot;
+	IoT_Error_t rc = SUCCESS;
+	IoT_Error_t sendRc;
+	uint8_t completed = 0;
+	uint32_t now_ms;
+	uint8_t i;
+
+	FUNC_ENTRY;
+
+	if(NULL == pPublisher || NULL == pPublisher->pClient) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	_aws_iot_mqtt_async_publish_lock(pPublisher);
+
+	for(i = 0; i < pPublisher->params.windowSize; i++) {
+		pSlot = &(pPublisher->slots[i]);
+		now_ms = aws_iot_mqtt_tap_now_ms();
+
+		switch(pSlot->state) {
+			case IOT_ASYNC_PUBLISH_SLOT_DONE:
+				_aws_iot_mqtt_async_publish_complete(pPublisher, i, pSlot->status, &completions[completed++]);
+				break;
+
+			case IOT_ASYNC_PUBLISH_SLOT_IN_FLIGHT:
+				if(!aws_iot_mqtt_is_client_connected(pPublisher->pClient) ||
+				   _aws_iot_mqtt_async_publish_retry_ms(pPublisher, pSlot) > now_ms - pSlot->sentAt_ms) {
+					break;
+				}
+				if(pSlot->retries >= pPublisher->params.maxRetries) {
+					_aws_iot_mqtt_async_publish_complete(pPublisher, i, IOT_ASYNC_PUBLISH_TIMEOUT,
+														 &completions[completed++]);
+					break;
+				}
+				pSlot->retries++;
+				/* fall through */
+			case IOT_ASYNC_PUBLISH_SLOT_RESEND:
+				if(!aws_iot_mqtt_is_client_connected(pPublisher->pClient)) {
+					break;
+				}
+				pSlot->packet[0] |= ASYNC_PUBLISH_DUP_FLAG;
+				sendRc = _aws_iot_mqtt_async_publish_send(pPublisher, pSlot);
+				if(SUCCESS == sendRc) {
+					pSlot->state = IOT_ASYNC_PUBLISH_SLOT_IN_FLIGHT;
+					pPublisher->stats.retransmitted++;
+				} else {
+					rc = sendRc;
+				}
+				break;
+
+			default:
+				break;
+		}
+	}
+
+	_aws_iot_mqtt_async_publish_unlock(pPublisher);
+
+	_aws_iot_mqtt_async_publish_run_completions(pPublisher, completions, completed);
+
+	FUNC_EXIT_RC(rc);
+}
+
+void aws_iot_mqtt_async_publish_abort_all(AWS_IoT_Async_Publisher_t *pPublisher) {
+	_IoT_Async_Publish_Completion_t completions[AWS_IOT_MQTT_ASYNC_PUBLISH_MAX_WINDOW];
+	IoT_Async_Publish_Slot_t *pSlot;
+	uint8_t completed = 0;
+	uint8_t i;
+
+	if(NULL == pPublisher) {
+		return;
+	}
+
+	_aws_iot_mqtt_async_publish_lock(pPublisher);
+	for(i = 0; i < pPublisher->params.windowSize; i++) {
+		pSlot = &(pPublisher->slots[i]);
+		if(IOT_ASYNC_PUBLISH_SLOT_FREE != pSlot->state) {
+			_aws_iot_mqtt_async_publish_complete(pPublisher, i,
+												 IOT_ASYNC_PUBLISH_SLOT_DONE == pSlot->state ?
+												 pSlot->status : IOT_ASYNC_PUBLISH_ABORTED,
+												 &completions[completed++]);
+		}
+	}
+	_aws_iot_mqtt_async_publish_unlock(pPublisher);
+
+	_aws_iot_mqtt_async_publish_run_completions(pPublisher, completions, completed);
+}
+
+uint8_t aws_iot_mqtt_async_publish_in_flight(const AWS_IoT_Async_Publisher_t *pPublisher) {
+	uint8_t count = 0;
+	uint8_t i;
+
+	for(i = 0; i < pPublisher->params.windowSize; i++) {
+		if(IOT_ASYNC_PUBLISH_SLOT_IN_FLIGHT == pPublisher->slots[i].state ||
+		   IOT_ASYNC_PUBLISH_SLOT_RESEND == pPublisher->slots[i].state) {
+			count++;
+		}
+	}
+	return count;
+}
+
+bool aws_iot_mqtt_async_publish_can_publish(const AWS_IoT_Async_Publisher_t *pPublisher) {
+	uint8_t i;
+
+	for(i = 0; i < pPublisher->params.windowSize; i++) {
+		if(IOT_ASYNC_PUBLISH_SLOT_FREE == pPublisher->slots[i].state) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void aws_iot_mqtt_async_publish_get_stats(const AWS_IoT_Async_Publisher_t *pPublisher,
+										  IoT_Async_Publish_Stats_t *pStats) {
+	*pStats = pPublisher->stats;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,1087 @@
+/**
+  *****************************************************************************
+  * @file   aws_iot_mqtt_client_dispatch.c
+  *
+  *****************************************************************************
+  * @attention
+  *
+  *
+  *  Copyright (c) 2022, InnoPhase, Inc.
+  *
+  *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  *  POSSIBILITY OF SUCH DAMAGE.
+  *
+  *****************************************************************************
+  */
+
+/**
+ * @file aws_iot_mqtt_client_dispatch.c
+ * @brief Topic-filter trie for subscription dispatch
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <string.h>
+
+#include "aws_iot_log.h"
+#include "aws_iot_mqtt_client_common_internal.h"
+#include "aws_iot_mqtt_client_dispatch.h"
+#include "timer_interface.h"
+
+#define DISPATCH_SUBSCRIBE_HEADER   0x82
+#define DISPATCH_UNSUBSCRIBE_HEADER 0xA2
+#define DISPATCH_PUBACK_HEADER      0x40
+#define DISPATCH_SUBACK_FAILURE     0x80
+#define DISPATCH_ROOT               0
+
+typedef struct {
+	IoT_Dispatch_Match_t *pMatches;
+	uint8_t count;
+	bool isStream;  ///< Collect stream handlers rather than message handlers
+} _IoT_Dispatch_Matches_t;
+
+static void _aws_iot_mqtt_dispatch_lock(AWS_IoT_Dispatcher_t *pDispatcher) {
+#ifdef _ENABLE_THREAD_SUPPORT_
+	(void) aws_iot_thread_mutex_lock(&(pDispatcher->lock));
+#else
+	IOT_UNUSED(pDispatcher);
+#endif
+}
+
+static void _aws_iot_mqtt_dispatch_unlock(AWS_IoT_Dispatcher_t *pDispatcher) {
+#ifdef _ENABLE_THREAD_SUPPORT_
+	(void) aws_iot_thread_mutex_unlock(&(pDispatcher->lock));
+#else
+	IOT_UNUSED(pDispatcher);
+#endif
+}
+
+static bool _aws_iot_mqtt_dispatch_string_equals(const AWS_IoT_Dispatcher_t *pDispatcher, uint16_t idx,
+												 const char *pStr, uint16_t len) {
+	const IoT_Dispatch_String_t *pString = &(pDispatcher->strings[idx]);
+
+	return len == pString->len && 0 == memcmp(&(pDispatcher->pool[pString->offset]), pStr, len);
+}
+
+static uint16_t _aws_iot_mqtt_dispatch_find_string(const AWS_IoT_Dispatcher_t *pDispatcher, const char *pStr,
+												   uint16_t len) {
+	uint16_t i;
+
+	for(i = 0; i < pDispatcher->stringCount; i++) {
+		if(_aws_iot_mqtt_dispatch_string_equals(pDispatcher, i, pStr, len)) {
+			return i;
+		}
+	}
+	return IOT_DISPATCH_NONE;
+}
+
+static uint16_t _aws_iot_mqtt_dispatch_intern(AWS_IoT_Dispatcher_t *pDispatcher, const char *pStr, uint16_t len) {
+	uint16_t idx = _aws_iot_mqtt_dispatch_find_string(pDispatcher, pStr, len);
+
+	if(IOT_DISPATCH_NONE != idx) {
+		return idx;
+	}
+
+	if(AWS_IOT_MQTT_DISPATCH_MAX_STRINGS <= pDispatcher->stringCount ||
+	   AWS_IOT_MQTT_DISPATCH_POOL_LEN - pDispatcher->poolLen < len) {
+		IOT_ERROR("dispatch: string pool full");
+		return IOT_DISPATCH_NONE;
+	}
+
+	idx = pDispatcher->stringCount++;
+	pDispatcher->strings[idx].offset = pDispatcher->poolLen;
+	pDispatcher->strings[idx].len = len;
+	memcpy(&(pDispatcher->pool[pDispatcher->poolLen]), pStr, len);
+	pDispatcher->poolLen = (uint16_t) (pDispatcher->poolLen + len);
+
+	return idx;
+}
+
+static uint16_t _aws_iot_mqtt_dispatch_level_end(const char *pTopic, uint16_t topicLen, uint16_t start) {
+	while(start < topicLen && '/' != pTopic[start]) {
+		start++;
+	}
+	return start;
+}
+
+/* '#' only as the whole last level, '+' only as a whole level */
+static bool _aws_iot_mqtt_dispatch_is_filter_valid(const char *pFilter, uint16_t len) {
+	uint16_t i;
+
+	for(i = 0; i < len; i++) {
+		if('+' == pFilter[i] || '#' == pFilter[i]) {
+			if((0 < i && '/' != pFilter[i - 1]) || (i + 1 < len && '/' != pFilter[i + 1])) {
+				return false;
+			}
+			if('#' == pFilter[i] && i + 1 != len) {
+				return false;
+			}
+		}
+	}
+	return 0 < len;
+}
+
+static uint16_t _aws_iot_mqtt_dispatch_find_child(const AWS_IoT_Dispatcher_t *pDispatcher, uint16_t parent,
+												  const char *pLevel, uint16_t len) {
+	const IoT_Dispatch_Node_t *pParent = &(pDispatcher->nodes[parent]);
+	uint16_t child;
+
+	if(1 == len && '+' == pLevel[0]) {
+		return pParent->plusChild;
+	}
+	if(1 == len && '#' == pLevel[0]) {
+		return pParent->hashChild;
+	}
+
+	for(child = pParent->firstChild; IOT_DISPATCH_NONE != child; child = pDispatcher->nodes[child].nextSibling) {
+		if(_aws_iot_mqtt_dispatch_string_equals(pDispatcher, pDispatcher->nodes[child].level, pLevel, len)) {
+			return child;
+		}
+	}
+	return IOT_DISPATCH_NONE;
+}
+
+static uint16_t _aws_iot_mqtt_dispatch_add_child(AWS_IoT_Dispatcher_t *pDispatcher, uint16_t parent,
+												 const char *pLevel, uint16_t len) {
+	IoT_Dispatch_Node_t *pParent = &(pDispatcher->nodes[parent]);
+	IoT_Dispatch_Node_t *pNode;
+	uint16_t level;
+	uint16_t idx;
+
+	if(AWS_IOT_MQTT_DISPATCH_MAX_NODES <= pDispatcher->nodeCount) {
+		IOT_ERROR("dispatch: no free trie node");
+		return IOT_DISPATCH_NONE;
+	}
+
+	level = _aws_iot_mqtt_dispatch_intern(pDispatcher, pLevel, len);
+	if(IOT_DISPATCH_NONE == level) {
+		return IOT_DISPATCH_NONE;
+	}
+
+	idx = pDispatcher->nodeCount++;
+	pNode = &(pDispatcher->nodes[idx]);
+	pNode->level = level;
+	pNode->firstChild = IOT_DISPATCH_NONE;
+	pNode->nextSibling = IOT_DISPATCH_NONE;
+	pNode->plusChild = IOT_DISPATCH_NONE;
+	pNode->hashChild = IOT_DISPATCH_NONE;
+	pNode->firstHandler = IOT_DISPATCH_NONE;
+
+	if(1 == len && '+' == pLevel[0]) {
+		pParent->plusChild = idx;
+	} else if(1 == len && '#' == pLevel[0]) {
+		pParent->hashChild = idx;
+	} else {
+		pNode->nextSibling = pParent->firstChild;
+		pParent->firstChild = idx;
+	}
+
+	return idx;
+}
+
+/* Node of the last level of a filter, created on the way if isCreate */
+static uint16_t _aws_iot_mqtt_dispatch_get_node(AWS_IoT_Dispatcher_t *pDispatcher, const char *pFilter, uint16_t len,
+												bool isCreate) {
+	uint16_t node = DISPATCH_ROOT;
+	uint16_t child;
+	uint16_t start = 0;
+	uint16_t end;
+
+	while(start <= len) {
+		end = _aws_iot_mqtt_dispatch_level_end(pFilter, len, start);
+		child = _aws_iot_mqtt_dispatch_find_child(pDispatcher, node, &pFilter[start], (uint16_t) (end - start));
+		if(IOT_DISPATCH_NONE == child) {
+			if(!isCreate) {
+				return IOT_DISPATCH_NONE;
+			}
+			child = _aws_iot_mqtt_dispatch_add_child(pDispatcher, node, &pFilter[start], (uint16_t) (end - start));
+			if(IOT_DISPATCH_NONE == child) {
+				return IOT_DISPATCH_NONE;
+			}
+		}
+		node = child;
+		start = (uint16_t) (end + 1);
+	}
+
+	return node;
+}
+
+static void _aws_iot_mqtt_dispatch_collect(const AWS_IoT_Dispatcher_t *pDispatcher, uint16_t node,
+										   _IoT_Dispatch_Matches_t *pMatches) {
+	uint16_t h;
+
+	for(h = pDispatcher->nodes[node].firstHandler; IOT_DISPATCH_NONE != h; h = pDispatcher->handlers[h].next) {
+		if(pMatches->isStream != (NULL == pDispatcher->handlers[h].handler)) {
+			continue;
+		}
+		if(AWS_IOT_MQTT_DISPATCH_MAX_MATCHES <= pMatches->count) {
+			IOT_WARN("dispatch: more than %d handlers match, some are skipped", AWS_IOT_MQTT_DISPATCH_MAX_MATCHES);
+			return;
+		}
+		pMatches->pMatches[pMatches->count].handler = pDispatcher->handlers[h].handler;
+		pMatches->pMatches[pMatches->count].streamHandler = pDispatcher->handlers[h].streamHandler;
+		pMatches->pMatches[pMatches->count].pHandlerData = pDispatcher->handlers[h].pHandlerData;
+		pMatches->count++;
+	}
+}
+
+/* Walks the trie one topic level at a time. start > topicLen once every level has been consumed. */
+static void _aws_iot_mqtt_dispatch_match(const AWS_IoT_Dispatcher_t *pDispatcher, uint16_t node, const char *pTopic,
+										 uint16_t topicLen, uint16_t start, _IoT_Dispatch_Matches_t *pMatches) {
+	const IoT_Dispatch_Node_t *pNode = &(pDispatcher->nodes[node]);
+	/* wildcards at the first level do not match topics starting with '$' */
+	bool isWildcardAllowed = !(DISPATCH_ROOT == node && 0 < topicLen && '$' == pTopic[0]);
+	uint16_t child;
+	uint16_t end;
+
+	if(start > topicLen) {
+		_aws_iot_mqtt_dispatch_collect(pDispatcher, node, pMatches);
+		/* "a/#" also matches "a" */
+		if(IOT_DISPATCH_NONE != pNode->hashChild) {
+			_aws_iot_mqtt_dispatch_collect(pDispatcher, pNode->hashChild, pMatches);
+		}
+		return;
+	}
+
+	if(IOT_DISPATCH_NONE != pNode->hashChild && isWildcardAllowed) {
+		_aws_iot_mqtt_dispatch_collect(pDispatcher, pNode->hashChild, pMatches);
+	}
+
+	end = _aws_iot_mqtt_dispatch_level_end(pTopic, topicLen, start);
+
+	for(child = pNode->firstChild; IOT_DISPATCH_NONE != child; child = pDispatcher->nodes[child].nextSibling) {
+		if(_aws_iot_mqtt_dispatch_string_equals(pDispatcher, pDispatcher->nodes[child].level, &pTopic[start],
+												(uint16_t) (end - start))) {
+			_aws_iot_mqtt_dispatch_match(pDispatcher, child, pTopic, topicLen, (uint16_t) (end + 1), pMatches);
+			/* levels are unique among siblings */
+			break;
+		}
+	}
+
+	if(IOT_DISPATCH_NONE != pNode->plusChild && isWildcardAllowed) {
+		_aws_iot_mqtt_dispatch_match(pDispatcher, pNode->plusChild, pTopic, topicLen, (uint16_t) (end + 1), pMatches);
+	}
+}
+
+static IoT_Dispatch_Subscription_t *_aws_iot_mqtt_dispatch_find_subscription(AWS_IoT_Dispatcher_t *pDispatcher,
+																			 uint16_t node) {
+	uint16_t i;
+
+	for(i = 0; i < AWS_IOT_MQTT_DISPATCH_MAX_SUBSCRIPTIONS; i++) {
+		if(IOT_DISPATCH_SUB_FREE != pDispatcher->subscriptions[i].state && node == pDispatcher->subscriptions[i].node) {
+			return &(pDispatcher->subscriptions[i]);
+		}
+	}
+	return NULL;
+}
+
+static IoT_Error_t _aws_iot_mqtt_dispatch_send_unsubscribe(AWS_IoT_Dispatcher_t *pDispatcher,
+														   IoT_Dispatch_Subscription_t *pSub, uint16_t packetId) {
+	const IoT_Dispatch_String_t *pFilter = &(pDispatcher->strings[pSub->filter]);
+	unsigned char *ptr = pDispatcher->txBuf;
+	uint32_t remainingLength = 2 + 2 + pFilter->len;
+
+	if(aws_iot_mqtt_internal_get_final_packet_length_from_remaining_length(remainingLength) >
+	   sizeof(pDispatcher->txBuf)) {
+		return MQTT_TX_BUFFER_TOO_SHORT_ERROR;
+	}
+
+	*ptr++ = DISPATCH_UNSUBSCRIBE_HEADER;
+	ptr += aws_iot_mqtt_internal_write_len_to_buffer(ptr, remainingLength);
+	aws_iot_mqtt_internal_write_uint_16(&ptr, packetId);
+	aws_iot_mqtt_internal_write_utf8_string(&ptr, &(pDispatcher->pool[pFilter->offset]), pFilter->len);
+
+	return aws_iot_mqtt_tap_write(pDispatcher->pClient, pDispatcher->txBuf, (size_t) (ptr - pDispatcher->txBuf),
+								  pDispatcher->pClient->clientData.commandTimeoutMs);
+}
+
+static bool _aws_iot_mqtt_dispatch_is_due(const IoT_Dispatch_Subscription_t *pSub, uint32_t now_ms) {
+	return IOT_DISPATCH_SUB_PENDING == pSub->state ||
+		   (IOT_DISPATCH_SUB_REQUESTED == pSub->state &&
+			AWS_IOT_MQTT_DISPATCH_SUBACK_TIMEOUT_MS <= now_ms - pSub->sentAt_ms);
+}
+
+/* Packs every pending subscription, and the ones whose SUBACK is overdue, into as few SUBSCRIBE packets as txBuf allows */
+static IoT_Error_t _aws_iot_mqtt_dispatch_send_subscribes(AWS_IoT_Dispatcher_t *pDispatcher) {
+	IoT_Dispatch_Subscription_t *batch[AWS_IOT_MQTT_DISPATCH_MAX_SUBSCRIPTIONS];
+	const IoT_Dispatch_String_t *pFilter;
+	IoT_Dispatch_Subscription_t *pSub;
+	IoT_Error_t rc = SUCCESS;
+	uint32_t now_ms = aws_iot_mqtt_tap_now_ms();
+	uint32_t remainingLength;
+	unsigned char *ptr;
+	uint16_t packetId;
+	uint16_t count;
+	uint16_t next = 0;
+	uint16_t i;
+
+	while(SUCCESS == rc && AWS_IOT_MQTT_DISPATCH_MAX_SUBSCRIPTIONS > next) {
+		remainingLength = 2;
+		count = 0;
+		for(i = next; i < AWS_IOT_MQTT_DISPATCH_MAX_SUBSCRIPTIONS; i++) {
+			pSub = &(pDispatcher->subscriptions[i]);
+			if(!_aws_iot_mqtt_dispatch_is_due(pSub, now_ms)) {
+				continue;
+			}
+			pFilter = &(pDispatcher->strings[pSub->filter]);
+			if(aws_iot_mqtt_internal_get_final_packet_length_from_remaining_length(
+				   remainingLength + 2 + pFilter->len + 1) > sizeof(pDispatcher->txBuf)) {
+				break;
+			}
+			remainingLength += 2 + pFilter->len + 1;
+			batch[count++] = pSub;
+		}
+		next = i;
+
+		if(0 == count) {
+			break;
+		}
+
+		packetId = aws_iot_mqtt_get_next_packet_id(pDispatcher->pClient);
+		ptr = pDispatcher->txBuf;
+		*ptr++ = DISPATCH_SUBSCRIBE_HEADER;
+		ptr += aws_iot_mqtt_internal_write_len_to_buffer(ptr, remainingLength);
+		aws_iot_mqtt_internal_write_uint_16(&ptr, packetId);
+		for(i = 0; i < count; i++) {
+			pFilter = &(pDispatcher->strings[batch[i]->filter]);
+			aws_iot_mqtt_internal_write_utf8_string(&ptr, &(pDispatcher->pool[pFilter->offset]), pFilter->len);
+			*ptr++ = (unsigned char) batch[i]->qos;
+			/* marked before the write, the SUBACK may be read by another thread as soon as the packet is out */
+			batch[i]->packetId = packetId;
+			batch[i]->batchIndex = (uint8_t) i;
+			batch[i]->sentAt_ms = now_ms;
+			batch[i]->state = IOT_DISPATCH_SUB_REQUESTED;
+		}
+
+		rc = aws_iot_mqtt_tap_write(pDispatcher->pClient, pDispatcher->txBuf, (size_t) (ptr - pDispatcher->txBuf),
+									pDispatcher->pClient->clientData.commandTimeoutMs);
+		if(SUCCESS != rc) {
+			for(i = 0; i < count; i++) {
+				batch[i]->state = IOT_DISPATCH_SUB_PENDING;
+			}
+		} else {
+			pDispatcher->stats.subscribePackets++;
+		}
+	}
+
+	return rc;
+}
+
+static void _aws_iot_mqtt_dispatch_on_suback(AWS_IoT_Dispatcher_t *pDispatcher, const unsigned char *pBody,
+											 size_t len) {
+	IoT_Dispatch_Subscription_t *pSub;
+	uint16_t packetId;
+	uint16_t i;
+
+	if(3 > len) {
+		return;
+	}
+	packetId = (uint16_t) ((pBody[0] << 8) | pBody[1]);
+
+	_aws_iot_mqtt_dispatch_lock(pDispatcher);
+	for(i = 0; i < AWS_IOT_MQTT_DISPATCH_MAX_SUBSCRIPTIONS; i++) {
+		pSub = &(pDispatcher->subscriptions[i]);
+		/* one return code per filter, in the order of the SUBSCRIBE */
+		if(IOT_DISPATCH_SUB_REQUESTED == pSub->state && packetId == pSub->packetId &&
+		   (size_t) pSub->batchIndex + 2 < len) {
+			pSub->grantedQos = pBody[2 + pSub->batchIndex];
+			if(DISPATCH_SUBACK_FAILURE == pSub->grantedQos) {
+				pSub->state = IOT_DISPATCH_SUB_REJECTED;
+				pDispatcher->stats.rejected++;
+				IOT_ERROR("dispatch: subscription to %.*s rejected", pDispatcher->strings[pSub->filter].len,
+						  &(pDispatcher->pool[pDispatcher->strings[pSub->filter].offset]));
+			} else {
+				pSub->state = IOT_DISPATCH_SUB_ACTIVE;
+			}
+		}
+	}
+	_aws_iot_mqtt_dispatch_unlock(pDispatcher);
+}
+
+static void _aws_iot_mqtt_dispatch_on_connack(AWS_IoT_Dispatcher_t *pDispatcher, const unsigned char *pBody,
+											  size_t len) {
+	IoT_Dispatch_Subscription_t *pSub;
+	bool isSessionPresent;
+	uint16_t i;
+
+	if(2 > len || 0 != pBody[1]) {
+		return;
+	}
+	isSessionPresent = (0 != (pBody[0] & 0x01));
+
+	_aws_iot_mqtt_dispatch_lock(pDispatcher);
+	for(i = 0; i < AWS_IOT_MQTT_DISPATCH_MAX_SUBSCRIPTIONS; i++) {
+		pSub = &(pDispatcher->subscriptions[i]);
+		/* the broker kept what it had granted only if the session is present */
+		if(IOT_DISPATCH_SUB_REQUESTED == pSub->state ||
+		   (!isSessionPresent && IOT_DISPATCH_SUB_FREE != pSub->state)) {
+			pSub->state = IOT_DISPATCH_SUB_PENDING;
+		}
+	}
+	_aws_iot_mqtt_dispatch_unlock(pDispatcher);
+}
+
+/* Length of the variable header of a publish, once its first two bytes are in rxBuf */
+static uint32_t _aws_iot_mqtt_dispatch_publish_header_len(const AWS_IoT_Dispatcher_t *pDispatcher, uint8_t header) {
+	uint16_t topicNameLen = (uint16_t) ((pDispatcher->rxBuf[0] << 8) | pDispatcher->rxBuf[1]);
+
+	return 2 + (uint32_t) topicNameLen + ((0 != ((header >> 1) & 0x03)) ? 2 : 0);
+}
+
+static void _aws_iot_mqtt_dispatch_parse_header(const AWS_IoT_Dispatcher_t *pDispatcher, uint8_t header,
+												uint32_t remainingLength, IoT_Dispatch_Chunk_t *pChunk) {
+	uint32_t headerLen = _aws_iot_mqtt_dispatch_publish_header_len(pDispatcher, header);
+
+	pChunk->topicNameLen = (uint16_t) ((pDispatcher->rxBuf[0] << 8) | pDispatcher->rxBuf[1]);
+	pChunk->pTopicName = (const char *) &(pDispatcher->rxBuf[2]);
+	pChunk->qos = (QoS) ((header >> 1) & 0x03);
+	pChunk->isRetained = (uint8_t) (header & 0x01);
+	pChunk->isDup = (uint8_t) ((header >> 3) & 0x01);
+	pChunk->id = 0;
+	if(QOS0 != pChunk->qos) {
+		pChunk->id = (uint16_t) ((pDispatcher->rxBuf[headerLen - 2] << 8) | pDispatcher->rxBuf[headerLen - 1]);
+	}
+	pChunk->pPayload = pDispatcher->chunkBuf;
+	pChunk->payloadLen = 0;
+	pChunk->offset = 0;
+	pChunk->totalLen = remainingLength - headerLen;
+	pChunk->isAborted = false;
+}
+
+static void _aws_iot_mqtt_dispatch_emit_chunk(AWS_IoT_Dispatcher_t *pDispatcher) {
+	IoT_Dispatch_Chunk_t *pChunk = &(pDispatcher->chunk);
+	uint8_t i;
+
+	for(i = 0; i < pDispatcher->streamMatchCount; i++) {
+		pDispatcher->streamMatches[i].streamHandler(pDispatcher->pClient, pChunk,
+													pDispatcher->streamMatches[i].pHandlerData);
+	}
+	pChunk->offset += (uint32_t) pChunk->payloadLen;
+	pChunk->payloadLen = 0;
+}
+
+/* Payload bytes of a streamed publish, cut into chunks of AWS_IOT_MQTT_DISPATCH_CHUNK_LEN */
+static void _aws_iot_mqtt_dispatch_stream(AWS_IoT_Dispatcher_t *pDispatcher, const unsigned char *pData,
+										  size_t len) {
+	IoT_Dispatch_Chunk_t *pChunk = &(pDispatcher->chunk);
+	size_t copyLen;
+
+	while(0 < len) {
+		copyLen = AWS_IOT_MQTT_DISPATCH_CHUNK_LEN - pChunk->payloadLen;
+		if(copyLen > len) {
+			copyLen = len;
+		}
+		memcpy(&(pDispatcher->chunkBuf[pChunk->payloadLen]), pData, copyLen);
+		pChunk->payloadLen += copyLen;
+		pData += copyLen;
+		len -= copyLen;
+		if(AWS_IOT_MQTT_DISPATCH_CHUNK_LEN == pChunk->payloadLen &&
+		   pChunk->offset + AWS_IOT_MQTT_DISPATCH_CHUNK_LEN < pChunk->totalLen) {
+			_aws_iot_mqtt_dispatch_emit_chunk(pDispatcher);
+		}
+	}
+}
+
+static void _aws_iot_mqtt_dispatch_abort_stream(AWS_IoT_Dispatcher_t *pDispatcher) {
+	if(IOT_DISPATCH_STREAM_PAYLOAD == pDispatcher->streamState) {
+		pDispatcher->chunk.payloadLen = 0;
+		pDispatcher->chunk.isAborted = true;
+		_aws_iot_mqtt_dispatch_emit_chunk(pDispatcher);
+	}
+	pDispatcher->streamState = IOT_DISPATCH_STREAM_IDLE;
+}
+
+static void _aws_iot_mqtt_dispatch_on_publish_data(AWS_IoT_Dispatcher_t *pDispatcher, const IoT_Tap_Event_t *pEvent) {
+	_IoT_Dispatch_Matches_t matches;
+	uint32_t received = pEvent->offset + (uint32_t) pEvent->dataLen;
+	uint32_t skip;
+
+	if(pEvent->offset < AWS_IOT_MQTT_DISPATCH_RX_BUF_LEN) {
+		memcpy(&(pDispatcher->rxBuf[pEvent->offset]), pEvent->pData,
+			   (received <= AWS_IOT_MQTT_DISPATCH_RX_BUF_LEN) ? pEvent->dataLen :
+															  AWS_IOT_MQTT_DISPATCH_RX_BUF_LEN - pEvent->offset);
+	}
+
+	if(IOT_DISPATCH_STREAM_HEADER == pDispatcher->streamState && 2 <= received) {
+		pDispatcher->streamHeaderLen = _aws_iot_mqtt_dispatch_publish_header_len(pDispatcher, pEvent->header);
+		if(pDispatcher->streamHeaderLen > AWS_IOT_MQTT_DISPATCH_RX_BUF_LEN ||
+		   pDispatcher->streamHeaderLen > pEvent->remainingLength) {
+			pDispatcher->streamState = IOT_DISPATCH_STREAM_SKIP;
+		} else if(pDispatcher->streamHeaderLen <= received) {
+			_aws_iot_mqtt_dispatch_parse_header(pDispatcher, pEvent->header, pEvent->remainingLength,
+												&(pDispatcher->chunk));
+			matches.pMatches = pDispatcher->streamMatches;
+			matches.count = 0;
+			matches.isStream = true;
+			_aws_iot_mqtt_dispatch_lock(pDispatcher);
+			_aws_iot_mqtt_dispatch_match(pDispatcher, DISPATCH_ROOT, pDispatcher->chunk.pTopicName,
+										 pDispatcher->chunk.topicNameLen, 0, &matches);
+			_aws_iot_mqtt_dispatch_unlock(pDispatcher);
+			pDispatcher->streamMatchCount = matches.count;
+			pDispatcher->streamState = (0 < matches.count) ? IOT_DISPATCH_STREAM_PAYLOAD : IOT_DISPATCH_STREAM_SKIP;
+		}
+	}
+
+	/* the header is complete at the latest in this event, so earlier events held no payload */
+	if(IOT_DISPATCH_STREAM_PAYLOAD == pDispatcher->streamState && pDispatcher->streamHeaderLen < received) {
+		skip = (pDispatcher->streamHeaderLen > pEvent->offset) ? pDispatcher->streamHeaderLen - pEvent->offset : 0;
+		_aws_iot_mqtt_dispatch_stream(pDispatcher, &(pEvent->pData[skip]), pEvent->dataLen - skip);
+	}
+}
+
+static IoT_Error_t _aws_iot_mqtt_dispatch_send_puback(AWS_IoT_Dispatcher_t *pDispatcher, uint16_t id) {
+	unsigned char puback[4];
+
+	puback[0] = DISPATCH_PUBACK_HEADER;
+	puback[1] = 2;
+	puback[2] = (unsigned char) (id >> 8);
+	puback[3] = (unsigned char) (id & 0xFF);
+	return aws_iot_mqtt_tap_write(pDispatcher->pClient, puback, sizeof(puback),
+								  pDispatcher->pClient->clientData.commandTimeoutMs);
+}
+
+/* QoS1 publishes the client discarded are not acknowledged by it */
+static void _aws_iot_mqtt_dispatch_queue_puback(AWS_IoT_Dispatcher_t *pDispatcher, const IoT_Tap_Event_t *pEvent) {
+	bool isQueued = false;
+
+	if(QOS1 != pDispatcher->chunk.qos ||
+	   AWS_IOT_MQTT_RX_BUF_LEN >=
+	   aws_iot_mqtt_internal_get_final_packet_length_from_remaining_length(pEvent->remainingLength)) {
+		return;
+	}
+
+	_aws_iot_mqtt_dispatch_lock(pDispatcher);
+	if(AWS_IOT_MQTT_DISPATCH_MAX_PENDING_ACKS > pDispatcher->pubackCount) {
+		pDispatcher->pubackIds[pDispatcher->pubackCount++] = pDispatcher->chunk.id;
+		isQueued = true;
+	}
+	_aws_iot_mqtt_dispatch_unlock(pDispatcher);
+
+	/* an unacknowledged publish would be redelivered for ever, acknowledge it from here */
+	if(!isQueued) {
+		pDispatcher->stats.ackOverflows++;
+		if(SUCCESS != _aws_iot_mqtt_dispatch_send_puback(pDispatcher, pDispatcher->chunk.id)) {
+			IOT_WARN("dispatch: unable to send the PUBACK of packet %u", (unsigned) pDispatcher->chunk.id);
+		}
+	}
+}
+
+static void _aws_iot_mqtt_dispatch_on_publish_end(AWS_IoT_Dispatcher_t *pDispatcher, const IoT_Tap_Event_t *pEvent) {
+	IoT_Publish_Message_Params params;
+	bool isStreamed = (IOT_DISPATCH_STREAM_PAYLOAD == pDispatcher->streamState);
+	bool isConsumed = isStreamed;
+
+	if(isStreamed) {
+		/* last chunk, possibly empty for an empty payload */
+		_aws_iot_mqtt_dispatch_emit_chunk(pDispatcher);
+		pDispatcher->stats.streamed++;
+	}
+
+	if(pDispatcher->isRxDropped) {
+		if(!isStreamed) {
+			pDispatcher->stats.dropped++;
+		}
+	} else if(2 <= pEvent->remainingLength &&
+			  _aws_iot_mqtt_dispatch_publish_header_len(pDispatcher, pEvent->header) <= pEvent->remainingLength) {
+		_aws_iot_mqtt_dispatch_parse_header(pDispatcher, pEvent->header, pEvent->remainingLength,
+											&(pDispatcher->chunk));
+		params.qos = pDispatcher->chunk.qos;
+		params.isRetained = pDispatcher->chunk.isRetained;
+		params.isDup = pDispatcher->chunk.isDup;
+		params.id = pDispatcher->chunk.id;
+		params.payloadLen = pDispatcher->chunk.totalLen;
+		params.payload = &(pDispatcher->rxBuf[pEvent->remainingLength - params.payloadLen]);
+		if(0 < aws_iot_mqtt_dispatch_deliver(pDispatcher, pDispatcher->chunk.pTopicName,
+											 pDispatcher->chunk.topicNameLen, &params)) {
+			isConsumed = true;
+		}
+	}
+
+	if(isConsumed) {
+		_aws_iot_mqtt_dispatch_queue_puback(pDispatcher, pEvent);
+	}
+
+	pDispatcher->streamState = IOT_DISPATCH_STREAM_IDLE;
+}
+
+/* Runs in the thread reading the socket */
+static void _aws_iot_mqtt_dispatch_on_packet(AWS_IoT_Client *pClient, const IoT_Tap_Event_t *pEvent, void *pData) {
+	AWS_IoT_Dispatcher_t *pDispatcher = (AWS_IoT_Dispatcher_t *) pData;
+	uint8_t type = IOT_TAP_PACKET_TYPE(pEvent->header);
+
+	IOT_UNUSED(pClient);
+
+	if(IOT_TAP_EVENT_CONNECTED == pEvent->type || IOT_TAP_EVENT_DISCONNECTED == pEvent->type) {
+		_aws_iot_mqtt_dispatch_abort_stream(pDispatcher);
+		_aws_iot_mqtt_dispatch_lock(pDispatcher);
+		pDispatcher->pubackCount = 0;
+		_aws_iot_mqtt_dispatch_unlock(pDispatcher);
+		return;
+	}
+
+	if(IOT_TAP_INBOUND != pEvent->direction) {
+		return;
+	}
+
+	if(IOT_TAP_PUBLISH == type) {
+		switch(pEvent->type) {
+			case IOT_TAP_EVENT_PACKET_BEGIN:
+				pDispatcher->isRxDropped = (AWS_IOT_MQTT_DISPATCH_RX_BUF_LEN < pEvent->remainingLength);
+				pDispatcher->streamState = IOT_DISPATCH_STREAM_HEADER;
+				break;
+			case IOT_TAP_EVENT_PACKET_DATA:
+				_aws_iot_mqtt_dispatch_on_publish_data(pDispatcher, pEvent);
+				break;
+			case IOT_TAP_EVENT_PACKET_END:
+				_aws_iot_mqtt_dispatch_on_publish_end(pDispatcher, pEvent);
+				break;
+			default:
+				break;
+		}
+	} else if(IOT_TAP_EVENT_PACKET_END == pEvent->type) {
+		if(IOT_TAP_SUBACK == type) {
+			_aws_iot_mqtt_dispatch_on_suback(pDispatcher, pEvent->pData, pEvent->dataLen);
+		} else if(IOT_TAP_CONNACK == type) {
+			_aws_iot_mqtt_dispatch_on_connack(pDispatcher, pEvent->pData, pEvent->dataLen);
+		}
+	}
+}
+
+IoT_Error_t aws_iot_mqtt_dispatch_init(AWS_IoT_Dispatcher_t *pDispatcher, AWS_IoT_Client *pClient) {
+	IoT_Error_t rc;
+	uint16_t i;
+
+	FUNC_ENTRY;
+
+	if(NULL == pDispatcher || NULL == pClient) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	memset(pDispatcher, 0, sizeof(AWS_IoT_Dispatcher_t));
+	pDispatcher->pClient = pClient;
+
+	/* root node, its level is never compared */
+	pDispatcher->nodeCount = 1;
+	pDispatcher->nodes[DISPATCH_ROOT].level = IOT_DISPATCH_NONE;
+	pDispatcher->nodes[DISPATCH_ROOT].firstChild = IOT_DISPATCH_NONE;
+	pDispatcher->nodes[DISPATCH_ROOT].nextSibling = IOT_DISPATCH_NONE;
+	pDispatcher->nodes[DISPATCH_ROOT].plusChild = IOT_DISPATCH_NONE;
+	pDispatcher->nodes[DISPATCH_ROOT].hashChild = IOT_DISPATCH_NONE;
+	pDispatcher->nodes[DISPATCH_ROOT].firstHandler = IOT_DISPATCH_NONE;
+
+	for(i = 0; i < AWS_IOT_MQTT_DISPATCH_MAX_HANDLERS; i++) {
+		pDispatcher->handlers[i].next = (uint16_t) ((i + 1 < AWS_IOT_MQTT_DISPATCH_MAX_HANDLERS) ? i + 1 : IOT_DISPATCH_NONE);
+	}
+	pDispatcher->freeHandler = 0;
+
+#ifdef _ENABLE_THREAD_SUPPORT_
+	rc = aws_iot_thread_mutex_init(&(pDispatcher->lock));
+	if(SUCCESS != rc) {
+		FUNC_EXIT_RC(rc);
+	}
+#endif
+
+	pDispatcher->observer.handler = _aws_iot_mqtt_dispatch_on_packet;
+	pDispatcher->observer.pHandlerData = pDispatcher;
+	rc = aws_iot_mqtt_tap_add_observer(pClient, &(pDispatcher->observer));
+
+	FUNC_EXIT_RC(rc);
+}
+
+IoT_Error_t aws_iot_mqtt_dispatch_deinit(AWS_IoT_Dispatcher_t *pDispatcher) {
+	FUNC_ENTRY;
+
+	if(NULL == pDispatcher || NULL == pDispatcher->pClient) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	(void) aws_iot_mqtt_tap_remove_observer(pDispatcher->pClient, &(pDispatcher->observer));
+#ifdef _ENABLE_THREAD_SUPPORT_
+	(void) aws_iot_thread_mutex_destroy(&(pDispatcher->lock));
+#endif
+	pDispatcher->pClient = NULL;
+
+	FUNC_EXIT_RC(SUCCESS);
+}
+
+/* Registers a handler. The SUBSCRIBE is sent at once only if isSendNow, otherwise by the caller or the next poll. */
+static IoT_Error_t _aws_iot_mqtt_dispatch_add(AWS_IoT_Dispatcher_t *pDispatcher, const char *pTopicFilter,
+											  uint16_t topicFilterLen, QoS qos, pApplicationHandler_t handler,
+											  iot_dispatch_stream_handler streamHandler, void *pHandlerData,
+											  bool isSendNow) {
+	IoT_Dispatch_Subscription_t *pSub;
+	IoT_Dispatch_Handler_t *pHandler;
+	IoT_Error_t rc = SUCCESS;
+	uint16_t node;
+	uint16_t h;
+	uint16_t i;
+
+	if(!_aws_iot_mqtt_dispatch_is_filter_valid(pTopicFilter, topicFilterLen)) {
+		IOT_ERROR("dispatch: invalid topic filter %.*s", topicFilterLen, pTopicFilter);
+		return FAILURE;
+	}
+
+	if(aws_iot_mqtt_internal_get_final_packet_length_from_remaining_length(2 + 2 + (uint32_t) topicFilterLen + 1) >
+	   sizeof(pDispatcher->txBuf)) {
+		return MQTT_TX_BUFFER_TOO_SHORT_ERROR;
+	}
+
+	_aws_iot_mqtt_dispatch_lock(pDispatcher);
+
+	node = _aws_iot_mqtt_dispatch_get_node(pDispatcher, pTopicFilter, topicFilterLen, true);
+	pSub = (IOT_DISPATCH_NONE != node) ? _aws_iot_mqtt_dispatch_find_subscription(pDispatcher, node) : NULL;
+	if(IOT_DISPATCH_NONE != node && NULL == pSub) {
+		for(i = 0; i < AWS_IOT_MQTT_DISPATCH_MAX_SUBSCRIPTIONS && NULL == pSub; i++) {
+			if(IOT_DISPATCH_SUB_FREE == pDispatcher->subscriptions[i].state) {
+				pSub = &(pDispatcher->subscriptions[i]);
+				pSub->filter = _aws_iot_mqtt_dispatch_intern(pDispatcher, pTopicFilter, topicFilterLen);
+				if(IOT_DISPATCH_NONE == pSub->filter) {
+					_aws_iot_mqtt_dispatch_unlock(pDispatcher);
+					return FAILURE;
+				}
+				pSub->node = node;
+				pSub->qos = qos;
+				pSub->state = IOT_DISPATCH_SUB_PENDING;
+			}
+		}
+	}
+
+	if(NULL == pSub || IOT_DISPATCH_NONE == pDispatcher->freeHandler) {
+		_aws_iot_mqtt_dispatch_unlock(pDispatcher);
+		IOT_ERROR("dispatch: no room for %.*s", topicFilterLen, pTopicFilter);
+		return MQTT_MAX_SUBSCRIPTIONS_REACHED_ERROR;
+	}
+
+	h = pDispatcher->freeHandler;
+	pHandler = &(pDispatcher->handlers[h]);
+	pDispatcher->freeHandler = pHandler->next;
+	pHandler->handler = handler;
+	pHandler->streamHandler = streamHandler;
+	pHandler->pHandlerData = pHandlerData;
+	pHandler->node = node;
+	pHandler->next = pDispatcher->nodes[node].firstHandler;
+	pDispatcher->nodes[node].firstHandler = h;
+
+	if(qos > pSub->qos) {
+		pSub->qos = qos;
+		pSub->state = IOT_DISPATCH_SUB_PENDING;
+	} else if(IOT_DISPATCH_SUB_REJECTED == pSub->state) {
+		pSub->state = IOT_DISPATCH_SUB_PENDING;
+	}
+
+	if(isSendNow && IOT_DISPATCH_SUB_PENDING == pSub->state &&
+	   aws_iot_mqtt_is_client_connected(pDispatcher->pClient)) {
+		rc = _aws_iot_mqtt_dispatch_send_subscribes(pDispatcher);
+		/* left pending, poll() tries again */
+		if(SUCCESS != rc) {
+			IOT_WARN("dispatch: SUBSCRIBE to %.*s not sent, %d", topicFilterLen, pTopicFilter, rc);
+			rc = SUCCESS;
+		}
+	}
+
+	_aws_iot_mqtt_dispatch_unlock(pDispatcher);
+
+	return rc;
+}
+
+/* Removes the matching handlers, all of them if both handler and streamHandler are NULL */
+static IoT_Error_t _aws_iot_mqtt_dispatch_remove(AWS_IoT_Dispatcher_t *pDispatcher, const char *pTopicFilter,
+												 uint16_t topicFilterLen, pApplicationHandler_t handler,
+												 iot_dispatch_stream_handler streamHandler, void *pHandlerData) {
+	IoT_Dispatch_Subscription_t *pSub;
+	IoT_Dispatch_Handler_t *pHandler;
+	IoT_Error_t rc = SUCCESS;
+	uint16_t *pLink;
+	uint16_t node;
+	uint16_t h;
+
+	_aws_iot_mqtt_dispatch_lock(pDispatcher);
+
+	node = _aws_iot_mqtt_dispatch_get_node(pDispatcher, pTopicFilter, topicFilterLen, false);
+	pSub = (IOT_DISPATCH_NONE != node) ? _aws_iot_mqtt_dispatch_find_subscription(pDispatcher, node) : NULL;
+	if(NULL == pSub) {
+		_aws_iot_mqtt_dispatch_unlock(pDispatcher);
+		return FAILURE;
+	}
+
+	pLink = &(pDispatcher->nodes[node].firstHandler);
+	while(IOT_DISPATCH_NONE != *pLink) {
+		h = *pLink;
+		pHandler = &(pDispatcher->handlers[h]);
+		if((NULL == handler && NULL == streamHandler) ||
+		   (handler == pHandler->handler && streamHandler == pHandler->streamHandler &&
+			pHandlerData == pHandler->pHandlerData)) {
+			*pLink = pHandler->next;
+			pHandler->next = pDispatcher->freeHandler;
+			pDispatcher->freeHandler = h;
+		} else {
+			pLink = &(pHandler->next);
+		}
+	}
+
+	if(IOT_DISPATCH_NONE == pDispatcher->nodes[node].firstHandler) {
+		if((IOT_DISPATCH_SUB_ACTIVE == pSub->state || IOT_DISPATCH_SUB_REQUESTED == pSub->state) &&
+		   aws_iot_mqtt_is_client_connected(pDispatcher->pClient)) {
+			/* the UNSUBACK is not waited for */
+			rc = _aws_iot_mqtt_dispatch_send_unsubscribe(pDispatcher, pSub,
+														aws_iot_mqtt_get_next_packet_id(pDispatcher->pClient));
+		}
+		pSub->state = IOT_DISPATCH_SUB_FREE;
+	}
+
+	_aws_iot_mqtt_dispatch_unlock(pDispatcher);
+
+	return rc;
+}
+
+IoT_Error_t aws_iot_mqtt_dispatch_subscribe(AWS_IoT_Dispatcher_t *pDispatcher, const char *pTopicFilter,
+											uint16_t topicFilterLen, QoS qos, pApplicationHandler_t handler,
+											void *pHandlerData) {
+	IoT_Error_t rc;
+
+	FUNC_ENTRY;
+
+	if(NULL == pDispatcher || NULL == pDispatcher->pClient || NULL == pTopicFilter || NULL == handler) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	rc = _aws_iot_mqtt_dispatch_add(pDispatcher, pTopicFilter, topicFilterLen, qos, handler, NULL, pHandlerData,
+									true);
+
+	FUNC_EXIT_RC(rc);
+}
+
+IoT_Error_t aws_iot_mqtt_dispatch_subscribe_stream(AWS_IoT_Dispatcher_t *pDispatcher, const char *pTopicFilter,
+												   uint16_t topicFilterLen, QoS qos,
+												   iot_dispatch_stream_handler handler, void *pHandlerData) {
+	IoT_Error_t rc;
+
+	FUNC_ENTRY;
+
+	if(NULL == pDispatcher || NULL == pDispatcher->pClient || NULL == pTopicFilter || NULL == handler) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	rc = _aws_iot_mqtt_dispatch_add(pDispatcher, pTopicFilter, topicFilterLen, qos, NULL, handler, pHandlerData,
+									true);
+
+	FUNC_EXIT_RC(rc);
+}
+
+IoT_Error_t aws_iot_mqtt_dispatch_unsubscribe(AWS_IoT_Dispatcher_t *pDispatcher, const char *pTopicFilter,
+											  uint16_t topicFilterLen, pApplicationHandler_t handler,
+											  void *pHandlerData) {
+	IoT_Error_t rc;
+
+	FUNC_ENTRY;
+
+	if(NULL == pDispatcher || NULL == pDispatcher->pClient || NULL == pTopicFilter) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	rc = _aws_iot_mqtt_dispatch_remove(pDispatcher, pTopicFilter, topicFilterLen, handler, NULL, pHandlerData);
+
+	FUNC_EXIT_RC(rc);
+}
+
+IoT_Error_t aws_iot_mqtt_dispatch_unsubscribe_stream(AWS_IoT_Dispatcher_t *pDispatcher, const char *pTopicFilter,
+													 uint16_t topicFilterLen, iot_dispatch_stream_handler handler,
+													 void *pHandlerData) {
+	IoT_Error_t rc;
+
+	FUNC_ENTRY;
+
+	if(NULL == pDispatcher || NULL == pDispatcher->pClient || NULL == pTopicFilter || NULL == handler) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	rc = _aws_iot_mqtt_dispatch_remove(pDispatcher, pTopicFilter, topicFilterLen, NULL, handler, pHandlerData);
+
+	FUNC_EXIT_RC(rc);
+}
+
+static bool _aws_iot_mqtt_dispatch_collect_results(AWS_IoT_Dispatcher_t *pDispatcher, IoT_Dispatch_Filter_t *pFilters,
+													uint8_t count) {
+	IoT_Dispatch_Subscription_t *pSub;
+	bool isDone = true;
+	uint16_t node;
+	uint8_t i;
+
+	_aws_iot_mqtt_dispatch_lock(pDispatcher);
+	for(i = 0; i < count; i++) {
+		node = _aws_iot_mqtt_dispatch_get_node(pDispatcher, pFilters[i].pTopicFilter, pFilters[i].topicFilterLen, false);
+		pSub = (IOT_DISPATCH_NONE != node) ? _aws_iot_mqtt_dispatch_find_subscription(pDispatcher, node) : NULL;
+		pFilters[i].state = (NULL != pSub) ? pSub->state : IOT_DISPATCH_SUB_FREE;
+		pFilters[i].grantedQos = (NULL != pSub) ? pSub->grantedQos : DISPATCH_SUBACK_FAILURE;
+		if(IOT_DISPATCH_SUB_PENDING == pFilters[i].state || IOT_DISPATCH_SUB_REQUESTED == pFilters[i].state) {
+			isDone = false;
+		}
+	}
+	_aws_iot_mqtt_dispatch_unlock(pDispatcher);
+
+	return isDone;
+}
+
+IoT_Error_t aws_iot_mqtt_dispatch_subscribe_batch(AWS_IoT_Dispatcher_t *pDispatcher, IoT_Dispatch_Filter_t *pFilters,
+												  uint8_t count, uint32_t timeout_ms) {
+	IoT_Error_t rc = SUCCESS;
+	Timer timer;
+	uint8_t i;
+
+	FUNC_ENTRY;
+
+	if(NULL == pDispatcher || NULL == pDispatcher->pClient || NULL == pFilters) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	for(i = 0; i < count; i++) {
+		if(NULL == pFilters[i].pTopicFilter || NULL == pFilters[i].handler) {
+			FUNC_EXIT_RC(NULL_VALUE_ERROR);
+		}
+	}
+
+	for(i = 0; i < count && SUCCESS == rc; i++) {
+		rc = _aws_iot_mqtt_dispatch_add(pDispatcher, pFilters[i].pTopicFilter, pFilters[i].topicFilterLen,
+										pFilters[i].qos, pFilters[i].handler, NULL, pFilters[i].pHandlerData, false);
+	}
+	if(SUCCESS != rc) {
+		/* all or nothing */
+		while(0 < i--) {
+			(void) _aws_iot_mqtt_dispatch_remove(pDispatcher, pFilters[i].pTopicFilter, pFilters[i].topicFilterLen,
+												 pFilters[i].handler, NULL, pFilters[i].pHandlerData);
+		}
+		FUNC_EXIT_RC(rc);
+	}
+
+	if(aws_iot_mqtt_is_client_connected(pDispatcher->pClient)) {
+		_aws_iot_mqtt_dispatch_lock(pDispatcher);
+		(void) _aws_iot_mqtt_dispatch_send_subscribes(pDispatcher);
+		_aws_iot_mqtt_dispatch_unlock(pDispatcher);
+	}
+
+	init_timer(&timer);
+	countdown_ms(&timer, timeout_ms);
+	while(!_aws_iot_mqtt_dispatch_collect_results(pDispatcher, pFilters, count)) {
+		if(has_timer_expired(&timer)) {
+			FUNC_EXIT_RC((0 == timeout_ms) ? SUCCESS : MQTT_REQUEST_TIMEOUT_ERROR);
+		}
+		/* the SUBACKs are seen by the tap while the client reads */
+		(void) aws_iot_mqtt_yield(pDispatcher->pClient, 10);
+		(void) aws_iot_mqtt_dispatch_poll(pDispatcher);
+	}
+
+	for(i = 0; i < count; i++) {
+		if(IOT_DISPATCH_SUB_ACTIVE != pFilters[i].state) {
+			rc = FAILURE;
+		}
+	}
+
+	FUNC_EXIT_RC(rc);
+}
+
+IoT_Error_t aws_iot_mqtt_dispatch_poll(AWS_IoT_Dispatcher_t *pDispatcher) {
+	IoT_Error_t rc = SUCCESS;
+
+	FUNC_ENTRY;
+
+	if(NULL == pDispatcher || NULL == pDispatcher->pClient) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	if(!aws_iot_mqtt_is_client_connected(pDispatcher->pClient)) {
+		FUNC_EXIT_RC(SUCCESS);
+	}
+
+	_aws_iot_mqtt_dispatch_lock(pDispatcher);
+
+	while(0 < pDispatcher->pubackCount) {
+		rc = _aws_iot_mqtt_dispatch_send_puback(pDispatcher, pDispatcher->pubackIds[0]);
+		if(SUCCESS != rc) {
+			break;
+		}
+		pDispatcher->pubackCount--;
+		memmove(&(pDispatcher->pubackIds[0]), &(pDispatcher->pubackIds[1]),
+				pDispatcher->pubackCount * sizeof(pDispatcher->pubackIds[0]));
+	}
+
+	if(SUCCESS == rc) {
+		rc = _aws_iot_mqtt_dispatch_send_subscribes(pDispatcher);
+	}
+	_aws_iot_mqtt_dispatch_unlock(pDispatcher);
+
+	FUNC_EXIT_RC(rc);
+}
+
+IoT_Dispatch_Sub_State_t aws_iot_mqtt_dispatch_get_state(AWS_IoT_Dispatcher_t *pDispatcher, const char *pTopicFilter,
+														 uint16_t topicFilterLen) {
+	IoT_Dispatch_Subscription_t *pSub = NULL;
+	IoT_Dispatch_Sub_State_t state;
+	uint16_t node;
+
+	_aws_iot_mqtt_dispatch_lock(pDispatcher);
+	node = _aws_iot_mqtt_dispatch_get_node(pDispatcher, pTopicFilter, topicFilterLen, false);
+	if(IOT_DISPATCH_NONE != node) {
+		pSub = _aws_iot_mqtt_dispatch_find_subscription(pDispatcher, node);
+	}
+	state = (NULL != pSub) ? pSub->state : IOT_DISPATCH_SUB_FREE;
+	_aws_iot_mqtt_dispatch_unlock(pDispatcher);
+
+	return state;
+}
+
+uint8_t aws_iot_mqtt_dispatch_deliver(AWS_IoT_Dispatcher_t *pDispatcher, const char *pTopicName, uint16_t topicNameLen,
+									  IoT_Publish_Message_Params *pParams) {
+	IoT_Dispatch_Match_t found[AWS_IOT_MQTT_DISPATCH_MAX_MATCHES];
+	_IoT_Dispatch_Matches_t matches;
+	bool isStateChanged;
+	uint8_t i;
+
+	matches.pMatches = found;
+	matches.count = 0;
+	matches.isStream = false;
+	_aws_iot_mqtt_dispatch_lock(pDispatcher);
+	_aws_iot_mqtt_dispatch_match(pDispatcher, DISPATCH_ROOT, pTopicName, topicNameLen, 0, &matches);
+	_aws_iot_mqtt_dispatch_unlock(pDispatcher);
+
+	if(0 == matches.count) {
+		pDispatcher->stats.unmatched++;
+		return 0;
+	}
+
+	pDispatcher->stats.dispatched++;
+	pDispatcher->stats.handlerCalls += matches.count;
+
+	/* The client only lets a publish through in this state. Unlike the client's own handlers these run while
+	 * the packet is read, with the read mutex of the client held: a call waiting for an ack would read again. */
+	isStateChanged = (SUCCESS == aws_iot_mqtt_set_client_state(pDispatcher->pClient,
+															   CLIENT_STATE_CONNECTED_YIELD_IN_PROGRESS,
+															   CLIENT_STATE_CONNECTED_WAIT_FOR_CB_RETURN));
+	for(i = 0; i < matches.count; i++) {
+		found[i].handler(pDispatcher->pClient, (char *) pTopicName, topicNameLen, pParams, found[i].pHandlerData);
+	}
+	if(isStateChanged) {
+		(void) aws_iot_mqtt_set_client_state(pDispatcher->pClient, CLIENT_STATE_CONNECTED_WAIT_FOR_CB_RETURN,
+											 CLIENT_STATE_CONNECTED_YIELD_IN_PROGRESS);
+	}
+
+	return matches.count;
+}
+
+void aws_iot_mqtt_dispatch_get_stats(const AWS_IoT_Dispatcher_t *pDispatcher, IoT_Dispatch_Stats_t *pStats) {
+	*pStats = pDispatcher->stats;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,253 @@
+/**
+  *****************************************************************************
+  * @file   aws_iot_mqtt_client_dispatch_benchmark.c
+  *
+  *****************************************************************************
+  * @attention
+  *
+  *
+  *  Copyright (c) 2022, InnoPhase, Inc.
+  *
+  *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  *  POSSIBILITY OF SUCH DAMAGE.
+  *
+  *****************************************************************************
+  */
+
+/**
+ * @file aws_iot_mqtt_client_dispatch_benchmark.c
+ * @brief Trie dispatch against the linear scan done by the MQTT client
+ *
+ * Built only with -DAWS_IOT_MQTT_DISPATCH_BENCHMARK.
+ */
+
+#ifdef AWS_IOT_MQTT_DISPATCH_BENCHMARK
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+#include <kernel/os.h>
+
+#include "aws_iot_log.h"
+#include "aws_iot_mqtt_client_dispatch.h"
+#include "memory_platform.h"
+
+#define BENCHMARK_THINGS   3
+#define BENCHMARK_MAX_SUBS 32
+
+static const char *const benchmarkShadowSuffixes[] = {
+	"/shadow/get/accepted", "/shadow/get/rejected",
+	"/shadow/update/accepted", "/shadow/update/rejected",
+	"/shadow/update/delta", "/shadow/delete/accepted",
+	"/shadow/delete/rejected",
+};
+
+static const char *const benchmarkJobsSuffixes[] = {
+	"/jobs/notify", "/jobs/notify-next",
+	"/jobs/get/accepted", "/jobs/get/rejected",
+	"/jobs/+/update/accepted",
+};
+
+static const char *const benchmarkTelemetryFilters[] = {
+	"inp301x/telemetry/+/temperature", "inp301x/telemetry/#", "inp301x/cmd/+",
+};
+
+static const char *const benchmarkTopics[] = {
+	"$aws/things/thing1/shadow/update/delta",
+	"$aws/things/thing2/shadow/get/accepted",
+	"$aws/things/thing0/shadow/update/accepted",
+	"$aws/things/thing1/jobs/notify-next",
+	"$aws/things/thing2/jobs/job-42/update/accepted",
+	"inp301x/telemetry/room1/temperature",
+	"inp301x/cmd/reboot",
+	"inp301x/unknown/topic",
+};
+
+typedef struct {
+	char filter[64];
+	uint16_t len;
+	pApplicationHandler_t handler;
+	void *pHandlerData;
+} _IoT_Benchmark_Sub_t;
+
+static uint32_t benchmarkCalls;
+
+static void _benchmark_handler(AWS_IoT_Client *pClient, char *pTopicName, uint16_t topicNameLen,
+							   IoT_Publish_Message_Params *pParams, void *pData) {
+	IOT_UNUSED(pClient);
+	IOT_UNUSED(pTopicName);
+	IOT_UNUSED(topicNameLen);
+	IOT_UNUSED(pParams);
+	IOT_UNUSED(pData);
+	benchmarkCalls++;
+}
+
+/* Same algorithm as the MQTT client uses for each of its handler slots */
+static bool _benchmark_is_topic_matched(const char *pTopicFilter, uint16_t filterLen, const char *pTopicName,
+										uint16_t topicNameLen) {
+	const char *curf = pTopicFilter;
+	const char *curn = pTopicName;
+	const char *curn_end = curn + topicNameLen;
+	const char *filter_end = curf + filterLen;
+
+	while(curf < filter_end && curn < curn_end) {
+		if('/' == *curn && '/' != *curf) {
+			break;
+		}
+		if('+' != *curf && '#' != *curf && *curf != *curn) {
+			break;
+		}
+		if('+' == *curf) {
+			const char *nextpos = curn + 1;
+			while(nextpos < curn_end && '/' != *nextpos) {
+				nextpos = ++curn + 1;
+			}
+		} else if('#' == *curf) {
+			curn = curn_end - 1;
+		}
+		curf++;
+		curn++;
+	}
+
+	return (curn == curn_end) && (curf == filter_end);
+}
+
+static uint32_t _benchmark_linear_deliver(const _IoT_Benchmark_Sub_t *pSubs, uint16_t count, AWS_IoT_Client *pClient,
+										  const char *pTopic, uint16_t topicLen, IoT_Publish_Message_Params *pParams) {
+	uint32_t calls = 0;
+	uint16_t i;
+
+	for(i = 0; i < count; i++) {
+		if(_benchmark_is_topic_matched(pSubs[i].filter, pSubs[i].len, pTopic, topicLen)) {
+			pSubs[i].handler(pClient, (char *) pTopic, topicLen, pParams, pSubs[i].pHandlerData);
+			calls++;
+		}
+	}
+	return calls;
+}
+
+void aws_iot_mqtt_dispatch_benchmark(uint32_t iterations) {
+	AWS_IoT_Dispatcher_t *pDispatcher;
+	AWS_IoT_Client *pClient;
+	_IoT_Benchmark_Sub_t *pSubs;
+	IoT_Publish_Message_Params params;
+	uint16_t topicLens[sizeof(benchmarkTopics) / sizeof(benchmarkTopics[0])];
+	uint16_t subCount = 0;
+	uint32_t linearCalls = 0;
+	uint32_t trieCalls;
+	uint64_t start;
+	uint64_t linear_us;
+	uint64_t trie_us;
+	uint32_t n;
+	size_t i;
+	size_t t;
+
+	pDispatcher = aws_iot_platform_malloc(sizeof(AWS_IoT_Dispatcher_t));
+	pClient = aws_iot_platform_malloc(sizeof(AWS_IoT_Client));
+	pSubs = aws_iot_platform_malloc(BENCHMARK_MAX_SUBS * sizeof(_IoT_Benchmark_Sub_t));
+	if(NULL == pDispatcher || NULL == pClient || NULL == pSubs) {
+		IOT_ERROR("dispatch benchmark: out of memory");
+		goto out;
+	}
+
+	/* a client that is never connected, only its state mutex is used */
+	memset(pClient, 0, sizeof(AWS_IoT_Client));
+#ifdef _ENABLE_THREAD_SUPPORT_
+	(void) aws_iot_thread_mutex_init(&(pClient->clientData.state_change_mutex));
+#endif
+	if(SUCCESS != aws_iot_mqtt_dispatch_init(pDispatcher, pClient)) {
+		goto out;
+	}
+
+	for(t = 0; t < BENCHMARK_THINGS; t++) {
+		for(i = 0; i < sizeof(benchmarkShadowSuffixes) / sizeof(benchmarkShadowSuffixes[0]); i++) {
+			pSubs[subCount].len = (uint16_t) snprintf(pSubs[subCount].filter, sizeof(pSubs[subCount].filter),
+													  "$aws/things/thing%u%s", (unsigned) t, benchmarkShadowSuffixes[i]);
+			subCount++;
+		}
+	}
+	for(t = 0; t < BENCHMARK_THINGS; t++) {
+		for(i = 0; i < sizeof(benchmarkJobsSuffixes) / sizeof(benchmarkJobsSuffixes[0]) && subCount < BENCHMARK_MAX_SUBS - 3; i++) {
+			pSubs[subCount].len = (uint16_t) snprintf(pSubs[subCount].filter, sizeof(pSubs[subCount].filter),
+													  "$aws/things/thing%u%s", (unsigned) t, benchmarkJobsSuffixes[i]);
+			subCount++;
+		}
+	}
+	for(i = 0; i < sizeof(benchmarkTelemetryFilters) / sizeof(benchmarkTelemetryFilters[0]); i++) {
+		pSubs[subCount].len = (uint16_t) snprintf(pSubs[subCount].filter, sizeof(pSubs[subCount].filter), "%s",
+												  benchmarkTelemetryFilters[i]);
+		subCount++;
+	}
+
+	for(i = 0; i < subCount; i++) {
+		pSubs[i].handler = _benchmark_handler;
+		pSubs[i].pHandlerData = NULL;
+		if(SUCCESS != aws_iot_mqtt_dispatch_subscribe(pDispatcher, pSubs[i].filter, pSubs[i].len, QOS0,
+													  _benchmark_handler, NULL)) {
+			IOT_ERROR("dispatch benchmark: cannot subscribe %s", pSubs[i].filter);
+			goto deinit;
+		}
+	}
+
+	for(t = 0; t < sizeof(benchmarkTopics) / sizeof(benchmarkTopics[0]); t++) {
+		topicLens[t] = (uint16_t) strlen(benchmarkTopics[t]);
+	}
+
+	memset(&params, 0, sizeof(params));
+
+	start = os_systime64();
+	for(n = 0; n < iterations; n++) {
+		for(t = 0; t < sizeof(benchmarkTopics) / sizeof(benchmarkTopics[0]); t++) {
+			linearCalls += _benchmark_linear_deliver(pSubs, subCount, pClient, benchmarkTopics[t], topicLens[t],
+													 &params);
+		}
+	}
+	linear_us = os_systime64() - start;
+
+	benchmarkCalls = 0;
+	start = os_systime64();
+	for(n = 0; n < iterations; n++) {
+		for(t = 0; t < sizeof(benchmarkTopics) / sizeof(benchmarkTopics[0]); t++) {
+			(void) aws_iot_mqtt_dispatch_deliver(pDispatcher, benchmarkTopics[t], topicLens[t], &params);
+		}
+	}
+	trie_us = os_systime64() - start;
+	trieCalls = benchmarkCalls;
+
+	os_printf("\ndispatch benchmark: %u filters, %u topics, %u iterations\n", (unsigned) subCount,
+			  (unsigned) (sizeof(benchmarkTopics) / sizeof(benchmarkTopics[0])), (unsigned) iterations);
+	os_printf("  linear scan: %u us, %u handler calls\n", (unsigned) linear_us, (unsigned) linearCalls);
+	os_printf("  trie:        %u us, %u handler calls\n", (unsigned) trie_us, (unsigned) trieCalls);
+	os_printf("  trie pool: %u bytes, %u strings, %u nodes\n", (unsigned) pDispatcher->poolLen,
+			  (unsigned) pDispatcher->stringCount, (unsigned) pDispatcher->nodeCount);
+	if(linearCalls != trieCalls) {
+		IOT_ERROR("dispatch benchmark: handler calls differ");
+	}
+
+deinit:
+	(void) aws_iot_mqtt_dispatch_deinit(pDispatcher);
+	(void) aws_iot_mqtt_tap_detach(pClient);
+out:
+	aws_iot_platform_free(pSubs);
+	aws_iot_platform_free(pDispatcher);
+	aws_iot_platform_free(pClient);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AWS_IOT_MQTT_DISPATCH_BENCHMARK */
@@ -0,0 +1,300 @@
+/**
+  *****************************************************************************
+  * @file   aws_iot_mqtt_client_keepalive.c
+  *
+  *****************************************************************************
+  * @attention
+  *
+  *
+  *  Copyright (c) 2022, InnoPhase, Inc.
+  *
+  *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  *  POSSIBILITY OF SUCH DAMAGE.
+  *
+  *****************************************************************************
+  */
+
+/**
+ * @file aws_iot_mqtt_client_keepalive.c
+ * @brief Adaptive MQTT keepalive
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <string.h>
+
+#include "aws_iot_log.h"
+#include "aws_iot_mqtt_client_common_internal.h"
+#include "aws_iot_mqtt_client_keepalive.h"
+#include "timer_interface.h"
+
+#define KEEPALIVE_PINGREQ_HEADER 0xC0
+
+const IoT_Keepalive_Params_t iotKeepaliveParamsDefault = {AWS_IOT_MQTT_KEEPALIVE_MIN_INTERVAL_MS,
+														  AWS_IOT_MQTT_KEEPALIVE_MAX_INTERVAL_MS,
+														  AWS_IOT_MQTT_KEEPALIVE_INITIAL_INTERVAL_MS,
+														  AWS_IOT_MQTT_KEEPALIVE_STEP_MS,
+														  AWS_IOT_MQTT_KEEPALIVE_PROBE_AFTER,
+														  AWS_IOT_MQTT_KEEPALIVE_RESPONSE_TIMEOUT_MS,
+														  0};
+
+static uint32_t _aws_iot_mqtt_keepalive_client_ms(const AWS_IoT_Keepalive_t *pKeepalive) {
+	return (uint32_t) pKeepalive->pClient->clientData.keepAliveInterval * 1000;
+}
+
+/* Longest idle period allowed by the parameters, the learned ceiling and the CONNECT keepalive */
+static uint32_t _aws_iot_mqtt_keepalive_limit(const AWS_IoT_Keepalive_t *pKeepalive) {
+	uint32_t clientLimit = _aws_iot_mqtt_keepalive_client_ms(pKeepalive);
+	uint32_t limit = pKeepalive->ceiling_ms;
+
+	clientLimit = (clientLimit > pKeepalive->params.responseTimeout_ms) ?
+				  clientLimit - pKeepalive->params.responseTimeout_ms : clientLimit;
+	if(limit > clientLimit) {
+		limit = clientLimit;
+	}
+	return limit;
+}
+
+static uint32_t _aws_iot_mqtt_keepalive_next_ping_at(const AWS_IoT_Keepalive_t *pKeepalive) {
+	uint32_t interval = pKeepalive->interval_ms;
+	uint32_t limit = _aws_iot_mqtt_keepalive_limit(pKeepalive);
+	uint32_t period = pKeepalive->params.wakePeriod_ms;
+	uint32_t due;
+	uint32_t aligned;
+
+	if(interval > limit) {
+		interval = limit;
+	}
+	due = pKeepalive->lastTx_ms + interval;
+
+	/* moved back to the last wake-up before it, never later: a later ping could outlast the NAT */
+	if(0 != period) {
+		aligned = due - ((due - pKeepalive->wakeAnchor_ms) % period);
+		if(0 < aligned - pKeepalive->lastTx_ms && aligned - pKeepalive->lastTx_ms <= interval) {
+			due = aligned;
+		}
+	}
+
+	return due;
+}
+
+/* The connection did not survive pingIdle_ms without traffic */
+static void _aws_iot_mqtt_keepalive_on_idle_failure(AWS_IoT_Keepalive_t *pKeepalive) {
+	uint32_t ceiling = pKeepalive->params.minInterval_ms;
+
+	if(pKeepalive->pingIdle_ms > pKeepalive->params.minInterval_ms + pKeepalive->params.step_ms) {
+		ceiling = pKeepalive->pingIdle_ms - pKeepalive->params.step_ms;
+	}
+	if(pKeepalive->ceiling_ms > ceiling) {
+		pKeepalive->ceiling_ms = ceiling;
+	}
+	if(pKeepalive->interval_ms > pKeepalive->ceiling_ms) {
+		pKeepalive->interval_ms = pKeepalive->ceiling_ms;
+	}
+	pKeepalive->answeredInRow = 0;
+	pKeepalive->stats.pingTimeouts++;
+
+	IOT_WARN("keepalive: no PINGRESP after %u ms idle, interval now %u ms", (unsigned) pKeepalive->pingIdle_ms,
+			 (unsigned) pKeepalive->interval_ms);
+}
+
+static void _aws_iot_mqtt_keepalive_on_pingresp(AWS_IoT_Keepalive_t *pKeepalive) {
+	pKeepalive->isPingOutstanding = false;
+	pKeepalive->stats.pingsAnswered++;
+
+	/* only a ping that followed a full idle period tells something about the path */
+	if(pKeepalive->pingIdle_ms < pKeepalive->interval_ms) {
+		return;
+	}
+
+	pKeepalive->answeredInRow++;
+	if(pKeepalive->answeredInRow >= pKeepalive->params.probeAfter &&
+	   pKeepalive->interval_ms < pKeepalive->ceiling_ms) {
+		pKeepalive->interval_ms += pKeepalive->params.step_ms;
+		if(pKeepalive->interval_ms > pKeepalive->ceiling_ms) {
+			pKeepalive->interval_ms = pKeepalive->ceiling_ms;
+		}
+		pKeepalive->answeredInRow = 0;
+		IOT_DEBUG("keepalive: probing %u ms", (unsigned) pKeepalive->interval_ms);
+	}
+}
+
+/* Runs in the thread doing the network I/O */
+static void _aws_iot_mqtt_keepalive_on_packet(AWS_IoT_Client *pClient, const IoT_Tap_Event_t *pEvent, void *pData) {
+	AWS_IoT_Keepalive_t *pKeepalive = (AWS_IoT_Keepalive_t *) pData;
+
+	IOT_UNUSED(pClient);
+
+	switch(pEvent->type) {
+		case IOT_TAP_EVENT_CONNECTED:
+			pKeepalive->lastTx_ms = pEvent->timestamp_ms;
+			pKeepalive->isPingOutstanding = false;
+			pKeepalive->isTimeoutReported = false;
+			break;
+
+		case IOT_TAP_EVENT_DISCONNECTED:
+			/* dropped while a ping was on its way: the same as no answer */
+			if(pKeepalive->isPingOutstanding && !pKeepalive->isTimeoutReported) {
+				_aws_iot_mqtt_keepalive_on_idle_failure(pKeepalive);
+			}
+			pKeepalive->isPingOutstanding = false;
+			break;
+
+		case IOT_TAP_EVENT_PACKET_BEGIN:
+			if(IOT_TAP_OUTBOUND == pEvent->direction) {
+				pKeepalive->lastTx_ms = pEvent->timestamp_ms;
+			}
+			break;
+
+		case IOT_TAP_EVENT_PACKET_END:
+			if(IOT_TAP_INBOUND == pEvent->direction && IOT_TAP_PINGRESP == IOT_TAP_PACKET_TYPE(pEvent->header) &&
+			   pKeepalive->isPingOutstanding) {
+				_aws_iot_mqtt_keepalive_on_pingresp(pKeepalive);
+			}
+			break;
+
+		default:
+			break;
+	}
+}
+
+IoT_Error_t aws_iot_mqtt_keepalive_init(AWS_IoT_Keepalive_t *pKeepalive, AWS_IoT_Client *pClient,
+										const IoT_Keepalive_Params_t *pParams) {
+	IoT_Error_t rc;
+
+	FUNC_ENTRY;
+
+	if(NULL == pKeepalive || NULL == pClient) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	if(NULL == pParams) {
+		pParams = &iotKeepaliveParamsDefault;
+	}
+
+	if(0 == pParams->minInterval_ms || pParams->minInterval_ms > pParams->initialInterval_ms ||
+	   pParams->initialInterval_ms > pParams->maxInterval_ms || 0 == pParams->probeAfter) {
+		IOT_ERROR("keepalive: invalid intervals");
+		FUNC_EXIT_RC(FAILURE);
+	}
+
+	memset(pKeepalive, 0, sizeof(AWS_IoT_Keepalive_t));
+	pKeepalive->pClient = pClient;
+	pKeepalive->params = *pParams;
+	pKeepalive->interval_ms = pParams->initialInterval_ms;
+	pKeepalive->ceiling_ms = pParams->maxInterval_ms;
+	pKeepalive->lastTx_ms = aws_iot_mqtt_tap_now_ms();
+
+	pKeepalive->observer.handler = _aws_iot_mqtt_keepalive_on_packet;
+	pKeepalive->observer.pHandlerData = pKeepalive;
+	rc = aws_iot_mqtt_tap_add_observer(pClient, &(pKeepalive->observer));
+
+	FUNC_EXIT_RC(rc);
+}
+
+IoT_Error_t aws_iot_mqtt_keepalive_deinit(AWS_IoT_Keepalive_t *pKeepalive) {
+	FUNC_ENTRY;
+
+	if(NULL == pKeepalive || NULL == pKeepalive->pClient) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	(void) aws_iot_mqtt_tap_remove_observer(pKeepalive->pClient, &(pKeepalive->observer));
+	pKeepalive->pClient = NULL;
+
+	FUNC_EXIT_RC(SUCCESS);
+}
+
+void aws_iot_mqtt_keepalive_set_wake_schedule(AWS_IoT_Keepalive_t *pKeepalive, uint32_t anchor_ms,
+											  uint32_t period_ms) {
+	pKeepalive->wakeAnchor_ms = anchor_ms;
+	pKeepalive->params.wakePeriod_ms = period_ms;
+}
+
+IoT_Error_t aws_iot_mqtt_keepalive_poll(AWS_IoT_Keepalive_t *pKeepalive) {
+	static const unsigned char pingreq[2] = {KEEPALIVE_PINGREQ_HEADER, 0};
+	AWS_IoT_Client *pClient;
+	uint32_t clientKeepalive_ms;
+	uint32_t now_ms;
+	IoT_Error_t rc;
+
+	FUNC_ENTRY;
+
+	if(NULL == pKeepalive || NULL == pKeepalive->pClient) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	pClient = pKeepalive->pClient;
+	clientKeepalive_ms = _aws_iot_mqtt_keepalive_client_ms(pKeepalive);
+	if(0 == clientKeepalive_ms || !aws_iot_mqtt_is_client_connected(pClient)) {
+		FUNC_EXIT_RC(SUCCESS);
+	}
+
+	now_ms = aws_iot_mqtt_tap_now_ms();
+
+	if(pKeepalive->isPingOutstanding) {
+		if(!pKeepalive->isTimeoutReported &&
+		   pKeepalive->params.responseTimeout_ms <= now_ms - pKeepalive->pingSentAt_ms) {
+			_aws_iot_mqtt_keepalive_on_idle_failure(pKeepalive);
+			pKeepalive->isTimeoutReported = true;
+			/* the client disconnects, and reconnects if enabled, at its next yield */
+			pClient->clientStatus.isPingOutstanding = true;
+			countdown_ms(&(pClient->pingTimer), 0);
+		}
+		FUNC_EXIT_RC(SUCCESS);
+	}
+
+	if(0 > (int32_t) (now_ms - _aws_iot_mqtt_keepalive_next_ping_at(pKeepalive))) {
+		/* keeps the client's own ping from firing while this one is in charge */
+		countdown_ms(&(pClient->pingTimer), clientKeepalive_ms);
+		FUNC_EXIT_RC(SUCCESS);
+	}
+
+	pKeepalive->pingIdle_ms = now_ms - pKeepalive->lastTx_ms;
+	pKeepalive->pingSentAt_ms = now_ms;
+	/* set before the write, the PINGRESP may be read by another thread as soon as the packet is out */
+	pKeepalive->isPingOutstanding = true;
+
+	rc = aws_iot_mqtt_tap_write(pClient, pingreq, sizeof(pingreq), pClient->clientData.commandTimeoutMs);
+	if(SUCCESS != rc) {
+		pKeepalive->isPingOutstanding = false;
+		FUNC_EXIT_RC(rc);
+	}
+
+	pKeepalive->stats.pingsSent++;
+	countdown_ms(&(pClient->pingTimer), clientKeepalive_ms);
+
+	FUNC_EXIT_RC(SUCCESS);
+}
+
+uint32_t aws_iot_mqtt_keepalive_time_to_ping(const AWS_IoT_Keepalive_t *pKeepalive) {
+	int32_t remaining;
+
+	if(pKeepalive->isPingOutstanding) {
+		return 0;
+	}
+
+	remaining = (int32_t) (_aws_iot_mqtt_keepalive_next_ping_at(pKeepalive) - aws_iot_mqtt_tap_now_ms());
+	return (0 < remaining) ? (uint32_t) remaining : 0;
+}
+
+void aws_iot_mqtt_keepalive_get_stats(const AWS_IoT_Keepalive_t *pKeepalive, IoT_Keepalive_Stats_t *pStats) {
+	*pStats = pKeepalive->stats;
+	pStats->interval_ms = pKeepalive->interval_ms;
+	pStats->ceiling_ms = pKeepalive->ceiling_ms;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,574 @@
+/**
+  *****************************************************************************
+  * @file   aws_iot_mqtt_client_outbox.c
+  *
+  *****************************************************************************
+  * @attention
+  *
+  *
+  *  Copyright (c) 2022, InnoPhase, Inc.
+  *
+  *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  *  POSSIBILITY OF SUCH DAMAGE.
+  *
+  *****************************************************************************
+  */
+
+/**
+ * @file aws_iot_mqtt_client_outbox.c
+ * @brief Persistent QoS1 outbox for store-and-forward while offline
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <string.h>
+
+#include "aws_iot_file_utils.h"
+#include "aws_iot_log.h"
+#include "aws_iot_mqtt_client_outbox.h"
+#include "fs_utils.h"
+#include "memory_platform.h"
+
+#define OUTBOX_RECORD_MAGIC   0xA7
+#define OUTBOX_RECORD_PUBLISH 'P'
+#define OUTBOX_RECORD_ACK     'A'
+#define OUTBOX_FLAG_RETAINED  0x01
+#define OUTBOX_CHECKSUM_POS   3
+
+#define OUTBOX_ENTRY(pOutbox, i) \
+	(&((pOutbox)->entries[((pOutbox)->first + (i)) % AWS_IOT_MQTT_OUTBOX_MAX_MESSAGES]))
+
+const IoT_Outbox_Params_t iotOutboxParamsDefault = {MOUNT_PATH "aws_outbox", AWS_IOT_MQTT_OUTBOX_MAX_MESSAGES,
+													 AWS_IOT_MQTT_OUTBOX_MAX_FILE_SIZE, IOT_OUTBOX_DROP_OLDEST};
+
+static void _aws_iot_mqtt_outbox_put16(unsigned char *p, uint16_t v) {
+	p[0] = (unsigned char) (v & 0xFF);
+	p[1] = (unsigned char) (v >> 8);
+}
+
+static void _aws_iot_mqtt_outbox_put32(unsigned char *p, uint32_t v) {
+	_aws_iot_mqtt_outbox_put16(p, (uint16_t) (v & 0xFFFF));
+	_aws_iot_mqtt_outbox_put16(p + 2, (uint16_t) (v >> 16));
+}
+
+static uint16_t _aws_iot_mqtt_outbox_get16(const unsigned char *p) {
+	return (uint16_t) (p[0] | (p[1] << 8));
+}
+
+static uint32_t _aws_iot_mqtt_outbox_get32(const unsigned char *p) {
+	return (uint32_t) _aws_iot_mqtt_outbox_get16(p) | ((uint32_t) _aws_iot_mqtt_outbox_get16(p + 2) << 16);
+}
+
+static uint8_t _aws_iot_mqtt_outbox_checksum(const unsigned char *pRecord, size_t len) {
+	uint8_t sum = 0;
+	size_t i;
+
+	for(i = 0; i < len; i++) {
+		if(OUTBOX_CHECKSUM_POS != i) {
+			sum = (uint8_t) (sum + pRecord[i]);
+		}
+	}
+	return (uint8_t) ~sum;
+}
+
+static size_t _aws_iot_mqtt_outbox_encode(unsigned char *pRecord, uint8_t type, uint8_t flags, uint32_t seq,
+										  const char *pTopicName, uint16_t topicNameLen,
+										  const void *pPayload, uint16_t payloadLen) {
+	size_t len = AWS_IOT_MQTT_OUTBOX_RECORD_HEADER_LEN + topicNameLen + payloadLen;
+
+	pRecord[0] = OUTBOX_RECORD_MAGIC;
+	pRecord[1] = type;
+	pRecord[2] = flags;
+	_aws_iot_mqtt_outbox_put32(&pRecord[4], seq);
+	_aws_iot_mqtt_outbox_put16(&pRecord[8], topicNameLen);
+	_aws_iot_mqtt_outbox_put16(&pRecord[10], payloadLen);
+	if(0 < topicNameLen) {
+		memcpy(&pRecord[AWS_IOT_MQTT_OUTBOX_RECORD_HEADER_LEN], pTopicName, topicNameLen);
+	}
+	if(0 < payloadLen) {
+		memcpy(&pRecord[AWS_IOT_MQTT_OUTBOX_RECORD_HEADER_LEN + topicNameLen], pPayload, payloadLen);
+	}
+	pRecord[OUTBOX_CHECKSUM_POS] = _aws_iot_mqtt_outbox_checksum(pRecord, len);
+
+	return len;
+}
+
+/* Length of the record at pRecord, or 0 if it is not a complete valid record */
+static size_t _aws_iot_mqtt_outbox_validate(const unsigned char *pRecord, size_t available) {
+	size_t len;
+
+	if(AWS_IOT_MQTT_OUTBOX_RECORD_HEADER_LEN > available || OUTBOX_RECORD_MAGIC != pRecord[0]) {
+		return 0;
+	}
+
+	len = AWS_IOT_MQTT_OUTBOX_RECORD_HEADER_LEN + _aws_iot_mqtt_outbox_get16(&pRecord[8]) +
+		  _aws_iot_mqtt_outbox_get16(&pRecord[10]);
+	if(len > available || AWS_IOT_MQTT_OUTBOX_MAX_RECORD_LEN < len ||
+	   _aws_iot_mqtt_outbox_checksum(pRecord, len) != pRecord[OUTBOX_CHECKSUM_POS]) {
+		return 0;
+	}
+
+	return len;
+}
+
+/* A record is committed before the call returns */
+static IoT_Error_t _aws_iot_mqtt_outbox_append(AWS_IoT_Outbox_t *pOutbox, const unsigned char *pRecord, size_t len) {
+	IoT_Error_t rc;
+
+	rc = aws_iot_file_append(pOutbox->params.pFilePath, pRecord, len);
+	if(SUCCESS == rc) {
+		pOutbox->fileSize += (uint32_t) len;
+	}
+	return rc;
+}
+
+/* Appends the ack record of a message, it is dead from the start */
+static IoT_Error_t _aws_iot_mqtt_outbox_append_ack(AWS_IoT_Outbox_t *pOutbox, uint32_t seq) {
+	unsigned char ack[AWS_IOT_MQTT_OUTBOX_RECORD_HEADER_LEN];
+	size_t ackLen;
+	IoT_Error_t rc;
+
+	ackLen = _aws_iot_mqtt_outbox_encode(ack, OUTBOX_RECORD_ACK, 0, seq, NULL, 0, NULL, 0);
+	rc = _aws_iot_mqtt_outbox_append(pOutbox, ack, ackLen);
+	if(SUCCESS == rc) {
+		pOutbox->deadBytes += (uint32_t) ackLen;
+	}
+	return rc;
+}
+
+static IoT_Error_t _aws_iot_mqtt_outbox_read_record(AWS_IoT_Outbox_t *pOutbox, int fd, const IoT_Outbox_Entry_t *pEntry) {
+	if(SUCCESS != aws_iot_file_read_at(fd, pEntry->offset, pOutbox->record, pEntry->recordLen) ||
+	   pEntry->recordLen != _aws_iot_mqtt_outbox_validate(pOutbox->record, pEntry->recordLen)) {
+		IOT_ERROR("outbox: record %u unreadable", (unsigned) pEntry->seq);
+		return FAILURE;
+	}
+	return SUCCESS;
+}
+
+static IoT_Outbox_Entry_t *_aws_iot_mqtt_outbox_find_seq(AWS_IoT_Outbox_t *pOutbox, uint32_t seq) {
+	uint16_t i;
+
+	for(i = 0; i < pOutbox->count; i++) {
+		if(seq == OUTBOX_ENTRY(pOutbox, i)->seq) {
+			return OUTBOX_ENTRY(pOutbox, i);
+		}
+	}
+	return NULL;
+}
+
+static void _aws_iot_mqtt_outbox_mark_acked(AWS_IoT_Outbox_t *pOutbox, IoT_Outbox_Entry_t *pEntry) {
+	pEntry->state = IOT_OUTBOX_ENTRY_ACKED;
+	pOutbox->deadBytes += pEntry->recordLen;
+}
+
+static void _aws_iot_mqtt_outbox_pop_acked(AWS_IoT_Outbox_t *pOutbox) {
+	while(0 < pOutbox->count && IOT_OUTBOX_ENTRY_ACKED == OUTBOX_ENTRY(pOutbox, 0)->state) {
+		pOutbox->first = (uint16_t) ((pOutbox->first + 1) % AWS_IOT_MQTT_OUTBOX_MAX_MESSAGES);
+		pOutbox->count--;
+	}
+}
+
+/* The caller records the eviction in the log, or compacts it */
+static void _aws_iot_mqtt_outbox_evict_oldest(AWS_IoT_Outbox_t *pOutbox) {
+	IoT_Outbox_Entry_t *pEntry = OUTBOX_ENTRY(pOutbox, 0);
+
+	IOT_WARN("outbox: full, dropping message %u", (unsigned) pEntry->seq);
+	_aws_iot_mqtt_outbox_mark_acked(pOutbox, pEntry);
+	_aws_iot_mqtt_outbox_pop_acked(pOutbox);
+	pOutbox->stats.evicted++;
+}
+
+/* Copies the live records to a new file which then replaces the log */
+static IoT_Error_t _aws_iot_mqtt_outbox_compact(AWS_IoT_Outbox_t *pOutbox) {
+	uint32_t offsets[AWS_IOT_MQTT_OUTBOX_MAX_MESSAGES];
+	IoT_File_Replace_t replace;
+	IoT_Outbox_Entry_t *pEntry;
+	IoT_Error_t rc;
+	uint32_t newSize = 0;
+	uint16_t kept = 0;
+	uint16_t i;
+	int in = -1;
+
+	rc = aws_iot_file_replace_begin(&replace, pOutbox->params.pFilePath);
+	if(SUCCESS == rc && 0 < pOutbox->count) {
+		rc = aws_iot_file_open(pOutbox->params.pFilePath, &in);
+	}
+
+	for(i = 0; i < pOutbox->count && SUCCESS == rc; i++) {
+		pEntry = OUTBOX_ENTRY(pOutbox, i);
+		if(IOT_OUTBOX_ENTRY_ACKED == pEntry->state) {
+			continue;
+		}
+		rc = _aws_iot_mqtt_outbox_read_record(pOutbox, in, pEntry);
+		if(SUCCESS == rc) {
+			rc = aws_iot_file_replace_write(&replace, pOutbox->record, pEntry->recordLen);
+		}
+		offsets[i] = newSize;
+		newSize += pEntry->recordLen;
+	}
+
+	if(0 <= in) {
+		aws_iot_file_close(in);
+	}
+
+	if(SUCCESS == rc) {
+		rc = aws_iot_file_replace_commit(&replace);
+	} else {
+		aws_iot_file_replace_abort(&replace);
+	}
+
+	if(SUCCESS != rc) {
+		/* the log is left as it was */
+		IOT_ERROR("outbox: compaction failed");
+		return rc;
+	}
+
+	/* The log now only holds live records, drop the acked entries from the ring too */
+	for(i = 0; i < pOutbox->count; i++) {
+		pEntry = OUTBOX_ENTRY(pOutbox, i);
+		if(IOT_OUTBOX_ENTRY_ACKED != pEntry->state) {
+			pEntry->offset = offsets[i];
+			*OUTBOX_ENTRY(pOutbox, kept) = *pEntry;
+			kept++;
+		}
+	}
+	pOutbox->count = kept;
+	pOutbox->fileSize = newSize;
+	pOutbox->deadBytes = 0;
+	pOutbox->stats.compactions++;
+
+	return SUCCESS;
+}
+
+static IoT_Error_t _aws_iot_mqtt_outbox_load(AWS_IoT_Outbox_t *pOutbox) {
+	IoT_Outbox_Entry_t *pEntry;
+	unsigned char *pLog;
+	size_t offset = 0;
+	size_t recordLen;
+	uint32_t seq;
+	int logLen = 0;
+
+	aws_iot_file_recover(pOutbox->params.pFilePath);
+	pLog = (unsigned char *) utils_file_get(pOutbox->params.pFilePath, &logLen);
+	if(NULL == pLog) {
+		/* no log yet */
+		return SUCCESS;
+	}
+
+	while(0 < (recordLen = _aws_iot_mqtt_outbox_validate(&pLog[offset], (size_t) logLen - offset))) {
+		seq = _aws_iot_mqtt_outbox_get32(&pLog[offset + 4]);
+
+		if(OUTBOX_RECORD_PUBLISH == pLog[offset + 1]) {
+			/* a log written with a larger limit keeps its newest messages, compacted below */
+			if(pOutbox->params.maxMessages <= pOutbox->count) {
+				_aws_iot_mqtt_outbox_evict_oldest(pOutbox);
+			}
+			pEntry = OUTBOX_ENTRY(pOutbox, pOutbox->count);
+			pEntry->seq = seq;
+			pEntry->offset = (uint32_t) offset;
+			pEntry->recordLen = (uint16_t) recordLen;
+			pEntry->packetId = 0;
+			pEntry->state = IOT_OUTBOX_ENTRY_PENDING;
+			pOutbox->count++;
+			if(seq >= pOutbox->nextSeq) {
+				pOutbox->nextSeq = seq + 1;
+			}
+		} else if(OUTBOX_RECORD_ACK == pLog[offset + 1]) {
+			pEntry = _aws_iot_mqtt_outbox_find_seq(pOutbox, seq);
+			if(NULL != pEntry && IOT_OUTBOX_ENTRY_ACKED != pEntry->state) {
+				_aws_iot_mqtt_outbox_mark_acked(pOutbox, pEntry);
+			}
+			pOutbox->deadBytes += (uint32_t) recordLen;
+		}
+
+		offset += recordLen;
+	}
+
+	pOutbox->fileSize = (uint32_t) offset;
+	if(offset != (size_t) logLen) {
+		/* torn record at the end, appending after it would hide the new records */
+		IOT_WARN("outbox: %u bytes of damaged log discarded", (unsigned) ((size_t) logLen - offset));
+		pOutbox->deadBytes += (uint32_t) ((size_t) logLen - offset);
+	}
+
+	aws_iot_platform_free(pLog);
+
+	_aws_iot_mqtt_outbox_pop_acked(pOutbox);
+	pOutbox->stats.replayed = aws_iot_mqtt_outbox_pending(pOutbox);
+
+	return (0 < pOutbox->deadBytes) ? _aws_iot_mqtt_outbox_compact(pOutbox) : SUCCESS;
+}
+
+static void _aws_iot_mqtt_outbox_on_complete(AWS_IoT_Client *pClient, uint16_t packetId,
+											 IoT_Async_Publish_Status_t status, void *pData) {
+	AWS_IoT_Outbox_t *pOutbox = (AWS_IoT_Outbox_t *) pData;
+	IoT_Outbox_Entry_t *pEntry = NULL;
+	uint16_t i;
+
+	IOT_UNUSED(pClient);
+
+	for(i = 0; i < pOutbox->count; i++) {
+		if(IOT_OUTBOX_ENTRY_SENDING == OUTBOX_ENTRY(pOutbox, i)->state && packetId == OUTBOX_ENTRY(pOutbox, i)->packetId) {
+			pEntry = OUTBOX_ENTRY(pOutbox, i);
+			break;
+		}
+	}
+
+	if(NULL == pEntry) {
+		/* evicted while in flight */
+		return;
+	}
+
+	if(IOT_ASYNC_PUBLISH_ACKED != status) {
+		/* stays in the outbox and is sent again */
+		pEntry->state = IOT_OUTBOX_ENTRY_PENDING;
+		return;
+	}
+
+	(void) _aws_iot_mqtt_outbox_append_ack(pOutbox, pEntry->seq);
+	_aws_iot_mqtt_outbox_mark_acked(pOutbox, pEntry);
+	pOutbox->stats.delivered++;
+}
+
+IoT_Error_t aws_iot_mqtt_outbox_init(AWS_IoT_Outbox_t *pOutbox, const IoT_Outbox_Params_t *pParams) {
+	IoT_Error_t rc;
+
+	FUNC_ENTRY;
+
+	if(NULL == pOutbox) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	if(NULL == pParams) {
+		pParams = &iotOutboxParamsDefault;
+	}
+
+	if(NULL == pParams->pFilePath || AWS_IOT_MQTT_OUTBOX_MAX_PATH_LEN < strlen(pParams->pFilePath) ||
+	   0 == pParams->maxMessages || AWS_IOT_MQTT_OUTBOX_MAX_MESSAGES < pParams->maxMessages ||
+	   AWS_IOT_MQTT_OUTBOX_MAX_RECORD_LEN > pParams->maxFileSize) {
+		IOT_ERROR("outbox: invalid parameters");
+		FUNC_EXIT_RC(FAILURE);
+	}
+
+	memset(pOutbox, 0, sizeof(AWS_IoT_Outbox_t));
+	pOutbox->params = *pParams;
+
+	rc = _aws_iot_mqtt_outbox_load(pOutbox);
+	if(0 < pOutbox->stats.replayed) {
+		IOT_INFO("outbox: %u unacked messages to replay", (unsigned) pOutbox->stats.replayed);
+	}
+
+	FUNC_EXIT_RC(rc);
+}
+
+void aws_iot_mqtt_outbox_set_publisher(AWS_IoT_Outbox_t *pOutbox, AWS_IoT_Async_Publisher_t *pPublisher) {
+	uint16_t i;
+
+	for(i = 0; i < pOutbox->count; i++) {
+		if(IOT_OUTBOX_ENTRY_SENDING == OUTBOX_ENTRY(pOutbox, i)->state) {
+			OUTBOX_ENTRY(pOutbox, i)->state = IOT_OUTBOX_ENTRY_PENDING;
+		}
+	}
+	pOutbox->pPublisher = pPublisher;
+}
+
+void aws_iot_mqtt_outbox_set_scheduler(AWS_IoT_Outbox_t *pOutbox, AWS_IoT_Scheduler_t *pScheduler) {
+	pOutbox->pScheduler = pScheduler;
+}
+
+IoT_Error_t aws_iot_mqtt_outbox_publish(AWS_IoT_Outbox_t *pOutbox, const char *pTopicName, uint16_t topicNameLen,
+										IoT_Publish_Message_Params *pParams) {
+	IoT_Outbox_Entry_t *pEntry;
+	size_t recordLen;
+	IoT_Error_t rc;
+
+	FUNC_ENTRY;
+
+	if(NULL == pOutbox || NULL == pTopicName || 0 == topicNameLen || NULL == pParams ||
+	   (NULL == pParams->payload && 0 != pParams->payloadLen)) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	recordLen = AWS_IOT_MQTT_OUTBOX_RECORD_HEADER_LEN + topicNameLen + pParams->payloadLen;
+	if(AWS_IOT_MQTT_OUTBOX_MAX_RECORD_LEN < recordLen) {
+		FUNC_EXIT_RC(MQTT_TX_BUFFER_TOO_SHORT_ERROR);
+	}
+
+	_aws_iot_mqtt_outbox_pop_acked(pOutbox);
+	while(pOutbox->count >= pOutbox->params.maxMessages ||
+		  pOutbox->fileSize - pOutbox->deadBytes + recordLen > pOutbox->params.maxFileSize) {
+		if(pOutbox->count >= pOutbox->params.maxMessages && aws_iot_mqtt_outbox_pending(pOutbox) < pOutbox->count) {
+			/* acked messages hold their slot until the log is compacted */
+			rc = _aws_iot_mqtt_outbox_compact(pOutbox);
+			if(SUCCESS != rc) {
+				FUNC_EXIT_RC(rc);
+			}
+			continue;
+		}
+		if(IOT_OUTBOX_REJECT_NEW == pOutbox->params.eviction || 0 == pOutbox->count) {
+			pOutbox->stats.rejected++;
+			FUNC_EXIT_RC(MQTT_OUTBOX_FULL_ERROR);
+		}
+		/* an ack record keeps the message from being replayed after a reboot, the poll compacts */
+		rc = _aws_iot_mqtt_outbox_append_ack(pOutbox, OUTBOX_ENTRY(pOutbox, 0)->seq);
+		if(SUCCESS != rc) {
+			FUNC_EXIT_RC(rc);
+		}
+		_aws_iot_mqtt_outbox_evict_oldest(pOutbox);
+	}
+
+	/* the poll keeps the dead records under half of the log, unless it is not called */
+	if(pOutbox->fileSize + recordLen > 2 * pOutbox->params.maxFileSize && 0 < pOutbox->deadBytes) {
+		rc = _aws_iot_mqtt_outbox_compact(pOutbox);
+		if(SUCCESS != rc) {
+			FUNC_EXIT_RC(rc);
+		}
+	}
+
+	recordLen = _aws_iot_mqtt_outbox_encode(pOutbox->record, OUTBOX_RECORD_PUBLISH,
+											pParams->isRetained ? OUTBOX_FLAG_RETAINED : 0, pOutbox->nextSeq,
+											pTopicName, topicNameLen, pParams->payload,
+											(uint16_t) pParams->payloadLen);
+
+	pEntry = OUTBOX_ENTRY(pOutbox, pOutbox->count);
+	pEntry->offset = pOutbox->fileSize;
+
+	rc = _aws_iot_mqtt_outbox_append(pOutbox, pOutbox->record, recordLen);
+	if(SUCCESS != rc) {
+		FUNC_EXIT_RC(rc);
+	}
+
+	pEntry->seq = pOutbox->nextSeq++;
+	pEntry->recordLen = (uint16_t) recordLen;
+	pEntry->packetId = 0;
+	pEntry->state = IOT_OUTBOX_ENTRY_PENDING;
+	pOutbox->count++;
+	pOutbox->stats.stored++;
+
+	FUNC_EXIT_RC(SUCCESS);
+}
+
+static IoT_Error_t _aws_iot_mqtt_outbox_send_pending(AWS_IoT_Outbox_t *pOutbox) {
+	IoT_Publish_Message_Params params;
+	IoT_Outbox_Entry_t *pEntry;
+	IoT_Error_t rc = SUCCESS;
+	uint16_t topicNameLen;
+	uint16_t i;
+	int fd = -1;
+
+	for(i = 0; i < pOutbox->count && aws_iot_mqtt_async_publish_can_publish(pOutbox->pPublisher); i++) {
+		pEntry = OUTBOX_ENTRY(pOutbox, i);
+		if(IOT_OUTBOX_ENTRY_PENDING != pEntry->state) {
+			continue;
+		}
+
+		/* the packet size only depends on the topic and payload lengths together */
+		if(NULL != pOutbox->pScheduler &&
+		   !aws_iot_mqtt_scheduler_admit(pOutbox->pScheduler, IOT_SCHEDULER_LANE_BULK, 0,
+										 pEntry->recordLen - AWS_IOT_MQTT_OUTBOX_RECORD_HEADER_LEN, QOS1)) {
+			/* over budget, the rest waits in the log for the next poll */
+			break;
+		}
+
+		if(0 > fd) {
+			rc = aws_iot_file_open(pOutbox->params.pFilePath, &fd);
+			if(SUCCESS != rc) {
+				break;
+			}
+		}
+
+		rc = _aws_iot_mqtt_outbox_read_record(pOutbox, fd, pEntry);
+		if(SUCCESS != rc) {
+			/* unreadable, do not let it block the messages behind it */
+			_aws_iot_mqtt_outbox_mark_acked(pOutbox, pEntry);
+			continue;
+		}
+
+		topicNameLen = _aws_iot_mqtt_outbox_get16(&pOutbox->record[8]);
+		params.qos = QOS1;
+		params.isRetained = (pOutbox->record[2] & OUTBOX_FLAG_RETAINED) ? 1 : 0;
+		params.isDup = 0;
+		params.id = 0;
+		params.payload = &pOutbox->record[AWS_IOT_MQTT_OUTBOX_RECORD_HEADER_LEN + topicNameLen];
+		params.payloadLen = _aws_iot_mqtt_outbox_get16(&pOutbox->record[10]);
+
+		rc = aws_iot_mqtt_async_publish(pOutbox->pPublisher,
+										(const char *) &pOutbox->record[AWS_IOT_MQTT_OUTBOX_RECORD_HEADER_LEN],
+										topicNameLen, &params, _aws_iot_mqtt_outbox_on_complete, pOutbox,
+										&pEntry->packetId);
+		if(SUCCESS != rc) {
+			break;
+		}
+		pEntry->state = IOT_OUTBOX_ENTRY_SENDING;
+	}
+
+	if(0 <= fd) {
+		aws_iot_file_close(fd);
+	}
+
+	return (MQTT_ASYNC_PUBLISH_WINDOW_FULL_ERROR == rc) ? SUCCESS : rc;
+}
+
+IoT_Error_t aws_iot_mqtt_outbox_poll(AWS_IoT_Outbox_t *pOutbox) {
+	IoT_Error_t rc = SUCCESS;
+	IoT_Error_t sendRc;
+
+	FUNC_ENTRY;
+
+	if(NULL == pOutbox) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	if(NULL != pOutbox->pPublisher) {
+		rc = aws_iot_mqtt_async_publish_poll(pOutbox->pPublisher);
+	}
+
+	_aws_iot_mqtt_outbox_pop_acked(pOutbox);
+
+	if(0 < pOutbox->deadBytes && pOutbox->deadBytes >= pOutbox->fileSize / 2) {
+		sendRc = _aws_iot_mqtt_outbox_compact(pOutbox);
+		if(SUCCESS == rc) {
+			rc = sendRc;
+		}
+	}
+
+	if(NULL != pOutbox->pPublisher && aws_iot_mqtt_is_client_connected(pOutbox->pPublisher->pClient)) {
+		sendRc = _aws_iot_mqtt_outbox_send_pending(pOutbox);
+		if(SUCCESS == rc) {
+			rc = sendRc;
+		}
+	}
+
+	FUNC_EXIT_RC(rc);
+}
+
+uint16_t aws_iot_mqtt_outbox_pending(const AWS_IoT_Outbox_t *pOutbox) {
+	uint16_t pending = 0;
+	uint16_t i;
+
+	for(i = 0; i < pOutbox->count; i++) {
+		if(IOT_OUTBOX_ENTRY_ACKED != pOutbox->entries[(pOutbox->first + i) % AWS_IOT_MQTT_OUTBOX_MAX_MESSAGES].state) {
+			pending++;
+		}
+	}
+	return pending;
+}
+
+void aws_iot_mqtt_outbox_get_stats(const AWS_IoT_Outbox_t *pOutbox, IoT_Outbox_Stats_t *pStats) {
+	*pStats = pOutbox->stats;
+}
+
+#ifdef __cplusplus
+}
+#endif
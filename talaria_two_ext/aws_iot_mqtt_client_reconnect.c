@@ -0,0 +1,413 @@
+/**
+  *****************************************************************************
+  * @file   aws_iot_mqtt_client_reconnect.c
+  *
+  *****************************************************************************
+  * @attention
+  *
+  *
+  *  Copyright (c) 2022, InnoPhase, Inc.
+  *
+  *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  *  POSSIBILITY OF SUCH DAMAGE.
+  *
+  *****************************************************************************
+  */
+
+/**
+ * @file aws_iot_mqtt_client_reconnect.c
+ * @brief Reconnect state machine with full-jitter backoff and link awareness
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <string.h>
+
+#include "aws_iot_log.h"
+#include "aws_iot_mqtt_client_reconnect.h"
+#include "aws_iot_mqtt_client_tap.h"
+#include "timer_interface.h"
+
+#define RECONNECT_WORKER_WAIT_MS 10
+
+const IoT_Reconnect_Params_t iotReconnectParamsDefault = {AWS_IOT_MQTT_MIN_RECONNECT_WAIT_INTERVAL,
+														  AWS_IOT_MQTT_MAX_RECONNECT_WAIT_INTERVAL,
+														  false, NULL, NULL};
+
+static void _aws_iot_mqtt_reconnect_lock(AWS_IoT_Reconnect_t *pReconnect) {
+#ifdef _ENABLE_THREAD_SUPPORT_
+	(void) aws_iot_thread_mutex_lock(&(pReconnect->lock));
+#else
+	IOT_UNUSED(pReconnect);
+#endif
+}
+
+static void _aws_iot_mqtt_reconnect_unlock(AWS_IoT_Reconnect_t *pReconnect) {
+#ifdef _ENABLE_THREAD_SUPPORT_
+	(void) aws_iot_thread_mutex_unlock(&(pReconnect->lock));
+#else
+	IOT_UNUSED(pReconnect);
+#endif
+}
+
+/* xorshift32, seeded per device so that devices restarted together draw different delays */
+static uint32_t _aws_iot_mqtt_reconnect_random(AWS_IoT_Reconnect_t *pReconnect) {
+	uint32_t x = pReconnect->random;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	pReconnect->random = x;
+	return x;
+}
+
+static void _aws_iot_mqtt_reconnect_seed(AWS_IoT_Reconnect_t *pReconnect) {
+	const IoT_Client_Connect_Params *pOptions = &(pReconnect->pClient->clientData.options);
+	uint32_t hash = 2166136261u;
+	uint16_t i;
+
+	/* FNV-1a of the client id, unique per device, mixed with the time since boot */
+	if(NULL != pOptions->pClientID) {
+		for(i = 0; i < pOptions->clientIDLen; i++) {
+			hash = (hash ^ (uint8_t) pOptions->pClientID[i]) * 16777619u;
+		}
+	}
+	hash ^= (uint32_t) os_systime64();
+	pReconnect->random = (0 != hash) ? hash : 1;
+}
+
+/* Full jitter: uniform in [0, min(max, min * 2^n)] */
+static uint32_t _aws_iot_mqtt_reconnect_backoff(AWS_IoT_Reconnect_t *pReconnect) {
+	uint32_t cap = pReconnect->params.minBackoff_ms;
+	uint8_t i;
+
+	for(i = 0; i < pReconnect->backoffExp && cap < pReconnect->params.maxBackoff_ms; i++) {
+		cap <<= 1;
+	}
+	if(cap > pReconnect->params.maxBackoff_ms) {
+		cap = pReconnect->params.maxBackoff_ms;
+	} else if(cap < pReconnect->params.maxBackoff_ms) {
+		pReconnect->backoffExp++;
+	}
+
+	return _aws_iot_mqtt_reconnect_random(pReconnect) % (cap + 1);
+}
+
+static void _aws_iot_mqtt_reconnect_schedule(AWS_IoT_Reconnect_t *pReconnect, uint32_t now_ms) {
+	pReconnect->attempt.backoff_ms = _aws_iot_mqtt_reconnect_backoff(pReconnect);
+	pReconnect->attempt.isLinkTriggered = false;
+	pReconnect->nextAttempt_ms = now_ms + pReconnect->attempt.backoff_ms;
+	pReconnect->state = pReconnect->isLinkUp ? IOT_RECONNECT_STATE_BACKOFF : IOT_RECONNECT_STATE_LINK_DOWN;
+}
+
+/* Like aws_iot_mqtt_attempt_reconnect(), which returns NETWORK_ATTEMPTING_RECONNECT for any failure */
+static IoT_Error_t _aws_iot_mqtt_reconnect_attempt(AWS_IoT_Client *pClient) {
+	IoT_Error_t rc;
+
+	rc = aws_iot_mqtt_connect(pClient, NULL);
+	if(SUCCESS == rc) {
+		rc = aws_iot_mqtt_resubscribe(pClient);
+	}
+	return rc;
+}
+
+#ifdef _ENABLE_THREAD_SUPPORT_
+static void _aws_iot_mqtt_reconnect_worker(void *pArg) {
+	AWS_IoT_Reconnect_t *pReconnect = (AWS_IoT_Reconnect_t *) pArg;
+	IoT_Thread_t thread = pReconnect->thread;
+	IoT_Error_t rc;
+
+	for(;;) {
+		aws_iot_thread_sem_wait(&(pReconnect->wake));
+		if(pReconnect->isStopRequested) {
+			break;
+		}
+
+		rc = _aws_iot_mqtt_reconnect_attempt(pReconnect->pClient);
+
+		_aws_iot_mqtt_reconnect_lock(pReconnect);
+		pReconnect->workerRc = rc;
+		pReconnect->isWorkerDone = true;
+		_aws_iot_mqtt_reconnect_unlock(pReconnect);
+	}
+
+	/* deinit may release pReconnect once this is seen, exit on the local copy */
+	pReconnect->isWorkerRunning = false;
+	aws_iot_thread_exit(&thread);
+}
+#endif
+
+/* Called with the lock held. Fills in the attempt record and copies it to pReport before the next one is scheduled. */
+static void _aws_iot_mqtt_reconnect_finish(AWS_IoT_Reconnect_t *pReconnect, IoT_Error_t rc, uint32_t now_ms,
+										   IoT_Reconnect_Attempt_t *pReport) {
+	IoT_Reconnect_Attempt_t *pAttempt = &(pReconnect->attempt);
+
+	pAttempt->rc = rc;
+	pAttempt->duration_ms = now_ms - pReconnect->attemptStart_ms;
+	pAttempt->outage_ms = now_ms - pReconnect->lostAt_ms;
+	pReconnect->stats.lastRc = rc;
+	if(pAttempt->duration_ms > pReconnect->stats.longestAttempt_ms) {
+		pReconnect->stats.longestAttempt_ms = pAttempt->duration_ms;
+	}
+
+	if(SUCCESS == rc || NETWORK_ALREADY_CONNECTED_ERROR == rc) {
+		pReconnect->stats.successes++;
+		pReconnect->stats.lastOutage_ms = pAttempt->outage_ms;
+		if(pAttempt->outage_ms > pReconnect->stats.longestOutage_ms) {
+			pReconnect->stats.longestOutage_ms = pAttempt->outage_ms;
+		}
+		*pReport = *pAttempt;
+		pReconnect->state = IOT_RECONNECT_STATE_CONNECTED;
+		pReconnect->isReconnected = true;
+		return;
+	}
+
+	IOT_WARN("reconnect: attempt %u failed (%d) after %u ms", (unsigned) pAttempt->number, rc,
+			 (unsigned) pAttempt->duration_ms);
+	*pReport = *pAttempt;
+	_aws_iot_mqtt_reconnect_schedule(pReconnect, now_ms);
+}
+
+static void _aws_iot_mqtt_reconnect_report(AWS_IoT_Reconnect_t *pReconnect, const IoT_Reconnect_Attempt_t *pAttempt) {
+	if(NULL != pReconnect->params.handler) {
+		pReconnect->params.handler(pReconnect->pClient, pAttempt, pReconnect->params.pHandlerData);
+	}
+}
+
+IoT_Error_t aws_iot_mqtt_reconnect_init(AWS_IoT_Reconnect_t *pReconnect, AWS_IoT_Client *pClient,
+										const IoT_Reconnect_Params_t *pParams) {
+	IoT_Error_t rc;
+
+	FUNC_ENTRY;
+
+	if(NULL == pReconnect || NULL == pClient) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	if(NULL == pParams) {
+		pParams = &iotReconnectParamsDefault;
+	}
+
+	if(0 == pParams->minBackoff_ms || pParams->minBackoff_ms > pParams->maxBackoff_ms) {
+		IOT_ERROR("reconnect: invalid backoff bounds");
+		FUNC_EXIT_RC(FAILURE);
+	}
+
+	memset(pReconnect, 0, sizeof(AWS_IoT_Reconnect_t));
+	pReconnect->pClient = pClient;
+	pReconnect->params = *pParams;
+#ifndef _ENABLE_THREAD_SUPPORT_
+	pReconnect->params.isAttemptInThread = false;
+#endif
+	pReconnect->state = IOT_RECONNECT_STATE_CONNECTED;
+	pReconnect->isLinkUp = true;
+	_aws_iot_mqtt_reconnect_seed(pReconnect);
+
+#ifdef _ENABLE_THREAD_SUPPORT_
+	rc = aws_iot_thread_mutex_init(&(pReconnect->lock));
+	if(SUCCESS != rc) {
+		FUNC_EXIT_RC(rc);
+	}
+	rc = aws_iot_thread_sem_init(&(pReconnect->wake));
+	if(SUCCESS != rc) {
+		(void) aws_iot_thread_mutex_destroy(&(pReconnect->lock));
+		FUNC_EXIT_RC(rc);
+	}
+#endif
+
+	rc = aws_iot_mqtt_autoreconnect_set_status(pClient, false);
+
+	FUNC_EXIT_RC(rc);
+}
+
+IoT_Error_t aws_iot_mqtt_reconnect_deinit(AWS_IoT_Reconnect_t *pReconnect) {
+	FUNC_ENTRY;
+
+	if(NULL == pReconnect || NULL == pReconnect->pClient) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	_aws_iot_mqtt_reconnect_lock(pReconnect);
+	while(IOT_RECONNECT_STATE_CONNECTING == pReconnect->state && !pReconnect->isWorkerDone) {
+		_aws_iot_mqtt_reconnect_unlock(pReconnect);
+		delay(RECONNECT_WORKER_WAIT_MS);
+		_aws_iot_mqtt_reconnect_lock(pReconnect);
+	}
+	_aws_iot_mqtt_reconnect_unlock(pReconnect);
+
+#ifdef _ENABLE_THREAD_SUPPORT_
+	if(pReconnect->isWorkerRunning) {
+		pReconnect->isStopRequested = true;
+		aws_iot_thread_sem_post(&(pReconnect->wake));
+		while(pReconnect->isWorkerRunning) {
+			delay(RECONNECT_WORKER_WAIT_MS);
+		}
+	}
+	aws_iot_thread_sem_destroy(&(pReconnect->wake));
+	(void) aws_iot_thread_mutex_destroy(&(pReconnect->lock));
+#endif
+	pReconnect->pClient = NULL;
+
+	FUNC_EXIT_RC(SUCCESS);
+}
+
+void aws_iot_mqtt_reconnect_set_link(AWS_IoT_Reconnect_t *pReconnect, bool isUp) {
+	if(NULL == pReconnect || NULL == pReconnect->pClient) {
+		return;
+	}
+
+	_aws_iot_mqtt_reconnect_lock(pReconnect);
+	if(isUp && !pReconnect->isLinkUp) {
+		pReconnect->stats.linkUps++;
+		pReconnect->isLinkUpPending = true;
+	} else if(!isUp && pReconnect->isLinkUp) {
+		pReconnect->stats.linkDowns++;
+		pReconnect->isLinkUpPending = false;
+	}
+	pReconnect->isLinkUp = isUp;
+	_aws_iot_mqtt_reconnect_unlock(pReconnect);
+}
+
+IoT_Error_t aws_iot_mqtt_reconnect_poll(AWS_IoT_Reconnect_t *pReconnect) {
+	IoT_Reconnect_Attempt_t attempt;
+	IoT_Error_t rc;
+	uint32_t now_ms = aws_iot_mqtt_tap_now_ms();
+	bool isAttemptDue = false;
+	bool isAttemptDone = false;
+
+	if(NULL == pReconnect || NULL == pReconnect->pClient) {
+		return NULL_VALUE_ERROR;
+	}
+
+	_aws_iot_mqtt_reconnect_lock(pReconnect);
+
+	switch(pReconnect->state) {
+		case IOT_RECONNECT_STATE_CONNECTED:
+			if(aws_iot_mqtt_is_client_connected(pReconnect->pClient)) {
+				break;
+			}
+			pReconnect->stats.disconnects++;
+			pReconnect->lostAt_ms = now_ms;
+			pReconnect->backoffExp = 0;
+			pReconnect->attempt.number = 0;
+			pReconnect->isLinkUpPending = false;
+			_aws_iot_mqtt_reconnect_schedule(pReconnect, now_ms);
+			/* fall through */
+
+		case IOT_RECONNECT_STATE_LINK_DOWN:
+		case IOT_RECONNECT_STATE_BACKOFF:
+			if(!pReconnect->isLinkUp) {
+				pReconnect->state = IOT_RECONNECT_STATE_LINK_DOWN;
+				break;
+			}
+			if(pReconnect->isLinkUpPending) {
+				/* the outage is over, no reason to wait */
+				pReconnect->isLinkUpPending = false;
+				pReconnect->backoffExp = 0;
+				pReconnect->attempt.backoff_ms = 0;
+				pReconnect->attempt.isLinkTriggered = true;
+				pReconnect->nextAttempt_ms = now_ms;
+			} else if(IOT_RECONNECT_STATE_LINK_DOWN == pReconnect->state) {
+				/* link back without a notification */
+				pReconnect->nextAttempt_ms = now_ms;
+			}
+			pReconnect->state = IOT_RECONNECT_STATE_BACKOFF;
+			isAttemptDue = (int32_t) (now_ms - pReconnect->nextAttempt_ms) >= 0;
+			break;
+
+		case IOT_RECONNECT_STATE_CONNECTING:
+			if(pReconnect->isWorkerDone) {
+				pReconnect->isWorkerDone = false;
+				_aws_iot_mqtt_reconnect_finish(pReconnect, pReconnect->workerRc, now_ms, &attempt);
+				isAttemptDone = true;
+			}
+			break;
+
+		default:
+			pReconnect->state = IOT_RECONNECT_STATE_CONNECTED;
+			break;
+	}
+
+	if(isAttemptDue) {
+		pReconnect->attempt.number++;
+		pReconnect->stats.attempts++;
+		pReconnect->attemptStart_ms = now_ms;
+		pReconnect->state = IOT_RECONNECT_STATE_CONNECTING;
+
+#ifdef _ENABLE_THREAD_SUPPORT_
+		if(pReconnect->params.isAttemptInThread) {
+			pReconnect->isWorkerDone = false;
+			if(!pReconnect->isWorkerRunning) {
+				pReconnect->isWorkerRunning = true;
+				if(SUCCESS != aws_iot_thread_create(&(pReconnect->thread), "mqtt_reconnect",
+													_aws_iot_mqtt_reconnect_worker, pReconnect,
+													AWS_IOT_MQTT_RECONNECT_STACK_SIZE,
+													AWS_IOT_MQTT_RECONNECT_PRIORITY)) {
+					pReconnect->isWorkerRunning = false;
+					IOT_WARN("reconnect: unable to create the attempt thread, attempting inline");
+				}
+			}
+			if(pReconnect->isWorkerRunning) {
+				aws_iot_thread_sem_post(&(pReconnect->wake));
+				isAttemptDue = false;
+			}
+		}
+#endif
+	}
+
+	if(isAttemptDue) {
+		_aws_iot_mqtt_reconnect_unlock(pReconnect);
+		rc = _aws_iot_mqtt_reconnect_attempt(pReconnect->pClient);
+		_aws_iot_mqtt_reconnect_lock(pReconnect);
+		_aws_iot_mqtt_reconnect_finish(pReconnect, rc, aws_iot_mqtt_tap_now_ms(), &attempt);
+		isAttemptDone = true;
+	}
+
+	if(IOT_RECONNECT_STATE_CONNECTED != pReconnect->state) {
+		rc = NETWORK_ATTEMPTING_RECONNECT;
+	} else if(pReconnect->isReconnected) {
+		pReconnect->isReconnected = false;
+		rc = NETWORK_RECONNECTED;
+	} else {
+		rc = SUCCESS;
+	}
+
+	_aws_iot_mqtt_reconnect_unlock(pReconnect);
+
+	if(isAttemptDone) {
+		_aws_iot_mqtt_reconnect_report(pReconnect, &attempt);
+	}
+
+	return rc;
+}
+
+IoT_Reconnect_State_t aws_iot_mqtt_reconnect_get_state(AWS_IoT_Reconnect_t *pReconnect) {
+	IoT_Reconnect_State_t state;
+
+	_aws_iot_mqtt_reconnect_lock(pReconnect);
+	state = pReconnect->state;
+	_aws_iot_mqtt_reconnect_unlock(pReconnect);
+
+	return state;
+}
+
+void aws_iot_mqtt_reconnect_get_stats(AWS_IoT_Reconnect_t *pReconnect, IoT_Reconnect_Stats_t *pStats) {
+	_aws_iot_mqtt_reconnect_lock(pReconnect);
+	*pStats = pReconnect->stats;
+	_aws_iot_mqtt_reconnect_unlock(pReconnect);
+}
+
+#ifdef __cplusplus
+}
+#endif
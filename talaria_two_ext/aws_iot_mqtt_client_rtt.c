@@ -0,0 +1,293 @@
+/**
+  *****************************************************************************
+  * @file   aws_iot_mqtt_client_rtt.c
+  *
+  *****************************************************************************
+  * @attention
+  *
+  *
+  *  Copyright (c) 2022, InnoPhase, Inc.
+  *
+  *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  *  POSSIBILITY OF SUCH DAMAGE.
+  *
+  *****************************************************************************
+  */
+
+/**
+ * @file aws_iot_mqtt_client_rtt.c
+ * @brief Round-trip time estimator and adaptive retransmission timeout
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <string.h>
+
+#include "aws_iot_log.h"
+#include "aws_iot_mqtt_client_rtt.h"
+
+#define RTT_PUBLISH_QOS(header) (((header) >> 1) & 0x03)
+#define RTT_PUBLISH_DUP_FLAG 0x08
+
+const IoT_Rtt_Params_t iotRttParamsDefault = {AWS_IOT_MQTT_RTT_INITIAL_RTO_MS,
+											  AWS_IOT_MQTT_RTT_MIN_RTO_MS,
+											  AWS_IOT_MQTT_RTT_MAX_RTO_MS};
+
+static void _aws_iot_mqtt_rtt_lock(AWS_IoT_Rtt_t *pRtt) {
+#ifdef _ENABLE_THREAD_SUPPORT_
+	(void) aws_iot_thread_mutex_lock(&(pRtt->lock));
+#else
+	IOT_UNUSED(pRtt);
+#endif
+}
+
+static void _aws_iot_mqtt_rtt_unlock(AWS_IoT_Rtt_t *pRtt) {
+#ifdef _ENABLE_THREAD_SUPPORT_
+	(void) aws_iot_thread_mutex_unlock(&(pRtt->lock));
+#else
+	IOT_UNUSED(pRtt);
+#endif
+}
+
+static uint32_t _aws_iot_mqtt_rtt_clamp(const AWS_IoT_Rtt_t *pRtt, uint32_t rto_ms) {
+	if(rto_ms < pRtt->params.minRto_ms) {
+		return pRtt->params.minRto_ms;
+	}
+	if(rto_ms > pRtt->params.maxRto_ms) {
+		return pRtt->params.maxRto_ms;
+	}
+	return rto_ms;
+}
+
+/* Jacobson's integer form of the RFC 6298 update, SRTT scaled by 8 and RTTVAR by 4 */
+static void _aws_iot_mqtt_rtt_sample(AWS_IoT_Rtt_t *pRtt, uint32_t rtt_ms) {
+	int32_t delta;
+
+	if(0 == pRtt->stats.samples) {
+		pRtt->srtt_x8 = rtt_ms << 3;
+		pRtt->rttvar_x4 = rtt_ms << 1;
+		pRtt->stats.minRtt_ms = rtt_ms;
+		pRtt->stats.maxRtt_ms = rtt_ms;
+	} else {
+		delta = (int32_t) rtt_ms - (int32_t) (pRtt->srtt_x8 >> 3);
+		pRtt->srtt_x8 = (uint32_t) ((int32_t) pRtt->srtt_x8 + delta);
+		if(0 > delta) {
+			delta = -delta;
+		}
+		delta -= (int32_t) (pRtt->rttvar_x4 >> 2);
+		pRtt->rttvar_x4 = (uint32_t) ((int32_t) pRtt->rttvar_x4 + delta);
+		if(rtt_ms < pRtt->stats.minRtt_ms) {
+			pRtt->stats.minRtt_ms = rtt_ms;
+		}
+		if(rtt_ms > pRtt->stats.maxRtt_ms) {
+			pRtt->stats.maxRtt_ms = rtt_ms;
+		}
+	}
+
+	pRtt->stats.samples++;
+	pRtt->stats.lastRtt_ms = rtt_ms;
+	pRtt->stats.srtt_ms = pRtt->srtt_x8 >> 3;
+	pRtt->stats.rttvar_ms = pRtt->rttvar_x4 >> 2;
+	pRtt->stats.rto_ms = _aws_iot_mqtt_rtt_clamp(pRtt, (pRtt->srtt_x8 >> 3) + pRtt->rttvar_x4);
+}
+
+static IoT_Rtt_Pending_t *_aws_iot_mqtt_rtt_find(AWS_IoT_Rtt_t *pRtt, uint8_t type, uint16_t packetId) {
+	uint8_t i;
+
+	for(i = 0; i < AWS_IOT_MQTT_RTT_MAX_PENDING; i++) {
+		if(packetId == pRtt->pending[i].packetId && type == pRtt->pending[i].type) {
+			return &(pRtt->pending[i]);
+		}
+	}
+	return NULL;
+}
+
+static void _aws_iot_mqtt_rtt_on_request(AWS_IoT_Rtt_t *pRtt, uint8_t type, uint16_t packetId, bool isDup,
+										 uint32_t now_ms) {
+	IoT_Rtt_Pending_t *pPending = _aws_iot_mqtt_rtt_find(pRtt, type, packetId);
+	uint8_t i;
+
+	if(NULL != pPending) {
+		/* sent again, or the id was reused after an ack the tap did not see */
+		pPending->isRetransmitted = pPending->isRetransmitted || isDup;
+		pPending->sentAt_ms = now_ms;
+		return;
+	}
+
+	pPending = &(pRtt->pending[0]);
+	for(i = 0; i < AWS_IOT_MQTT_RTT_MAX_PENDING; i++) {
+		if(0 == pRtt->pending[i].packetId) {
+			pPending = &(pRtt->pending[i]);
+			break;
+		}
+		if(now_ms - pRtt->pending[i].sentAt_ms > now_ms - pPending->sentAt_ms) {
+			pPending = &(pRtt->pending[i]);
+		}
+	}
+
+	pPending->packetId = packetId;
+	pPending->type = type;
+	pPending->isRetransmitted = isDup;
+	pPending->sentAt_ms = now_ms;
+}
+
+static void _aws_iot_mqtt_rtt_on_ack(AWS_IoT_Rtt_t *pRtt, uint8_t type, uint16_t packetId, uint32_t now_ms) {
+	IoT_Rtt_Pending_t *pPending = _aws_iot_mqtt_rtt_find(pRtt, type, packetId);
+
+	if(NULL == pPending) {
+		return;
+	}
+
+	if(pPending->isRetransmitted) {
+		pRtt->stats.ambiguous++;
+	} else {
+		_aws_iot_mqtt_rtt_sample(pRtt, now_ms - pPending->sentAt_ms);
+	}
+	pPending->packetId = 0;
+}
+
+/* Runs in the thread doing the network I/O */
+static void _aws_iot_mqtt_rtt_on_packet(AWS_IoT_Client *pClient, const IoT_Tap_Event_t *pEvent, void *pData) {
+	AWS_IoT_Rtt_t *pRtt = (AWS_IoT_Rtt_t *) pData;
+	uint8_t type = IOT_TAP_PACKET_TYPE(pEvent->header);
+	uint16_t topicLen;
+	size_t idOffset;
+
+	IOT_UNUSED(pClient);
+
+	if(IOT_TAP_EVENT_CONNECTED == pEvent->type) {
+		/* the acks of the previous connection will not come */
+		_aws_iot_mqtt_rtt_lock(pRtt);
+		memset(pRtt->pending, 0, sizeof(pRtt->pending));
+		_aws_iot_mqtt_rtt_unlock(pRtt);
+		return;
+	}
+
+	if(IOT_TAP_EVENT_PACKET_END != pEvent->type || 2 > pEvent->dataLen) {
+		return;
+	}
+
+	if(IOT_TAP_OUTBOUND == pEvent->direction) {
+		if(IOT_TAP_PUBLISH == type) {
+			if(QOS0 == RTT_PUBLISH_QOS(pEvent->header)) {
+				return;
+			}
+			topicLen = (uint16_t) ((pEvent->pData[0] << 8) | pEvent->pData[1]);
+			idOffset = 2 + (size_t) topicLen;
+			if(idOffset + 2 > pEvent->dataLen) {
+				/* topic longer than the prefix kept by the tap */
+				return;
+			}
+		} else if(IOT_TAP_SUBSCRIBE == type) {
+			idOffset = 0;
+		} else {
+			return;
+		}
+		_aws_iot_mqtt_rtt_lock(pRtt);
+		_aws_iot_mqtt_rtt_on_request(pRtt, type,
+									 (uint16_t) ((pEvent->pData[idOffset] << 8) | pEvent->pData[idOffset + 1]),
+									 0 != (pEvent->header & RTT_PUBLISH_DUP_FLAG), pEvent->timestamp_ms);
+		_aws_iot_mqtt_rtt_unlock(pRtt);
+		return;
+	}
+
+	if(IOT_TAP_PUBACK == type || IOT_TAP_SUBACK == type) {
+		_aws_iot_mqtt_rtt_lock(pRtt);
+		_aws_iot_mqtt_rtt_on_ack(pRtt, (IOT_TAP_PUBACK == type) ? IOT_TAP_PUBLISH : IOT_TAP_SUBSCRIBE,
+								 (uint16_t) ((pEvent->pData[0] << 8) | pEvent->pData[1]), pEvent->timestamp_ms);
+		_aws_iot_mqtt_rtt_unlock(pRtt);
+	}
+}
+
+IoT_Error_t aws_iot_mqtt_rtt_init(AWS_IoT_Rtt_t *pRtt, AWS_IoT_Client *pClient, const IoT_Rtt_Params_t *pParams) {
+	IoT_Error_t rc;
+
+	FUNC_ENTRY;
+
+	if(NULL == pRtt || NULL == pClient) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	if(NULL == pParams) {
+		pParams = &iotRttParamsDefault;
+	}
+
+	if(0 == pParams->minRto_ms || pParams->minRto_ms > pParams->maxRto_ms) {
+		IOT_ERROR("rtt: invalid timeout bounds");
+		FUNC_EXIT_RC(FAILURE);
+	}
+
+	memset(pRtt, 0, sizeof(AWS_IoT_Rtt_t));
+	pRtt->pClient = pClient;
+	pRtt->params = *pParams;
+	pRtt->stats.rto_ms = _aws_iot_mqtt_rtt_clamp(pRtt, pParams->initialRto_ms);
+
+#ifdef _ENABLE_THREAD_SUPPORT_
+	rc = aws_iot_thread_mutex_init(&(pRtt->lock));
+	if(SUCCESS != rc) {
+		FUNC_EXIT_RC(rc);
+	}
+#endif
+
+	pRtt->observer.handler = _aws_iot_mqtt_rtt_on_packet;
+	pRtt->observer.pHandlerData = pRtt;
+	rc = aws_iot_mqtt_tap_add_observer(pClient, &(pRtt->observer));
+
+	FUNC_EXIT_RC(rc);
+}
+
+IoT_Error_t aws_iot_mqtt_rtt_deinit(AWS_IoT_Rtt_t *pRtt) {
+	FUNC_ENTRY;
+
+	if(NULL == pRtt || NULL == pRtt->pClient) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	(void) aws_iot_mqtt_tap_remove_observer(pRtt->pClient, &(pRtt->observer));
+#ifdef _ENABLE_THREAD_SUPPORT_
+	(void) aws_iot_thread_mutex_destroy(&(pRtt->lock));
+#endif
+	pRtt->pClient = NULL;
+
+	FUNC_EXIT_RC(SUCCESS);
+}
+
+uint32_t aws_iot_mqtt_rtt_get_rto_ms(AWS_IoT_Rtt_t *pRtt) {
+	uint32_t rto_ms;
+
+	_aws_iot_mqtt_rtt_lock(pRtt);
+	rto_ms = pRtt->stats.rto_ms;
+	_aws_iot_mqtt_rtt_unlock(pRtt);
+
+	return rto_ms;
+}
+
+uint32_t aws_iot_mqtt_rtt_backoff_ms(AWS_IoT_Rtt_t *pRtt, uint8_t retries) {
+	uint32_t timeout_ms = aws_iot_mqtt_rtt_get_rto_ms(pRtt);
+
+	while(0 < retries-- && timeout_ms < pRtt->params.maxRto_ms) {
+		timeout_ms <<= 1;
+	}
+	return _aws_iot_mqtt_rtt_clamp(pRtt, timeout_ms);
+}
+
+void aws_iot_mqtt_rtt_get_stats(AWS_IoT_Rtt_t *pRtt, IoT_Rtt_Stats_t *pStats) {
+	_aws_iot_mqtt_rtt_lock(pRtt);
+	*pStats = pRtt->stats;
+	_aws_iot_mqtt_rtt_unlock(pRtt);
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,349 @@
+/**
+  *****************************************************************************
+  * @file   aws_iot_mqtt_client_rx_task.c
+  *
+  *****************************************************************************
+  * @attention
+  *
+  *
+  *  Copyright (c) 2022, InnoPhase, Inc.
+  *
+  *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  *  POSSIBILITY OF SUCH DAMAGE.
+  *
+  *****************************************************************************
+  */
+
+/**
+ * @file aws_iot_mqtt_client_rx_task.c
+ * @brief Dedicated MQTT receive task with a lock-free SPSC hand-off
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <string.h>
+
+#include "aws_iot_log.h"
+#include "aws_iot_mqtt_client_rx_task.h"
+#include "timer_interface.h"
+
+#if (AWS_IOT_MQTT_RX_TASK_QUEUE_DEPTH & (AWS_IOT_MQTT_RX_TASK_QUEUE_DEPTH - 1)) != 0
+#error "AWS_IOT_MQTT_RX_TASK_QUEUE_DEPTH must be a power of two"
+#endif
+
+#define RX_TASK_SLOT(idx) ((idx) & (AWS_IOT_MQTT_RX_TASK_QUEUE_DEPTH - 1))
+
+/* Granularity of the wait while reads are held back by backpressure */
+#define RX_TASK_STALL_STEP_MS 20
+
+/* Granularity of the wait for the client lock */
+#define RX_TASK_LOCK_STEP_MS 1
+
+const IoT_Rx_Task_Params_t iotRxTaskParamsDefault = {NULL, NULL, AWS_IOT_MQTT_RX_TASK_YIELD_TIMEOUT_MS};
+
+static uint32_t _aws_iot_mqtt_rx_task_fill(const AWS_IoT_Rx_Task_t *pRxTask) {
+	return pRxTask->head - pRxTask->tail;
+}
+
+static void _aws_iot_mqtt_rx_task_set_backpressure(AWS_IoT_Rx_Task_t *pRxTask, bool isAsserted) {
+	if(pRxTask->isBackpressured == isAsserted) {
+		return;
+	}
+
+	pRxTask->isBackpressured = isAsserted;
+	IOT_DEBUG("rx task backpressure %s, fill %u", isAsserted ? "asserted" : "released",
+			  (unsigned) _aws_iot_mqtt_rx_task_fill(pRxTask));
+
+	if(NULL != pRxTask->params.backpressureHandler) {
+		pRxTask->params.backpressureHandler(pRxTask->pClient, isAsserted, pRxTask->params.backpressureHandlerData);
+	}
+}
+
+/* Runs inside aws_iot_mqtt_yield() on the receive task, the only producer of the ring */
+static void _aws_iot_mqtt_rx_task_enqueue(AWS_IoT_Client *pClient, char *pTopicName, uint16_t topicNameLen,
+										  IoT_Publish_Message_Params *pParams, void *pData) {
+	AWS_IoT_Rx_Task_t *pRxTask = (AWS_IoT_Rx_Task_t *) pData;
+	IoT_Rx_Message_t *pMsg;
+	uint32_t head;
+	uint32_t fill;
+
+	IOT_UNUSED(pClient);
+
+	head = pRxTask->head;
+	fill = head - pRxTask->tail;
+	if(AWS_IOT_MQTT_RX_TASK_QUEUE_DEPTH <= fill && QOS0 == pParams->qos) {
+		pRxTask->stats.dropped++;
+		IOT_WARN("rx task ring full, dropping QoS0 message on %.*s", topicNameLen, pTopicName);
+		return;
+	}
+
+	/* the PUBACK goes out when this returns, so a QoS1 message waits for the consumer instead */
+	if(AWS_IOT_MQTT_RX_TASK_QUEUE_DEPTH <= fill) {
+		pRxTask->stats.waits++;
+		pRxTask->isWaitingForRoom = true;
+		while(AWS_IOT_MQTT_RX_TASK_QUEUE_DEPTH <= _aws_iot_mqtt_rx_task_fill(pRxTask)) {
+			delay(RX_TASK_STALL_STEP_MS);
+		}
+		pRxTask->isWaitingForRoom = false;
+		fill = head - pRxTask->tail;
+	}
+
+	pMsg = &(pRxTask->ring[RX_TASK_SLOT(head)]);
+	pMsg->isTruncated = false;
+
+	pMsg->topicNameLen = topicNameLen;
+	if(AWS_IOT_MQTT_RX_TASK_MAX_TOPIC_LEN < pMsg->topicNameLen) {
+		pMsg->topicNameLen = AWS_IOT_MQTT_RX_TASK_MAX_TOPIC_LEN;
+		pMsg->isTruncated = true;
+	}
+	memcpy(pMsg->topicName, pTopicName, pMsg->topicNameLen);
+	pMsg->topicName[pMsg->topicNameLen] = '\0';
+
+	pMsg->payloadLen = pParams->payloadLen;
+	if(AWS_IOT_MQTT_RX_TASK_MAX_PAYLOAD_LEN < pMsg->payloadLen) {
+		pMsg->payloadLen = AWS_IOT_MQTT_RX_TASK_MAX_PAYLOAD_LEN;
+		pMsg->isTruncated = true;
+	}
+	memcpy(pMsg->payload, pParams->payload, pMsg->payloadLen);
+
+	pMsg->qos = pParams->qos;
+	pMsg->isRetained = pParams->isRetained;
+	pMsg->isDup = pParams->isDup;
+	pMsg->id = pParams->id;
+
+	if(pMsg->isTruncated) {
+		pRxTask->stats.truncated++;
+	}
+
+	/* descriptor contents must be visible before the consumer can see the new head */
+	__sync_synchronize();
+	pRxTask->head = head + 1;
+
+	pRxTask->stats.received++;
+	fill++;
+	if(fill > pRxTask->stats.highWatermark) {
+		pRxTask->stats.highWatermark = fill;
+	}
+	if(AWS_IOT_MQTT_RX_TASK_HIGH_WATERMARK <= fill) {
+		_aws_iot_mqtt_rx_task_set_backpressure(pRxTask, true);
+	}
+}
+
+/* Hold back socket reads while the consumer catches up, but not long enough to miss a keepalive unless the ring is full */
+static void _aws_iot_mqtt_rx_task_stall(AWS_IoT_Rx_Task_t *pRxTask) {
+	uint32_t stalled_ms = 0;
+
+	if(AWS_IOT_MQTT_RX_TASK_HIGH_WATERMARK <= _aws_iot_mqtt_rx_task_fill(pRxTask)) {
+		_aws_iot_mqtt_rx_task_set_backpressure(pRxTask, true);
+		pRxTask->stats.stalls++;
+
+		while(!pRxTask->isStopRequested
+			  && (stalled_ms < AWS_IOT_MQTT_RX_TASK_MAX_STALL_MS
+				  || AWS_IOT_MQTT_RX_TASK_QUEUE_DEPTH <= _aws_iot_mqtt_rx_task_fill(pRxTask))
+			  && (AWS_IOT_MQTT_RX_TASK_QUEUE_DEPTH / 2) < _aws_iot_mqtt_rx_task_fill(pRxTask)) {
+			delay(RX_TASK_STALL_STEP_MS);
+			stalled_ms += RX_TASK_STALL_STEP_MS;
+		}
+	}
+
+	/* backpressure state is only ever changed from the receive task */
+	if(pRxTask->isBackpressured && (AWS_IOT_MQTT_RX_TASK_QUEUE_DEPTH / 2) >= _aws_iot_mqtt_rx_task_fill(pRxTask)) {
+		_aws_iot_mqtt_rx_task_set_backpressure(pRxTask, false);
+	}
+}
+
+static void _aws_iot_mqtt_rx_task_main(void *pArg) {
+	AWS_IoT_Rx_Task_t *pRxTask = (AWS_IoT_Rx_Task_t *) pArg;
+	IoT_Thread_t thread;
+	IoT_Error_t rc;
+
+	IOT_DEBUG("rx task running");
+
+	while(!pRxTask->isStopRequested) {
+		_aws_iot_mqtt_rx_task_stall(pRxTask);
+
+		aws_iot_thread_mutex_lock(&(pRxTask->clientLock));
+		rc = aws_iot_mqtt_yield(pRxTask->pClient, pRxTask->params.yieldTimeout_ms);
+		aws_iot_thread_mutex_unlock(&(pRxTask->clientLock));
+
+		pRxTask->lastYieldRc = rc;
+
+		if(NETWORK_ATTEMPTING_RECONNECT == rc) {
+			delay(AWS_IOT_MQTT_RX_TASK_YIELD_TIMEOUT_MS);
+		} else {
+			delay(AWS_IOT_MQTT_RX_TASK_IDLE_MS);
+		}
+	}
+
+	IOT_DEBUG("rx task exiting");
+	/* stop() may return and pRxTask be released once this is seen, exit on the local copy */
+	thread = pRxTask->thread;
+	pRxTask->isRunning = false;
+	aws_iot_thread_exit(&thread);
+}
+
+IoT_Error_t aws_iot_mqtt_rx_task_init(AWS_IoT_Rx_Task_t *pRxTask, AWS_IoT_Client *pClient,
+									  const IoT_Rx_Task_Params_t *pParams) {
+	IoT_Error_t rc;
+
+	FUNC_ENTRY;
+
+	if(NULL == pRxTask || NULL == pClient) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	memset(pRxTask, 0, sizeof(AWS_IoT_Rx_Task_t));
+	pRxTask->pClient = pClient;
+	pRxTask->params = (NULL != pParams) ? *pParams : iotRxTaskParamsDefault;
+	if(0 == pRxTask->params.yieldTimeout_ms) {
+		pRxTask->params.yieldTimeout_ms = AWS_IOT_MQTT_RX_TASK_YIELD_TIMEOUT_MS;
+	}
+	pRxTask->lastYieldRc = SUCCESS;
+
+	rc = aws_iot_thread_mutex_init(&(pRxTask->clientLock));
+
+	FUNC_EXIT_RC(rc);
+}
+
+IoT_Error_t aws_iot_mqtt_rx_task_start(AWS_IoT_Rx_Task_t *pRxTask) {
+	IoT_Error_t rc;
+
+	FUNC_ENTRY;
+
+	if(NULL == pRxTask) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	if(pRxTask->isRunning) {
+		FUNC_EXIT_RC(SUCCESS);
+	}
+
+	pRxTask->isStopRequested = false;
+	pRxTask->isRunning = true;
+	rc = aws_iot_thread_create(&(pRxTask->thread), "mqtt_rx", _aws_iot_mqtt_rx_task_main, pRxTask,
+							   AWS_IOT_MQTT_RX_TASK_STACK_SIZE, AWS_IOT_MQTT_RX_TASK_PRIORITY);
+	if(SUCCESS != rc) {
+		IOT_ERROR("Unable to create the mqtt rx task");
+		pRxTask->isRunning = false;
+	}
+
+	FUNC_EXIT_RC(rc);
+}
+
+IoT_Error_t aws_iot_mqtt_rx_task_stop(AWS_IoT_Rx_Task_t *pRxTask) {
+	FUNC_ENTRY;
+
+	if(NULL == pRxTask) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	pRxTask->isStopRequested = true;
+	while(pRxTask->isRunning) {
+		if(pRxTask->isWaitingForRoom) {
+			FUNC_EXIT_RC(MUTEX_LOCK_ERROR);
+		}
+		delay(AWS_IOT_MQTT_RX_TASK_IDLE_MS);
+	}
+
+	FUNC_EXIT_RC(SUCCESS);
+}
+
+IoT_Error_t aws_iot_mqtt_rx_task_subscribe(AWS_IoT_Rx_Task_t *pRxTask, const char *pTopicName,
+										   uint16_t topicNameLen, QoS qos) {
+	IoT_Error_t rc;
+
+	FUNC_ENTRY;
+
+	if(NULL == pRxTask || NULL == pTopicName) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	aws_iot_thread_mutex_lock(&(pRxTask->clientLock));
+	rc = aws_iot_mqtt_subscribe(pRxTask->pClient, pTopicName, topicNameLen, qos,
+								_aws_iot_mqtt_rx_task_enqueue, pRxTask);
+	aws_iot_thread_mutex_unlock(&(pRxTask->clientLock));
+
+	FUNC_EXIT_RC(rc);
+}
+
+IoT_Rx_Message_t *aws_iot_mqtt_rx_task_peek(AWS_IoT_Rx_Task_t *pRxTask) {
+	uint32_t tail;
+
+	if(NULL == pRxTask) {
+		return NULL;
+	}
+
+	tail = pRxTask->tail;
+	if(tail == pRxTask->head) {
+		return NULL;
+	}
+
+	/* pairs with the barrier before the head update in the producer */
+	__sync_synchronize();
+	return &(pRxTask->ring[RX_TASK_SLOT(tail)]);
+}
+
+void aws_iot_mqtt_rx_task_release(AWS_IoT_Rx_Task_t *pRxTask) {
+	if(NULL == pRxTask || pRxTask->tail == pRxTask->head) {
+		return;
+	}
+
+	/* all reads of the descriptor must be done before the producer can reuse it */
+	__sync_synchronize();
+	pRxTask->tail++;
+}
+
+uint32_t aws_iot_mqtt_rx_task_pending(const AWS_IoT_Rx_Task_t *pRxTask) {
+	return (NULL != pRxTask) ? _aws_iot_mqtt_rx_task_fill(pRxTask) : 0;
+}
+
+bool aws_iot_mqtt_rx_task_is_backpressured(const AWS_IoT_Rx_Task_t *pRxTask) {
+	return (NULL != pRxTask) ? pRxTask->isBackpressured : false;
+}
+
+IoT_Error_t aws_iot_mqtt_rx_task_get_status(const AWS_IoT_Rx_Task_t *pRxTask) {
+	return (NULL != pRxTask) ? pRxTask->lastYieldRc : NULL_VALUE_ERROR;
+}
+
+void aws_iot_mqtt_rx_task_get_stats(const AWS_IoT_Rx_Task_t *pRxTask, IoT_Rx_Task_Stats_t *pStats) {
+	if(NULL != pRxTask && NULL != pStats) {
+		*pStats = pRxTask->stats;
+	}
+}
+
+IoT_Error_t aws_iot_mqtt_rx_task_lock(AWS_IoT_Rx_Task_t *pRxTask) {
+	if(NULL == pRxTask) {
+		return NULL_VALUE_ERROR;
+	}
+
+	/* blocking here would deadlock with a receive callback waiting for this consumer to release a descriptor */
+	while(SUCCESS != aws_iot_thread_mutex_trylock(&(pRxTask->clientLock))) {
+		if(pRxTask->isWaitingForRoom) {
+			return MUTEX_LOCK_ERROR;
+		}
+		delay(RX_TASK_LOCK_STEP_MS);
+	}
+	return SUCCESS;
+}
+
+IoT_Error_t aws_iot_mqtt_rx_task_unlock(AWS_IoT_Rx_Task_t *pRxTask) {
+	if(NULL == pRxTask) {
+		return NULL_VALUE_ERROR;
+	}
+	return aws_iot_thread_mutex_unlock(&(pRxTask->clientLock));
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,488 @@
+/**
+  *****************************************************************************
+  * @file   aws_iot_mqtt_client_scheduler.c
+  *
+  *****************************************************************************
+  * @attention
+  *
+  *
+  *  Copyright (c) 2022, InnoPhase, Inc.
+  *
+  *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  *  POSSIBILITY OF SUCH DAMAGE.
+  *
+  *****************************************************************************
+  */
+
+/**
+ * @file aws_iot_mqtt_client_scheduler.c
+ * @brief Token-bucket publish scheduler with priority lanes
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <string.h>
+
+#include "aws_iot_log.h"
+#include "aws_iot_mqtt_client_scheduler.h"
+
+const IoT_Scheduler_Params_t iotSchedulerParamsDefault = {AWS_IOT_MQTT_SCHEDULER_PUBLISH_RATE,
+														  0,
+														  AWS_IOT_MQTT_SCHEDULER_BYTE_RATE,
+														  0,
+														  2,
+														  NULL};
+
+static void _aws_iot_mqtt_scheduler_lock(AWS_IoT_Scheduler_t *pScheduler) {
+#ifdef _ENABLE_THREAD_SUPPORT_
+	(void) aws_iot_thread_mutex_lock(&(pScheduler->lock));
+#else
+	IOT_UNUSED(pScheduler);
+#endif
+}
+
+static void _aws_iot_mqtt_scheduler_unlock(AWS_IoT_Scheduler_t *pScheduler) {
+#ifdef _ENABLE_THREAD_SUPPORT_
+	(void) aws_iot_thread_mutex_unlock(&(pScheduler->lock));
+#else
+	IOT_UNUSED(pScheduler);
+#endif
+}
+
+/* Fixed header, remaining length and body of a PUBLISH */
+static uint32_t _aws_iot_mqtt_scheduler_wire_len(uint32_t remainingLength) {
+	uint32_t len = 1 + 1 + remainingLength;
+
+	while(remainingLength >= 128) {
+		remainingLength >>= 7;
+		len++;
+	}
+	return len;
+}
+
+static uint32_t _aws_iot_mqtt_scheduler_publish_len(uint16_t topicNameLen, size_t payloadLen, QoS qos) {
+	return _aws_iot_mqtt_scheduler_wire_len((uint32_t) (2 + topicNameLen + ((QOS0 == qos) ? 0 : 2) + payloadLen));
+}
+
+/* Rates are per second and time is in ms, so rate * elapsed is already in thousandths */
+static void _aws_iot_mqtt_scheduler_refill(AWS_IoT_Scheduler_t *pScheduler, uint32_t now_ms) {
+	int64_t elapsed_ms = (int32_t) (now_ms - pScheduler->refilledAt_ms);
+	int64_t max_x1000;
+
+	/* a tap event stamped before the last refill, from another thread */
+	if(0 >= elapsed_ms) {
+		return;
+	}
+	pScheduler->refilledAt_ms = now_ms;
+
+	if(0 != pScheduler->params.publishRate) {
+		max_x1000 = (int64_t) pScheduler->params.publishBurst * 1000;
+		pScheduler->publishTokens_x1000 += elapsed_ms * pScheduler->params.publishRate;
+		if(pScheduler->publishTokens_x1000 > max_x1000) {
+			pScheduler->publishTokens_x1000 = max_x1000;
+		}
+	}
+
+	if(0 != pScheduler->params.byteRate) {
+		max_x1000 = (int64_t) pScheduler->params.byteBurst * 1000;
+		pScheduler->byteTokens_x1000 += elapsed_ms * pScheduler->params.byteRate;
+		if(pScheduler->byteTokens_x1000 > max_x1000) {
+			pScheduler->byteTokens_x1000 = max_x1000;
+		}
+	}
+}
+
+/* Called with the lock held, after a refill */
+static bool _aws_iot_mqtt_scheduler_has_tokens(const AWS_IoT_Scheduler_t *pScheduler, IoT_Scheduler_Lane_t lane,
+											   uint32_t packetLen) {
+	int64_t need_x1000;
+
+	if(0 != pScheduler->params.publishRate) {
+		need_x1000 = 1000;
+		if(IOT_SCHEDULER_LANE_BULK == lane) {
+			need_x1000 += (int64_t) pScheduler->params.controlReserve * 1000;
+		}
+		if(pScheduler->publishTokens_x1000 < need_x1000) {
+			return false;
+		}
+	}
+
+	if(0 != pScheduler->params.byteRate) {
+		/* a packet larger than the bucket goes once the bucket is full */
+		if(packetLen > pScheduler->params.byteBurst) {
+			packetLen = pScheduler->params.byteBurst;
+		}
+		if(pScheduler->byteTokens_x1000 < (int64_t) packetLen * 1000) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/* Runs in the thread doing the network I/O */
+static void _aws_iot_mqtt_scheduler_on_packet(AWS_IoT_Client *pClient, const IoT_Tap_Event_t *pEvent, void *pData) {
+	AWS_IoT_Scheduler_t *pScheduler = (AWS_IoT_Scheduler_t *) pData;
+	uint32_t packetLen;
+
+	IOT_UNUSED(pClient);
+
+	if(IOT_TAP_EVENT_PACKET_BEGIN != pEvent->type || IOT_TAP_OUTBOUND != pEvent->direction ||
+	   IOT_TAP_PUBLISH != IOT_TAP_PACKET_TYPE(pEvent->header)) {
+		return;
+	}
+
+	packetLen = _aws_iot_mqtt_scheduler_wire_len(pEvent->remainingLength);
+
+	_aws_iot_mqtt_scheduler_lock(pScheduler);
+	_aws_iot_mqtt_scheduler_refill(pScheduler, pEvent->timestamp_ms);
+
+	/* publishes sent past the scheduler can overdraw the buckets, by one burst at most */
+	if(0 != pScheduler->params.publishRate) {
+		pScheduler->publishTokens_x1000 -= 1000;
+		if(pScheduler->publishTokens_x1000 < -(int64_t) pScheduler->params.publishBurst * 1000) {
+			pScheduler->publishTokens_x1000 = -(int64_t) pScheduler->params.publishBurst * 1000;
+		}
+	}
+	if(0 != pScheduler->params.byteRate) {
+		pScheduler->byteTokens_x1000 -= (int64_t) packetLen * 1000;
+		if(pScheduler->byteTokens_x1000 < -(int64_t) pScheduler->params.byteBurst * 1000) {
+			pScheduler->byteTokens_x1000 = -(int64_t) pScheduler->params.byteBurst * 1000;
+		}
+	}
+
+	pScheduler->stats.charged++;
+	pScheduler->stats.chargedBytes += packetLen;
+	_aws_iot_mqtt_scheduler_unlock(pScheduler);
+}
+
+/* Oldest deferred message of a lane, or NULL. Called with the lock held. */
+static IoT_Scheduler_Message_t *_aws_iot_mqtt_scheduler_head(AWS_IoT_Scheduler_t *pScheduler,
+															 IoT_Scheduler_Lane_t lane) {
+	IoT_Scheduler_Message_t *pHead = NULL;
+	uint8_t i;
+
+	for(i = 0; i < AWS_IOT_MQTT_SCHEDULER_MAX_QUEUED; i++) {
+		if(!pScheduler->queue[i].isUsed || lane != pScheduler->queue[i].lane) {
+			continue;
+		}
+		if(NULL == pHead || (int32_t) (pScheduler->queue[i].seq - pHead->seq) < 0) {
+			pHead = &(pScheduler->queue[i]);
+		}
+	}
+	return pHead;
+}
+
+/* Called with the lock held */
+static IoT_Scheduler_Message_t *_aws_iot_mqtt_scheduler_alloc(AWS_IoT_Scheduler_t *pScheduler,
+															  IoT_Scheduler_Lane_t lane) {
+	IoT_Scheduler_Message_t *pFree = NULL;
+	uint8_t freeCount = 0;
+	uint8_t i;
+
+	for(i = 0; i < AWS_IOT_MQTT_SCHEDULER_MAX_QUEUED; i++) {
+		if(!pScheduler->queue[i].isUsed) {
+			freeCount++;
+			if(NULL == pFree) {
+				pFree = &(pScheduler->queue[i]);
+			}
+		}
+	}
+
+	if(IOT_SCHEDULER_LANE_BULK == lane && freeCount <= AWS_IOT_MQTT_SCHEDULER_CONTROL_SLOTS) {
+		return NULL;
+	}
+	return pFree;
+}
+
+/* Called without the lock, the tap observer takes it while the packet is written */
+static IoT_Error_t _aws_iot_mqtt_scheduler_send(AWS_IoT_Scheduler_t *pScheduler, const char *pTopicName,
+												uint16_t topicNameLen, IoT_Publish_Message_Params *pParams,
+												iot_async_publish_complete_handler handler, void *pHandlerData) {
+	/* QOS1 messages are only admitted with a publisher */
+	if(QOS1 == pParams->qos) {
+		return aws_iot_mqtt_async_publish(pScheduler->params.pPublisher, pTopicName, topicNameLen, pParams,
+										  handler, pHandlerData, NULL);
+	}
+
+	return aws_iot_mqtt_publish(pScheduler->pClient, pTopicName, topicNameLen, pParams);
+}
+
+IoT_Error_t aws_iot_mqtt_scheduler_init(AWS_IoT_Scheduler_t *pScheduler, AWS_IoT_Client *pClient,
+										const IoT_Scheduler_Params_t *pParams) {
+	IoT_Error_t rc;
+
+	FUNC_ENTRY;
+
+	if(NULL == pScheduler || NULL == pClient) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	if(NULL == pParams) {
+		pParams = &iotSchedulerParamsDefault;
+	}
+
+	memset(pScheduler, 0, sizeof(AWS_IoT_Scheduler_t));
+	pScheduler->pClient = pClient;
+	pScheduler->params = *pParams;
+	if(0 == pScheduler->params.publishBurst) {
+		pScheduler->params.publishBurst = pScheduler->params.publishRate;
+	}
+	if(0 == pScheduler->params.byteBurst) {
+		pScheduler->params.byteBurst = pScheduler->params.byteRate;
+	}
+
+	if(0 != pScheduler->params.publishRate && pScheduler->params.controlReserve >= pScheduler->params.publishBurst) {
+		IOT_ERROR("scheduler: the control reserve leaves no room for bulk messages");
+		FUNC_EXIT_RC(FAILURE);
+	}
+
+	pScheduler->publishTokens_x1000 = (int64_t) pScheduler->params.publishBurst * 1000;
+	pScheduler->byteTokens_x1000 = (int64_t) pScheduler->params.byteBurst * 1000;
+	pScheduler->refilledAt_ms = aws_iot_mqtt_tap_now_ms();
+
+#ifdef _ENABLE_THREAD_SUPPORT_
+	rc = aws_iot_thread_mutex_init(&(pScheduler->lock));
+	if(SUCCESS != rc) {
+		FUNC_EXIT_RC(rc);
+	}
+#endif
+
+	pScheduler->observer.handler = _aws_iot_mqtt_scheduler_on_packet;
+	pScheduler->observer.pHandlerData = pScheduler;
+	rc = aws_iot_mqtt_tap_add_observer(pClient, &(pScheduler->observer));
+
+	FUNC_EXIT_RC(rc);
+}
+
+IoT_Error_t aws_iot_mqtt_scheduler_deinit(AWS_IoT_Scheduler_t *pScheduler) {
+	IoT_Scheduler_Message_t *pMessage;
+	uint8_t i;
+
+	FUNC_ENTRY;
+
+	if(NULL == pScheduler || NULL == pScheduler->pClient) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	(void) aws_iot_mqtt_tap_remove_observer(pScheduler->pClient, &(pScheduler->observer));
+
+	for(i = 0; i < AWS_IOT_MQTT_SCHEDULER_MAX_QUEUED; i++) {
+		pMessage = &(pScheduler->queue[i]);
+		if(pMessage->isUsed && QOS1 == pMessage->qos && NULL != pMessage->handler) {
+			pMessage->handler(pScheduler->pClient, 0, IOT_ASYNC_PUBLISH_ABORTED, pMessage->pHandlerData);
+		}
+		pMessage->isUsed = false;
+	}
+
+#ifdef _ENABLE_THREAD_SUPPORT_
+	(void) aws_iot_thread_mutex_destroy(&(pScheduler->lock));
+#endif
+	pScheduler->pClient = NULL;
+
+	FUNC_EXIT_RC(SUCCESS);
+}
+
+bool aws_iot_mqtt_scheduler_admit(AWS_IoT_Scheduler_t *pScheduler, IoT_Scheduler_Lane_t lane,
+								  uint16_t topicNameLen, size_t payloadLen, QoS qos) {
+	bool isAdmitted;
+
+	if(NULL == pScheduler || NULL == pScheduler->pClient || IOT_SCHEDULER_LANE_COUNT <= lane) {
+		return false;
+	}
+
+	_aws_iot_mqtt_scheduler_lock(pScheduler);
+	_aws_iot_mqtt_scheduler_refill(pScheduler, aws_iot_mqtt_tap_now_ms());
+	isAdmitted = _aws_iot_mqtt_scheduler_has_tokens(pScheduler, lane,
+													_aws_iot_mqtt_scheduler_publish_len(topicNameLen, payloadLen, qos));
+	if(!isAdmitted && !pScheduler->isAdmitRefused[lane]) {
+		pScheduler->stats.lanes[lane].deferred++;
+	}
+	pScheduler->isAdmitRefused[lane] = !isAdmitted;
+	_aws_iot_mqtt_scheduler_unlock(pScheduler);
+
+	return isAdmitted;
+}
+
+IoT_Error_t aws_iot_mqtt_scheduler_publish(AWS_IoT_Scheduler_t *pScheduler, IoT_Scheduler_Lane_t lane,
+										   const char *pTopicName, uint16_t topicNameLen,
+										   IoT_Publish_Message_Params *pParams,
+										   iot_async_publish_complete_handler handler, void *pHandlerData) {
+	IoT_Scheduler_Message_t *pMessage;
+	uint32_t packetLen;
+	IoT_Error_t rc;
+
+	FUNC_ENTRY;
+
+	if(NULL == pScheduler || NULL == pScheduler->pClient || NULL == pTopicName || 0 == topicNameLen ||
+	   NULL == pParams || (NULL == pParams->payload && 0 != pParams->payloadLen) ||
+	   IOT_SCHEDULER_LANE_COUNT <= lane) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	if(QOS0 != pParams->qos && QOS1 != pParams->qos) {
+		FUNC_EXIT_RC(FAILURE);
+	}
+
+	/* sent with aws_iot_mqtt_publish(), a QOS1 message would block the poll until its PUBACK */
+	if(QOS1 == pParams->qos && NULL == pScheduler->params.pPublisher) {
+		IOT_ERROR("scheduler: QOS1 needs an async publisher");
+		FUNC_EXIT_RC(FAILURE);
+	}
+
+	packetLen = _aws_iot_mqtt_scheduler_publish_len(topicNameLen, pParams->payloadLen, pParams->qos);
+
+	_aws_iot_mqtt_scheduler_lock(pScheduler);
+	_aws_iot_mqtt_scheduler_refill(pScheduler, aws_iot_mqtt_tap_now_ms());
+	if(aws_iot_mqtt_is_client_connected(pScheduler->pClient) &&
+	   NULL == _aws_iot_mqtt_scheduler_head(pScheduler, lane) &&
+	   _aws_iot_mqtt_scheduler_has_tokens(pScheduler, lane, packetLen)) {
+		_aws_iot_mqtt_scheduler_unlock(pScheduler);
+
+		rc = _aws_iot_mqtt_scheduler_send(pScheduler, pTopicName, topicNameLen, pParams, handler, pHandlerData);
+
+		_aws_iot_mqtt_scheduler_lock(pScheduler);
+		if(MQTT_ASYNC_PUBLISH_WINDOW_FULL_ERROR != rc) {
+			if(SUCCESS == rc) {
+				pScheduler->stats.lanes[lane].sent++;
+			}
+			_aws_iot_mqtt_scheduler_unlock(pScheduler);
+			FUNC_EXIT_RC(rc);
+		}
+		/* no room in the async window, wait like for tokens */
+	}
+
+	if((size_t) topicNameLen + pParams->payloadLen > AWS_IOT_MQTT_SCHEDULER_MAX_MESSAGE_LEN) {
+		_aws_iot_mqtt_scheduler_unlock(pScheduler);
+		FUNC_EXIT_RC(MQTT_TX_BUFFER_TOO_SHORT_ERROR);
+	}
+
+	pMessage = _aws_iot_mqtt_scheduler_alloc(pScheduler, lane);
+	if(NULL == pMessage) {
+		pScheduler->stats.lanes[lane].queueFull++;
+		_aws_iot_mqtt_scheduler_unlock(pScheduler);
+		FUNC_EXIT_RC(MQTT_SCHEDULER_QUEUE_FULL_ERROR);
+	}
+
+	pMessage->isUsed = true;
+	pMessage->lane = lane;
+	pMessage->seq = pScheduler->nextSeq++;
+	pMessage->queuedAt_ms = aws_iot_mqtt_tap_now_ms();
+	pMessage->qos = pParams->qos;
+	pMessage->isRetained = pParams->isRetained;
+	pMessage->handler = handler;
+	pMessage->pHandlerData = pHandlerData;
+	pMessage->topicNameLen = topicNameLen;
+	pMessage->payloadLen = pParams->payloadLen;
+	memcpy(pMessage->data, pTopicName, topicNameLen);
+	if(0 < pParams->payloadLen) {
+		memcpy(&(pMessage->data[topicNameLen]), pParams->payload, pParams->payloadLen);
+	}
+	pScheduler->stats.lanes[lane].deferred++;
+	_aws_iot_mqtt_scheduler_unlock(pScheduler);
+
+	FUNC_EXIT_RC(SUCCESS);
+}
+
+IoT_Error_t aws_iot_mqtt_scheduler_poll(AWS_IoT_Scheduler_t *pScheduler) {
+	IoT_Scheduler_Message_t *pMessage;
+	IoT_Scheduler_Lane_t lane;
+	IoT_Publish_Message_Params params;
+	IoT_Error_t rc = SUCCESS;
+	uint32_t delay_ms;
+
+	FUNC_ENTRY;
+
+	if(NULL == pScheduler || NULL == pScheduler->pClient) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	while(aws_iot_mqtt_is_client_connected(pScheduler->pClient)) {
+		_aws_iot_mqtt_scheduler_lock(pScheduler);
+		_aws_iot_mqtt_scheduler_refill(pScheduler, aws_iot_mqtt_tap_now_ms());
+
+		/* a control message waiting for tokens holds the bulk lane back too */
+		lane = IOT_SCHEDULER_LANE_CONTROL;
+		pMessage = _aws_iot_mqtt_scheduler_head(pScheduler, lane);
+		if(NULL == pMessage) {
+			lane = IOT_SCHEDULER_LANE_BULK;
+			pMessage = _aws_iot_mqtt_scheduler_head(pScheduler, lane);
+		}
+		if(NULL == pMessage ||
+		   !_aws_iot_mqtt_scheduler_has_tokens(pScheduler, lane,
+											   _aws_iot_mqtt_scheduler_publish_len(pMessage->topicNameLen,
+																				   pMessage->payloadLen,
+																				   pMessage->qos))) {
+			_aws_iot_mqtt_scheduler_unlock(pScheduler);
+			break;
+		}
+		_aws_iot_mqtt_scheduler_unlock(pScheduler);
+
+		/* only this thread frees slots, the message stays in place while it is sent */
+		params.qos = pMessage->qos;
+		params.isRetained = pMessage->isRetained;
+		params.isDup = 0;
+		params.id = 0;
+		params.payload = &(pMessage->data[pMessage->topicNameLen]);
+		params.payloadLen = pMessage->payloadLen;
+
+		rc = _aws_iot_mqtt_scheduler_send(pScheduler, (const char *) pMessage->data, pMessage->topicNameLen, &params,
+										  pMessage->handler, pMessage->pHandlerData);
+		if(MQTT_ASYNC_PUBLISH_WINDOW_FULL_ERROR == rc) {
+			rc = SUCCESS;
+			break;
+		}
+		if(SUCCESS != rc && MQTT_REQUEST_TIMEOUT_ERROR != rc) {
+			/* not written, sent again at the next poll */
+			break;
+		}
+
+		_aws_iot_mqtt_scheduler_lock(pScheduler);
+		delay_ms = aws_iot_mqtt_tap_now_ms() - pMessage->queuedAt_ms;
+		if(delay_ms > pScheduler->stats.lanes[lane].maxDelay_ms) {
+			pScheduler->stats.lanes[lane].maxDelay_ms = delay_ms;
+		}
+		pScheduler->stats.lanes[lane].sent++;
+		pMessage->isUsed = false;
+		_aws_iot_mqtt_scheduler_unlock(pScheduler);
+		rc = SUCCESS;
+	}
+
+	FUNC_EXIT_RC(rc);
+}
+
+uint8_t aws_iot_mqtt_scheduler_queued(AWS_IoT_Scheduler_t *pScheduler, IoT_Scheduler_Lane_t lane) {
+	uint8_t queued = 0;
+	uint8_t i;
+
+	_aws_iot_mqtt_scheduler_lock(pScheduler);
+	for(i = 0; i < AWS_IOT_MQTT_SCHEDULER_MAX_QUEUED; i++) {
+		if(pScheduler->queue[i].isUsed && lane == pScheduler->queue[i].lane) {
+			queued++;
+		}
+	}
+	_aws_iot_mqtt_scheduler_unlock(pScheduler);
+
+	return queued;
+}
+
+void aws_iot_mqtt_scheduler_get_stats(AWS_IoT_Scheduler_t *pScheduler, IoT_Scheduler_Stats_t *pStats) {
+	_aws_iot_mqtt_scheduler_lock(pScheduler);
+	*pStats = pScheduler->stats;
+	_aws_iot_mqtt_scheduler_unlock(pScheduler);
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,139 @@
+/**
+  *****************************************************************************
+  * @file   aws_iot_mqtt_client_session.c
+  *
+  *****************************************************************************
+  * @attention
+  *
+  *
+  *  Copyright (c) 2022, InnoPhase, Inc.
+  *
+  *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  *  POSSIBILITY OF SUCH DAMAGE.
+  *
+  *****************************************************************************
+  */
+
+/**
+ * @file aws_iot_mqtt_client_session.c
+ * @brief Persistent MQTT session across reconnects
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <string.h>
+
+#include "aws_iot_log.h"
+#include "aws_iot_mqtt_client_session.h"
+
+const IoT_Session_Params_t iotSessionParamsDefault = {false, NULL, NULL};
+
+/* Runs in the thread doing the network I/O */
+static void _aws_iot_mqtt_session_on_packet(AWS_IoT_Client *pClient, const IoT_Tap_Event_t *pEvent, void *pData) {
+	AWS_IoT_Session_t *pSession = (AWS_IoT_Session_t *) pData;
+
+	IOT_UNUSED(pClient);
+
+	if(IOT_TAP_EVENT_PACKET_END != pEvent->type || IOT_TAP_INBOUND != pEvent->direction ||
+	   IOT_TAP_CONNACK != IOT_TAP_PACKET_TYPE(pEvent->header) || 2 > pEvent->dataLen) {
+		return;
+	}
+
+	/* refused connections are retried by the client, the next CONNACK tells */
+	if(0 != pEvent->pData[1]) {
+		return;
+	}
+
+	pSession->isResumed = (0 != (pEvent->pData[0] & 0x01));
+	pSession->stats.connacks++;
+	if(pSession->isResumed) {
+		pSession->stats.resumed++;
+	}
+	pSession->isEventPending = true;
+}
+
+IoT_Error_t aws_iot_mqtt_session_init(AWS_IoT_Session_t *pSession, AWS_IoT_Client *pClient,
+									  const IoT_Session_Params_t *pParams) {
+	IoT_Error_t rc;
+
+	FUNC_ENTRY;
+
+	if(NULL == pSession || NULL == pClient) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	if(NULL == pParams) {
+		pParams = &iotSessionParamsDefault;
+	}
+
+	memset(pSession, 0, sizeof(AWS_IoT_Session_t));
+	pSession->pClient = pClient;
+	pSession->params = *pParams;
+
+	pSession->observer.handler = _aws_iot_mqtt_session_on_packet;
+	pSession->observer.pHandlerData = pSession;
+	rc = aws_iot_mqtt_tap_add_observer(pClient, &(pSession->observer));
+	if(SUCCESS != rc) {
+		FUNC_EXIT_RC(rc);
+	}
+
+	if(pParams->isPersistent) {
+		/* used as is by the client's reconnects */
+		pClient->clientData.options.isCleanSession = false;
+	}
+
+	FUNC_EXIT_RC(SUCCESS);
+}
+
+IoT_Error_t aws_iot_mqtt_session_deinit(AWS_IoT_Session_t *pSession) {
+	FUNC_ENTRY;
+
+	if(NULL == pSession || NULL == pSession->pClient) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	(void) aws_iot_mqtt_tap_remove_observer(pSession->pClient, &(pSession->observer));
+	pSession->pClient = NULL;
+
+	FUNC_EXIT_RC(SUCCESS);
+}
+
+bool aws_iot_mqtt_session_poll(AWS_IoT_Session_t *pSession) {
+	IoT_Session_Event_t event;
+
+	if(NULL == pSession || NULL == pSession->pClient || !pSession->isEventPending) {
+		return false;
+	}
+
+	pSession->isEventPending = false;
+	event = pSession->isResumed ? IOT_SESSION_EVENT_RESUMED : IOT_SESSION_EVENT_NEW;
+	IOT_DEBUG("session: %s", (IOT_SESSION_EVENT_RESUMED == event) ? "resumed" : "new");
+
+	if(NULL != pSession->params.handler) {
+		pSession->params.handler(pSession->pClient, event, pSession->params.pHandlerData);
+	}
+	return true;
+}
+
+bool aws_iot_mqtt_session_is_resumed(const AWS_IoT_Session_t *pSession) {
+	return pSession->isResumed;
+}
+
+void aws_iot_mqtt_session_get_stats(const AWS_IoT_Session_t *pSession, IoT_Session_Stats_t *pStats) {
+	*pStats = pSession->stats;
+}
+
+#ifdef __cplusplus
+}
+#endif
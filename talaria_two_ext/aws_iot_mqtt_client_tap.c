@@ -0,0 +1,451 @@
+/**
+  *****************************************************************************
+  * @file   aws_iot_mqtt_client_tap.c
+  *
+  *****************************************************************************
+  * @attention
+  *
+  *
+  *  Copyright (c) 2022, InnoPhase, Inc.
+  *
+  *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  *  POSSIBILITY OF SUCH DAMAGE.
+  *
+  *****************************************************************************
+  */
+
+/**
+ * @file aws_iot_mqtt_client_tap.c
+ * @brief MQTT packet tap on the network layer of a client
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <string.h>
+
+#include "aws_iot_log.h"
+#include "aws_iot_mqtt_client_common_internal.h"
+#include "aws_iot_mqtt_client_tap.h"
+#include "timer_interface.h"
+
+typedef enum {
+	TAP_PARSE_HEADER,
+	TAP_PARSE_LENGTH,
+	TAP_PARSE_BODY,
+} _IoT_Tap_Parse_State_t;
+
+typedef struct {
+	_IoT_Tap_Parse_State_t state;
+	uint8_t header;
+	uint8_t lengthBytes;
+	uint32_t multiplier;
+	uint32_t remainingLength;
+	uint32_t offset;
+	size_t prefixLen;
+	unsigned char prefix[AWS_IOT_MQTT_TAP_PREFIX_LEN];
+} _IoT_Tap_Parser_t;
+
+typedef struct {
+	AWS_IoT_Client *pClient;
+	IoT_Error_t (*connect)(Network *, TLSConnectParams *);
+	IoT_Error_t (*read)(Network *, unsigned char *, size_t, Timer *, size_t *);
+	IoT_Error_t (*write)(Network *, unsigned char *, size_t, Timer *, size_t *);
+	IoT_Error_t (*disconnect)(Network *);
+	IoT_Tap_Observer_t *pObservers;
+	_IoT_Tap_Parser_t parsers[2];
+} _IoT_Tap_t;
+
+static _IoT_Tap_t taps[AWS_IOT_MQTT_TAP_MAX_CLIENTS];
+
+uint32_t aws_iot_mqtt_tap_now_ms(void) {
+	return (uint32_t) (os_systime64() / 1000);
+}
+
+static _IoT_Tap_t *_aws_iot_mqtt_tap_find_by_network(Network *pNetwork) {
+	uint8_t i;
+
+	for(i = 0; i < AWS_IOT_MQTT_TAP_MAX_CLIENTS; i++) {
+		if(NULL != taps[i].pClient && &(taps[i].pClient->networkStack) == pNetwork) {
+			return &taps[i];
+		}
+	}
+	return NULL;
+}
+
+static _IoT_Tap_t *_aws_iot_mqtt_tap_find(AWS_IoT_Client *pClient) {
+	uint8_t i;
+
+	for(i = 0; i < AWS_IOT_MQTT_TAP_MAX_CLIENTS; i++) {
+		if(pClient == taps[i].pClient) {
+			return &taps[i];
+		}
+	}
+	return NULL;
+}
+
+static void _aws_iot_mqtt_tap_notify(_IoT_Tap_t *pTap, IoT_Tap_Event_t *pEvent) {
+	IoT_Tap_Observer_t *pObserver;
+
+	pEvent->timestamp_ms = aws_iot_mqtt_tap_now_ms();
+	for(pObserver = pTap->pObservers; NULL != pObserver; pObserver = pObserver->pNext) {
+		pObserver->handler(pTap->pClient, pEvent, pObserver->pHandlerData);
+	}
+}
+
+static void _aws_iot_mqtt_tap_notify_link(_IoT_Tap_t *pTap, IoT_Tap_Event_Type_t type) {
+	IoT_Tap_Event_t event;
+
+	memset(&event, 0, sizeof(IoT_Tap_Event_t));
+	event.type = type;
+	_aws_iot_mqtt_tap_notify(pTap, &event);
+}
+
+static void _aws_iot_mqtt_tap_notify_packet(_IoT_Tap_t *pTap, IoT_Tap_Direction_t direction,
+											IoT_Tap_Event_Type_t type, const unsigned char *pData,
+											size_t dataLen) {
+	_IoT_Tap_Parser_t *pParser = &(pTap->parsers[direction]);
+	IoT_Tap_Event_t event;
+
+	event.type = type;
+	event.direction = direction;
+	event.header = pParser->header;
+	event.remainingLength = pParser->remainingLength;
+	event.offset = pParser->offset;
+	event.pData = pData;
+	event.dataLen = dataLen;
+	_aws_iot_mqtt_tap_notify(pTap, &event);
+}
+
+static void _aws_iot_mqtt_tap_reset_parsers(_IoT_Tap_t *pTap) {
+	pTap->parsers[IOT_TAP_INBOUND].state = TAP_PARSE_HEADER;
+	pTap->parsers[IOT_TAP_OUTBOUND].state = TAP_PARSE_HEADER;
+}
+
+/* Decodes the packet stream in one direction. Works with any split of the stream into buffers. */
+static void _aws_iot_mqtt_tap_feed(_IoT_Tap_t *pTap, IoT_Tap_Direction_t direction,
+								   const unsigned char *pBuf, size_t len) {
+	_IoT_Tap_Parser_t *pParser = &(pTap->parsers[direction]);
+	size_t chunkLen;
+	size_t copyLen;
+	uint8_t byte;
+
+	while(0 < len) {
+		switch(pParser->state) {
+			case TAP_PARSE_HEADER:
+				pParser->header = *pBuf++;
+				len--;
+				pParser->remainingLength = 0;
+				pParser->multiplier = 1;
+				pParser->lengthBytes = 0;
+				pParser->state = TAP_PARSE_LENGTH;
+				break;
+
+			case TAP_PARSE_LENGTH:
+				byte = *pBuf++;
+				len--;
+				pParser->remainingLength += (uint32_t) (byte & 127) * pParser->multiplier;
+				pParser->multiplier *= 128;
+				pParser->lengthBytes++;
+				if(0 == (byte & 128)) {
+					pParser->offset = 0;
+					pParser->prefixLen = 0;
+					_aws_iot_mqtt_tap_notify_packet(pTap, direction, IOT_TAP_EVENT_PACKET_BEGIN, NULL, 0);
+					if(0 == pParser->remainingLength) {
+						_aws_iot_mqtt_tap_notify_packet(pTap, direction, IOT_TAP_EVENT_PACKET_END, NULL, 0);
+						pParser->state = TAP_PARSE_HEADER;
+					} else {
+						pParser->state = TAP_PARSE_BODY;
+					}
+				} else if(4 <= pParser->lengthBytes) {
+					IOT_WARN("tap: malformed remaining length, resynchronizing");
+					pParser->state = TAP_PARSE_HEADER;
+				}
+				break;
+
+			case TAP_PARSE_BODY:
+				chunkLen = pParser->remainingLength - pParser->offset;
+				if(chunkLen > len) {
+					chunkLen = len;
+				}
+
+				_aws_iot_mqtt_tap_notify_packet(pTap, direction, IOT_TAP_EVENT_PACKET_DATA, pBuf, chunkLen);
+
+				if(AWS_IOT_MQTT_TAP_PREFIX_LEN > pParser->prefixLen) {
+					copyLen = AWS_IOT_MQTT_TAP_PREFIX_LEN - pParser->prefixLen;
+					if(copyLen > chunkLen) {
+						copyLen = chunkLen;
+					}
+					memcpy(&(pParser->prefix[pParser->prefixLen]), pBuf, copyLen);
+					pParser->prefixLen += copyLen;
+				}
+
+				pParser->offset += chunkLen;
+				pBuf += chunkLen;
+				len -= chunkLen;
+
+				if(pParser->offset == pParser->remainingLength) {
+					_aws_iot_mqtt_tap_notify_packet(pTap, direction, IOT_TAP_EVENT_PACKET_END,
+													pParser->prefix, pParser->prefixLen);
+					pParser->state = TAP_PARSE_HEADER;
+				}
+				break;
+
+			default:
+				pParser->state = TAP_PARSE_HEADER;
+				break;
+		}
+	}
+}
+
+static IoT_Error_t _aws_iot_mqtt_tap_read(Network *pNetwork, unsigned char *pMsg, size_t len, Timer *pTimer,
+										  size_t *pReadLen) {
+	_IoT_Tap_t *pTap = _aws_iot_mqtt_tap_find_by_network(pNetwork);
+	IoT_Error_t rc;
+
+	if(NULL == pTap) {
+		return FAILURE;
+	}
+
+	rc = pTap->read(pNetwork, pMsg, len, pTimer, pReadLen);
+	if(SUCCESS == rc) {
+		_aws_iot_mqtt_tap_feed(pTap, IOT_TAP_INBOUND, pMsg, *pReadLen);
+	} else if(NETWORK_SSL_NOTHING_TO_READ != rc) {
+		/* bytes of a partial read are lost, the stream has to restart at a packet boundary */
+		pTap->parsers[IOT_TAP_INBOUND].state = TAP_PARSE_HEADER;
+	}
+
+	return rc;
+}
+
+static IoT_Error_t _aws_iot_mqtt_tap_write(Network *pNetwork, unsigned char *pMsg, size_t len, Timer *pTimer,
+										   size_t *pWrittenLen) {
+	_IoT_Tap_t *pTap = _aws_iot_mqtt_tap_find_by_network(pNetwork);
+	IoT_Error_t rc;
+
+	if(NULL == pTap) {
+		return FAILURE;
+	}
+
+	*pWrittenLen = 0;
+	rc = pTap->write(pNetwork, pMsg, len, pTimer, pWrittenLen);
+	if(0 < *pWrittenLen) {
+		_aws_iot_mqtt_tap_feed(pTap, IOT_TAP_OUTBOUND, pMsg, *pWrittenLen);
+	}
+
+	return rc;
+}
+
+static IoT_Error_t _aws_iot_mqtt_tap_connect(Network *pNetwork, TLSConnectParams *pParams) {
+	_IoT_Tap_t *pTap = _aws_iot_mqtt_tap_find_by_network(pNetwork);
+	IoT_Error_t rc;
+
+	if(NULL == pTap) {
+		return FAILURE;
+	}
+
+	rc = pTap->connect(pNetwork, pParams);
+	if(SUCCESS == rc) {
+		_aws_iot_mqtt_tap_reset_parsers(pTap);
+		_aws_iot_mqtt_tap_notify_link(pTap, IOT_TAP_EVENT_CONNECTED);
+	}
+
+	return rc;
+}
+
+static IoT_Error_t _aws_iot_mqtt_tap_disconnect(Network *pNetwork) {
+	_IoT_Tap_t *pTap = _aws_iot_mqtt_tap_find_by_network(pNetwork);
+
+	if(NULL == pTap) {
+		return FAILURE;
+	}
+
+	_aws_iot_mqtt_tap_reset_parsers(pTap);
+	_aws_iot_mqtt_tap_notify_link(pTap, IOT_TAP_EVENT_DISCONNECTED);
+
+	return pTap->disconnect(pNetwork);
+}
+
+IoT_Error_t aws_iot_mqtt_tap_attach(AWS_IoT_Client *pClient) {
+	_IoT_Tap_t *pTap;
+
+	FUNC_ENTRY;
+
+	if(NULL == pClient) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	pTap = _aws_iot_mqtt_tap_find(pClient);
+	if(NULL != pTap && _aws_iot_mqtt_tap_read == pClient->networkStack.read) {
+		FUNC_EXIT_RC(SUCCESS);
+	}
+
+	if(NULL == pTap) {
+		pTap = _aws_iot_mqtt_tap_find(NULL);
+		if(NULL == pTap) {
+			IOT_ERROR("tap: no free slot, increase AWS_IOT_MQTT_TAP_MAX_CLIENTS");
+			FUNC_EXIT_RC(FAILURE);
+		}
+		memset(pTap, 0, sizeof(_IoT_Tap_t));
+	}
+
+	/* either a new tap, or the client was initialized again and the Network functions were reset */
+	pTap->connect = pClient->networkStack.connect;
+	pTap->read = pClient->networkStack.read;
+	pTap->write = pClient->networkStack.write;
+	pTap->disconnect = pClient->networkStack.disconnect;
+	_aws_iot_mqtt_tap_reset_parsers(pTap);
+	pTap->pClient = pClient;
+
+	pClient->networkStack.connect = _aws_iot_mqtt_tap_connect;
+	pClient->networkStack.read = _aws_iot_mqtt_tap_read;
+	pClient->networkStack.write = _aws_iot_mqtt_tap_write;
+	pClient->networkStack.disconnect = _aws_iot_mqtt_tap_disconnect;
+
+	FUNC_EXIT_RC(SUCCESS);
+}
+
+IoT_Error_t aws_iot_mqtt_tap_detach(AWS_IoT_Client *pClient) {
+	_IoT_Tap_t *pTap;
+
+	FUNC_ENTRY;
+
+	if(NULL == pClient) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	pTap = _aws_iot_mqtt_tap_find(pClient);
+	if(NULL == pTap) {
+		FUNC_EXIT_RC(SUCCESS);
+	}
+
+	if(_aws_iot_mqtt_tap_read == pClient->networkStack.read) {
+		pClient->networkStack.connect = pTap->connect;
+		pClient->networkStack.read = pTap->read;
+		pClient->networkStack.write = pTap->write;
+		pClient->networkStack.disconnect = pTap->disconnect;
+	}
+	memset(pTap, 0, sizeof(_IoT_Tap_t));
+
+	FUNC_EXIT_RC(SUCCESS);
+}
+
+IoT_Error_t aws_iot_mqtt_tap_add_observer(AWS_IoT_Client *pClient, IoT_Tap_Observer_t *pObserver) {
+	_IoT_Tap_t *pTap;
+	IoT_Tap_Observer_t *pCur;
+	IoT_Error_t rc;
+
+	FUNC_ENTRY;
+
+	if(NULL == pClient || NULL == pObserver || NULL == pObserver->handler) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	rc = aws_iot_mqtt_tap_attach(pClient);
+	if(SUCCESS != rc) {
+		FUNC_EXIT_RC(rc);
+	}
+
+	pTap = _aws_iot_mqtt_tap_find(pClient);
+	for(pCur = pTap->pObservers; NULL != pCur; pCur = pCur->pNext) {
+		if(pCur == pObserver) {
+			FUNC_EXIT_RC(SUCCESS);
+		}
+	}
+
+	pObserver->pNext = pTap->pObservers;
+	pTap->pObservers = pObserver;
+
+	FUNC_EXIT_RC(SUCCESS);
+}
+
+IoT_Error_t aws_iot_mqtt_tap_remove_observer(AWS_IoT_Client *pClient, IoT_Tap_Observer_t *pObserver) {
+	_IoT_Tap_t *pTap;
+	IoT_Tap_Observer_t **ppCur;
+
+	FUNC_ENTRY;
+
+	if(NULL == pClient || NULL == pObserver) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	pTap = _aws_iot_mqtt_tap_find(pClient);
+	if(NULL == pTap) {
+		FUNC_EXIT_RC(SUCCESS);
+	}
+
+	for(ppCur = &(pTap->pObservers); NULL != *ppCur; ppCur = &((*ppCur)->pNext)) {
+		if(*ppCur == pObserver) {
+			*ppCur = pObserver->pNext;
+			pObserver->pNext = NULL;
+			break;
+		}
+	}
+
+	FUNC_EXIT_RC(SUCCESS);
+}
+
+IoT_Error_t aws_iot_mqtt_tap_writev(AWS_IoT_Client *pClient, const unsigned char *const *ppBufs, const size_t *pLens,
+									uint8_t count, uint32_t timeout_ms) {
+	IoT_Error_t rc = SUCCESS;
+	Timer timer;
+	size_t sentLen;
+	size_t writtenLen;
+	uint8_t i;
+
+	FUNC_ENTRY;
+
+	if(NULL == pClient || NULL == ppBufs || NULL == pLens) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	init_timer(&timer);
+	countdown_ms(&timer, timeout_ms);
+
+#ifdef _ENABLE_THREAD_SUPPORT_
+	rc = aws_iot_mqtt_client_lock_mutex(pClient, &(pClient->clientData.tls_write_mutex));
+	if(SUCCESS != rc) {
+		FUNC_EXIT_RC(rc);
+	}
+#endif
+
+	for(i = 0; i < count && SUCCESS == rc; i++) {
+		sentLen = 0;
+		while(sentLen < pLens[i] && !has_timer_expired(&timer)) {
+			writtenLen = 0;
+			rc = pClient->networkStack.write(&(pClient->networkStack), (unsigned char *) &(ppBufs[i][sentLen]),
+											 pLens[i] - sentLen, &timer, &writtenLen);
+			if(SUCCESS != rc) {
+				break;
+			}
+			sentLen += writtenLen;
+		}
+		if(SUCCESS == rc && sentLen != pLens[i]) {
+			rc = MQTT_REQUEST_TIMEOUT_ERROR;
+		}
+	}
+
+#ifdef _ENABLE_THREAD_SUPPORT_
+	(void) aws_iot_mqtt_client_unlock_mutex(pClient, &(pClient->clientData.tls_write_mutex));
+#endif
+
+	FUNC_EXIT_RC(rc);
+}
+
+IoT_Error_t aws_iot_mqtt_tap_write(AWS_IoT_Client *pClient, const unsigned char *pBuf, size_t len, uint32_t timeout_ms) {
+	return aws_iot_mqtt_tap_writev(pClient, &pBuf, &len, 1, timeout_ms);
+}
+
+#ifdef __cplusplus
+}
+#endif
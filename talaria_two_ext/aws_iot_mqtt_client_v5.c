@@ -0,0 +1,1120 @@
+/**
+  *****************************************************************************
+  * @file   aws_iot_mqtt_client_v5.c
+  *
+  *****************************************************************************
+  * @attention
+  *
+  *
+  *  Copyright (c) 2022, InnoPhase, Inc.
+  *
+  *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  *  POSSIBILITY OF SUCH DAMAGE.
+  *
+  *****************************************************************************
+  */
+
+/**
+ * @file aws_iot_mqtt_client_v5.c
+ * @brief MQTT 5 translation on the network layer of a client
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <string.h>
+
+#include "aws_iot_log.h"
+#include "aws_iot_mqtt_client_common_internal.h"
+#include "aws_iot_mqtt_client_tap.h"
+#include "aws_iot_mqtt_client_v5.h"
+#include "timer_interface.h"
+
+#define MQTT5_PROTOCOL_LEVEL 5
+#define MQTT5_AUTH           15
+
+#define MQTT5_CONNECT_CLEAN_SESSION_FLAG 0x02
+#define MQTT5_CONNECT_WILL_FLAG          0x04
+
+#define MQTT5_PUBLISH_QOS(header) (((header) >> 1) & 0x03)
+
+#define MQTT5_PROP_SESSION_EXPIRY_INTERVAL 0x11
+#define MQTT5_PROP_RECEIVE_MAXIMUM         0x21
+#define MQTT5_PROP_TOPIC_ALIAS_MAXIMUM     0x22
+#define MQTT5_PROP_TOPIC_ALIAS             0x23
+
+/* CONNACK return codes of MQTT 3.1.1 */
+#define MQTT311_CONNACK_UNACCEPTABLE_PROTOCOL 1
+#define MQTT311_CONNACK_IDENTIFIER_REJECTED   2
+#define MQTT311_CONNACK_SERVER_UNAVAILABLE    3
+#define MQTT311_CONNACK_BAD_USERDATA          4
+#define MQTT311_CONNACK_NOT_AUTHORIZED        5
+
+#define MQTT311_SUBACK_FAILURE 0x80
+
+typedef enum {
+	MQTT5_STREAM_HEADER,
+	MQTT5_STREAM_LENGTH,
+	MQTT5_STREAM_COLLECT,
+	MQTT5_STREAM_PASS,
+} _IoT_Mqtt5_Stream_State_t;
+
+const IoT_Mqtt5_Params_t iotMqtt5ParamsDefault = {AWS_IOT_MQTT5_SESSION_EXPIRY_S, AWS_IOT_MQTT5_RECEIVE_MAXIMUM,
+												  AWS_IOT_MQTT5_MAX_TOPIC_ALIASES, NULL, NULL};
+
+static AWS_IoT_Mqtt5_t *adapters[AWS_IOT_MQTT5_MAX_CLIENTS];
+
+static void _aws_iot_mqtt_v5_lock(AWS_IoT_Mqtt5_t *pMqtt5) {
+#ifdef _ENABLE_THREAD_SUPPORT_
+	(void) aws_iot_thread_mutex_lock(&(pMqtt5->lock));
+#else
+	IOT_UNUSED(pMqtt5);
+#endif
+}
+
+static void _aws_iot_mqtt_v5_unlock(AWS_IoT_Mqtt5_t *pMqtt5) {
+#ifdef _ENABLE_THREAD_SUPPORT_
+	(void) aws_iot_thread_mutex_unlock(&(pMqtt5->lock));
+#else
+	IOT_UNUSED(pMqtt5);
+#endif
+}
+
+static AWS_IoT_Mqtt5_t *_aws_iot_mqtt_v5_find_by_network(Network *pNetwork) {
+	uint8_t i;
+
+	for(i = 0; i < AWS_IOT_MQTT5_MAX_CLIENTS; i++) {
+		if(NULL != adapters[i] && &(adapters[i]->pClient->networkStack) == pNetwork) {
+			return adapters[i];
+		}
+	}
+	return NULL;
+}
+
+static size_t _aws_iot_mqtt_v5_encode_length(unsigned char *pBuf, uint32_t length) {
+	size_t len = 0;
+	unsigned char byte;
+
+	do {
+		byte = (unsigned char) (length % 128);
+		length /= 128;
+		if(0 < length) {
+			byte |= 128;
+		}
+		pBuf[len++] = byte;
+	} while(0 < length);
+
+	return len;
+}
+
+/* Returns the bytes used by the variable byte integer, 0 if it is malformed or truncated */
+static size_t _aws_iot_mqtt_v5_decode_length(const unsigned char *pBuf, size_t bufLen, uint32_t *pLength) {
+	uint32_t multiplier = 1;
+	size_t len = 0;
+
+	*pLength = 0;
+	do {
+		if(len == bufLen || 4 == len) {
+			return 0;
+		}
+		*pLength += (uint32_t) (pBuf[len] & 127) * multiplier;
+		multiplier *= 128;
+	} while(0 != (pBuf[len++] & 128));
+
+	return len;
+}
+
+/* Returns the length of the property at pBuf, identifier included, 0 if it is unknown or truncated */
+static size_t _aws_iot_mqtt_v5_property_len(const unsigned char *pBuf, size_t bufLen) {
+	uint32_t value;
+	size_t len;
+
+	if(0 == bufLen) {
+		return 0;
+	}
+
+	switch(pBuf[0]) {
+		case 0x01: case 0x17: case 0x19: case 0x24: case 0x25: case 0x28: case 0x29: case 0x2A:
+			len = 2;
+			break;
+		case 0x13: case 0x21: case 0x22: case 0x23:
+			len = 3;
+			break;
+		case 0x02: case 0x11: case 0x18: case 0x27:
+			len = 5;
+			break;
+		case 0x0B:
+			len = _aws_iot_mqtt_v5_decode_length(&pBuf[1], bufLen - 1, &value);
+			len = (0 == len) ? 0 : len + 1;
+			break;
+		case 0x03: case 0x08: case 0x09: case 0x12: case 0x15: case 0x16: case 0x1A: case 0x1C: case 0x1F:
+			if(3 > bufLen) {
+				return 0;
+			}
+			len = 3 + (size_t) ((pBuf[1] << 8) | pBuf[2]);
+			break;
+		case 0x26:
+			/* user property, a pair of strings */
+			if(3 > bufLen) {
+				return 0;
+			}
+			len = 3 + (size_t) ((pBuf[1] << 8) | pBuf[2]);
+			if(len + 2 > bufLen) {
+				return 0;
+			}
+			len += 2 + (size_t) ((pBuf[len] << 8) | pBuf[len + 1]);
+			break;
+		default:
+			return 0;
+	}
+
+	return (len > bufLen) ? 0 : len;
+}
+
+static void _aws_iot_mqtt_v5_report(AWS_IoT_Mqtt5_t *pMqtt5, uint8_t packetType, uint16_t packetId,
+									uint8_t reasonCode) {
+	_aws_iot_mqtt_v5_lock(pMqtt5);
+	if(IOT_TAP_DISCONNECT == packetType) {
+		pMqtt5->stats.serverDisconnects++;
+	} else {
+		pMqtt5->stats.reasonErrors++;
+	}
+	pMqtt5->stats.lastReasonCode = reasonCode;
+	_aws_iot_mqtt_v5_unlock(pMqtt5);
+
+	IOT_WARN("mqtt5: reason code 0x%02X in packet type %u, packet id %u", reasonCode, packetType, packetId);
+	if(NULL != pMqtt5->params.reasonHandler) {
+		pMqtt5->params.reasonHandler(pMqtt5->pClient, packetType, packetId, reasonCode,
+									 pMqtt5->params.pReasonHandlerData);
+	}
+}
+
+static uint8_t _aws_iot_mqtt_v5_in_flight(const AWS_IoT_Mqtt5_t *pMqtt5) {
+	uint8_t count = 0;
+	uint8_t i;
+
+	for(i = 0; i < AWS_IOT_MQTT5_MAX_IN_FLIGHT; i++) {
+		if(0 != pMqtt5->inFlight[i]) {
+			count++;
+		}
+	}
+	return count;
+}
+
+static void _aws_iot_mqtt_v5_in_flight_add(AWS_IoT_Mqtt5_t *pMqtt5, uint16_t packetId) {
+	uint8_t freeSlot = AWS_IOT_MQTT5_MAX_IN_FLIGHT;
+	uint8_t i;
+
+	_aws_iot_mqtt_v5_lock(pMqtt5);
+	for(i = 0; i < AWS_IOT_MQTT5_MAX_IN_FLIGHT; i++) {
+		if(packetId == pMqtt5->inFlight[i]) {
+			/* retransmission, already counted */
+			_aws_iot_mqtt_v5_unlock(pMqtt5);
+			return;
+		}
+		if(0 == pMqtt5->inFlight[i] && AWS_IOT_MQTT5_MAX_IN_FLIGHT == freeSlot) {
+			freeSlot = i;
+		}
+	}
+
+	if(_aws_iot_mqtt_v5_in_flight(pMqtt5) >= pMqtt5->serverReceiveMaximum) {
+		pMqtt5->stats.quotaExceeded++;
+		IOT_WARN("mqtt5: QoS1 publish beyond the receive maximum %u of the broker", pMqtt5->serverReceiveMaximum);
+	}
+	if(AWS_IOT_MQTT5_MAX_IN_FLIGHT != freeSlot) {
+		pMqtt5->inFlight[freeSlot] = packetId;
+	}
+	_aws_iot_mqtt_v5_unlock(pMqtt5);
+}
+
+static void _aws_iot_mqtt_v5_in_flight_remove(AWS_IoT_Mqtt5_t *pMqtt5, uint16_t packetId) {
+	uint8_t i;
+
+	_aws_iot_mqtt_v5_lock(pMqtt5);
+	for(i = 0; i < AWS_IOT_MQTT5_MAX_IN_FLIGHT; i++) {
+		if(packetId == pMqtt5->inFlight[i]) {
+			pMqtt5->inFlight[i] = 0;
+			break;
+		}
+	}
+	_aws_iot_mqtt_v5_unlock(pMqtt5);
+}
+
+/* Returns the alias of the topic, 0 for none. *pIsKnown is set if the broker already has the alias. */
+static uint16_t _aws_iot_mqtt_v5_alias(AWS_IoT_Mqtt5_t *pMqtt5, const unsigned char *pTopic, uint16_t topicLen,
+									   bool *pIsKnown) {
+	IoT_Mqtt5_Alias_t *pAlias;
+	uint16_t limit = pMqtt5->params.maxTopicAliases;
+	uint16_t victim = 0;
+	uint16_t i;
+
+	*pIsKnown = false;
+	if(limit > pMqtt5->serverTopicAliasMaximum) {
+		limit = pMqtt5->serverTopicAliasMaximum;
+	}
+	if(0 == limit || 0 == topicLen || AWS_IOT_MQTT5_MAX_ALIAS_TOPIC_LEN < topicLen) {
+		return 0;
+	}
+
+	pMqtt5->aliasClock++;
+	for(i = 0; i < limit; i++) {
+		pAlias = &(pMqtt5->aliases[i]);
+		if(topicLen == pAlias->topicLen && 0 == memcmp(pAlias->topic, pTopic, topicLen)) {
+			pAlias->lastUsed = pMqtt5->aliasClock;
+			*pIsKnown = true;
+			return (uint16_t) (i + 1);
+		}
+		if(0 != pMqtt5->aliases[victim].topicLen &&
+		   (0 == pAlias->topicLen || pAlias->lastUsed < pMqtt5->aliases[victim].lastUsed)) {
+			victim = i;
+		}
+	}
+
+	/* the PUBLISH carrying the topic redefines the alias at the broker */
+	pAlias = &(pMqtt5->aliases[victim]);
+	memcpy(pAlias->topic, pTopic, topicLen);
+	pAlias->topicLen = topicLen;
+	pAlias->lastUsed = pMqtt5->aliasClock;
+	return (uint16_t) (victim + 1);
+}
+
+static void _aws_iot_mqtt_v5_reset(AWS_IoT_Mqtt5_t *pMqtt5) {
+	pMqtt5->in.state = MQTT5_STREAM_HEADER;
+	pMqtt5->in.passLen = 0;
+	pMqtt5->in.xlatLen = 0;
+	pMqtt5->in.xlatPos = 0;
+	pMqtt5->out.state = MQTT5_STREAM_HEADER;
+	pMqtt5->out.passLen = 0;
+	pMqtt5->out.xlatLen = 0;
+	pMqtt5->out.xlatPos = 0;
+
+	/* aliases and the receive maximum only last for one connection */
+	memset(pMqtt5->aliases, 0, sizeof(pMqtt5->aliases));
+	pMqtt5->aliasClock = 0;
+	pMqtt5->serverTopicAliasMaximum = 0;
+	_aws_iot_mqtt_v5_lock(pMqtt5);
+	memset(pMqtt5->inFlight, 0, sizeof(pMqtt5->inFlight));
+	pMqtt5->serverReceiveMaximum = 65535;
+	_aws_iot_mqtt_v5_unlock(pMqtt5);
+}
+
+static void _aws_iot_mqtt_v5_xlat_header(IoT_Mqtt5_Stream_t *pStream, uint8_t header, uint32_t remainingLength) {
+	pStream->xlat[0] = header;
+	pStream->xlatLen = 1 + _aws_iot_mqtt_v5_encode_length(&(pStream->xlat[1]), remainingLength);
+	pStream->xlatPos = 0;
+}
+
+static void _aws_iot_mqtt_v5_xlat_append(IoT_Mqtt5_Stream_t *pStream, const unsigned char *pBuf, size_t len) {
+	memcpy(&(pStream->xlat[pStream->xlatLen]), pBuf, len);
+	pStream->xlatLen += len;
+}
+
+/*
+ * Outbound: the packets written by the client are parsed as they come, in
+ * any split, and the headers that change are collected in out.buf. Once
+ * translated they are written to the lower layer, followed by the rest of
+ * the packet unchanged.
+ */
+
+static IoT_Error_t _aws_iot_mqtt_v5_write_all(AWS_IoT_Mqtt5_t *pMqtt5, Network *pNetwork, const unsigned char *pBuf,
+											  size_t len, Timer *pTimer) {
+	IoT_Error_t rc;
+	size_t written;
+	size_t sent = 0;
+
+	while(sent < len) {
+		written = 0;
+		rc = pMqtt5->write(pNetwork, (unsigned char *) &pBuf[sent], len - sent, pTimer, &written);
+		if(SUCCESS != rc) {
+			return rc;
+		}
+		sent += written;
+		if(sent < len && has_timer_expired(pTimer)) {
+			return NETWORK_SSL_WRITE_TIMEOUT_ERROR;
+		}
+	}
+
+	return SUCCESS;
+}
+
+static IoT_Error_t _aws_iot_mqtt_v5_translate_connect(AWS_IoT_Mqtt5_t *pMqtt5) {
+	IoT_Mqtt5_Stream_t *pStream = &(pMqtt5->out);
+	const unsigned char *pBody = pStream->buf;
+	unsigned char props[8];
+	unsigned char propsLenBuf[4];
+	size_t propsLen = 0;
+	size_t propsLenBytes;
+	size_t willOffset;
+	uint8_t flags;
+	uint8_t level = MQTT5_PROTOCOL_LEVEL;
+
+	/* protocol name "MQTT", level, flags, keep alive, then the client id */
+	if(12 > pStream->bufLen || 4 != ((pBody[0] << 8) | pBody[1])) {
+		IOT_ERROR("mqtt5: malformed CONNECT");
+		return FAILURE;
+	}
+	willOffset = 12 + (size_t) ((pBody[10] << 8) | pBody[11]);
+	if(willOffset > pStream->bufLen) {
+		IOT_ERROR("mqtt5: malformed CONNECT");
+		return FAILURE;
+	}
+
+	flags = pBody[7];
+	if(0 == (flags & MQTT5_CONNECT_CLEAN_SESSION_FLAG) && 0 < pMqtt5->params.sessionExpiryInterval_s) {
+		props[propsLen++] = MQTT5_PROP_SESSION_EXPIRY_INTERVAL;
+		props[propsLen++] = (unsigned char) (pMqtt5->params.sessionExpiryInterval_s >> 24);
+		props[propsLen++] = (unsigned char) (pMqtt5->params.sessionExpiryInterval_s >> 16);
+		props[propsLen++] = (unsigned char) (pMqtt5->params.sessionExpiryInterval_s >> 8);
+		props[propsLen++] = (unsigned char) pMqtt5->params.sessionExpiryInterval_s;
+	}
+	if(0 < pMqtt5->params.receiveMaximum) {
+		props[propsLen++] = MQTT5_PROP_RECEIVE_MAXIMUM;
+		props[propsLen++] = (unsigned char) (pMqtt5->params.receiveMaximum >> 8);
+		props[propsLen++] = (unsigned char) pMqtt5->params.receiveMaximum;
+	}
+	propsLenBytes = _aws_iot_mqtt_v5_encode_length(propsLenBuf, (uint32_t) propsLen);
+
+	_aws_iot_mqtt_v5_xlat_header(pStream, pStream->header,
+								 (uint32_t) (pStream->bufLen + propsLenBytes + propsLen +
+											 ((0 != (flags & MQTT5_CONNECT_WILL_FLAG)) ? 1 : 0)));
+	_aws_iot_mqtt_v5_xlat_append(pStream, pBody, 6);
+	_aws_iot_mqtt_v5_xlat_append(pStream, &level, 1);
+	_aws_iot_mqtt_v5_xlat_append(pStream, &pBody[7], 3);
+	_aws_iot_mqtt_v5_xlat_append(pStream, propsLenBuf, propsLenBytes);
+	_aws_iot_mqtt_v5_xlat_append(pStream, props, propsLen);
+	_aws_iot_mqtt_v5_xlat_append(pStream, &pBody[10], willOffset - 10);
+	if(0 != (flags & MQTT5_CONNECT_WILL_FLAG)) {
+		/* empty will properties */
+		pStream->xlat[pStream->xlatLen++] = 0;
+	}
+	_aws_iot_mqtt_v5_xlat_append(pStream, &pBody[willOffset], pStream->bufLen - willOffset);
+
+	return SUCCESS;
+}
+
+static IoT_Error_t _aws_iot_mqtt_v5_translate_publish(AWS_IoT_Mqtt5_t *pMqtt5) {
+	IoT_Mqtt5_Stream_t *pStream = &(pMqtt5->out);
+	const unsigned char *pBody = pStream->buf;
+	uint8_t qos = MQTT5_PUBLISH_QOS(pStream->header);
+	uint16_t topicLen = (uint16_t) ((pBody[0] << 8) | pBody[1]);
+	uint16_t sentTopicLen;
+	uint16_t alias;
+	unsigned char props[4];
+	size_t propsLen = 0;
+	size_t headLen = 2 + (size_t) topicLen + ((QOS0 == qos) ? 0 : 2);
+	bool isKnown;
+
+	if(headLen > pStream->bufLen) {
+		/* the topic length is in, now collect the topic and the packet id */
+		if(headLen > AWS_IOT_MQTT5_HEADER_BUF_LEN || headLen > pStream->remainingLength) {
+			IOT_ERROR("mqtt5: PUBLISH topic of %u bytes does not fit AWS_IOT_MQTT5_HEADER_BUF_LEN", topicLen);
+			return FAILURE;
+		}
+		pStream->need = (uint32_t) headLen;
+		return SUCCESS;
+	}
+
+	alias = _aws_iot_mqtt_v5_alias(pMqtt5, &pBody[2], topicLen, &isKnown);
+	sentTopicLen = isKnown ? 0 : topicLen;
+	if(0 != alias) {
+		props[propsLen++] = MQTT5_PROP_TOPIC_ALIAS;
+		props[propsLen++] = (unsigned char) (alias >> 8);
+		props[propsLen++] = (unsigned char) alias;
+	}
+
+	_aws_iot_mqtt_v5_xlat_header(pStream, pStream->header,
+								 pStream->remainingLength - topicLen + sentTopicLen + 1 + (uint32_t) propsLen);
+	pStream->xlat[pStream->xlatLen++] = (unsigned char) (sentTopicLen >> 8);
+	pStream->xlat[pStream->xlatLen++] = (unsigned char) sentTopicLen;
+	_aws_iot_mqtt_v5_xlat_append(pStream, &pBody[2], sentTopicLen);
+	_aws_iot_mqtt_v5_xlat_append(pStream, &pBody[2 + topicLen], headLen - 2 - topicLen);
+	pStream->xlat[pStream->xlatLen++] = (unsigned char) propsLen;
+	_aws_iot_mqtt_v5_xlat_append(pStream, props, propsLen);
+
+	if(QOS0 != qos) {
+		_aws_iot_mqtt_v5_in_flight_add(pMqtt5, (uint16_t) ((pBody[headLen - 2] << 8) | pBody[headLen - 1]));
+	}
+	if(isKnown) {
+		_aws_iot_mqtt_v5_lock(pMqtt5);
+		pMqtt5->stats.aliasedPublishes++;
+		pMqtt5->stats.aliasBytesSaved += topicLen;
+		_aws_iot_mqtt_v5_unlock(pMqtt5);
+	}
+
+	return SUCCESS;
+}
+
+/* Called each time out.buf holds out.need bytes. Leaves xlat empty if more bytes are needed. */
+static IoT_Error_t _aws_iot_mqtt_v5_translate_outbound(AWS_IoT_Mqtt5_t *pMqtt5) {
+	IoT_Mqtt5_Stream_t *pStream = &(pMqtt5->out);
+	IoT_Error_t rc = SUCCESS;
+
+	pStream->xlatLen = 0;
+	switch(IOT_TAP_PACKET_TYPE(pStream->header)) {
+		case IOT_TAP_CONNECT:
+			rc = _aws_iot_mqtt_v5_translate_connect(pMqtt5);
+			break;
+
+		case IOT_TAP_PUBLISH:
+			rc = _aws_iot_mqtt_v5_translate_publish(pMqtt5);
+			break;
+
+		case IOT_TAP_SUBSCRIBE:
+		case IOT_TAP_UNSUBSCRIBE:
+			/* packet id, then empty properties */
+			_aws_iot_mqtt_v5_xlat_header(pStream, pStream->header, pStream->remainingLength + 1);
+			_aws_iot_mqtt_v5_xlat_append(pStream, pStream->buf, 2);
+			pStream->xlat[pStream->xlatLen++] = 0;
+			break;
+
+		default:
+			break;
+	}
+
+	if(0 < pStream->xlatLen) {
+		pStream->passLen = pStream->remainingLength - (uint32_t) pStream->bufLen;
+	}
+	return rc;
+}
+
+static IoT_Error_t _aws_iot_mqtt_v5_flush_outbound(AWS_IoT_Mqtt5_t *pMqtt5, Network *pNetwork, Timer *pTimer) {
+	IoT_Mqtt5_Stream_t *pStream = &(pMqtt5->out);
+	IoT_Error_t rc;
+
+	rc = _aws_iot_mqtt_v5_write_all(pMqtt5, pNetwork, pStream->xlat, pStream->xlatLen, pTimer);
+	pStream->xlatLen = 0;
+	pStream->state = (0 < pStream->passLen) ? MQTT5_STREAM_PASS : MQTT5_STREAM_HEADER;
+	return rc;
+}
+
+static IoT_Error_t _aws_iot_mqtt_v5_begin_outbound(AWS_IoT_Mqtt5_t *pMqtt5, Network *pNetwork, Timer *pTimer) {
+	IoT_Mqtt5_Stream_t *pStream = &(pMqtt5->out);
+
+	pStream->bufLen = 0;
+	switch(IOT_TAP_PACKET_TYPE(pStream->header)) {
+		case IOT_TAP_CONNECT:
+			pStream->need = pStream->remainingLength;
+			break;
+		case IOT_TAP_PUBLISH:
+		case IOT_TAP_SUBSCRIBE:
+		case IOT_TAP_UNSUBSCRIBE:
+			pStream->need = 2;
+			break;
+		default:
+			pStream->need = 0;
+			break;
+	}
+
+	if(pStream->need > pStream->remainingLength || pStream->need > AWS_IOT_MQTT5_HEADER_BUF_LEN) {
+		IOT_ERROR("mqtt5: cannot translate packet type %u of %u bytes", IOT_TAP_PACKET_TYPE(pStream->header),
+				  (unsigned) pStream->remainingLength);
+		return FAILURE;
+	}
+
+	if(0 < pStream->need) {
+		pStream->state = MQTT5_STREAM_COLLECT;
+		return SUCCESS;
+	}
+
+	/* same in both versions */
+	_aws_iot_mqtt_v5_xlat_header(pStream, pStream->header, pStream->remainingLength);
+	pStream->passLen = pStream->remainingLength;
+	return _aws_iot_mqtt_v5_flush_outbound(pMqtt5, pNetwork, pTimer);
+}
+
+static IoT_Error_t _aws_iot_mqtt_v5_write(Network *pNetwork, unsigned char *pMsg, size_t len, Timer *pTimer,
+										  size_t *pWrittenLen) {
+	AWS_IoT_Mqtt5_t *pMqtt5 = _aws_iot_mqtt_v5_find_by_network(pNetwork);
+	IoT_Mqtt5_Stream_t *pStream;
+	IoT_Error_t rc = SUCCESS;
+	size_t consumed = 0;
+	size_t chunkLen;
+	uint8_t byte;
+
+	if(NULL == pMqtt5) {
+		return FAILURE;
+	}
+	pStream = &(pMqtt5->out);
+
+	while(consumed < len && SUCCESS == rc) {
+		switch(pStream->state) {
+			case MQTT5_STREAM_HEADER:
+				pStream->header = pMsg[consumed++];
+				pStream->remainingLength = 0;
+				pStream->multiplier = 1;
+				pStream->lengthBytes = 0;
+				pStream->state = MQTT5_STREAM_LENGTH;
+				break;
+
+			case MQTT5_STREAM_LENGTH:
+				byte = pMsg[consumed++];
+				pStream->remainingLength += (uint32_t) (byte & 127) * pStream->multiplier;
+				pStream->multiplier *= 128;
+				pStream->lengthBytes++;
+				if(0 == (byte & 128)) {
+					rc = _aws_iot_mqtt_v5_begin_outbound(pMqtt5, pNetwork, pTimer);
+				} else if(4 <= pStream->lengthBytes) {
+					IOT_ERROR("mqtt5: malformed remaining length");
+					rc = FAILURE;
+				}
+				break;
+
+			case MQTT5_STREAM_COLLECT:
+				chunkLen = pStream->need - pStream->bufLen;
+				if(chunkLen > len - consumed) {
+					chunkLen = len - consumed;
+				}
+				memcpy(&(pStream->buf[pStream->bufLen]), &pMsg[consumed], chunkLen);
+				pStream->bufLen += chunkLen;
+				consumed += chunkLen;
+				if(pStream->bufLen == pStream->need) {
+					rc = _aws_iot_mqtt_v5_translate_outbound(pMqtt5);
+					if(SUCCESS == rc && 0 < pStream->xlatLen) {
+						rc = _aws_iot_mqtt_v5_flush_outbound(pMqtt5, pNetwork, pTimer);
+					}
+				}
+				break;
+
+			case MQTT5_STREAM_PASS:
+				chunkLen = pStream->passLen;
+				if(chunkLen > len - consumed) {
+					chunkLen = len - consumed;
+				}
+				rc = _aws_iot_mqtt_v5_write_all(pMqtt5, pNetwork, &pMsg[consumed], chunkLen, pTimer);
+				consumed += chunkLen;
+				pStream->passLen -= (uint32_t) chunkLen;
+				if(0 == pStream->passLen) {
+					pStream->state = MQTT5_STREAM_HEADER;
+				}
+				break;
+
+			default:
+				pStream->state = MQTT5_STREAM_HEADER;
+				break;
+		}
+	}
+
+	if(SUCCESS != rc) {
+		/* the client drops the connection, the stream restarts at the next connect */
+		pStream->state = MQTT5_STREAM_HEADER;
+	}
+	*pWrittenLen = consumed;
+	return rc;
+}
+
+/*
+ * Inbound: at each packet boundary the fixed header and the part of the
+ * packet that changes are read from the lower layer and translated into
+ * in.xlat. The client reads the translation, then the rest of the packet
+ * straight from the lower layer.
+ */
+
+static IoT_Error_t _aws_iot_mqtt_v5_read_all(AWS_IoT_Mqtt5_t *pMqtt5, Network *pNetwork, unsigned char *pBuf,
+											 size_t len, Timer *pTimer) {
+	IoT_Error_t rc;
+	size_t readLen;
+	size_t got = 0;
+
+	while(got < len) {
+		readLen = 0;
+		rc = pMqtt5->read(pNetwork, &pBuf[got], len - got, pTimer, &readLen);
+		if(SUCCESS == rc) {
+			got += readLen;
+		} else if(NETWORK_SSL_NOTHING_TO_READ != rc) {
+			return rc;
+		}
+		if(got < len && has_timer_expired(pTimer)) {
+			return NETWORK_SSL_READ_TIMEOUT_ERROR;
+		}
+	}
+
+	return SUCCESS;
+}
+
+static IoT_Error_t _aws_iot_mqtt_v5_discard(AWS_IoT_Mqtt5_t *pMqtt5, Network *pNetwork, size_t len, Timer *pTimer) {
+	IoT_Mqtt5_Stream_t *pStream = &(pMqtt5->in);
+	IoT_Error_t rc = SUCCESS;
+	size_t chunkLen;
+
+	while(0 < len && SUCCESS == rc) {
+		chunkLen = (len > sizeof(pStream->xlat)) ? sizeof(pStream->xlat) : len;
+		rc = _aws_iot_mqtt_v5_read_all(pMqtt5, pNetwork, pStream->xlat, chunkLen, pTimer);
+		len -= chunkLen;
+	}
+	return rc;
+}
+
+/* Position of the first byte after the properties starting at offset, 0 if they are malformed */
+static size_t _aws_iot_mqtt_v5_skip_properties(const unsigned char *pBody, size_t bodyLen, size_t offset,
+											   const unsigned char **ppProps, size_t *pPropsLen) {
+	uint32_t propsLen;
+	size_t propsLenBytes;
+
+	if(offset >= bodyLen) {
+		/* properties are omitted when there is nothing after the reason code */
+		*ppProps = NULL;
+		*pPropsLen = 0;
+		return bodyLen;
+	}
+
+	propsLenBytes = _aws_iot_mqtt_v5_decode_length(&pBody[offset], bodyLen - offset, &propsLen);
+	if(0 == propsLenBytes || offset + propsLenBytes + propsLen > bodyLen) {
+		return 0;
+	}
+	*ppProps = &pBody[offset + propsLenBytes];
+	*pPropsLen = propsLen;
+	return offset + propsLenBytes + propsLen;
+}
+
+static IoT_Error_t _aws_iot_mqtt_v5_translate_connack(AWS_IoT_Mqtt5_t *pMqtt5) {
+	IoT_Mqtt5_Stream_t *pStream = &(pMqtt5->in);
+	const unsigned char *pProps;
+	size_t propsLen;
+	size_t propLen;
+	uint8_t returnCode;
+
+	if(2 > pStream->bufLen ||
+	   0 == _aws_iot_mqtt_v5_skip_properties(pStream->buf, pStream->bufLen, 2, &pProps, &propsLen)) {
+		IOT_ERROR("mqtt5: malformed CONNACK");
+		return FAILURE;
+	}
+
+	for(; 0 < propsLen; pProps += propLen, propsLen -= propLen) {
+		propLen = _aws_iot_mqtt_v5_property_len(pProps, propsLen);
+		if(0 == propLen) {
+			IOT_ERROR("mqtt5: malformed CONNACK properties");
+			return FAILURE;
+		}
+		if(MQTT5_PROP_RECEIVE_MAXIMUM == pProps[0]) {
+			_aws_iot_mqtt_v5_lock(pMqtt5);
+			pMqtt5->serverReceiveMaximum = (uint16_t) ((pProps[1] << 8) | pProps[2]);
+			_aws_iot_mqtt_v5_unlock(pMqtt5);
+		} else if(MQTT5_PROP_TOPIC_ALIAS_MAXIMUM == pProps[0]) {
+			pMqtt5->serverTopicAliasMaximum = (uint16_t) ((pProps[1] << 8) | pProps[2]);
+		}
+	}
+
+	switch(pStream->buf[1]) {
+		case IOT_MQTT5_RC_SUCCESS:
+			returnCode = 0;
+			break;
+		case IOT_MQTT5_RC_UNSUPPORTED_VERSION:
+			returnCode = MQTT311_CONNACK_UNACCEPTABLE_PROTOCOL;
+			break;
+		case IOT_MQTT5_RC_CLIENT_ID_NOT_VALID:
+			returnCode = MQTT311_CONNACK_IDENTIFIER_REJECTED;
+			break;
+		case IOT_MQTT5_RC_BAD_USER_NAME_OR_PASSWORD:
+			returnCode = MQTT311_CONNACK_BAD_USERDATA;
+			break;
+		case IOT_MQTT5_RC_NOT_AUTHORIZED:
+		case IOT_MQTT5_RC_BANNED:
+			returnCode = MQTT311_CONNACK_NOT_AUTHORIZED;
+			break;
+		default:
+			returnCode = MQTT311_CONNACK_SERVER_UNAVAILABLE;
+			break;
+	}
+	if(0 != returnCode) {
+		_aws_iot_mqtt_v5_report(pMqtt5, IOT_TAP_CONNACK, 0, pStream->buf[1]);
+	}
+
+	_aws_iot_mqtt_v5_xlat_header(pStream, pStream->header, 2);
+	pStream->xlat[pStream->xlatLen++] = pStream->buf[0];
+	pStream->xlat[pStream->xlatLen++] = returnCode;
+	return SUCCESS;
+}
+
+static IoT_Error_t _aws_iot_mqtt_v5_translate_ack(AWS_IoT_Mqtt5_t *pMqtt5) {
+	IoT_Mqtt5_Stream_t *pStream = &(pMqtt5->in);
+	uint8_t type = IOT_TAP_PACKET_TYPE(pStream->header);
+	const unsigned char *pProps;
+	size_t propsLen;
+	size_t codes;
+	uint16_t packetId;
+	uint8_t reasonCode;
+
+	if(2 > pStream->bufLen) {
+		IOT_ERROR("mqtt5: malformed ack of type %u", type);
+		return FAILURE;
+	}
+	packetId = (uint16_t) ((pStream->buf[0] << 8) | pStream->buf[1]);
+
+	if(IOT_TAP_PUBACK == type) {
+		_aws_iot_mqtt_v5_in_flight_remove(pMqtt5, packetId);
+		reasonCode = (2 < pStream->bufLen) ? pStream->buf[2] : IOT_MQTT5_RC_SUCCESS;
+		if(IOT_MQTT5_RC_UNSPECIFIED_ERROR <= reasonCode) {
+			/* MQTT 3.1.1 has no failed PUBACK, the message is acked for the client */
+			_aws_iot_mqtt_v5_report(pMqtt5, type, packetId, reasonCode);
+		}
+		_aws_iot_mqtt_v5_xlat_header(pStream, pStream->header, 2);
+		_aws_iot_mqtt_v5_xlat_append(pStream, pStream->buf, 2);
+		return SUCCESS;
+	}
+
+	/* SUBACK and UNSUBACK: packet id, properties, one reason code per filter */
+	codes = _aws_iot_mqtt_v5_skip_properties(pStream->buf, pStream->bufLen, 2, &pProps, &propsLen);
+	if(0 == codes) {
+		IOT_ERROR("mqtt5: malformed ack of type %u", type);
+		return FAILURE;
+	}
+
+	_aws_iot_mqtt_v5_xlat_header(pStream, pStream->header,
+								 (IOT_TAP_SUBACK == type) ? (uint32_t) (2 + pStream->bufLen - codes) : 2);
+	_aws_iot_mqtt_v5_xlat_append(pStream, pStream->buf, 2);
+	for(; codes < pStream->bufLen; codes++) {
+		reasonCode = pStream->buf[codes];
+		if(IOT_MQTT5_RC_UNSPECIFIED_ERROR <= reasonCode) {
+			_aws_iot_mqtt_v5_report(pMqtt5, type, packetId, reasonCode);
+			reasonCode = MQTT311_SUBACK_FAILURE;
+		}
+		if(IOT_TAP_SUBACK == type) {
+			pStream->xlat[pStream->xlatLen++] = reasonCode;
+		}
+	}
+
+	return SUCCESS;
+}
+
+static IoT_Error_t _aws_iot_mqtt_v5_translate_inbound_publish(AWS_IoT_Mqtt5_t *pMqtt5, Network *pNetwork,
+															  Timer *pTimer) {
+	IoT_Mqtt5_Stream_t *pStream = &(pMqtt5->in);
+	IoT_Error_t rc;
+	uint32_t propsLen = 0;
+	uint32_t multiplier = 1;
+	size_t propsLenBytes = 0;
+	size_t headLen;
+	unsigned char byte;
+
+	if(2 > pStream->remainingLength) {
+		IOT_ERROR("mqtt5: malformed PUBLISH");
+		return FAILURE;
+	}
+	rc = _aws_iot_mqtt_v5_read_all(pMqtt5, pNetwork, pStream->buf, 2, pTimer);
+	if(SUCCESS != rc) {
+		return rc;
+	}
+
+	headLen = 2 + (size_t) ((pStream->buf[0] << 8) | pStream->buf[1]) +
+			  ((QOS0 == MQTT5_PUBLISH_QOS(pStream->header)) ? 0 : 2);
+	if(headLen > AWS_IOT_MQTT5_HEADER_BUF_LEN || headLen >= pStream->remainingLength) {
+		IOT_ERROR("mqtt5: PUBLISH topic too long or malformed");
+		return FAILURE;
+	}
+	rc = _aws_iot_mqtt_v5_read_all(pMqtt5, pNetwork, &(pStream->buf[2]), headLen - 2, pTimer);
+
+	do {
+		if(SUCCESS != rc) {
+			return rc;
+		}
+		if(4 == propsLenBytes) {
+			IOT_ERROR("mqtt5: malformed PUBLISH properties");
+			return FAILURE;
+		}
+		rc = _aws_iot_mqtt_v5_read_all(pMqtt5, pNetwork, &byte, 1, pTimer);
+		propsLen += (uint32_t) (byte & 127) * multiplier;
+		multiplier *= 128;
+		propsLenBytes++;
+	} while(0 != (byte & 128));
+	if(SUCCESS != rc) {
+		return rc;
+	}
+
+	if(headLen + propsLenBytes + propsLen > pStream->remainingLength) {
+		IOT_ERROR("mqtt5: malformed PUBLISH properties");
+		return FAILURE;
+	}
+	/* no topic alias maximum is sent in CONNECT, so the broker always sends the topic */
+	rc = _aws_iot_mqtt_v5_discard(pMqtt5, pNetwork, propsLen, pTimer);
+	if(SUCCESS != rc) {
+		return rc;
+	}
+
+	_aws_iot_mqtt_v5_xlat_header(pStream, pStream->header,
+								 pStream->remainingLength - (uint32_t) propsLenBytes - propsLen);
+	_aws_iot_mqtt_v5_xlat_append(pStream, pStream->buf, headLen);
+	pStream->passLen = pStream->remainingLength - (uint32_t) (headLen + propsLenBytes) - propsLen;
+	return SUCCESS;
+}
+
+static IoT_Error_t _aws_iot_mqtt_v5_next_inbound(AWS_IoT_Mqtt5_t *pMqtt5, Network *pNetwork, Timer *pTimer) {
+	IoT_Mqtt5_Stream_t *pStream = &(pMqtt5->in);
+	IoT_Error_t rc;
+	Timer packetTimer;
+	size_t readLen = 0;
+	uint8_t type;
+	unsigned char byte;
+
+	/* the client polls for the first byte, the rest of the packet is waited for */
+	rc = pMqtt5->read(pNetwork, &(pStream->header), 1, pTimer, &readLen);
+	if(SUCCESS != rc) {
+		return rc;
+	}
+	if(0 == readLen) {
+		return NETWORK_SSL_NOTHING_TO_READ;
+	}
+
+	init_timer(&packetTimer);
+	countdown_ms(&packetTimer, pMqtt5->pClient->clientData.packetTimeoutMs);
+
+	pStream->remainingLength = 0;
+	pStream->multiplier = 1;
+	pStream->lengthBytes = 0;
+	do {
+		if(4 == pStream->lengthBytes) {
+			IOT_ERROR("mqtt5: malformed remaining length");
+			return FAILURE;
+		}
+		rc = _aws_iot_mqtt_v5_read_all(pMqtt5, pNetwork, &byte, 1, &packetTimer);
+		if(SUCCESS != rc) {
+			return rc;
+		}
+		pStream->remainingLength += (uint32_t) (byte & 127) * pStream->multiplier;
+		pStream->multiplier *= 128;
+		pStream->lengthBytes++;
+	} while(0 != (byte & 128));
+
+	pStream->xlatLen = 0;
+	pStream->xlatPos = 0;
+	pStream->passLen = 0;
+	type = IOT_TAP_PACKET_TYPE(pStream->header);
+
+	switch(type) {
+		case IOT_TAP_PUBLISH:
+			return _aws_iot_mqtt_v5_translate_inbound_publish(pMqtt5, pNetwork, &packetTimer);
+
+		case IOT_TAP_CONNACK:
+		case IOT_TAP_PUBACK:
+		case IOT_TAP_SUBACK:
+		case IOT_TAP_UNSUBACK:
+		case IOT_TAP_DISCONNECT:
+		case MQTT5_AUTH:
+			break;
+
+		default:
+			/* same in both versions */
+			_aws_iot_mqtt_v5_xlat_header(pStream, pStream->header, pStream->remainingLength);
+			pStream->passLen = pStream->remainingLength;
+			return SUCCESS;
+	}
+
+	if(pStream->remainingLength > AWS_IOT_MQTT5_HEADER_BUF_LEN) {
+		IOT_ERROR("mqtt5: packet type %u of %u bytes does not fit AWS_IOT_MQTT5_HEADER_BUF_LEN", type,
+				  (unsigned) pStream->remainingLength);
+		return FAILURE;
+	}
+	rc = _aws_iot_mqtt_v5_read_all(pMqtt5, pNetwork, pStream->buf, pStream->remainingLength, &packetTimer);
+	if(SUCCESS != rc) {
+		return rc;
+	}
+	pStream->bufLen = pStream->remainingLength;
+
+	switch(type) {
+		case IOT_TAP_CONNACK:
+			return _aws_iot_mqtt_v5_translate_connack(pMqtt5);
+
+		case IOT_TAP_PUBACK:
+		case IOT_TAP_SUBACK:
+		case IOT_TAP_UNSUBACK:
+			return _aws_iot_mqtt_v5_translate_ack(pMqtt5);
+
+		case IOT_TAP_DISCONNECT:
+			/* e.g. session taken over, or a limit of the broker exceeded: the client sees a lost connection */
+			_aws_iot_mqtt_v5_report(pMqtt5, type, 0, (0 < pStream->bufLen) ? pStream->buf[0] : 0);
+			return NETWORK_SSL_READ_ERROR;
+
+		default:
+			IOT_ERROR("mqtt5: enhanced authentication is not supported");
+			return NETWORK_SSL_READ_ERROR;
+	}
+}
+
+static IoT_Error_t _aws_iot_mqtt_v5_read(Network *pNetwork, unsigned char *pMsg, size_t len, Timer *pTimer,
+										 size_t *pReadLen) {
+	AWS_IoT_Mqtt5_t *pMqtt5 = _aws_iot_mqtt_v5_find_by_network(pNetwork);
+	IoT_Mqtt5_Stream_t *pStream;
+	IoT_Error_t rc = SUCCESS;
+	size_t total = 0;
+	size_t chunkLen;
+
+	if(NULL == pMqtt5) {
+		return FAILURE;
+	}
+	pStream = &(pMqtt5->in);
+
+	while(total < len) {
+		if(pStream->xlatPos < pStream->xlatLen) {
+			chunkLen = pStream->xlatLen - pStream->xlatPos;
+			if(chunkLen > len - total) {
+				chunkLen = len - total;
+			}
+			memcpy(&pMsg[total], &(pStream->xlat[pStream->xlatPos]), chunkLen);
+			pStream->xlatPos += chunkLen;
+			total += chunkLen;
+		} else if(0 < pStream->passLen) {
+			chunkLen = pStream->passLen;
+			if(chunkLen > len - total) {
+				chunkLen = len - total;
+			}
+			rc = _aws_iot_mqtt_v5_read_all(pMqtt5, pNetwork, &pMsg[total], chunkLen, pTimer);
+			if(SUCCESS != rc) {
+				break;
+			}
+			pStream->passLen -= (uint32_t) chunkLen;
+			total += chunkLen;
+		} else if(0 < total) {
+			/* end of the packet */
+			break;
+		} else {
+			rc = _aws_iot_mqtt_v5_next_inbound(pMqtt5, pNetwork, pTimer);
+			if(SUCCESS != rc) {
+				break;
+			}
+		}
+	}
+
+	if(SUCCESS != rc && NETWORK_SSL_NOTHING_TO_READ != rc) {
+		/* the client drops the connection, the stream restarts at the next connect */
+		pStream->xlatLen = 0;
+		pStream->xlatPos = 0;
+		pStream->passLen = 0;
+	}
+	*pReadLen = total;
+	return rc;
+}
+
+static IoT_Error_t _aws_iot_mqtt_v5_connect(Network *pNetwork, TLSConnectParams *pParams) {
+	AWS_IoT_Mqtt5_t *pMqtt5 = _aws_iot_mqtt_v5_find_by_network(pNetwork);
+
+	if(NULL == pMqtt5) {
+		return FAILURE;
+	}
+
+	_aws_iot_mqtt_v5_reset(pMqtt5);
+	return pMqtt5->connect(pNetwork, pParams);
+}
+
+IoT_Error_t aws_iot_mqtt_v5_attach(AWS_IoT_Mqtt5_t *pMqtt5, AWS_IoT_Client *pClient, const IoT_Mqtt5_Params_t *pParams) {
+	uint8_t slot = AWS_IOT_MQTT5_MAX_CLIENTS;
+	uint8_t i;
+	IoT_Error_t rc = SUCCESS;
+
+	FUNC_ENTRY;
+
+	if(NULL == pMqtt5 || NULL == pClient) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	if(NULL == pParams) {
+		pParams = &iotMqtt5ParamsDefault;
+	}
+
+	for(i = 0; i < AWS_IOT_MQTT5_MAX_CLIENTS; i++) {
+		if(NULL != adapters[i] && pClient == adapters[i]->pClient) {
+			IOT_ERROR("mqtt5: adapter already attached to the client");
+			FUNC_EXIT_RC(FAILURE);
+		}
+		if(NULL == adapters[i] && AWS_IOT_MQTT5_MAX_CLIENTS == slot) {
+			slot = i;
+		}
+	}
+	if(AWS_IOT_MQTT5_MAX_CLIENTS == slot) {
+		IOT_ERROR("mqtt5: no free slot, increase AWS_IOT_MQTT5_MAX_CLIENTS");
+		FUNC_EXIT_RC(FAILURE);
+	}
+
+	memset(pMqtt5, 0, sizeof(AWS_IoT_Mqtt5_t));
+	pMqtt5->pClient = pClient;
+	pMqtt5->params = *pParams;
+	if(AWS_IOT_MQTT5_MAX_TOPIC_ALIASES < pMqtt5->params.maxTopicAliases) {
+		pMqtt5->params.maxTopicAliases = AWS_IOT_MQTT5_MAX_TOPIC_ALIASES;
+	}
+
+#ifdef _ENABLE_THREAD_SUPPORT_
+	rc = aws_iot_thread_mutex_init(&(pMqtt5->lock));
+	if(SUCCESS != rc) {
+		FUNC_EXIT_RC(rc);
+	}
+#endif
+	_aws_iot_mqtt_v5_reset(pMqtt5);
+
+	pMqtt5->connect = pClient->networkStack.connect;
+	pMqtt5->read = pClient->networkStack.read;
+	pMqtt5->write = pClient->networkStack.write;
+	adapters[slot] = pMqtt5;
+
+	pClient->networkStack.connect = _aws_iot_mqtt_v5_connect;
+	pClient->networkStack.read = _aws_iot_mqtt_v5_read;
+	pClient->networkStack.write = _aws_iot_mqtt_v5_write;
+
+	FUNC_EXIT_RC(rc);
+}
+
+IoT_Error_t aws_iot_mqtt_v5_detach(AWS_IoT_Mqtt5_t *pMqtt5) {
+	uint8_t i;
+
+	FUNC_ENTRY;
+
+	if(NULL == pMqtt5 || NULL == pMqtt5->pClient) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	if(_aws_iot_mqtt_v5_read == pMqtt5->pClient->networkStack.read) {
+		pMqtt5->pClient->networkStack.connect = pMqtt5->connect;
+		pMqtt5->pClient->networkStack.read = pMqtt5->read;
+		pMqtt5->pClient->networkStack.write = pMqtt5->write;
+	}
+	for(i = 0; i < AWS_IOT_MQTT5_MAX_CLIENTS; i++) {
+		if(pMqtt5 == adapters[i]) {
+			adapters[i] = NULL;
+		}
+	}
+#ifdef _ENABLE_THREAD_SUPPORT_
+	(void) aws_iot_thread_mutex_destroy(&(pMqtt5->lock));
+#endif
+	pMqtt5->pClient = NULL;
+
+	FUNC_EXIT_RC(SUCCESS);
+}
+
+bool aws_iot_mqtt_v5_can_publish(AWS_IoT_Mqtt5_t *pMqtt5) {
+	uint8_t count;
+	bool canPublish;
+
+	_aws_iot_mqtt_v5_lock(pMqtt5);
+	count = _aws_iot_mqtt_v5_in_flight(pMqtt5);
+	canPublish = count < pMqtt5->serverReceiveMaximum && count < AWS_IOT_MQTT5_MAX_IN_FLIGHT;
+	_aws_iot_mqtt_v5_unlock(pMqtt5);
+
+	return canPublish;
+}
+
+uint16_t aws_iot_mqtt_v5_get_receive_maximum(AWS_IoT_Mqtt5_t *pMqtt5) {
+	uint16_t receiveMaximum;
+
+	_aws_iot_mqtt_v5_lock(pMqtt5);
+	receiveMaximum = pMqtt5->serverReceiveMaximum;
+	_aws_iot_mqtt_v5_unlock(pMqtt5);
+
+	return receiveMaximum;
+}
+
+void aws_iot_mqtt_v5_get_stats(AWS_IoT_Mqtt5_t *pMqtt5, IoT_Mqtt5_Stats_t *pStats) {
+	_aws_iot_mqtt_v5_lock(pMqtt5);
+	*pStats = pMqtt5->stats;
+	_aws_iot_mqtt_v5_unlock(pMqtt5);
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,323 @@
+/**
+  *****************************************************************************
+  * @file   aws_iot_mqtt_client_v5_loopback.c
+  *
+  *****************************************************************************
+  * @attention
+  *
+  *
+  *  Copyright (c) 2022, InnoPhase, Inc.
+  *
+  *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  *  POSSIBILITY OF SUCH DAMAGE.
+  *
+  *****************************************************************************
+  */
+
+/**
+ * @file aws_iot_mqtt_client_v5_loopback.c
+ * @brief MQTT 5 adapter against a scripted broker, without network
+ *
+ * Built only with -DAWS_IOT_MQTT5_LOOPBACK.
+ */
+
+#ifdef AWS_IOT_MQTT5_LOOPBACK
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+#include <kernel/os.h>
+
+#include "aws_iot_log.h"
+#include "aws_iot_mqtt_client_v5.h"
+#include "memory_platform.h"
+#include "timer_interface.h"
+
+#define LOOPBACK_BUF_LEN 256
+
+/* Bytes the client sends to the broker, and bytes the broker has queued for the client */
+typedef struct {
+	unsigned char toBroker[LOOPBACK_BUF_LEN];
+	size_t toBrokerLen;
+	unsigned char toClient[LOOPBACK_BUF_LEN];
+	size_t toClientLen;
+	size_t toClientPos;
+	uint8_t lastReasonCode;
+} _IoT_Mqtt5_Loopback_t;
+
+static _IoT_Mqtt5_Loopback_t *pLoopback;
+
+static IoT_Error_t _loopback_connect(Network *pNetwork, TLSConnectParams *pParams) {
+	IOT_UNUSED(pNetwork);
+	IOT_UNUSED(pParams);
+
+	pLoopback->toBrokerLen = 0;
+	pLoopback->toClientLen = 0;
+	pLoopback->toClientPos = 0;
+	return SUCCESS;
+}
+
+static IoT_Error_t _loopback_read(Network *pNetwork, unsigned char *pMsg, size_t len, Timer *pTimer,
+								  size_t *pReadLen) {
+	size_t avail = pLoopback->toClientLen - pLoopback->toClientPos;
+
+	IOT_UNUSED(pNetwork);
+	IOT_UNUSED(pTimer);
+
+	/* one byte at a time past the first, like a slow link */
+	if(1 < len) {
+		len = (len + 1) / 2;
+	}
+	*pReadLen = (len > avail) ? avail : len;
+	if(0 == *pReadLen) {
+		return NETWORK_SSL_NOTHING_TO_READ;
+	}
+	memcpy(pMsg, &(pLoopback->toClient[pLoopback->toClientPos]), *pReadLen);
+	pLoopback->toClientPos += *pReadLen;
+	return SUCCESS;
+}
+
+static IoT_Error_t _loopback_write(Network *pNetwork, unsigned char *pMsg, size_t len, Timer *pTimer,
+								   size_t *pWrittenLen) {
+	IOT_UNUSED(pNetwork);
+	IOT_UNUSED(pTimer);
+
+	if(len > LOOPBACK_BUF_LEN - pLoopback->toBrokerLen) {
+		return NETWORK_SSL_WRITE_ERROR;
+	}
+	memcpy(&(pLoopback->toBroker[pLoopback->toBrokerLen]), pMsg, len);
+	pLoopback->toBrokerLen += len;
+	*pWrittenLen = len;
+	return SUCCESS;
+}
+
+static void _loopback_on_reason(AWS_IoT_Client *pClient, uint8_t packetType, uint16_t packetId, uint8_t reasonCode,
+								void *pData) {
+	IOT_UNUSED(pClient);
+	IOT_UNUSED(packetType);
+	IOT_UNUSED(packetId);
+	IOT_UNUSED(pData);
+
+	pLoopback->lastReasonCode = reasonCode;
+}
+
+static void _loopback_queue(const unsigned char *pPacket, size_t len) {
+	memcpy(pLoopback->toClient, pPacket, len);
+	pLoopback->toClientPos = 0;
+	pLoopback->toClientLen = len;
+}
+
+/* Writes a 3.1.1 packet through the adapter, in chunks of chunkLen, and compares what the broker got */
+static uint32_t _loopback_send(AWS_IoT_Client *pClient, const char *pName, const unsigned char *pPacket,
+							   size_t len, size_t chunkLen, const unsigned char *pExpected, size_t expectedLen) {
+	Timer timer;
+	size_t written;
+	size_t sent;
+	IoT_Error_t rc = SUCCESS;
+
+	init_timer(&timer);
+	countdown_ms(&timer, 1000);
+	pLoopback->toBrokerLen = 0;
+	for(sent = 0; sent < len && SUCCESS == rc; sent += written) {
+		written = 0;
+		rc = pClient->networkStack.write(&(pClient->networkStack), (unsigned char *) &pPacket[sent],
+										 (len - sent > chunkLen) ? chunkLen : len - sent, &timer, &written);
+	}
+
+	if(SUCCESS != rc || expectedLen != pLoopback->toBrokerLen ||
+	   0 != memcmp(pExpected, pLoopback->toBroker, expectedLen)) {
+		os_printf("  %-28s FAILED (rc %d, %u bytes)\n", pName, rc, (unsigned) pLoopback->toBrokerLen);
+		return 1;
+	}
+	os_printf("  %-28s ok, %u bytes for %u\n", pName, (unsigned) expectedLen, (unsigned) len);
+	return 0;
+}
+
+/* Queues a 5 packet at the broker and compares what the client reads through the adapter, the way it reads */
+static uint32_t _loopback_receive(AWS_IoT_Client *pClient, const char *pName, const unsigned char *pPacket,
+								  size_t len, IoT_Error_t expectedRc, const unsigned char *pExpected,
+								  size_t expectedLen) {
+	unsigned char buf[LOOPBACK_BUF_LEN];
+	size_t got = 0;
+	size_t readLen = 0;
+	size_t remaining;
+	Timer timer;
+	IoT_Error_t rc;
+
+	_loopback_queue(pPacket, len);
+	init_timer(&timer);
+	countdown_ms(&timer, 1000);
+
+	/* fixed header byte by byte, then the rest of the packet at once */
+	rc = pClient->networkStack.read(&(pClient->networkStack), buf, 1, &timer, &readLen);
+	got += readLen;
+	while(SUCCESS == rc && (1 == got || 0 != (buf[got - 1] & 128))) {
+		rc = pClient->networkStack.read(&(pClient->networkStack), &buf[got], 1, &timer, &readLen);
+		got += readLen;
+	}
+	if(SUCCESS == rc && got < expectedLen) {
+		remaining = expectedLen - got;
+		rc = pClient->networkStack.read(&(pClient->networkStack), &buf[got], remaining, &timer, &readLen);
+		got += readLen;
+	}
+
+	if(expectedRc != rc || (SUCCESS == rc && (expectedLen != got || 0 != memcmp(pExpected, buf, expectedLen)))) {
+		os_printf("  %-28s FAILED (rc %d, %u bytes)\n", pName, rc, (unsigned) got);
+		return 1;
+	}
+	os_printf("  %-28s ok\n", pName);
+	return 0;
+}
+
+uint32_t aws_iot_mqtt_v5_loopback_check(void) {
+	/* CONNECT, client id "t2", no clean session, keep alive 60 s */
+	static const unsigned char connect311[] = {0x10, 0x0E, 0x00, 0x04, 'M', 'Q', 'T', 'T', 0x04, 0x00,
+											   0x00, 0x3C, 0x00, 0x02, 't', '2'};
+	static const unsigned char connect5[] = {0x10, 0x17, 0x00, 0x04, 'M', 'Q', 'T', 'T', 0x05, 0x00, 0x00, 0x3C,
+											 0x08, 0x11, 0x00, 0x00, 0x0E, 0x10, 0x21, 0x00, 0x08,
+											 0x00, 0x02, 't', '2'};
+	/* session present, receive maximum 2, topic alias maximum 4, assigned client id left out */
+	static const unsigned char connack5[] = {0x20, 0x09, 0x01, 0x00, 0x06, 0x21, 0x00, 0x02, 0x22, 0x00, 0x04};
+	static const unsigned char connack311[] = {0x20, 0x02, 0x01, 0x00};
+	static const unsigned char subscribe311[] = {0x82, 0x08, 0x00, 0x01, 0x00, 0x03, 'a', '/', 'b', 0x01};
+	static const unsigned char subscribe5[] = {0x82, 0x09, 0x00, 0x01, 0x00, 0x00, 0x03, 'a', '/', 'b', 0x01};
+	static const unsigned char suback5[] = {0x90, 0x04, 0x00, 0x01, 0x00, 0x87};
+	static const unsigned char suback311[] = {0x90, 0x03, 0x00, 0x01, 0x80};
+	/* QoS1 on "sensor/t2/temp", id 2 then 3 */
+	static const unsigned char publish311a[] = {0x32, 0x16, 0x00, 0x0E, 's', 'e', 'n', 's', 'o', 'r', '/', 't', '2',
+												'/', 't', 'e', 'm', 'p', 0x00, 0x02, '2', '1', '.', '5'};
+	static const unsigned char publish5a[] = {0x32, 0x1A, 0x00, 0x0E, 's', 'e', 'n', 's', 'o', 'r', '/', 't', '2',
+											  '/', 't', 'e', 'm', 'p', 0x00, 0x02, 0x03, 0x23, 0x00, 0x01,
+											  '2', '1', '.', '5'};
+	static const unsigned char publish311b[] = {0x32, 0x16, 0x00, 0x0E, 's', 'e', 'n', 's', 'o', 'r', '/', 't', '2',
+												'/', 't', 'e', 'm', 'p', 0x00, 0x03, '2', '1', '.', '6'};
+	static const unsigned char publish5b[] = {0x32, 0x0C, 0x00, 0x00, 0x00, 0x03, 0x03, 0x23, 0x00, 0x01,
+											  '2', '1', '.', '6'};
+	/* no matching subscribers is a success, quota exceeded is not */
+	static const unsigned char puback5a[] = {0x40, 0x04, 0x00, 0x02, 0x10, 0x00};
+	static const unsigned char puback311a[] = {0x40, 0x02, 0x00, 0x02};
+	static const unsigned char puback5b[] = {0x40, 0x03, 0x00, 0x03, 0x97};
+	static const unsigned char puback311b[] = {0x40, 0x02, 0x00, 0x03};
+	/* QoS0 on "a/b" with message expiry and a user property */
+	static const unsigned char inbound5[] = {0x30, 0x16, 0x00, 0x03, 'a', '/', 'b', 0x0D, 0x02, 0x00, 0x00, 0x00,
+											 0x3C, 0x26, 0x00, 0x01, 'k', 0x00, 0x02, 'v', 'v', 'o', 'n', '!'};
+	static const unsigned char inbound311[] = {0x30, 0x08, 0x00, 0x03, 'a', '/', 'b', 'o', 'n', '!'};
+	static const unsigned char pingresp[] = {0xD0, 0x00};
+	/* session taken over */
+	static const unsigned char disconnect5[] = {0xE0, 0x01, 0x8E};
+
+	AWS_IoT_Client *pClient;
+	AWS_IoT_Mqtt5_t *pMqtt5;
+	IoT_Mqtt5_Params_t params = iotMqtt5ParamsDefault;
+	IoT_Mqtt5_Stats_t stats;
+	uint32_t failures = 0;
+
+	pClient = (AWS_IoT_Client *) aws_iot_platform_malloc(sizeof(AWS_IoT_Client));
+	pMqtt5 = (AWS_IoT_Mqtt5_t *) aws_iot_platform_malloc(sizeof(AWS_IoT_Mqtt5_t));
+	pLoopback = (_IoT_Mqtt5_Loopback_t *) aws_iot_platform_malloc(sizeof(_IoT_Mqtt5_Loopback_t));
+	if(NULL == pClient || NULL == pMqtt5 || NULL == pLoopback) {
+		os_printf("mqtt5 loopback: out of memory\n");
+		aws_iot_platform_free(pClient);
+		aws_iot_platform_free(pMqtt5);
+		aws_iot_platform_free(pLoopback);
+		return 1;
+	}
+
+	/* only the network functions and the packet timeout of the client are used */
+	memset(pClient, 0, sizeof(AWS_IoT_Client));
+	memset(pLoopback, 0, sizeof(_IoT_Mqtt5_Loopback_t));
+	pClient->networkStack.connect = _loopback_connect;
+	pClient->networkStack.read = _loopback_read;
+	pClient->networkStack.write = _loopback_write;
+	pClient->clientData.packetTimeoutMs = 1000;
+
+	params.sessionExpiryInterval_s = 3600;
+	params.receiveMaximum = 8;
+	params.reasonHandler = _loopback_on_reason;
+	if(SUCCESS != aws_iot_mqtt_v5_attach(pMqtt5, pClient, &params)) {
+		os_printf("mqtt5 loopback: attach failed\n");
+		failures++;
+		goto cleanup;
+	}
+
+	os_printf("\nmqtt5 loopback:\n");
+	(void) pClient->networkStack.connect(&(pClient->networkStack), NULL);
+	failures += _loopback_send(pClient, "CONNECT", connect311, sizeof(connect311), 5,
+							   connect5, sizeof(connect5));
+	failures += _loopback_receive(pClient, "CONNACK", connack5, sizeof(connack5), SUCCESS,
+								  connack311, sizeof(connack311));
+	if(2 != aws_iot_mqtt_v5_get_receive_maximum(pMqtt5)) {
+		os_printf("  %-28s FAILED\n", "receive maximum");
+		failures++;
+	}
+
+	failures += _loopback_send(pClient, "SUBSCRIBE", subscribe311, sizeof(subscribe311), sizeof(subscribe311),
+							   subscribe5, sizeof(subscribe5));
+	failures += _loopback_receive(pClient, "SUBACK not authorized", suback5, sizeof(suback5), SUCCESS,
+								  suback311, sizeof(suback311));
+
+	failures += _loopback_send(pClient, "PUBLISH alias set", publish311a, sizeof(publish311a), 3,
+							   publish5a, sizeof(publish5a));
+	failures += _loopback_send(pClient, "PUBLISH alias used", publish311b, sizeof(publish311b), 7,
+							   publish5b, sizeof(publish5b));
+	if(aws_iot_mqtt_v5_can_publish(pMqtt5)) {
+		os_printf("  %-28s FAILED\n", "receive maximum reached");
+		failures++;
+	}
+	failures += _loopback_receive(pClient, "PUBACK no subscribers", puback5a, sizeof(puback5a), SUCCESS,
+								  puback311a, sizeof(puback311a));
+	failures += _loopback_receive(pClient, "PUBACK quota exceeded", puback5b, sizeof(puback5b), SUCCESS,
+								  puback311b, sizeof(puback311b));
+	if(!aws_iot_mqtt_v5_can_publish(pMqtt5) || IOT_MQTT5_RC_QUOTA_EXCEEDED != pLoopback->lastReasonCode) {
+		os_printf("  %-28s FAILED\n", "PUBACK accounting");
+		failures++;
+	}
+
+	failures += _loopback_receive(pClient, "PUBLISH properties", inbound5, sizeof(inbound5), SUCCESS,
+								  inbound311, sizeof(inbound311));
+	failures += _loopback_send(pClient, "PINGREQ", (const unsigned char *) "\xC0\x00", 2, 2,
+							   (const unsigned char *) "\xC0\x00", 2);
+	failures += _loopback_receive(pClient, "PINGRESP", pingresp, sizeof(pingresp), SUCCESS,
+								  pingresp, sizeof(pingresp));
+	failures += _loopback_receive(pClient, "DISCONNECT from broker", disconnect5, sizeof(disconnect5),
+								  NETWORK_SSL_READ_ERROR, NULL, 0);
+
+	aws_iot_mqtt_v5_get_stats(pMqtt5, &stats);
+	os_printf("  aliased %u, saved %u bytes, reason errors %u, disconnects %u, last 0x%02X\n",
+			  (unsigned) stats.aliasedPublishes, (unsigned) stats.aliasBytesSaved, (unsigned) stats.reasonErrors,
+			  (unsigned) stats.serverDisconnects, stats.lastReasonCode);
+	if(1 != stats.aliasedPublishes || 2 != stats.reasonErrors || 1 != stats.serverDisconnects) {
+		os_printf("  %-28s FAILED\n", "counters");
+		failures++;
+	}
+	os_printf("mqtt5 loopback: %u failed\n", (unsigned) failures);
+
+	(void) aws_iot_mqtt_v5_detach(pMqtt5);
+
+cleanup:
+	aws_iot_platform_free(pClient);
+	aws_iot_platform_free(pMqtt5);
+	aws_iot_platform_free(pLoopback);
+	pLoopback = NULL;
+
+	return failures;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AWS_IOT_MQTT5_LOOPBACK */
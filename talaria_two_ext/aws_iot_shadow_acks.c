@@ -0,0 +1,255 @@
+/**
+  *****************************************************************************
+  * @file   aws_iot_shadow_acks.c
+  *
+  *****************************************************************************
+  * @attention
+  *
+  *
+  *  Copyright (c) 2022, InnoPhase, Inc.
+  *
+  *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  *  POSSIBILITY OF SUCH DAMAGE.
+  *
+  *****************************************************************************
+  */
+
+/**
+ * @file aws_iot_shadow_acks.c
+ * @brief Shadow requests waiting for their response
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <string.h>
+
+#include "aws_iot_log.h"
+#include "aws_iot_shadow_acks.h"
+
+#define SHADOW_ACKS_INDEX_MASK ((uint16_t) ((1 << AWS_IOT_SHADOW_ACKS_INDEX_BITS) - 1))
+
+/* FNV-1a */
+static uint32_t _aws_iot_shadow_acks_hash(const char *pToken, size_t tokenLen) {
+	uint32_t hash = 2166136261u;
+	size_t i;
+
+	for(i = 0; i < tokenLen; i++) {
+		hash ^= (uint8_t) pToken[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/* Deadlines compared across the wrap of the millisecond clock */
+static bool _aws_iot_shadow_acks_before(const AWS_IoT_Shadow_Acks_t *pAcks, uint16_t a, uint16_t b) {
+	return 0 > (int32_t) (pAcks->slots[a].ack.deadline_ms - pAcks->slots[b].ack.deadline_ms);
+}
+
+static void _aws_iot_shadow_acks_heap_set(AWS_IoT_Shadow_Acks_t *pAcks, uint16_t pos, uint16_t slot) {
+	pAcks->heap[pos] = slot;
+	pAcks->slots[slot].heapPos = pos;
+}
+
+static void _aws_iot_shadow_acks_sift_up(AWS_IoT_Shadow_Acks_t *pAcks, uint16_t pos) {
+	uint16_t slot = pAcks->heap[pos];
+	uint16_t parent;
+
+	while(0 < pos) {
+		parent = (uint16_t) ((pos - 1) / 2);
+		if(!_aws_iot_shadow_acks_before(pAcks, slot, pAcks->heap[parent])) {
+			break;
+		}
+		_aws_iot_shadow_acks_heap_set(pAcks, pos, pAcks->heap[parent]);
+		pos = parent;
+	}
+	_aws_iot_shadow_acks_heap_set(pAcks, pos, slot);
+}
+
+static void _aws_iot_shadow_acks_sift_down(AWS_IoT_Shadow_Acks_t *pAcks, uint16_t pos) {
+	uint16_t slot = pAcks->heap[pos];
+	uint16_t child;
+
+	for(;;) {
+		child = (uint16_t) (2 * pos + 1);
+		if(child >= pAcks->count) {
+			break;
+		}
+		if(child + 1 < pAcks->count && _aws_iot_shadow_acks_before(pAcks, pAcks->heap[child + 1], pAcks->heap[child])) {
+			child++;
+		}
+		if(!_aws_iot_shadow_acks_before(pAcks, pAcks->heap[child], slot)) {
+			break;
+		}
+		_aws_iot_shadow_acks_heap_set(pAcks, pos, pAcks->heap[child]);
+		pos = child;
+	}
+	_aws_iot_shadow_acks_heap_set(pAcks, pos, slot);
+}
+
+/* Bucket of the token, or the free bucket where it would be added. *pIsFound tells which. */
+static uint16_t _aws_iot_shadow_acks_search(const AWS_IoT_Shadow_Acks_t *pAcks, const char *pToken, size_t tokenLen,
+											uint32_t hash, bool *pIsFound) {
+	const IoT_Shadow_Ack_Slot_t *pSlot;
+	uint16_t bucket = (uint16_t) (hash & SHADOW_ACKS_INDEX_MASK);
+
+	/* never full: at least half of the buckets are free */
+	while(0 != pAcks->index[bucket]) {
+		pSlot = &(pAcks->slots[pAcks->index[bucket] - 1]);
+		if(pSlot->hash == hash && pSlot->tokenLen == tokenLen && 0 == memcmp(pSlot->ack.clientToken, pToken, tokenLen)) {
+			*pIsFound = true;
+			return bucket;
+		}
+		bucket = (uint16_t) ((bucket + 1) & SHADOW_ACKS_INDEX_MASK);
+	}
+	*pIsFound = false;
+	return bucket;
+}
+
+/* Frees the bucket, moving back the entries of the probe sequence behind it */
+static void _aws_iot_shadow_acks_unindex(AWS_IoT_Shadow_Acks_t *pAcks, uint16_t bucket) {
+	uint16_t next = bucket;
+	uint16_t home;
+
+	for(;;) {
+		next = (uint16_t) ((next + 1) & SHADOW_ACKS_INDEX_MASK);
+		if(0 == pAcks->index[next]) {
+			break;
+		}
+		home = (uint16_t) (pAcks->slots[pAcks->index[next] - 1].hash & SHADOW_ACKS_INDEX_MASK);
+		/* an entry stays if its home is cyclically in (bucket, next] */
+		if((bucket < next) ? (bucket < home && home <= next) : (bucket < home || home <= next)) {
+			continue;
+		}
+		pAcks->index[bucket] = pAcks->index[next];
+		bucket = next;
+	}
+	pAcks->index[bucket] = 0;
+}
+
+/* Removes the request indexed in bucket */
+static void _aws_iot_shadow_acks_remove(AWS_IoT_Shadow_Acks_t *pAcks, uint16_t bucket, IoT_Shadow_Ack_t *pAck) {
+	uint16_t slot = (uint16_t) (pAcks->index[bucket] - 1);
+	uint16_t pos = pAcks->slots[slot].heapPos;
+	uint16_t last;
+
+	*pAck = pAcks->slots[slot].ack;
+	_aws_iot_shadow_acks_unindex(pAcks, bucket);
+
+	/* the last request of the heap takes its place, then moves down or up */
+	pAcks->count--;
+	if(pos < pAcks->count) {
+		last = pAcks->heap[pAcks->count];
+		_aws_iot_shadow_acks_heap_set(pAcks, pos, last);
+		_aws_iot_shadow_acks_sift_down(pAcks, pos);
+		_aws_iot_shadow_acks_sift_up(pAcks, pAcks->slots[last].heapPos);
+	}
+
+	pAcks->freeSlots[pAcks->freeCount++] = slot;
+}
+
+IoT_Error_t aws_iot_shadow_acks_init(AWS_IoT_Shadow_Acks_t *pAcks) {
+	uint16_t i;
+
+	FUNC_ENTRY;
+
+	if(NULL == pAcks) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	memset(pAcks, 0, sizeof(AWS_IoT_Shadow_Acks_t));
+	for(i = 0; i < AWS_IOT_SHADOW_ACKS_MAX; i++) {
+		pAcks->freeSlots[i] = (uint16_t) (AWS_IOT_SHADOW_ACKS_MAX - 1 - i);
+	}
+	pAcks->freeCount = AWS_IOT_SHADOW_ACKS_MAX;
+
+	FUNC_EXIT_RC(SUCCESS);
+}
+
+IoT_Error_t aws_iot_shadow_acks_add(AWS_IoT_Shadow_Acks_t *pAcks, const IoT_Shadow_Ack_t *pAck) {
+	IoT_Shadow_Ack_Slot_t *pSlot;
+	size_t tokenLen;
+	uint32_t hash;
+	uint16_t bucket;
+	uint16_t slot;
+	bool isFound;
+
+	FUNC_ENTRY;
+
+	if(NULL == pAcks || NULL == pAck) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	if(0 == pAcks->freeCount) {
+		FUNC_EXIT_RC(MAX_SIZE_ERROR);
+	}
+
+	tokenLen = strlen(pAck->clientToken);
+	hash = _aws_iot_shadow_acks_hash(pAck->clientToken, tokenLen);
+	bucket = _aws_iot_shadow_acks_search(pAcks, pAck->clientToken, tokenLen, hash, &isFound);
+	if(isFound) {
+		IOT_WARN("Shadow clientToken %s already waiting", pAck->clientToken);
+		FUNC_EXIT_RC(FAILURE);
+	}
+
+	slot = pAcks->freeSlots[--pAcks->freeCount];
+	pSlot = &(pAcks->slots[slot]);
+	pSlot->ack = *pAck;
+	pSlot->hash = hash;
+	pSlot->tokenLen = (uint16_t) tokenLen;
+	pAcks->index[bucket] = (uint16_t) (slot + 1);
+
+	_aws_iot_shadow_acks_heap_set(pAcks, pAcks->count, slot);
+	pAcks->count++;
+	_aws_iot_shadow_acks_sift_up(pAcks, pSlot->heapPos);
+
+	FUNC_EXIT_RC(SUCCESS);
+}
+
+bool aws_iot_shadow_acks_take(AWS_IoT_Shadow_Acks_t *pAcks, ShadowActions_t action, const char *pClientToken,
+							  size_t tokenLen, IoT_Shadow_Ack_t *pAck) {
+	uint16_t bucket;
+	bool isFound;
+
+	bucket = _aws_iot_shadow_acks_search(pAcks, pClientToken, tokenLen,
+										 _aws_iot_shadow_acks_hash(pClientToken, tokenLen), &isFound);
+	if(!isFound || action != pAcks->slots[pAcks->index[bucket] - 1].ack.action) {
+		return false;
+	}
+
+	_aws_iot_shadow_acks_remove(pAcks, bucket, pAck);
+	return true;
+}
+
+bool aws_iot_shadow_acks_take_expired(AWS_IoT_Shadow_Acks_t *pAcks, uint32_t now_ms, IoT_Shadow_Ack_t *pAck) {
+	const IoT_Shadow_Ack_Slot_t *pSlot;
+	uint16_t bucket;
+	bool isFound;
+
+	if(0 == pAcks->count) {
+		return false;
+	}
+
+	pSlot = &(pAcks->slots[pAcks->heap[0]]);
+	if(0 > (int32_t) (now_ms - pSlot->ack.deadline_ms)) {
+		return false;
+	}
+
+	bucket = _aws_iot_shadow_acks_search(pAcks, pSlot->ack.clientToken, pSlot->tokenLen, pSlot->hash, &isFound);
+	_aws_iot_shadow_acks_remove(pAcks, bucket, pAck);
+	return true;
+}
+
+#ifdef __cplusplus
+}
+#endif
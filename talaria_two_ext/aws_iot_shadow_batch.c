@@ -0,0 +1,339 @@
+/**
+  *****************************************************************************
+  * @file   aws_iot_shadow_batch.c
+  *
+  *****************************************************************************
+  * @attention
+  *
+  *
+  *  Copyright (c) 2022, InnoPhase, Inc.
+  *
+  *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  *  POSSIBILITY OF SUCH DAMAGE.
+  *
+  *****************************************************************************
+  */
+
+/**
+ * @file aws_iot_shadow_batch.c
+ * @brief Coalesced multi-attribute shadow updates
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <string.h>
+
+#include "aws_iot_log.h"
+#include "aws_iot_mqtt_client_tap.h"
+#include "aws_iot_shadow_batch.h"
+
+/* aws_iot_shadow_add_reported() and aws_iot_shadow_add_desired() take their attributes as variable
+ * arguments. The whole list is always passed, count tells how many are used. */
+#define SHADOW_BATCH_ARGS(list) list[0], list[1], list[2], list[3], list[4], list[5], list[6], list[7]
+
+const IoT_Shadow_Batch_Params_t iotShadowBatchParamsDefault = {AWS_IOT_SHADOW_BATCH_WINDOW_MS,
+															   10,
+															   NULL,
+															   NULL,
+															   NULL,
+															   NULL};
+
+static void _aws_iot_shadow_batch_on_response(const char *pThingName, ShadowActions_t action,
+											  Shadow_Ack_Status_t status, const char *pReceivedJsonDocument,
+											  void *pContextData) {
+	AWS_IoT_Shadow_Batch_t *pBatch = (AWS_IoT_Shadow_Batch_t *) pContextData;
+	IoT_Shadow_Batch_Attribute_t *pAttribute;
+	uint8_t i;
+
+	pBatch->isInFlight = false;
+
+	for(i = 0; i < pBatch->attributeCount; i++) {
+		pAttribute = &(pBatch->attributes[i]);
+		if(SHADOW_ACK_ACCEPTED != status && 0 != pAttribute->inFlight) {
+			/* not known to be in the shadow, send the current value again */
+			if(!pBatch->isDirty) {
+				pBatch->isDirty = true;
+				pBatch->windowStart_ms = aws_iot_mqtt_tap_now_ms();
+			}
+			pAttribute->dirty |= pAttribute->inFlight;
+		}
+		pAttribute->inFlight = 0;
+	}
+
+	switch(status) {
+		case SHADOW_ACK_ACCEPTED:
+			pBatch->stats.accepted++;
+			break;
+		case SHADOW_ACK_REJECTED:
+			pBatch->stats.rejected++;
+			break;
+		default:
+			pBatch->stats.timeouts++;
+			break;
+	}
+
+	if(NULL != pBatch->params.callback) {
+		pBatch->params.callback(pThingName, action, status, pReceivedJsonDocument, pBatch->params.pCallbackContext);
+	}
+}
+
+/* Lists the dirty attributes of a section, in the order they were first marked */
+static uint8_t _aws_iot_shadow_batch_collect(AWS_IoT_Shadow_Batch_t *pBatch, uint8_t section,
+											 jsonStruct_t *list[8]) {
+	uint8_t count = 0;
+	uint8_t i;
+
+	for(i = 0; i < 8; i++) {
+		list[i] = NULL;
+	}
+	for(i = 0; i < pBatch->attributeCount; i++) {
+		if(0 != (pBatch->attributes[i].dirty & section)) {
+			list[count++] = pBatch->attributes[i].pStruct;
+		}
+	}
+	return count;
+}
+
+static IoT_Error_t _aws_iot_shadow_batch_build(AWS_IoT_Shadow_Batch_t *pBatch, uint8_t *pAttributeCount) {
+	jsonStruct_t *list[8];
+	uint8_t count;
+	IoT_Error_t rc;
+
+	*pAttributeCount = 0;
+
+	rc = aws_iot_shadow_init_json_document(pBatch->document, sizeof(pBatch->document));
+	if(SUCCESS != rc) {
+		return rc;
+	}
+
+	count = _aws_iot_shadow_batch_collect(pBatch, IOT_SHADOW_BATCH_REPORTED, list);
+	if(0 < count) {
+		if(NULL != pBatch->params.writer) {
+			rc = pBatch->params.writer(pBatch->document, sizeof(pBatch->document), IOT_SHADOW_BATCH_REPORTED, list,
+									   count);
+		} else {
+			rc = aws_iot_shadow_add_reported(pBatch->document, sizeof(pBatch->document), count,
+											 SHADOW_BATCH_ARGS(list));
+		}
+		if(SUCCESS != rc) {
+			return rc;
+		}
+		*pAttributeCount += count;
+	}
+
+	count = _aws_iot_shadow_batch_collect(pBatch, IOT_SHADOW_BATCH_DESIRED, list);
+	if(0 < count) {
+		if(NULL != pBatch->params.writer) {
+			rc = pBatch->params.writer(pBatch->document, sizeof(pBatch->document), IOT_SHADOW_BATCH_DESIRED, list,
+									   count);
+		} else {
+			rc = aws_iot_shadow_add_desired(pBatch->document, sizeof(pBatch->document), count,
+											SHADOW_BATCH_ARGS(list));
+		}
+		if(SUCCESS != rc) {
+			return rc;
+		}
+		*pAttributeCount += count;
+	}
+
+	return aws_iot_finalize_json_document(pBatch->document, sizeof(pBatch->document));
+}
+
+/* Drops the last marked dirty attribute, false if none is left */
+static bool _aws_iot_shadow_batch_drop_last(AWS_IoT_Shadow_Batch_t *pBatch) {
+	uint8_t i = pBatch->attributeCount;
+
+	while(0 < i) {
+		i--;
+		if(0 != pBatch->attributes[i].dirty) {
+			IOT_ERROR("shadow batch: %s does not fit in the update document, dropped",
+					  pBatch->attributes[i].pStruct->pKey);
+			pBatch->attributes[i].dirty = 0;
+			pBatch->stats.dropped++;
+			return true;
+		}
+	}
+	return false;
+}
+
+static IoT_Error_t _aws_iot_shadow_batch_send(AWS_IoT_Shadow_Batch_t *pBatch) {
+	uint8_t attributeCount;
+	uint8_t i;
+	IoT_Error_t rc;
+
+	rc = _aws_iot_shadow_batch_build(pBatch, &attributeCount);
+	/* would not fit next time either, keep the attributes that do */
+	while(SUCCESS != rc && _aws_iot_shadow_batch_drop_last(pBatch)) {
+		rc = _aws_iot_shadow_batch_build(pBatch, &attributeCount);
+	}
+	if(SUCCESS != rc || 0 == attributeCount) {
+		if(SUCCESS != rc) {
+			IOT_ERROR("shadow batch: update document not built (%d)", rc);
+		}
+		pBatch->isDirty = false;
+		return rc;
+	}
+
+	/* set before the send, the response may come before it returns */
+	for(i = 0; i < pBatch->attributeCount; i++) {
+		pBatch->attributes[i].inFlight = pBatch->attributes[i].dirty;
+		pBatch->attributes[i].dirty = 0;
+	}
+	pBatch->isDirty = false;
+	pBatch->isInFlight = true;
+
+	if(NULL != pBatch->params.pDemux) {
+		rc = aws_iot_shadow_demux_update(pBatch->params.pDemux, pBatch->document, _aws_iot_shadow_batch_on_response,
+										 pBatch, pBatch->params.timeout_seconds);
+	} else {
+		rc = aws_iot_shadow_update(pBatch->pClient, pBatch->pThingName, pBatch->document,
+								   _aws_iot_shadow_batch_on_response, pBatch, pBatch->params.timeout_seconds, true);
+	}
+	if(SUCCESS != rc) {
+		/* dirty again, tried at the next poll */
+		for(i = 0; i < pBatch->attributeCount; i++) {
+			pBatch->attributes[i].dirty |= pBatch->attributes[i].inFlight;
+			pBatch->attributes[i].inFlight = 0;
+		}
+		pBatch->isDirty = true;
+		pBatch->isInFlight = false;
+		return rc;
+	}
+
+	IOT_DEBUG("shadow batch: %s", pBatch->document);
+
+	pBatch->stats.documents++;
+	if(attributeCount > pBatch->stats.maxAttributes) {
+		pBatch->stats.maxAttributes = attributeCount;
+	}
+
+	return SUCCESS;
+}
+
+IoT_Error_t aws_iot_shadow_batch_init(AWS_IoT_Shadow_Batch_t *pBatch, AWS_IoT_Client *pClient,
+									  const char *pThingName, const IoT_Shadow_Batch_Params_t *pParams) {
+	FUNC_ENTRY;
+
+	if(NULL == pBatch || NULL == pClient) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	if(NULL == pParams) {
+		pParams = &iotShadowBatchParamsDefault;
+	}
+
+	if(NULL == pThingName && NULL == pParams->pDemux) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	memset(pBatch, 0, sizeof(AWS_IoT_Shadow_Batch_t));
+	pBatch->pClient = pClient;
+	pBatch->pThingName = pThingName;
+	pBatch->params = *pParams;
+
+	FUNC_EXIT_RC(SUCCESS);
+}
+
+IoT_Error_t aws_iot_shadow_batch_mark(AWS_IoT_Shadow_Batch_t *pBatch, jsonStruct_t *pStruct, uint8_t section) {
+	IoT_Shadow_Batch_Attribute_t *pAttribute = NULL;
+	uint8_t i;
+
+	FUNC_ENTRY;
+
+	if(NULL == pBatch || NULL == pStruct || NULL == pStruct->pKey || NULL == pStruct->pData) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	section &= (IOT_SHADOW_BATCH_REPORTED | IOT_SHADOW_BATCH_DESIRED);
+	if(0 == section) {
+		FUNC_EXIT_RC(FAILURE);
+	}
+
+	for(i = 0; i < pBatch->attributeCount; i++) {
+		if(pStruct == pBatch->attributes[i].pStruct) {
+			pAttribute = &(pBatch->attributes[i]);
+			break;
+		}
+	}
+
+	if(NULL == pAttribute) {
+		if(AWS_IOT_SHADOW_BATCH_MAX_ATTRIBUTES <= pBatch->attributeCount) {
+			FUNC_EXIT_RC(MAX_SIZE_ERROR);
+		}
+		pAttribute = &(pBatch->attributes[pBatch->attributeCount++]);
+		pAttribute->pStruct = pStruct;
+	}
+
+	pBatch->stats.marks++;
+	if(section == (pAttribute->dirty & section)) {
+		pBatch->stats.coalesced++;
+	}
+	pAttribute->dirty |= section;
+
+	if(!pBatch->isDirty) {
+		pBatch->isDirty = true;
+		pBatch->windowStart_ms = aws_iot_mqtt_tap_now_ms();
+	}
+
+	FUNC_EXIT_RC(SUCCESS);
+}
+
+IoT_Error_t aws_iot_shadow_batch_flush(AWS_IoT_Shadow_Batch_t *pBatch) {
+	IoT_Error_t rc;
+
+	FUNC_ENTRY;
+
+	if(NULL == pBatch || NULL == pBatch->pClient) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	if(!pBatch->isDirty || pBatch->isInFlight) {
+		FUNC_EXIT_RC(SUCCESS);
+	}
+
+	rc = _aws_iot_shadow_batch_send(pBatch);
+
+	FUNC_EXIT_RC(rc);
+}
+
+IoT_Error_t aws_iot_shadow_batch_poll(AWS_IoT_Shadow_Batch_t *pBatch) {
+	IoT_Error_t rc;
+
+	FUNC_ENTRY;
+
+	if(NULL == pBatch || NULL == pBatch->pClient) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	if(!pBatch->isDirty || pBatch->isInFlight ||
+	   aws_iot_mqtt_tap_now_ms() - pBatch->windowStart_ms < pBatch->params.window_ms) {
+		FUNC_EXIT_RC(SUCCESS);
+	}
+
+	rc = _aws_iot_shadow_batch_send(pBatch);
+
+	FUNC_EXIT_RC(rc);
+}
+
+bool aws_iot_shadow_batch_is_idle(const AWS_IoT_Shadow_Batch_t *pBatch) {
+	return !pBatch->isDirty && !pBatch->isInFlight;
+}
+
+void aws_iot_shadow_batch_get_stats(const AWS_IoT_Shadow_Batch_t *pBatch, IoT_Shadow_Batch_Stats_t *pStats) {
+	*pStats = pBatch->stats;
+}
+
+#ifdef __cplusplus
+}
+#endif
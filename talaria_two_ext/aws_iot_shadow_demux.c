@@ -0,0 +1,606 @@
+/**
+  *****************************************************************************
+  * @file   aws_iot_shadow_demux.c
+  *
+  *****************************************************************************
+  * @attention
+  *
+  *
+  *  Copyright (c) 2022, InnoPhase, Inc.
+  *
+  *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  *  POSSIBILITY OF SUCH DAMAGE.
+  *
+  *****************************************************************************
+  */
+
+/**
+ * @file aws_iot_shadow_demux.c
+ * @brief Thing shadow over a single wildcard subscription
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+#include "aws_iot_log.h"
+#include "aws_iot_mqtt_client_tap.h"
+#include "aws_iot_shadow_demux.h"
+
+#define SHADOW_DEMUX_WILDCARD     "+/+"
+#define SHADOW_DEMUX_DELTA        "update/delta"
+
+/* id of the attributes registered one by one, which have their own callback */
+#define SHADOW_DEMUX_DELTA_NO_ID UINT8_MAX
+
+const IoT_Shadow_Demux_Params_t iotShadowDemuxParamsDefault = {AWS_IOT_SHADOW_DEMUX_SUBSCRIBE_TIMEOUT_MS, true, QOS0};
+
+typedef struct {
+	const char *pSuffix;
+	ShadowActions_t action;
+	Shadow_Ack_Status_t status;
+} _IoT_Shadow_Demux_Response_t;
+
+static const _IoT_Shadow_Demux_Response_t responseTopics[] = {
+	{"update/accepted", SHADOW_UPDATE, SHADOW_ACK_ACCEPTED},
+	{"update/rejected", SHADOW_UPDATE, SHADOW_ACK_REJECTED},
+	{"get/accepted", SHADOW_GET, SHADOW_ACK_ACCEPTED},
+	{"get/rejected", SHADOW_GET, SHADOW_ACK_REJECTED},
+	{"delete/accepted", SHADOW_DELETE, SHADOW_ACK_ACCEPTED},
+	{"delete/rejected", SHADOW_DELETE, SHADOW_ACK_REJECTED},
+};
+
+typedef struct {
+	jsonStruct_t *pStruct;
+	uint8_t id;
+	const char *pValue;
+	uint32_t valueLen;
+} _IoT_Shadow_Demux_Delta_Call_t;
+
+static void _aws_iot_shadow_demux_lock(AWS_IoT_Shadow_Demux_t *pDemux) {
+#ifdef _ENABLE_THREAD_SUPPORT_
+	(void) aws_iot_thread_mutex_lock(&(pDemux->lock));
+#else
+	IOT_UNUSED(pDemux);
+#endif
+}
+
+static void _aws_iot_shadow_demux_unlock(AWS_IoT_Shadow_Demux_t *pDemux) {
+#ifdef _ENABLE_THREAD_SUPPORT_
+	(void) aws_iot_thread_mutex_unlock(&(pDemux->lock));
+#else
+	IOT_UNUSED(pDemux);
+#endif
+}
+
+/* Index of the token after the value starting at token i, nested tokens included */
+static int32_t _aws_iot_shadow_demux_skip(const AWS_IoT_Shadow_Demux_t *pDemux, int32_t i, int32_t count) {
+	int end = pDemux->tokens[i].end;
+
+	for(i++; i < count && pDemux->tokens[i].start < end; i++) {
+	}
+	return i;
+}
+
+/* Token of the value of key in the object at token parent, -1 if absent */
+static int32_t _aws_iot_shadow_demux_find_key(AWS_IoT_Shadow_Demux_t *pDemux, const char *pJson, int32_t parent,
+											  int32_t count, const char *pKey) {
+	int32_t i = parent + 1;
+
+	if(JSMN_OBJECT != pDemux->tokens[parent].type) {
+		return -1;
+	}
+
+	while(i + 1 < count && pDemux->tokens[i].start < pDemux->tokens[parent].end) {
+		if(0 == jsoneq(pJson, &(pDemux->tokens[i]), pKey)) {
+			return i + 1;
+		}
+		i = _aws_iot_shadow_demux_skip(pDemux, i + 1, count);
+	}
+	return -1;
+}
+
+static int32_t _aws_iot_shadow_demux_parse(AWS_IoT_Shadow_Demux_t *pDemux, const char *pJson, size_t len) {
+	int32_t count;
+
+	jsmn_init(&(pDemux->parser));
+	count = jsmn_parse(&(pDemux->parser), pJson, (unsigned int) len, pDemux->tokens, MAX_JSON_TOKEN_EXPECTED);
+	if(1 > count || JSMN_OBJECT != pDemux->tokens[0].type) {
+		return -1;
+	}
+	return count;
+}
+
+static IoT_Error_t _aws_iot_shadow_demux_update_value(const char *pJson, jsmntok_t *pToken, jsonStruct_t *pStruct) {
+	switch(pStruct->type) {
+		case SHADOW_JSON_INT32:
+			return parseInteger32Value((int32_t *) pStruct->pData, pJson, pToken);
+		case SHADOW_JSON_INT16:
+			return parseInteger16Value((int16_t *) pStruct->pData, pJson, pToken);
+		case SHADOW_JSON_INT8:
+			return parseInteger8Value((int8_t *) pStruct->pData, pJson, pToken);
+		case SHADOW_JSON_UINT32:
+			return parseUnsignedInteger32Value((uint32_t *) pStruct->pData, pJson, pToken);
+		case SHADOW_JSON_UINT16:
+			return parseUnsignedInteger16Value((uint16_t *) pStruct->pData, pJson, pToken);
+		case SHADOW_JSON_UINT8:
+			return parseUnsignedInteger8Value((uint8_t *) pStruct->pData, pJson, pToken);
+		case SHADOW_JSON_FLOAT:
+			return parseFloatValue((float *) pStruct->pData, pJson, pToken);
+		case SHADOW_JSON_DOUBLE:
+			return parseDoubleValue((double *) pStruct->pData, pJson, pToken);
+		case SHADOW_JSON_BOOL:
+			return parseBooleanValue((bool *) pStruct->pData, pJson, pToken);
+		case SHADOW_JSON_STRING:
+			return parseStringValue((char *) pStruct->pData, pStruct->dataLength, pJson, pToken);
+		case SHADOW_JSON_OBJECT:
+		default:
+			return SUCCESS;
+	}
+}
+
+/* Copies the clientToken of the JSON document in tokens into pToken */
+static bool _aws_iot_shadow_demux_get_token(AWS_IoT_Shadow_Demux_t *pDemux, const char *pJson, int32_t count,
+											char *pToken, size_t tokenSize) {
+	int32_t t = _aws_iot_shadow_demux_find_key(pDemux, pJson, 0, count, "clientToken");
+
+	if(0 > t || JSMN_STRING != pDemux->tokens[t].type ||
+	   (size_t) (pDemux->tokens[t].end - pDemux->tokens[t].start) >= tokenSize) {
+		return false;
+	}
+	memcpy(pToken, &(pJson[pDemux->tokens[t].start]), (size_t) (pDemux->tokens[t].end - pDemux->tokens[t].start));
+	pToken[pDemux->tokens[t].end - pDemux->tokens[t].start] = '\0';
+	return true;
+}
+
+/* rxBuf holds the delta. Runs in the thread reading the socket. */
+static void _aws_iot_shadow_demux_on_delta(AWS_IoT_Shadow_Demux_t *pDemux, size_t len) {
+	_IoT_Shadow_Demux_Delta_Call_t calls[AWS_IOT_SHADOW_DEMUX_MAX_DELTAS];
+	const IoT_Shadow_Key_t *pKey;
+	IoT_Error_t rc;
+	uint8_t callCount = 0;
+	uint32_t version = 0;
+	int32_t count;
+	int32_t state;
+	int32_t t;
+	uint8_t i;
+
+	_aws_iot_shadow_demux_lock(pDemux);
+
+	count = _aws_iot_shadow_demux_parse(pDemux, pDemux->rxBuf, len);
+	state = (0 < count) ? _aws_iot_shadow_demux_find_key(pDemux, pDemux->rxBuf, 0, count, "state") : -1;
+	if(0 > state) {
+		pDemux->stats.dropped++;
+		_aws_iot_shadow_demux_unlock(pDemux);
+		return;
+	}
+
+	t = _aws_iot_shadow_demux_find_key(pDemux, pDemux->rxBuf, 0, count, "version");
+	if(0 <= t && SUCCESS == parseUnsignedInteger32Value(&version, pDemux->rxBuf, &(pDemux->tokens[t]))) {
+		if(pDemux->params.isDiscardOldDeltaEnabled && version <= pDemux->deltaVersion) {
+			pDemux->stats.ignored++;
+			_aws_iot_shadow_demux_unlock(pDemux);
+			return;
+		}
+		pDemux->deltaVersion = version;
+	}
+
+	/* each key of the state looked up once, in the order of the delta */
+	t = (JSMN_OBJECT == pDemux->tokens[state].type) ? state + 1 : count;
+	while(t + 1 < count && pDemux->tokens[t].start < pDemux->tokens[state].end &&
+		  callCount < AWS_IOT_SHADOW_DEMUX_MAX_DELTAS) {
+		pKey = aws_iot_shadow_keys_find(&(pDemux->deltaKeys), &(pDemux->rxBuf[pDemux->tokens[t].start]),
+										(size_t) (pDemux->tokens[t].end - pDemux->tokens[t].start));
+		if(NULL == pKey) {
+			rc = FAILURE;
+		} else if(SHADOW_DEMUX_DELTA_NO_ID != pKey->id && NULL != pDemux->pDeltaParsers) {
+			rc = pDemux->pDeltaParsers[pKey->id](pDemux->rxBuf, &(pDemux->tokens[t + 1]));
+		} else {
+			rc = _aws_iot_shadow_demux_update_value(pDemux->rxBuf, &(pDemux->tokens[t + 1]), pKey->pStruct);
+		}
+		if(SUCCESS == rc) {
+			calls[callCount].pStruct = pKey->pStruct;
+			calls[callCount].id = pKey->id;
+			calls[callCount].pValue = &(pDemux->rxBuf[pDemux->tokens[t + 1].start]);
+			calls[callCount].valueLen = (uint32_t) (pDemux->tokens[t + 1].end - pDemux->tokens[t + 1].start);
+			callCount++;
+		}
+		t = _aws_iot_shadow_demux_skip(pDemux, t + 1, count);
+	}
+	pDemux->stats.deltas++;
+
+	_aws_iot_shadow_demux_unlock(pDemux);
+
+	for(i = 0; i < callCount; i++) {
+		if(SHADOW_DEMUX_DELTA_NO_ID != calls[i].id && NULL != pDemux->deltaCallback) {
+			pDemux->deltaCallback(calls[i].pValue, calls[i].valueLen, calls[i].pStruct, calls[i].id,
+								  pDemux->pDeltaContext);
+		} else if(NULL != calls[i].pStruct->cb) {
+			calls[i].pStruct->cb(calls[i].pValue, calls[i].valueLen, calls[i].pStruct);
+		}
+	}
+}
+
+/* rxBuf holds an accepted or rejected response. Runs in the thread reading the socket. */
+static void _aws_iot_shadow_demux_on_response(AWS_IoT_Shadow_Demux_t *pDemux,
+											  const _IoT_Shadow_Demux_Response_t *pResponse, size_t len) {
+	IoT_Shadow_Ack_t ack;
+	bool isFound = false;
+	int32_t count;
+	int32_t t;
+
+	_aws_iot_shadow_demux_lock(pDemux);
+
+	count = _aws_iot_shadow_demux_parse(pDemux, pDemux->rxBuf, len);
+	t = (0 < count) ? _aws_iot_shadow_demux_find_key(pDemux, pDemux->rxBuf, 0, count, "clientToken") : -1;
+	if(0 <= t && JSMN_STRING == pDemux->tokens[t].type) {
+		/* looked up in place, in the response */
+		isFound = aws_iot_shadow_acks_take(&(pDemux->acks), pResponse->action,
+										   &(pDemux->rxBuf[pDemux->tokens[t].start]),
+										   (size_t) (pDemux->tokens[t].end - pDemux->tokens[t].start), &ack);
+	}
+
+	if(SHADOW_DELETE == pResponse->action && SHADOW_ACK_ACCEPTED == pResponse->status) {
+		/* a new shadow starts again from version 1 */
+		pDemux->deltaVersion = 0;
+	}
+
+	if(!isFound) {
+		pDemux->stats.unmatched++;
+	} else if(SHADOW_ACK_ACCEPTED == pResponse->status) {
+		pDemux->stats.accepted++;
+	} else {
+		pDemux->stats.rejected++;
+	}
+
+	_aws_iot_shadow_demux_unlock(pDemux);
+
+	if(isFound && NULL != ack.callback) {
+		ack.callback(pDemux->pTopics->thingName, ack.action, pResponse->status, pDemux->rxBuf, ack.pCallbackContext);
+	}
+}
+
+static void _aws_iot_shadow_demux_on_message(AWS_IoT_Client *pClient, char *pTopicName, uint16_t topicNameLen,
+											 IoT_Publish_Message_Params *pParams, void *pData) {
+	AWS_IoT_Shadow_Demux_t *pDemux = (AWS_IoT_Shadow_Demux_t *) pData;
+	/* the filter without its "+/+" */
+	uint16_t prefixLen = (uint16_t) (pDemux->pTopics->topics[IOT_THING_TOPIC_SHADOW_ALL].topicLen -
+									 strlen(SHADOW_DEMUX_WILDCARD));
+	const char *pSuffix;
+	size_t suffixLen;
+	uint8_t i;
+
+	IOT_UNUSED(pClient);
+
+	if(topicNameLen <= prefixLen) {
+		return;
+	}
+	pSuffix = &(pTopicName[prefixLen]);
+	suffixLen = (size_t) (topicNameLen - prefixLen);
+
+	/* the caller's buffer is not NUL terminated: callbacks get a string as with the SDK shadow */
+	if(pParams->payloadLen >= sizeof(pDemux->rxBuf)) {
+		_aws_iot_shadow_demux_lock(pDemux);
+		pDemux->stats.dropped++;
+		_aws_iot_shadow_demux_unlock(pDemux);
+		return;
+	}
+	memcpy(pDemux->rxBuf, pParams->payload, pParams->payloadLen);
+	pDemux->rxBuf[pParams->payloadLen] = '\0';
+
+	if(strlen(SHADOW_DEMUX_DELTA) == suffixLen && 0 == strncmp(pSuffix, SHADOW_DEMUX_DELTA, suffixLen)) {
+		_aws_iot_shadow_demux_on_delta(pDemux, pParams->payloadLen);
+		return;
+	}
+
+	for(i = 0; i < sizeof(responseTopics) / sizeof(responseTopics[0]); i++) {
+		if(strlen(responseTopics[i].pSuffix) == suffixLen &&
+		   0 == strncmp(pSuffix, responseTopics[i].pSuffix, suffixLen)) {
+			_aws_iot_shadow_demux_on_response(pDemux, &(responseTopics[i]), pParams->payloadLen);
+			return;
+		}
+	}
+
+	_aws_iot_shadow_demux_lock(pDemux);
+	pDemux->stats.ignored++;
+	_aws_iot_shadow_demux_unlock(pDemux);
+}
+
+IoT_Error_t aws_iot_shadow_demux_init(AWS_IoT_Shadow_Demux_t *pDemux, AWS_IoT_Dispatcher_t *pDispatcher,
+									  const AWS_IoT_Thing_Topics_t *pTopics, const IoT_Shadow_Demux_Params_t *pParams) {
+	const IoT_Thing_Topic_t *pFilter;
+	IoT_Dispatch_Filter_t filter;
+	IoT_Error_t rc;
+
+	FUNC_ENTRY;
+
+	if(NULL == pDemux || NULL == pDispatcher || NULL == pTopics) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	memset(pDemux, 0, sizeof(AWS_IoT_Shadow_Demux_t));
+	(void) aws_iot_shadow_acks_init(&(pDemux->acks));
+	pDemux->pDispatcher = pDispatcher;
+	pDemux->params = (NULL != pParams) ? *pParams : iotShadowDemuxParamsDefault;
+	pDemux->pTopics = pTopics;
+
+#ifdef _ENABLE_THREAD_SUPPORT_
+	rc = aws_iot_thread_mutex_init(&(pDemux->lock));
+	if(SUCCESS != rc) {
+		FUNC_EXIT_RC(rc);
+	}
+#endif
+
+	pFilter = &(pTopics->topics[IOT_THING_TOPIC_SHADOW_ALL]);
+	filter.pTopicFilter = pFilter->pTopic;
+	filter.topicFilterLen = pFilter->topicLen;
+	filter.qos = pDemux->params.qos;
+	filter.handler = _aws_iot_shadow_demux_on_message;
+	filter.pHandlerData = pDemux;
+	rc = aws_iot_mqtt_dispatch_subscribe_batch(pDispatcher, &filter, 1, pDemux->params.subscribeTimeout_ms);
+	if(SUCCESS != rc && MQTT_REQUEST_TIMEOUT_ERROR != rc) {
+		(void) aws_iot_mqtt_dispatch_unsubscribe(pDispatcher, pFilter->pTopic, pFilter->topicLen,
+												 _aws_iot_shadow_demux_on_message, pDemux);
+#ifdef _ENABLE_THREAD_SUPPORT_
+		(void) aws_iot_thread_mutex_destroy(&(pDemux->lock));
+#endif
+		pDemux->pDispatcher = NULL;
+	}
+
+	FUNC_EXIT_RC(rc);
+}
+
+IoT_Error_t aws_iot_shadow_demux_deinit(AWS_IoT_Shadow_Demux_t *pDemux) {
+	const IoT_Thing_Topic_t *pFilter;
+	IoT_Error_t rc;
+
+	FUNC_ENTRY;
+
+	if(NULL == pDemux || NULL == pDemux->pDispatcher) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	pFilter = &(pDemux->pTopics->topics[IOT_THING_TOPIC_SHADOW_ALL]);
+	rc = aws_iot_mqtt_dispatch_unsubscribe(pDemux->pDispatcher, pFilter->pTopic, pFilter->topicLen,
+										   _aws_iot_shadow_demux_on_message, pDemux);
+#ifdef _ENABLE_THREAD_SUPPORT_
+	(void) aws_iot_thread_mutex_destroy(&(pDemux->lock));
+#endif
+	pDemux->pDispatcher = NULL;
+
+	FUNC_EXIT_RC(rc);
+}
+
+IoT_Error_t aws_iot_shadow_demux_register_delta(AWS_IoT_Shadow_Demux_t *pDemux, jsonStruct_t *pStruct) {
+	IoT_Error_t rc = SUCCESS;
+
+	FUNC_ENTRY;
+
+	if(NULL == pDemux || NULL == pStruct || NULL == pStruct->pKey) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	_aws_iot_shadow_demux_lock(pDemux);
+	if(AWS_IOT_SHADOW_DEMUX_MAX_DELTAS <= pDemux->deltaKeys.keyCount) {
+		rc = MAX_SIZE_ERROR;
+	} else {
+		rc = aws_iot_shadow_keys_add(&(pDemux->deltaKeys), pStruct, SHADOW_DEMUX_DELTA_NO_ID);
+	}
+	_aws_iot_shadow_demux_unlock(pDemux);
+
+	FUNC_EXIT_RC(rc);
+}
+
+IoT_Error_t aws_iot_shadow_demux_register_delta_table(AWS_IoT_Shadow_Demux_t *pDemux, jsonStruct_t *pTable,
+													  const fpShadowDemuxDeltaParser_t *pParsers, uint8_t count,
+													  fpShadowDemuxDeltaCallback_t callback, void *pContext) {
+	IoT_Error_t rc = SUCCESS;
+	uint8_t i;
+
+	FUNC_ENTRY;
+
+	if(NULL == pDemux || NULL == pTable || NULL == callback) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	if(SHADOW_DEMUX_DELTA_NO_ID <= count) {
+		FUNC_EXIT_RC(MAX_SIZE_ERROR);
+	}
+
+	_aws_iot_shadow_demux_lock(pDemux);
+	pDemux->deltaCallback = callback;
+	pDemux->pDeltaContext = pContext;
+	pDemux->pDeltaParsers = pParsers;
+	for(i = 0; i < count && SUCCESS == rc; i++) {
+		if(NULL == pTable[i].cb || NULL == pTable[i].pKey) {
+			continue;
+		}
+		if(AWS_IOT_SHADOW_DEMUX_MAX_DELTAS <= pDemux->deltaKeys.keyCount) {
+			rc = MAX_SIZE_ERROR;
+		} else {
+			rc = aws_iot_shadow_keys_add(&(pDemux->deltaKeys), &(pTable[i]), i);
+		}
+	}
+	_aws_iot_shadow_demux_unlock(pDemux);
+
+	FUNC_EXIT_RC(rc);
+}
+
+static IoT_Thing_Topic_Id_t _aws_iot_shadow_demux_request_topic(ShadowActions_t action) {
+	switch(action) {
+		case SHADOW_GET:
+			return IOT_THING_TOPIC_SHADOW_GET;
+		case SHADOW_DELETE:
+			return IOT_THING_TOPIC_SHADOW_DELETE;
+		case SHADOW_UPDATE:
+		default:
+			return IOT_THING_TOPIC_SHADOW_UPDATE;
+	}
+}
+
+/* Publishes pJson to the request topic of action, waiting for the response under clientToken if there is a callback */
+static IoT_Error_t _aws_iot_shadow_demux_request(AWS_IoT_Shadow_Demux_t *pDemux, ShadowActions_t action,
+												 const char *pJson, const char *pClientToken,
+												 fpActionCallback_t callback, void *pContextData,
+												 uint8_t timeout_seconds) {
+	const IoT_Thing_Topic_t *pTopic = &(pDemux->pTopics->topics[_aws_iot_shadow_demux_request_topic(action)]);
+	IoT_Publish_Message_Params params;
+	IoT_Shadow_Ack_t ack;
+	IoT_Error_t rc;
+
+	/* registered before the publish, the response may come before aws_iot_mqtt_publish() returns */
+	if(NULL != callback) {
+		ack.action = action;
+		strncpy(ack.clientToken, pClientToken, sizeof(ack.clientToken) - 1);
+		ack.clientToken[sizeof(ack.clientToken) - 1] = '\0';
+		ack.callback = callback;
+		ack.pCallbackContext = pContextData;
+		ack.deadline_ms = aws_iot_mqtt_tap_now_ms() + (uint32_t) timeout_seconds * 1000;
+
+		_aws_iot_shadow_demux_lock(pDemux);
+		rc = aws_iot_shadow_acks_add(&(pDemux->acks), &ack);
+		_aws_iot_shadow_demux_unlock(pDemux);
+		if(SUCCESS != rc) {
+			return rc;
+		}
+	}
+
+	params.qos = QOS0;
+	params.isRetained = 0;
+	params.isDup = 0;
+	params.id = 0;
+	params.payload = (void *) pJson;
+	params.payloadLen = strlen(pJson);
+	rc = aws_iot_mqtt_publish(pDemux->pDispatcher->pClient, pTopic->pTopic, pTopic->topicLen, &params);
+
+	if(SUCCESS != rc && NULL != callback) {
+		_aws_iot_shadow_demux_lock(pDemux);
+		(void) aws_iot_shadow_acks_take(&(pDemux->acks), action, ack.clientToken, strlen(ack.clientToken), &ack);
+		_aws_iot_shadow_demux_unlock(pDemux);
+	}
+
+	return rc;
+}
+
+IoT_Error_t aws_iot_shadow_demux_update(AWS_IoT_Shadow_Demux_t *pDemux, const char *pJsonString,
+										fpActionCallback_t callback, void *pContextData, uint8_t timeout_seconds) {
+	char clientToken[MAX_SIZE_CLIENT_TOKEN_CLIENT_SEQUENCE] = {0};
+	IoT_Error_t rc;
+	int32_t count;
+	bool isTokenFound = false;
+
+	FUNC_ENTRY;
+
+	if(NULL == pDemux || NULL == pDemux->pDispatcher || NULL == pJsonString) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	if(NULL != callback) {
+		_aws_iot_shadow_demux_lock(pDemux);
+		count = _aws_iot_shadow_demux_parse(pDemux, pJsonString, strlen(pJsonString));
+		isTokenFound = (0 < count) && _aws_iot_shadow_demux_get_token(pDemux, pJsonString, count, clientToken,
+																		sizeof(clientToken));
+		_aws_iot_shadow_demux_unlock(pDemux);
+		if(!isTokenFound) {
+			FUNC_EXIT_RC(SHADOW_JSON_ERROR);
+		}
+	}
+
+	rc = _aws_iot_shadow_demux_request(pDemux, SHADOW_UPDATE, pJsonString, clientToken, callback, pContextData,
+									   timeout_seconds);
+
+	FUNC_EXIT_RC(rc);
+}
+
+/* get and delete carry only a clientToken */
+static IoT_Error_t _aws_iot_shadow_demux_token_request(AWS_IoT_Shadow_Demux_t *pDemux, ShadowActions_t action,
+													   fpActionCallback_t callback, void *pContextData,
+													   uint8_t timeout_seconds) {
+	char clientToken[MAX_SIZE_CLIENT_TOKEN_CLIENT_SEQUENCE];
+	char json[MAX_SIZE_CLIENT_TOKEN_CLIENT_SEQUENCE + 20];
+	uint32_t sequence;
+
+	_aws_iot_shadow_demux_lock(pDemux);
+	sequence = pDemux->tokenSequence++;
+	_aws_iot_shadow_demux_unlock(pDemux);
+
+	/* 'r' keeps these apart from the numbered tokens of aws_iot_finalize_json_document() */
+	(void) snprintf(clientToken, sizeof(clientToken), "%s-r%u", pDemux->pTopics->thingName, (unsigned) sequence);
+	(void) snprintf(json, sizeof(json), "{\"clientToken\":\"%s\"}", clientToken);
+
+	return _aws_iot_shadow_demux_request(pDemux, action, json, clientToken, callback, pContextData, timeout_seconds);
+}
+
+IoT_Error_t aws_iot_shadow_demux_get(AWS_IoT_Shadow_Demux_t *pDemux, fpActionCallback_t callback,
+									 void *pContextData, uint8_t timeout_seconds) {
+	IoT_Error_t rc;
+
+	FUNC_ENTRY;
+
+	if(NULL == pDemux || NULL == pDemux->pDispatcher) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	rc = _aws_iot_shadow_demux_token_request(pDemux, SHADOW_GET, callback, pContextData, timeout_seconds);
+
+	FUNC_EXIT_RC(rc);
+}
+
+IoT_Error_t aws_iot_shadow_demux_delete(AWS_IoT_Shadow_Demux_t *pDemux, fpActionCallback_t callback,
+										void *pContextData, uint8_t timeout_seconds) {
+	IoT_Error_t rc;
+
+	FUNC_ENTRY;
+
+	if(NULL == pDemux || NULL == pDemux->pDispatcher) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	rc = _aws_iot_shadow_demux_token_request(pDemux, SHADOW_DELETE, callback, pContextData, timeout_seconds);
+
+	FUNC_EXIT_RC(rc);
+}
+
+uint8_t aws_iot_shadow_demux_poll(AWS_IoT_Shadow_Demux_t *pDemux) {
+	IoT_Shadow_Ack_t expired;
+	uint32_t now_ms = aws_iot_mqtt_tap_now_ms();
+	uint8_t count = 0;
+	bool isExpired;
+
+	/* earliest deadline first, one at a time so the callback runs unlocked */
+	do {
+		_aws_iot_shadow_demux_lock(pDemux);
+		isExpired = aws_iot_shadow_acks_take_expired(&(pDemux->acks), now_ms, &expired);
+		if(isExpired) {
+			pDemux->stats.timeouts++;
+		}
+		_aws_iot_shadow_demux_unlock(pDemux);
+
+		if(isExpired) {
+			expired.callback(pDemux->pTopics->thingName, expired.action, SHADOW_ACK_TIMEOUT, NULL, expired.pCallbackContext);
+			count++;
+		}
+	} while(isExpired && UINT8_MAX > count);
+
+	return count;
+}
+
+void aws_iot_shadow_demux_get_stats(const AWS_IoT_Shadow_Demux_t *pDemux, IoT_Shadow_Demux_Stats_t *pStats) {
+	*pStats = pDemux->stats;
+}
+
+#ifdef __cplusplus
+}
+#endif
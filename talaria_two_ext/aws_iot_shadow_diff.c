@@ -0,0 +1,452 @@
+/**
+  *****************************************************************************
+  * @file   aws_iot_shadow_diff.c
+  *
+  *****************************************************************************
+  * @attention
+  *
+  *
+  *  Copyright (c) 2022, InnoPhase, Inc.
+  *
+  *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  *  POSSIBILITY OF SUCH DAMAGE.
+  *
+  *****************************************************************************
+  */
+
+/**
+ * @file aws_iot_shadow_diff.c
+ * @brief Merge-patch shadow documents against the last accepted state
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+#include "aws_iot_log.h"
+#include "aws_iot_shadow_diff.h"
+
+/* Text being appended to the document buffer */
+typedef struct {
+	char *pBuffer;
+	size_t size;
+	size_t len;
+	bool isTruncated;
+} _IoT_Shadow_Diff_Out_t;
+
+static void _aws_iot_shadow_diff_append(_IoT_Shadow_Diff_Out_t *pOut, const char *pText, size_t len) {
+	if(pOut->isTruncated || pOut->len + len >= pOut->size) {
+		pOut->isTruncated = true;
+		return;
+	}
+	memcpy(&(pOut->pBuffer[pOut->len]), pText, len);
+	pOut->len += len;
+	pOut->pBuffer[pOut->len] = '\0';
+}
+
+static void _aws_iot_shadow_diff_append_key(_IoT_Shadow_Diff_Out_t *pOut, const char *pKey, size_t keyLen) {
+	_aws_iot_shadow_diff_append(pOut, "\"", 1);
+	_aws_iot_shadow_diff_append(pOut, pKey, keyLen);
+	_aws_iot_shadow_diff_append(pOut, "\":", 2);
+}
+
+/* Writes the value at token t as it is in pJson, quotes of strings included */
+static void _aws_iot_shadow_diff_append_token(_IoT_Shadow_Diff_Out_t *pOut, const char *pJson, const jsmntok_t *pToken) {
+	bool isString = (JSMN_STRING == pToken->type);
+
+	if(isString) {
+		_aws_iot_shadow_diff_append(pOut, "\"", 1);
+	}
+	_aws_iot_shadow_diff_append(pOut, &(pJson[pToken->start]), (size_t) (pToken->end - pToken->start));
+	if(isString) {
+		_aws_iot_shadow_diff_append(pOut, "\"", 1);
+	}
+}
+
+/* Text of a value as aws_iot_shadow_add_reported() writes it. False if it does not fit. */
+static bool _aws_iot_shadow_diff_to_text(const jsonStruct_t *pStruct, char *pText, size_t size) {
+	int len;
+
+	switch(pStruct->type) {
+		case SHADOW_JSON_INT32:
+			len = snprintf(pText, size, "%i", (int) *(const int32_t *) pStruct->pData);
+			break;
+		case SHADOW_JSON_INT16:
+			len = snprintf(pText, size, "%hi", *(const int16_t *) pStruct->pData);
+			break;
+		case SHADOW_JSON_INT8:
+			len = snprintf(pText, size, "%hhi", *(const int8_t *) pStruct->pData);
+			break;
+		case SHADOW_JSON_UINT32:
+			len = snprintf(pText, size, "%u", (unsigned) *(const uint32_t *) pStruct->pData);
+			break;
+		case SHADOW_JSON_UINT16:
+			len = snprintf(pText, size, "%hu", *(const uint16_t *) pStruct->pData);
+			break;
+		case SHADOW_JSON_UINT8:
+			len = snprintf(pText, size, "%hhu", *(const uint8_t *) pStruct->pData);
+			break;
+		case SHADOW_JSON_DOUBLE:
+			len = snprintf(pText, size, "%f", *(const double *) pStruct->pData);
+			break;
+		case SHADOW_JSON_FLOAT:
+			len = snprintf(pText, size, "%f", *(const float *) pStruct->pData);
+			break;
+		case SHADOW_JSON_BOOL:
+			len = snprintf(pText, size, "%s", *(const bool *) pStruct->pData ? "true" : "false");
+			break;
+		case SHADOW_JSON_STRING:
+			len = snprintf(pText, size, "\"%s\"", (const char *) pStruct->pData);
+			break;
+		case SHADOW_JSON_OBJECT:
+			len = snprintf(pText, size, "%s", (const char *) pStruct->pData);
+			break;
+		default:
+			return false;
+	}
+	return 0 <= len && (size_t) len < size;
+}
+
+/* Index of the token after the value starting at token i, nested tokens included */
+static int32_t _aws_iot_shadow_diff_skip(const jsmntok_t *pTokens, int32_t i, int32_t count) {
+	int32_t end = pTokens[i].end;
+
+	i++;
+	while(i < count && pTokens[i].start < end) {
+		i++;
+	}
+	return i;
+}
+
+/* Token of the value of the key at token key of pKeyJson in the object at token parent, -1 if absent */
+static int32_t _aws_iot_shadow_diff_find_key(const char *pJson, const jsmntok_t *pTokens, int32_t parent,
+											 int32_t count, const char *pKeyJson, const jsmntok_t *pKey) {
+	size_t keyLen = (size_t) (pKey->end - pKey->start);
+	int32_t i = parent + 1;
+
+	while(i + 1 < count && pTokens[i].start < pTokens[parent].end) {
+		if(JSMN_STRING == pTokens[i].type && keyLen == (size_t) (pTokens[i].end - pTokens[i].start) &&
+		   0 == strncmp(&(pJson[pTokens[i].start]), &(pKeyJson[pKey->start]), keyLen)) {
+			return i + 1;
+		}
+		i = _aws_iot_shadow_diff_skip(pTokens, i + 1, count);
+	}
+	return -1;
+}
+
+static bool _aws_iot_shadow_diff_is_same_token(const char *pA, const jsmntok_t *pTokenA, const char *pB,
+											   const jsmntok_t *pTokenB) {
+	size_t len = (size_t) (pTokenA->end - pTokenA->start);
+
+	return pTokenA->type == pTokenB->type && len == (size_t) (pTokenB->end - pTokenB->start) &&
+		   0 == strncmp(&(pA[pTokenA->start]), &(pB[pTokenB->start]), len);
+}
+
+/* Writes the merge-patch from the acked object at token a to the current object at token c.
+ * Returns the number of keys written, the object braces are written even when it is 0. */
+static uint32_t _aws_iot_shadow_diff_patch(AWS_IoT_Shadow_Diff_t *pDiff, _IoT_Shadow_Diff_Out_t *pOut,
+										   const char *pCurrent, int32_t c, int32_t currentCount,
+										   const char *pAcked, int32_t a, int32_t ackedCount) {
+	const jsmntok_t *pCurrentTokens = pDiff->currentTokens;
+	const jsmntok_t *pAckedTokens = pDiff->ackedTokens;
+	size_t keyStart;
+	uint32_t keys = 0;
+	int32_t i;
+	int32_t v;
+
+	_aws_iot_shadow_diff_append(pOut, "{", 1);
+
+	/* keys added or changed */
+	i = c + 1;
+	while(i + 1 < currentCount && pCurrentTokens[i].start < pCurrentTokens[c].end) {
+		v = _aws_iot_shadow_diff_find_key(pAcked, pAckedTokens, a, ackedCount, pCurrent, &(pCurrentTokens[i]));
+		if(0 > v || !_aws_iot_shadow_diff_is_same_token(pCurrent, &(pCurrentTokens[i + 1]), pAcked,
+														  &(pAckedTokens[v]))) {
+			keyStart = pOut->len;
+			if(0 < keys) {
+				_aws_iot_shadow_diff_append(pOut, ",", 1);
+			}
+			_aws_iot_shadow_diff_append_key(pOut, &(pCurrent[pCurrentTokens[i].start]),
+											(size_t) (pCurrentTokens[i].end - pCurrentTokens[i].start));
+			if(0 <= v && JSMN_OBJECT == pCurrentTokens[i + 1].type && JSMN_OBJECT == pAckedTokens[v].type) {
+				if(0 == _aws_iot_shadow_diff_patch(pDiff, pOut, pCurrent, i + 1, currentCount, pAcked, v,
+												   ackedCount)) {
+					/* same keys and values, written differently */
+					pOut->len = keyStart;
+					pOut->pBuffer[pOut->len] = '\0';
+					i = _aws_iot_shadow_diff_skip(pCurrentTokens, i + 1, currentCount);
+					continue;
+				}
+			} else {
+				_aws_iot_shadow_diff_append_token(pOut, pCurrent, &(pCurrentTokens[i + 1]));
+			}
+			keys++;
+		}
+		i = _aws_iot_shadow_diff_skip(pCurrentTokens, i + 1, currentCount);
+	}
+
+	/* keys removed */
+	i = a + 1;
+	while(i + 1 < ackedCount && pAckedTokens[i].start < pAckedTokens[a].end) {
+		if(0 > _aws_iot_shadow_diff_find_key(pCurrent, pCurrentTokens, c, currentCount, pAcked,
+											 &(pAckedTokens[i]))) {
+			if(0 < keys) {
+				_aws_iot_shadow_diff_append(pOut, ",", 1);
+			}
+			_aws_iot_shadow_diff_append_key(pOut, &(pAcked[pAckedTokens[i].start]),
+											(size_t) (pAckedTokens[i].end - pAckedTokens[i].start));
+			_aws_iot_shadow_diff_append(pOut, "null", 4);
+			keys++;
+		}
+		i = _aws_iot_shadow_diff_skip(pAckedTokens, i + 1, ackedCount);
+	}
+
+	_aws_iot_shadow_diff_append(pOut, "}", 1);
+	return keys;
+}
+
+static int32_t _aws_iot_shadow_diff_parse(AWS_IoT_Shadow_Diff_t *pDiff, const char *pJson, jsmntok_t *pTokens) {
+	int32_t count;
+
+	jsmn_init(&(pDiff->parser));
+	count = jsmn_parse(&(pDiff->parser), pJson, (unsigned int) strlen(pJson), pTokens, AWS_IOT_SHADOW_DIFF_MAX_TOKENS);
+	if(1 > count || JSMN_OBJECT != pTokens[0].type) {
+		return -1;
+	}
+	return count;
+}
+
+/* Writes "key":value for an attribute that changed. False if it did not. */
+static bool _aws_iot_shadow_diff_write_attribute(AWS_IoT_Shadow_Diff_t *pDiff, IoT_Shadow_Diff_Attribute_t *pAttribute,
+												 _IoT_Shadow_Diff_Out_t *pOut) {
+	const jsonStruct_t *pStruct = pAttribute->pStruct;
+	size_t keyStart = pOut->len;
+	int32_t currentCount;
+	int32_t ackedCount;
+
+	pAttribute->isPending = _aws_iot_shadow_diff_to_text(pStruct, pAttribute->pending, sizeof(pAttribute->pending));
+
+	if(pAttribute->isPending && pAttribute->isAcked && 0 == strcmp(pAttribute->pending, pAttribute->acked)) {
+		return false;
+	}
+
+	_aws_iot_shadow_diff_append_key(pOut, pStruct->pKey, strlen(pStruct->pKey));
+
+	if(SHADOW_JSON_OBJECT == pStruct->type && pAttribute->isPending && pAttribute->isAcked) {
+		currentCount = _aws_iot_shadow_diff_parse(pDiff, pAttribute->pending, pDiff->currentTokens);
+		ackedCount = _aws_iot_shadow_diff_parse(pDiff, pAttribute->acked, pDiff->ackedTokens);
+		if(0 < currentCount && 0 < ackedCount) {
+			if(0 == _aws_iot_shadow_diff_patch(pDiff, pOut, pAttribute->pending, 0, currentCount, pAttribute->acked,
+											   0, ackedCount)) {
+				pOut->len = keyStart;
+				pOut->pBuffer[pOut->len] = '\0';
+				return false;
+			}
+			_aws_iot_shadow_diff_append(pOut, ",", 1);
+			return true;
+		}
+	}
+
+	if(pAttribute->isPending) {
+		_aws_iot_shadow_diff_append(pOut, pAttribute->pending, strlen(pAttribute->pending));
+	} else if(SHADOW_JSON_STRING == pStruct->type) {
+		/* too long for a snapshot, written whole */
+		_aws_iot_shadow_diff_append(pOut, "\"", 1);
+		_aws_iot_shadow_diff_append(pOut, (const char *) pStruct->pData, strlen((const char *) pStruct->pData));
+		_aws_iot_shadow_diff_append(pOut, "\"", 1);
+	} else {
+		_aws_iot_shadow_diff_append(pOut, (const char *) pStruct->pData, strlen((const char *) pStruct->pData));
+	}
+	_aws_iot_shadow_diff_append(pOut, ",", 1);
+	return true;
+}
+
+/* Bytes of "key":value, for an attribute written whole */
+static size_t _aws_iot_shadow_diff_full_len(const IoT_Shadow_Diff_Attribute_t *pAttribute) {
+	const jsonStruct_t *pStruct = pAttribute->pStruct;
+	size_t len = strlen(pStruct->pKey) + 4;
+
+	if(pAttribute->isPending) {
+		return len + strlen(pAttribute->pending);
+	}
+	return len + strlen((const char *) pStruct->pData) + ((SHADOW_JSON_STRING == pStruct->type) ? 2 : 0);
+}
+
+IoT_Error_t aws_iot_shadow_diff_init(AWS_IoT_Shadow_Diff_t *pDiff, IoT_Shadow_Diff_Section_t section) {
+	FUNC_ENTRY;
+
+	if(NULL == pDiff) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	memset(pDiff, 0, sizeof(AWS_IoT_Shadow_Diff_t));
+	pDiff->section = section;
+
+	FUNC_EXIT_RC(SUCCESS);
+}
+
+IoT_Error_t aws_iot_shadow_diff_add(AWS_IoT_Shadow_Diff_t *pDiff, jsonStruct_t *pStruct) {
+	IoT_Shadow_Diff_Attribute_t *pAttribute;
+
+	FUNC_ENTRY;
+
+	if(NULL == pDiff || NULL == pStruct || NULL == pStruct->pKey || NULL == pStruct->pData) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	if(AWS_IOT_SHADOW_DIFF_MAX_ATTRIBUTES <= pDiff->attributeCount) {
+		FUNC_EXIT_RC(MAX_SIZE_ERROR);
+	}
+
+	pAttribute = &(pDiff->attributes[pDiff->attributeCount++]);
+	memset(pAttribute, 0, sizeof(IoT_Shadow_Diff_Attribute_t));
+	pAttribute->pStruct = pStruct;
+
+	FUNC_EXIT_RC(SUCCESS);
+}
+
+IoT_Error_t aws_iot_shadow_diff_add_patch(AWS_IoT_Shadow_Diff_t *pDiff, char *pJsonDocument,
+										  size_t maxSizeOfJsonDocument, uint8_t *pCount) {
+	_IoT_Shadow_Diff_Out_t out;
+	const char *pSection;
+	size_t start;
+	size_t fullLen;
+	uint8_t count = 0;
+	bool isWritten;
+	uint8_t i;
+
+	FUNC_ENTRY;
+
+	if(NULL == pDiff || NULL == pJsonDocument || NULL == pCount) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	*pCount = 0;
+
+	if(pDiff->isInFlight) {
+		FUNC_EXIT_RC(SHADOW_DIFF_IN_FLIGHT_ERROR);
+	}
+
+	start = strlen(pJsonDocument);
+	out.pBuffer = pJsonDocument;
+	out.size = maxSizeOfJsonDocument;
+	out.len = start;
+	out.isTruncated = false;
+
+	pSection = (IOT_SHADOW_DIFF_DESIRED == pDiff->section) ? "\"desired\":{" : "\"reported\":{";
+	_aws_iot_shadow_diff_append(&out, pSection, strlen(pSection));
+	fullLen = strlen(pSection) + 1;
+
+	for(i = 0; i < pDiff->attributeCount; i++) {
+		isWritten = _aws_iot_shadow_diff_write_attribute(pDiff, &(pDiff->attributes[i]), &out);
+		fullLen += _aws_iot_shadow_diff_full_len(&(pDiff->attributes[i]));
+		if(isWritten) {
+			count++;
+		} else {
+			/* already in the shadow, nothing to send again */
+			pDiff->attributes[i].isPending = false;
+		}
+	}
+
+	if(out.isTruncated) {
+		if(start < maxSizeOfJsonDocument) {
+			pJsonDocument[start] = '\0';
+		}
+		for(i = 0; i < pDiff->attributeCount; i++) {
+			pDiff->attributes[i].isPending = false;
+		}
+		FUNC_EXIT_RC(SHADOW_JSON_BUFFER_TRUNCATED);
+	}
+
+	pDiff->stats.fullBytes += (uint32_t) fullLen;
+	pDiff->stats.unchanged += (uint32_t) (pDiff->attributeCount - count);
+
+	if(0 == count) {
+		pJsonDocument[start] = '\0';
+		pDiff->stats.skipped++;
+		FUNC_EXIT_RC(SUCCESS);
+	}
+
+	/* the comma after the last attribute closes the section, as aws_iot_shadow_add_reported() does */
+	pJsonDocument[out.len - 1] = '}';
+	_aws_iot_shadow_diff_append(&out, ",", 1);
+	if(out.isTruncated) {
+		pJsonDocument[start] = '\0';
+		for(i = 0; i < pDiff->attributeCount; i++) {
+			pDiff->attributes[i].isPending = false;
+		}
+		FUNC_EXIT_RC(SHADOW_JSON_BUFFER_TRUNCATED);
+	}
+
+	pDiff->isInFlight = true;
+	pDiff->stats.documents++;
+	pDiff->stats.written += count;
+	pDiff->stats.patchBytes += (uint32_t) (out.len - start);
+	*pCount = count;
+
+	FUNC_EXIT_RC(SUCCESS);
+}
+
+void aws_iot_shadow_diff_commit(AWS_IoT_Shadow_Diff_t *pDiff) {
+	IoT_Shadow_Diff_Attribute_t *pAttribute;
+	uint8_t i;
+
+	if(!pDiff->isInFlight) {
+		return;
+	}
+
+	for(i = 0; i < pDiff->attributeCount; i++) {
+		pAttribute = &(pDiff->attributes[i]);
+		if(pAttribute->isPending) {
+			memcpy(pAttribute->acked, pAttribute->pending, sizeof(pAttribute->acked));
+			pAttribute->isAcked = true;
+			pAttribute->isPending = false;
+		}
+	}
+	pDiff->isInFlight = false;
+	pDiff->stats.commits++;
+}
+
+void aws_iot_shadow_diff_discard(AWS_IoT_Shadow_Diff_t *pDiff) {
+	uint8_t i;
+
+	if(!pDiff->isInFlight) {
+		return;
+	}
+
+	for(i = 0; i < pDiff->attributeCount; i++) {
+		pDiff->attributes[i].isPending = false;
+	}
+	pDiff->isInFlight = false;
+	pDiff->stats.discards++;
+}
+
+void aws_iot_shadow_diff_reset(AWS_IoT_Shadow_Diff_t *pDiff) {
+	uint8_t i;
+
+	for(i = 0; i < pDiff->attributeCount; i++) {
+		pDiff->attributes[i].isAcked = false;
+		pDiff->attributes[i].isPending = false;
+	}
+	pDiff->isInFlight = false;
+}
+
+void aws_iot_shadow_diff_get_stats(const AWS_IoT_Shadow_Diff_t *pDiff, IoT_Shadow_Diff_Stats_t *pStats) {
+	*pStats = pDiff->stats;
+}
+
+#ifdef __cplusplus
+}
+#endif
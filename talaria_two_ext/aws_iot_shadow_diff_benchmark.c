@@ -0,0 +1,186 @@
+/**
+  *****************************************************************************
+  * @file   aws_iot_shadow_diff_benchmark.c
+  *
+  *****************************************************************************
+  * @attention
+  *
+  *
+  *  Copyright (c) 2022, InnoPhase, Inc.
+  *
+  *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  *  POSSIBILITY OF SUCH DAMAGE.
+  *
+  *****************************************************************************
+  */
+
+/**
+ * @file aws_iot_shadow_diff_benchmark.c
+ * @brief Merge-patch documents against documents holding every attribute
+ *
+ * Built only with -DAWS_IOT_SHADOW_DIFF_BENCHMARK.
+ */
+
+#ifdef AWS_IOT_SHADOW_DIFF_BENCHMARK
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+#include <kernel/os.h>
+
+#include "aws_iot_log.h"
+#include "aws_iot_shadow_diff.h"
+#include "aws_iot_shadow_interface.h"
+#include "memory_platform.h"
+
+#define BENCHMARK_DOCUMENT_LEN 512
+#define BENCHMARK_CONFIG_LEN   96
+
+typedef struct {
+	AWS_IoT_Shadow_Diff_t diff;
+	char patchDocument[BENCHMARK_DOCUMENT_LEN];
+	char fullDocument[BENCHMARK_DOCUMENT_LEN];
+	char config[BENCHMARK_CONFIG_LEN];
+	char firmware[16];
+} _IoT_Benchmark_State_t;
+
+/* Readings of a sensor node: temperature moves at every step, the rest now and then */
+static void _benchmark_step(_IoT_Benchmark_State_t *pState, uint32_t n, float *pTemperature, float *pHumidity,
+							int32_t *pPressure, bool *pSwitch, uint32_t *pInterval) {
+	*pTemperature = 21.5f + (float) ((n * 7) % 11) * 0.1f;
+	if(0 == n % 3) {
+		*pHumidity = 40.0f + (float) ((n / 3) % 5);
+	}
+	if(0 == n % 5) {
+		*pPressure = 1013 + (int32_t) ((n / 5) % 3);
+	}
+	if(0 == n % 20) {
+		*pSwitch = !*pSwitch;
+	}
+	if(0 == n % 50) {
+		*pInterval = (0 == (n / 50) % 2) ? 1000 : 5000;
+	}
+	if(0 == n % 100) {
+		snprintf(pState->firmware, sizeof(pState->firmware), "2.%u.0", (unsigned) (n / 100));
+	}
+	if(0 == n % 10) {
+		/* a brightness edit, and now and then the low alarm dropped */
+		if(0 == n % 40) {
+			snprintf(pState->config, sizeof(pState->config),
+					 "{\"display\":{\"brightness\":%u,\"units\":\"C\"},\"alarm\":{\"high\":30},\"mode\":\"auto\"}",
+					 (unsigned) (60 + (n / 10) % 4 * 10));
+		} else {
+			snprintf(pState->config, sizeof(pState->config),
+					 "{\"display\":{\"brightness\":%u,\"units\":\"C\"},\"alarm\":{\"high\":30,\"low\":5},"
+					 "\"mode\":\"auto\"}", (unsigned) (60 + (n / 10) % 4 * 10));
+		}
+	}
+}
+
+void aws_iot_shadow_diff_benchmark(uint32_t steps) {
+	_IoT_Benchmark_State_t *pState;
+	float temperature = 0.0f;
+	float humidity = 0.0f;
+	int32_t pressure = 0;
+	bool sensorSwitch = false;
+	uint32_t interval = 0;
+	jsonStruct_t temperatureHandler = {"temperature", &temperature, sizeof(float), SHADOW_JSON_FLOAT, NULL};
+	jsonStruct_t humidityHandler = {"humidity", &humidity, sizeof(float), SHADOW_JSON_FLOAT, NULL};
+	jsonStruct_t pressureHandler = {"pressure", &pressure, sizeof(int32_t), SHADOW_JSON_INT32, NULL};
+	jsonStruct_t switchHandler = {"sensorSwitch", &sensorSwitch, sizeof(bool), SHADOW_JSON_BOOL, NULL};
+	jsonStruct_t intervalHandler = {"sensorPollInterval", &interval, sizeof(uint32_t), SHADOW_JSON_UINT32, NULL};
+	jsonStruct_t firmwareHandler = {"firmware", NULL, 0, SHADOW_JSON_STRING, NULL};
+	jsonStruct_t configHandler = {"config", NULL, 0, SHADOW_JSON_OBJECT, NULL};
+	IoT_Shadow_Diff_Stats_t stats;
+	uint32_t patchBytes = 0;
+	uint32_t fullBytes = 0;
+	uint32_t errors = 0;
+	uint64_t start;
+	uint64_t patch_us = 0;
+	uint64_t full_us = 0;
+	uint8_t count = 0;
+	uint32_t n;
+
+	pState = aws_iot_platform_malloc(sizeof(_IoT_Benchmark_State_t));
+	if(NULL == pState) {
+		IOT_ERROR("shadow diff benchmark: out of memory");
+		return;
+	}
+
+	firmwareHandler.pData = pState->firmware;
+	firmwareHandler.dataLength = sizeof(pState->firmware);
+	configHandler.pData = pState->config;
+	configHandler.dataLength = sizeof(pState->config);
+
+	(void) aws_iot_shadow_diff_init(&(pState->diff), IOT_SHADOW_DIFF_REPORTED);
+	(void) aws_iot_shadow_diff_add(&(pState->diff), &temperatureHandler);
+	(void) aws_iot_shadow_diff_add(&(pState->diff), &humidityHandler);
+	(void) aws_iot_shadow_diff_add(&(pState->diff), &pressureHandler);
+	(void) aws_iot_shadow_diff_add(&(pState->diff), &switchHandler);
+	(void) aws_iot_shadow_diff_add(&(pState->diff), &intervalHandler);
+	(void) aws_iot_shadow_diff_add(&(pState->diff), &firmwareHandler);
+	(void) aws_iot_shadow_diff_add(&(pState->diff), &configHandler);
+
+	for(n = 0; n < steps; n++) {
+		_benchmark_step(pState, n, &temperature, &humidity, &pressure, &sensorSwitch, &interval);
+
+		start = os_systime64();
+		if(SUCCESS != aws_iot_shadow_init_json_document(pState->fullDocument, BENCHMARK_DOCUMENT_LEN) ||
+		   SUCCESS != aws_iot_shadow_add_reported(pState->fullDocument, BENCHMARK_DOCUMENT_LEN, 7,
+												  &temperatureHandler, &humidityHandler, &pressureHandler,
+												  &switchHandler, &intervalHandler, &firmwareHandler,
+												  &configHandler)) {
+			errors++;
+		}
+		full_us += os_systime64() - start;
+		fullBytes += (uint32_t) strlen(pState->fullDocument);
+
+		start = os_systime64();
+		if(SUCCESS != aws_iot_shadow_init_json_document(pState->patchDocument, BENCHMARK_DOCUMENT_LEN) ||
+		   SUCCESS != aws_iot_shadow_diff_add_patch(&(pState->diff), pState->patchDocument, BENCHMARK_DOCUMENT_LEN,
+													&count)) {
+			errors++;
+		}
+		patch_us += os_systime64() - start;
+		if(0 < count) {
+			patchBytes += (uint32_t) strlen(pState->patchDocument);
+			/* every update accepted */
+			aws_iot_shadow_diff_commit(&(pState->diff));
+		}
+	}
+
+	aws_iot_shadow_diff_get_stats(&(pState->diff), &stats);
+
+	os_printf("\nshadow diff benchmark: 7 attributes, %u steps\n", (unsigned) steps);
+	os_printf("  full documents:  %u bytes, %u us\n", (unsigned) fullBytes, (unsigned) full_us);
+	os_printf("  patch documents: %u bytes, %u us, %u sent, %u skipped\n", (unsigned) patchBytes,
+			  (unsigned) patch_us, (unsigned) stats.documents, (unsigned) stats.skipped);
+	os_printf("  attributes: %u written, %u left out\n", (unsigned) stats.written, (unsigned) stats.unchanged);
+	if(0 < fullBytes) {
+		os_printf("  saved: %u%%\n", (unsigned) (100 - (uint64_t) patchBytes * 100 / fullBytes));
+	}
+	if(0 < errors) {
+		IOT_ERROR("shadow diff benchmark: %u documents not built", (unsigned) errors);
+	}
+
+	aws_iot_platform_free(pState);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AWS_IOT_SHADOW_DIFF_BENCHMARK */
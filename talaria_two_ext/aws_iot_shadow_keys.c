@@ -0,0 +1,146 @@
+/**
+  *****************************************************************************
+  * @file   aws_iot_shadow_keys.c
+  *
+  *****************************************************************************
+  * @attention
+  *
+  *
+  *  Copyright (c) 2022, InnoPhase, Inc.
+  *
+  *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  *  POSSIBILITY OF SUCH DAMAGE.
+  *
+  *****************************************************************************
+  */
+
+/**
+ * @file aws_iot_shadow_keys.c
+ * @brief Key lookup of shadow attributes
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <string.h>
+
+#include "aws_iot_log.h"
+#include "aws_iot_shadow_keys.h"
+
+/* Order of the index: by length first, so most comparisons stop there */
+static int _aws_iot_shadow_keys_compare(const IoT_Shadow_Key_t *pEntry, const char *pKey, size_t keyLen) {
+	if(pEntry->keyLen != keyLen) {
+		return (pEntry->keyLen < keyLen) ? -1 : 1;
+	}
+	return memcmp(pEntry->pStruct->pKey, pKey, keyLen);
+}
+
+/* Position of the key, or where it would be inserted. *pIsFound tells which. */
+static uint8_t _aws_iot_shadow_keys_search(const AWS_IoT_Shadow_Keys_t *pKeys, const char *pKey, size_t keyLen,
+										   bool *pIsFound) {
+	uint8_t low = 0;
+	uint8_t high = pKeys->keyCount;
+	uint8_t middle;
+	int cmp;
+
+	while(low < high) {
+		middle = (uint8_t) ((low + high) / 2);
+		cmp = _aws_iot_shadow_keys_compare(&(pKeys->keys[middle]), pKey, keyLen);
+		if(0 == cmp) {
+			*pIsFound = true;
+			return middle;
+		}
+		if(0 > cmp) {
+			low = (uint8_t) (middle + 1);
+		} else {
+			high = middle;
+		}
+	}
+	*pIsFound = false;
+	return low;
+}
+
+IoT_Error_t aws_iot_shadow_keys_init(AWS_IoT_Shadow_Keys_t *pKeys) {
+	FUNC_ENTRY;
+
+	if(NULL == pKeys) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	memset(pKeys, 0, sizeof(AWS_IoT_Shadow_Keys_t));
+
+	FUNC_EXIT_RC(SUCCESS);
+}
+
+IoT_Error_t aws_iot_shadow_keys_add(AWS_IoT_Shadow_Keys_t *pKeys, jsonStruct_t *pStruct, uint8_t id) {
+	size_t keyLen;
+	bool isFound;
+	uint8_t at;
+
+	FUNC_ENTRY;
+
+	if(NULL == pKeys || NULL == pStruct || NULL == pStruct->pKey) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	if(AWS_IOT_SHADOW_KEYS_MAX_ATTRIBUTES <= pKeys->keyCount) {
+		FUNC_EXIT_RC(MAX_SIZE_ERROR);
+	}
+
+	keyLen = strlen(pStruct->pKey);
+	at = _aws_iot_shadow_keys_search(pKeys, pStruct->pKey, keyLen, &isFound);
+	if(isFound) {
+		IOT_WARN("Shadow key %s added twice", pStruct->pKey);
+		FUNC_EXIT_RC(FAILURE);
+	}
+
+	memmove(&(pKeys->keys[at + 1]), &(pKeys->keys[at]), (size_t) (pKeys->keyCount - at) * sizeof(IoT_Shadow_Key_t));
+	pKeys->keys[at].pStruct = pStruct;
+	pKeys->keys[at].keyLen = (uint16_t) keyLen;
+	pKeys->keys[at].id = id;
+	pKeys->keyCount++;
+
+	FUNC_EXIT_RC(SUCCESS);
+}
+
+IoT_Error_t aws_iot_shadow_keys_add_table(AWS_IoT_Shadow_Keys_t *pKeys, jsonStruct_t *pTable, uint8_t count,
+										  bool isDeltaOnly) {
+	IoT_Error_t rc = SUCCESS;
+	uint8_t i;
+
+	FUNC_ENTRY;
+
+	if(NULL == pTable) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	for(i = 0; i < count && SUCCESS == rc; i++) {
+		if(!isDeltaOnly || NULL != pTable[i].cb) {
+			rc = aws_iot_shadow_keys_add(pKeys, &(pTable[i]), i);
+		}
+	}
+
+	FUNC_EXIT_RC(rc);
+}
+
+const IoT_Shadow_Key_t *aws_iot_shadow_keys_find(const AWS_IoT_Shadow_Keys_t *pKeys, const char *pKey,
+												 size_t keyLen) {
+	bool isFound;
+	uint8_t at = _aws_iot_shadow_keys_search(pKeys, pKey, keyLen, &isFound);
+
+	return isFound ? &(pKeys->keys[at]) : NULL;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,685 @@
+/**
+  *****************************************************************************
+  * @file   aws_iot_shadow_mirror.c
+  *
+  *****************************************************************************
+  * @attention
+  *
+  *
+  *  Copyright (c) 2022, InnoPhase, Inc.
+  *
+  *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  *  POSSIBILITY OF SUCH DAMAGE.
+  *
+  *****************************************************************************
+  */
+
+/**
+ * @file aws_iot_shadow_mirror.c
+ * @brief Local mirror of the shadow state, with version tracking
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <string.h>
+
+#include "aws_iot_file_utils.h"
+#include "aws_iot_log.h"
+#include "aws_iot_mqtt_client_tap.h"
+#include "aws_iot_shadow_mirror.h"
+#include "fs_utils.h"
+#include "memory_platform.h"
+
+#define MIRROR_MAGIC          0xA9
+#define MIRROR_FORMAT         1
+#define MIRROR_CHECKSUM_POS   2
+#define MIRROR_VERSION_KNOWN  0x01
+#define MIRROR_REPORTED_KNOWN 0x01
+#define MIRROR_DESIRED_KNOWN  0x02
+
+#define MIRROR_NOT_FOUND      404
+
+/* "%f" text of the largest float. Longer doubles are compared byte for byte. */
+#define MIRROR_NUMBER_TEXT_LEN 48
+
+const IoT_Shadow_Mirror_Params_t iotShadowMirrorParamsDefault = {NULL, AWS_IOT_SHADOW_MIRROR_SAVE_INTERVAL_MS};
+
+typedef struct {
+	jsonStruct_t *pStruct;
+	const char *pValue;
+	uint32_t valueLen;
+} _IoT_Shadow_Mirror_Delta_Call_t;
+
+static void _aws_iot_shadow_mirror_put32(unsigned char *p, uint32_t v) {
+	p[0] = (unsigned char) (v & 0xFF);
+	p[1] = (unsigned char) ((v >> 8) & 0xFF);
+	p[2] = (unsigned char) ((v >> 16) & 0xFF);
+	p[3] = (unsigned char) (v >> 24);
+}
+
+static uint32_t _aws_iot_shadow_mirror_get32(const unsigned char *p) {
+	return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static uint8_t _aws_iot_shadow_mirror_checksum(const unsigned char *pImage, size_t len) {
+	uint8_t sum = 0;
+	size_t i;
+
+	for(i = 0; i < len; i++) {
+		if(MIRROR_CHECKSUM_POS != i) {
+			sum = (uint8_t) (sum + pImage[i]);
+		}
+	}
+	return (uint8_t) ~sum;
+}
+
+/* FNV-1a */
+static uint32_t _aws_iot_shadow_mirror_hash(const char *pString) {
+	uint32_t hash = 2166136261u;
+
+	while('\0' != *pString) {
+		hash ^= (uint8_t) *pString++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static IoT_Shadow_Mirror_Attribute_t *_aws_iot_shadow_mirror_find(AWS_IoT_Shadow_Mirror_t *pMirror,
+																   const jsonStruct_t *pStruct) {
+	uint8_t i;
+
+	for(i = 0; i < pMirror->attributeCount; i++) {
+		if(pStruct == pMirror->attributes[i].pStruct) {
+			return &(pMirror->attributes[i]);
+		}
+	}
+	return NULL;
+}
+
+/* Index of the token after the value starting at token i, nested tokens included */
+static int32_t _aws_iot_shadow_mirror_skip(const AWS_IoT_Shadow_Mirror_t *pMirror, int32_t i, int32_t count) {
+	int32_t end = pMirror->tokens[i].end;
+
+	i++;
+	while(i < count && pMirror->tokens[i].start < end) {
+		i++;
+	}
+	return i;
+}
+
+/* Token of the value of key in the object at token parent, -1 if absent */
+static int32_t _aws_iot_shadow_mirror_find_key(AWS_IoT_Shadow_Mirror_t *pMirror, const char *pJson, int32_t parent,
+											   int32_t count, const char *pKey) {
+	int32_t i = parent + 1;
+
+	if(0 > parent || JSMN_OBJECT != pMirror->tokens[parent].type) {
+		return -1;
+	}
+
+	while(i + 1 < count && pMirror->tokens[i].start < pMirror->tokens[parent].end) {
+		if(0 == jsoneq(pJson, &(pMirror->tokens[i]), pKey)) {
+			return i + 1;
+		}
+		i = _aws_iot_shadow_mirror_skip(pMirror, i + 1, count);
+	}
+	return -1;
+}
+
+/* Reads the value at pToken into pValue, in the binary form of pStruct->pData */
+static bool _aws_iot_shadow_mirror_parse_value(const jsonStruct_t *pStruct, const char *pJson, jsmntok_t *pToken,
+											   uint8_t *pValue) {
+	union {
+		int32_t i32;
+		int16_t i16;
+		int8_t i8;
+		uint32_t u32;
+		uint16_t u16;
+		uint8_t u8;
+		float f;
+		double d;
+		bool b;
+	} value;
+	IoT_Error_t rc;
+
+	switch(pStruct->type) {
+		case SHADOW_JSON_INT32:
+			rc = parseInteger32Value(&(value.i32), pJson, pToken);
+			break;
+		case SHADOW_JSON_INT16:
+			rc = parseInteger16Value(&(value.i16), pJson, pToken);
+			break;
+		case SHADOW_JSON_INT8:
+			rc = parseInteger8Value(&(value.i8), pJson, pToken);
+			break;
+		case SHADOW_JSON_UINT32:
+			rc = parseUnsignedInteger32Value(&(value.u32), pJson, pToken);
+			break;
+		case SHADOW_JSON_UINT16:
+			rc = parseUnsignedInteger16Value(&(value.u16), pJson, pToken);
+			break;
+		case SHADOW_JSON_UINT8:
+			rc = parseUnsignedInteger8Value(&(value.u8), pJson, pToken);
+			break;
+		case SHADOW_JSON_FLOAT:
+			rc = parseFloatValue(&(value.f), pJson, pToken);
+			break;
+		case SHADOW_JSON_DOUBLE:
+			rc = parseDoubleValue(&(value.d), pJson, pToken);
+			break;
+		case SHADOW_JSON_BOOL:
+			rc = parseBooleanValue(&(value.b), pJson, pToken);
+			break;
+		case SHADOW_JSON_STRING:
+			return SUCCESS == parseStringValue((char *) pValue, pStruct->dataLength, pJson, pToken);
+		default:
+			return false;
+	}
+
+	if(SUCCESS != rc) {
+		return false;
+	}
+	memcpy(pValue, &value, pStruct->dataLength);
+	return true;
+}
+
+/* Whether two numbers have the same "%f" text, as written in the documents */
+static bool _aws_iot_shadow_mirror_is_same_text(double a, double b) {
+	char textA[MIRROR_NUMBER_TEXT_LEN];
+	char textB[MIRROR_NUMBER_TEXT_LEN];
+	int lenA = snprintf(textA, sizeof(textA), "%f", a);
+	int lenB = snprintf(textB, sizeof(textB), "%f", b);
+
+	if((int) sizeof(textA) <= lenA || (int) sizeof(textB) <= lenB) {
+		return a == b;
+	}
+	return 0 == strcmp(textA, textB);
+}
+
+/* Whether two values of pStruct would be written the same in a document */
+static bool _aws_iot_shadow_mirror_is_same(const jsonStruct_t *pStruct, const void *pA, const void *pB) {
+	float fa;
+	float fb;
+	double da;
+	double db;
+	bool ba;
+	bool bb;
+
+	switch(pStruct->type) {
+		case SHADOW_JSON_FLOAT:
+			memcpy(&fa, pA, sizeof(float));
+			memcpy(&fb, pB, sizeof(float));
+			return _aws_iot_shadow_mirror_is_same_text(fa, fb);
+		case SHADOW_JSON_DOUBLE:
+			memcpy(&da, pA, sizeof(double));
+			memcpy(&db, pB, sizeof(double));
+			return _aws_iot_shadow_mirror_is_same_text(da, db);
+		case SHADOW_JSON_BOOL:
+			memcpy(&ba, pA, sizeof(bool));
+			memcpy(&bb, pB, sizeof(bool));
+			return ba == bb;
+		case SHADOW_JSON_STRING:
+			return 0 == strncmp((const char *) pA, (const char *) pB, pStruct->dataLength);
+		default:
+			return 0 == memcmp(pA, pB, pStruct->dataLength);
+	}
+}
+
+/* Nothing is known of the shadow but its version */
+static void _aws_iot_shadow_mirror_reset(AWS_IoT_Shadow_Mirror_t *pMirror, uint32_t version) {
+	uint8_t i;
+
+	for(i = 0; i < pMirror->attributeCount; i++) {
+		pMirror->attributes[i].isReportedKnown = false;
+		pMirror->attributes[i].isDesiredKnown = false;
+	}
+	pMirror->isVersionKnown = true;
+	pMirror->version = version;
+	pMirror->isGap = false;
+	pMirror->isConfirmed = true;
+	pMirror->isDirty = true;
+}
+
+/* Follows the version of a response or a delta. False if it is older than the mirror and must not be applied. */
+static bool _aws_iot_shadow_mirror_see_version(AWS_IoT_Shadow_Mirror_t *pMirror, uint32_t version) {
+	if(!pMirror->isVersionKnown) {
+		/* applied, but only a get makes the values the whole state */
+		return true;
+	}
+
+	if(version < pMirror->version) {
+		pMirror->stats.stale++;
+		return false;
+	}
+
+	if(version > pMirror->version + 1) {
+		IOT_DEBUG("shadow mirror: version %u after %u", (unsigned) version, (unsigned) pMirror->version);
+		pMirror->isGap = true;
+		pMirror->stats.gaps++;
+	} else if(!pMirror->isGap) {
+		pMirror->isConfirmed = true;
+	}
+
+	if(version > pMirror->version) {
+		pMirror->version = version;
+		pMirror->isDirty = true;
+	}
+	return true;
+}
+
+/* Reads the values of the section at token section. isWhole: the keys absent from it are not in the shadow. */
+static void _aws_iot_shadow_mirror_apply_section(AWS_IoT_Shadow_Mirror_t *pMirror, const char *pJson, int32_t count,
+												 int32_t section, bool isDesired, bool isWhole) {
+	IoT_Shadow_Mirror_Attribute_t *pAttribute;
+	bool isKnown;
+	int32_t t;
+	uint8_t i;
+
+	for(i = 0; i < pMirror->attributeCount; i++) {
+		pAttribute = &(pMirror->attributes[i]);
+		t = _aws_iot_shadow_mirror_find_key(pMirror, pJson, section, count, pAttribute->pStruct->pKey);
+		if(0 > t && !isWhole) {
+			continue;
+		}
+
+		/* a null value removes the key */
+		isKnown = (0 <= t) && _aws_iot_shadow_mirror_parse_value(pAttribute->pStruct, pJson, &(pMirror->tokens[t]),
+																isDesired ? pAttribute->desired : pAttribute->reported);
+		if(isDesired) {
+			pAttribute->isDesiredKnown = isKnown;
+		} else {
+			pAttribute->isReportedKnown = isKnown;
+		}
+		pMirror->isDirty = true;
+	}
+}
+
+/* Applies to the device values the desired values of the get response that differ from them */
+static uint8_t _aws_iot_shadow_mirror_apply_desired(AWS_IoT_Shadow_Mirror_t *pMirror, const char *pJson,
+													int32_t count, int32_t desired,
+													_IoT_Shadow_Mirror_Delta_Call_t *pCalls) {
+	IoT_Shadow_Mirror_Attribute_t *pAttribute;
+	uint8_t callCount = 0;
+	int32_t t;
+	uint8_t i;
+
+	for(i = 0; i < pMirror->attributeCount; i++) {
+		pAttribute = &(pMirror->attributes[i]);
+		if(!pAttribute->isDesiredKnown ||
+		   _aws_iot_shadow_mirror_is_same(pAttribute->pStruct, pAttribute->desired, pAttribute->pStruct->pData)) {
+			continue;
+		}
+
+		t = _aws_iot_shadow_mirror_find_key(pMirror, pJson, desired, count, pAttribute->pStruct->pKey);
+		memcpy(pAttribute->pStruct->pData, pAttribute->desired, pAttribute->pStruct->dataLength);
+		pMirror->stats.applied++;
+
+		pCalls[callCount].pStruct = pAttribute->pStruct;
+		pCalls[callCount].pValue = &(pJson[pMirror->tokens[t].start]);
+		pCalls[callCount].valueLen = (uint32_t) (pMirror->tokens[t].end - pMirror->tokens[t].start);
+		callCount++;
+	}
+	return callCount;
+}
+
+static bool _aws_iot_shadow_mirror_is_not_found(AWS_IoT_Shadow_Mirror_t *pMirror, const char *pJson) {
+	int32_t code = 0;
+	int32_t count;
+	int32_t t;
+
+	jsmn_init(&(pMirror->parser));
+	count = jsmn_parse(&(pMirror->parser), pJson, (unsigned int) strlen(pJson), pMirror->tokens,
+					   MAX_JSON_TOKEN_EXPECTED);
+	t = (0 < count) ? _aws_iot_shadow_mirror_find_key(pMirror, pJson, 0, count, "code") : -1;
+	return 0 <= t && SUCCESS == parseInteger32Value(&code, pJson, &(pMirror->tokens[t])) && MIRROR_NOT_FOUND == code;
+}
+
+static void _aws_iot_shadow_mirror_load(AWS_IoT_Shadow_Mirror_t *pMirror) {
+	unsigned char *pFile;
+	int fileLen = 0;
+
+	aws_iot_file_recover(pMirror->params.pFilePath);
+	pFile = (unsigned char *) utils_file_get(pMirror->params.pFilePath, &fileLen);
+	if(NULL == pFile) {
+		/* not saved yet */
+		return;
+	}
+
+	if(AWS_IOT_SHADOW_MIRROR_HEADER_LEN > fileLen || AWS_IOT_SHADOW_MIRROR_IMAGE_LEN < fileLen ||
+	   MIRROR_MAGIC != pFile[0] || MIRROR_FORMAT != pFile[1] ||
+	   AWS_IOT_SHADOW_MIRROR_HEADER_LEN + pFile[3] * AWS_IOT_SHADOW_MIRROR_RECORD_LEN != fileLen ||
+	   _aws_iot_shadow_mirror_checksum(pFile, (size_t) fileLen) != pFile[MIRROR_CHECKSUM_POS]) {
+		IOT_WARN("shadow mirror: %s is not valid, ignored", pMirror->params.pFilePath);
+		aws_iot_platform_free(pFile);
+		return;
+	}
+
+	memcpy(pMirror->image, pFile, (size_t) fileLen);
+	pMirror->loadedLen = (uint16_t) fileLen;
+	pMirror->isVersionKnown = (0 != (pFile[8] & MIRROR_VERSION_KNOWN));
+	pMirror->version = _aws_iot_shadow_mirror_get32(&pFile[4]);
+	aws_iot_platform_free(pFile);
+}
+
+IoT_Error_t aws_iot_shadow_mirror_init(AWS_IoT_Shadow_Mirror_t *pMirror, const IoT_Shadow_Mirror_Params_t *pParams) {
+	FUNC_ENTRY;
+
+	if(NULL == pMirror) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	if(NULL == pParams) {
+		pParams = &iotShadowMirrorParamsDefault;
+	}
+
+	if(NULL != pParams->pFilePath && AWS_IOT_SHADOW_MIRROR_MAX_PATH_LEN <= strlen(pParams->pFilePath)) {
+		FUNC_EXIT_RC(MAX_SIZE_ERROR);
+	}
+
+	memset(pMirror, 0, sizeof(AWS_IoT_Shadow_Mirror_t));
+	pMirror->params = *pParams;
+	pMirror->lastSave_ms = aws_iot_mqtt_tap_now_ms();
+
+	if(NULL != pParams->pFilePath) {
+		_aws_iot_shadow_mirror_load(pMirror);
+	}
+
+	FUNC_EXIT_RC(SUCCESS);
+}
+
+IoT_Error_t aws_iot_shadow_mirror_add(AWS_IoT_Shadow_Mirror_t *pMirror, jsonStruct_t *pStruct) {
+	IoT_Shadow_Mirror_Attribute_t *pAttribute;
+	const unsigned char *pRecord;
+	uint8_t i;
+
+	FUNC_ENTRY;
+
+	if(NULL == pMirror || NULL == pStruct || NULL == pStruct->pKey || NULL == pStruct->pData) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	if(SHADOW_JSON_OBJECT == pStruct->type) {
+		FUNC_EXIT_RC(FAILURE);
+	}
+
+	if(AWS_IOT_SHADOW_MIRROR_MAX_ATTRIBUTES <= pMirror->attributeCount ||
+	   AWS_IOT_SHADOW_MIRROR_MAX_VALUE_LEN < pStruct->dataLength) {
+		FUNC_EXIT_RC(MAX_SIZE_ERROR);
+	}
+
+	pAttribute = &(pMirror->attributes[pMirror->attributeCount++]);
+	memset(pAttribute, 0, sizeof(IoT_Shadow_Mirror_Attribute_t));
+	pAttribute->pStruct = pStruct;
+	pAttribute->keyHash = _aws_iot_shadow_mirror_hash(pStruct->pKey);
+
+	for(i = 0; 0 < pMirror->loadedLen && i < pMirror->image[3]; i++) {
+		pRecord = &(pMirror->image[AWS_IOT_SHADOW_MIRROR_HEADER_LEN + i * AWS_IOT_SHADOW_MIRROR_RECORD_LEN]);
+		if(pAttribute->keyHash == _aws_iot_shadow_mirror_get32(pRecord) && pStruct->type == pRecord[4]) {
+			pAttribute->isReportedKnown = (0 != (pRecord[5] & MIRROR_REPORTED_KNOWN));
+			pAttribute->isDesiredKnown = (0 != (pRecord[5] & MIRROR_DESIRED_KNOWN));
+			memcpy(pAttribute->reported, &pRecord[6], AWS_IOT_SHADOW_MIRROR_MAX_VALUE_LEN);
+			memcpy(pAttribute->desired, &pRecord[6 + AWS_IOT_SHADOW_MIRROR_MAX_VALUE_LEN],
+				   AWS_IOT_SHADOW_MIRROR_MAX_VALUE_LEN);
+			pMirror->stats.restored++;
+			FUNC_EXIT_RC(SUCCESS);
+		}
+	}
+
+	/* the shadow may hold a value of it the mirror never saw */
+	if(pMirror->isVersionKnown) {
+		pMirror->isVersionKnown = false;
+		pMirror->isDirty = true;
+	}
+
+	FUNC_EXIT_RC(SUCCESS);
+}
+
+void aws_iot_shadow_mirror_connected(AWS_IoT_Shadow_Mirror_t *pMirror, bool isSessionResumed) {
+	pMirror->isConfirmed = isSessionResumed;
+	pMirror->isGetInFlight = false;
+}
+
+IoT_Shadow_Mirror_Sync_t aws_iot_shadow_mirror_sync(AWS_IoT_Shadow_Mirror_t *pMirror, jsonStruct_t **pSelected,
+													uint8_t maxSelected, uint8_t *pSelectedCount) {
+	IoT_Shadow_Mirror_Attribute_t *pAttribute;
+	uint8_t count = 0;
+	uint8_t i;
+
+	*pSelectedCount = 0;
+
+	if(pMirror->isGetInFlight) {
+		return IOT_SHADOW_MIRROR_SYNC_WAIT;
+	}
+
+	if(!pMirror->isVersionKnown || pMirror->isGap) {
+		pMirror->isGetInFlight = true;
+		pMirror->stats.gets++;
+		return IOT_SHADOW_MIRROR_SYNC_GET;
+	}
+
+	for(i = 0; i < pMirror->attributeCount && count < maxSelected; i++) {
+		pAttribute = &(pMirror->attributes[i]);
+		if(!pAttribute->isReportedKnown ||
+		   !_aws_iot_shadow_mirror_is_same(pAttribute->pStruct, pAttribute->reported, pAttribute->pStruct->pData)) {
+			pSelected[count++] = pAttribute->pStruct;
+		}
+	}
+	if(0 < count) {
+		*pSelectedCount = count;
+		pMirror->stats.updates++;
+		return IOT_SHADOW_MIRROR_SYNC_UPDATE;
+	}
+
+	if(pMirror->isConfirmed) {
+		return IOT_SHADOW_MIRROR_SYNC_NONE;
+	}
+
+	/* the version in the response of the smallest update tells whether the shadow changed while offline */
+	if(0 < pMirror->attributeCount && 0 < maxSelected) {
+		pSelected[0] = pMirror->attributes[0].pStruct;
+		*pSelectedCount = 1;
+		pMirror->stats.probes++;
+		return IOT_SHADOW_MIRROR_SYNC_UPDATE;
+	}
+
+	pMirror->isGetInFlight = true;
+	pMirror->stats.gets++;
+	return IOT_SHADOW_MIRROR_SYNC_GET;
+}
+
+void aws_iot_shadow_mirror_on_response(AWS_IoT_Shadow_Mirror_t *pMirror, ShadowActions_t action,
+									   Shadow_Ack_Status_t status, const char *pReceivedJsonDocument) {
+	_IoT_Shadow_Mirror_Delta_Call_t calls[AWS_IOT_SHADOW_MIRROR_MAX_ATTRIBUTES];
+	uint8_t callCount = 0;
+	uint32_t version = 0;
+	bool isVersionFound;
+	int32_t count;
+	int32_t state;
+	int32_t t;
+	uint8_t i;
+
+	if(SHADOW_GET == action) {
+		pMirror->isGetInFlight = false;
+	}
+
+	if(SHADOW_ACK_REJECTED == status && SHADOW_GET == action && NULL != pReceivedJsonDocument &&
+	   _aws_iot_shadow_mirror_is_not_found(pMirror, pReceivedJsonDocument)) {
+		_aws_iot_shadow_mirror_reset(pMirror, 0);
+		return;
+	}
+
+	if(SHADOW_ACK_ACCEPTED != status || NULL == pReceivedJsonDocument) {
+		return;
+	}
+
+	if(SHADOW_DELETE == action) {
+		/* a new shadow starts again from version 1 */
+		_aws_iot_shadow_mirror_reset(pMirror, 0);
+		return;
+	}
+
+	jsmn_init(&(pMirror->parser));
+	count = jsmn_parse(&(pMirror->parser), pReceivedJsonDocument, (unsigned int) strlen(pReceivedJsonDocument),
+					   pMirror->tokens, MAX_JSON_TOKEN_EXPECTED);
+	if(1 > count || JSMN_OBJECT != pMirror->tokens[0].type) {
+		return;
+	}
+
+	t = _aws_iot_shadow_mirror_find_key(pMirror, pReceivedJsonDocument, 0, count, "version");
+	isVersionFound = (0 <= t && SUCCESS == parseUnsignedInteger32Value(&version, pReceivedJsonDocument,
+																		&(pMirror->tokens[t])));
+	state = _aws_iot_shadow_mirror_find_key(pMirror, pReceivedJsonDocument, 0, count, "state");
+
+	if(SHADOW_GET == action) {
+		_aws_iot_shadow_mirror_apply_section(pMirror, pReceivedJsonDocument, count,
+											 _aws_iot_shadow_mirror_find_key(pMirror, pReceivedJsonDocument, state,
+																			 count, "reported"),
+											 false, true);
+		t = _aws_iot_shadow_mirror_find_key(pMirror, pReceivedJsonDocument, state, count, "desired");
+		_aws_iot_shadow_mirror_apply_section(pMirror, pReceivedJsonDocument, count, t, true, true);
+		callCount = _aws_iot_shadow_mirror_apply_desired(pMirror, pReceivedJsonDocument, count, t, calls);
+
+		pMirror->isVersionKnown = isVersionFound;
+		pMirror->version = version;
+		pMirror->isGap = false;
+		pMirror->isConfirmed = isVersionFound;
+		pMirror->isDirty = true;
+	} else if(SHADOW_UPDATE == action) {
+		if(!isVersionFound) {
+			pMirror->isVersionKnown = false;
+		} else if(!_aws_iot_shadow_mirror_see_version(pMirror, version)) {
+			return;
+		}
+		_aws_iot_shadow_mirror_apply_section(pMirror, pReceivedJsonDocument, count,
+											 _aws_iot_shadow_mirror_find_key(pMirror, pReceivedJsonDocument, state,
+																			 count, "reported"),
+											 false, false);
+		_aws_iot_shadow_mirror_apply_section(pMirror, pReceivedJsonDocument, count,
+											 _aws_iot_shadow_mirror_find_key(pMirror, pReceivedJsonDocument, state,
+																			 count, "desired"),
+											 true, false);
+	}
+
+	for(i = 0; i < callCount; i++) {
+		if(NULL != calls[i].pStruct->cb) {
+			calls[i].pStruct->cb(calls[i].pValue, calls[i].valueLen, calls[i].pStruct);
+		}
+	}
+}
+
+void aws_iot_shadow_mirror_on_delta(AWS_IoT_Shadow_Mirror_t *pMirror, jsonStruct_t *pStruct, uint32_t version) {
+	IoT_Shadow_Mirror_Attribute_t *pAttribute = _aws_iot_shadow_mirror_find(pMirror, pStruct);
+
+	if(NULL == pAttribute) {
+		return;
+	}
+
+	if(0 == version) {
+		if(pAttribute->isDesiredKnown && _aws_iot_shadow_mirror_is_same(pStruct, pAttribute->desired, pStruct->pData)) {
+			/* nothing new, e.g. the callback of a value applied from a get */
+			return;
+		}
+		pMirror->isVersionKnown = false;
+	} else if(!_aws_iot_shadow_mirror_see_version(pMirror, version)) {
+		return;
+	}
+
+	memcpy(pAttribute->desired, pStruct->pData, pStruct->dataLength);
+	pAttribute->isDesiredKnown = true;
+	pMirror->isDirty = true;
+}
+
+static size_t _aws_iot_shadow_mirror_encode(AWS_IoT_Shadow_Mirror_t *pMirror) {
+	const IoT_Shadow_Mirror_Attribute_t *pAttribute;
+	unsigned char *pRecord;
+	size_t len = AWS_IOT_SHADOW_MIRROR_HEADER_LEN + pMirror->attributeCount * AWS_IOT_SHADOW_MIRROR_RECORD_LEN;
+	uint8_t i;
+
+	memset(pMirror->image, 0, len);
+	pMirror->image[0] = MIRROR_MAGIC;
+	pMirror->image[1] = MIRROR_FORMAT;
+	pMirror->image[3] = pMirror->attributeCount;
+	_aws_iot_shadow_mirror_put32(&(pMirror->image[4]), pMirror->version);
+	pMirror->image[8] = pMirror->isVersionKnown ? MIRROR_VERSION_KNOWN : 0;
+
+	for(i = 0; i < pMirror->attributeCount; i++) {
+		pAttribute = &(pMirror->attributes[i]);
+		pRecord = &(pMirror->image[AWS_IOT_SHADOW_MIRROR_HEADER_LEN + i * AWS_IOT_SHADOW_MIRROR_RECORD_LEN]);
+		_aws_iot_shadow_mirror_put32(pRecord, pAttribute->keyHash);
+		pRecord[4] = (unsigned char) pAttribute->pStruct->type;
+		pRecord[5] = (unsigned char) ((pAttribute->isReportedKnown ? MIRROR_REPORTED_KNOWN : 0) |
+									  (pAttribute->isDesiredKnown ? MIRROR_DESIRED_KNOWN : 0));
+		memcpy(&pRecord[6], pAttribute->reported, AWS_IOT_SHADOW_MIRROR_MAX_VALUE_LEN);
+		memcpy(&pRecord[6 + AWS_IOT_SHADOW_MIRROR_MAX_VALUE_LEN], pAttribute->desired,
+			   AWS_IOT_SHADOW_MIRROR_MAX_VALUE_LEN);
+	}
+	pMirror->image[MIRROR_CHECKSUM_POS] = _aws_iot_shadow_mirror_checksum(pMirror->image, len);
+
+	/* the records loaded no longer match the image */
+	pMirror->loadedLen = 0;
+	return len;
+}
+
+IoT_Error_t aws_iot_shadow_mirror_save(AWS_IoT_Shadow_Mirror_t *pMirror) {
+	IoT_Error_t rc;
+	size_t len;
+
+	FUNC_ENTRY;
+
+	if(NULL == pMirror) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	if(NULL == pMirror->params.pFilePath || !pMirror->isDirty) {
+		FUNC_EXIT_RC(SUCCESS);
+	}
+
+	len = _aws_iot_shadow_mirror_encode(pMirror);
+
+	/* written aside then swapped in, so a reset during the save leaves a whole file */
+	rc = aws_iot_file_replace(pMirror->params.pFilePath, pMirror->image, len);
+	if(SUCCESS != rc) {
+		IOT_ERROR("shadow mirror: save to %s failed", pMirror->params.pFilePath);
+		FUNC_EXIT_RC(rc);
+	}
+
+	pMirror->isDirty = false;
+	pMirror->lastSave_ms = aws_iot_mqtt_tap_now_ms();
+	pMirror->stats.saves++;
+
+	FUNC_EXIT_RC(SUCCESS);
+}
+
+IoT_Error_t aws_iot_shadow_mirror_poll(AWS_IoT_Shadow_Mirror_t *pMirror) {
+	IoT_Error_t rc;
+
+	if(!pMirror->isDirty || NULL == pMirror->params.pFilePath ||
+	   aws_iot_mqtt_tap_now_ms() - pMirror->lastSave_ms < pMirror->params.saveInterval_ms) {
+		return SUCCESS;
+	}
+
+	rc = aws_iot_shadow_mirror_save(pMirror);
+	if(SUCCESS != rc) {
+		/* tried again after another interval rather than at every call */
+		pMirror->lastSave_ms = aws_iot_mqtt_tap_now_ms();
+	}
+	return rc;
+}
+
+void aws_iot_shadow_mirror_get_stats(const AWS_IoT_Shadow_Mirror_t *pMirror, IoT_Shadow_Mirror_Stats_t *pStats) {
+	*pStats = pMirror->stats;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,408 @@
+/**
+  *****************************************************************************
+  * @file   aws_iot_shadow_pipeline.c
+  *
+  *****************************************************************************
+  * @attention
+  *
+  *
+  *  Copyright (c) 2022, InnoPhase, Inc.
+  *
+  *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  *  POSSIBILITY OF SUCH DAMAGE.
+  *
+  *****************************************************************************
+  */
+
+/**
+ * @file aws_iot_shadow_pipeline.c
+ * @brief Pipelined shadow updates
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <string.h>
+
+#include "aws_iot_log.h"
+#include "aws_iot_shadow_pipeline.h"
+
+const IoT_Shadow_Pipeline_Params_t iotShadowPipelineParamsDefault = {AWS_IOT_SHADOW_PIPELINE_MAX_DEPTH, NULL};
+
+static void _aws_iot_shadow_pipeline_lock(AWS_IoT_Shadow_Pipeline_t *pPipeline) {
+#ifdef _ENABLE_THREAD_SUPPORT_
+	(void) aws_iot_thread_mutex_lock(&(pPipeline->lock));
+#else
+	IOT_UNUSED(pPipeline);
+#endif
+}
+
+static void _aws_iot_shadow_pipeline_unlock(AWS_IoT_Shadow_Pipeline_t *pPipeline) {
+#ifdef _ENABLE_THREAD_SUPPORT_
+	(void) aws_iot_thread_mutex_unlock(&(pPipeline->lock));
+#else
+	IOT_UNUSED(pPipeline);
+#endif
+}
+
+/* Whether sequence a was sent before sequence b */
+static bool _aws_iot_shadow_pipeline_before(uint32_t a, uint32_t b) {
+	return 0 > (int32_t) (a - b);
+}
+
+/* Reads the top level "version" of an accepted response */
+static bool _aws_iot_shadow_pipeline_get_version(AWS_IoT_Shadow_Pipeline_t *pPipeline, const char *pJson,
+												 uint32_t *pVersion) {
+	int32_t count;
+	int32_t end;
+	int32_t i;
+
+	if(NULL == pJson) {
+		return false;
+	}
+
+	jsmn_init(&(pPipeline->parser));
+	count = jsmn_parse(&(pPipeline->parser), pJson, (unsigned int) strlen(pJson), pPipeline->tokens,
+					   MAX_JSON_TOKEN_EXPECTED);
+	if(1 > count || JSMN_OBJECT != pPipeline->tokens[0].type) {
+		return false;
+	}
+
+	i = 1;
+	while(i + 1 < count) {
+		if(0 == jsoneq(pJson, &(pPipeline->tokens[i]), "version")) {
+			return SUCCESS == parseUnsignedInteger32Value(pVersion, pJson, &(pPipeline->tokens[i + 1]));
+		}
+		/* skip the key and its value, nested tokens included */
+		end = pPipeline->tokens[i + 1].end;
+		for(i += 2; i < count && pPipeline->tokens[i].start < end; i++) {
+		}
+	}
+	return false;
+}
+
+/* Frees the finished updates no update in flight was sent before */
+static void _aws_iot_shadow_pipeline_retire(AWS_IoT_Shadow_Pipeline_t *pPipeline) {
+	IoT_Shadow_Pipeline_Slot_t *pSlot;
+	bool isOldestSet = false;
+	uint32_t oldest = 0;
+	uint8_t i;
+
+	for(i = 0; i < AWS_IOT_SHADOW_PIPELINE_MAX_DEPTH; i++) {
+		pSlot = &(pPipeline->slots[i]);
+		if(IOT_SHADOW_PIPELINE_IN_FLIGHT == pSlot->state &&
+		   (!isOldestSet || _aws_iot_shadow_pipeline_before(pSlot->sequence, oldest))) {
+			oldest = pSlot->sequence;
+			isOldestSet = true;
+		}
+	}
+
+	for(i = 0; i < AWS_IOT_SHADOW_PIPELINE_MAX_DEPTH; i++) {
+		pSlot = &(pPipeline->slots[i]);
+		if(IOT_SHADOW_PIPELINE_DONE != pSlot->state ||
+		   (isOldestSet && _aws_iot_shadow_pipeline_before(oldest, pSlot->sequence))) {
+			continue;
+		}
+		if(pSlot->isVersionKnown && pSlot->version > pPipeline->retiredVersion) {
+			pPipeline->retiredVersion = pSlot->version;
+		}
+		pSlot->state = IOT_SHADOW_PIPELINE_FREE;
+	}
+}
+
+/* pAccepted made version: marks for sending again the updates it overwrote, itself included */
+static void _aws_iot_shadow_pipeline_order(AWS_IoT_Shadow_Pipeline_t *pPipeline,
+										   IoT_Shadow_Pipeline_Slot_t *pAccepted) {
+	IoT_Shadow_Pipeline_Slot_t *pSlot;
+	bool isOverwritten = (pAccepted->version < pPipeline->retiredVersion);
+	uint8_t i;
+
+	for(i = 0; i < AWS_IOT_SHADOW_PIPELINE_MAX_DEPTH; i++) {
+		pSlot = &(pPipeline->slots[i]);
+		if(pSlot == pAccepted || IOT_SHADOW_PIPELINE_DONE != pSlot->state || !pSlot->isVersionKnown) {
+			continue;
+		}
+		if(_aws_iot_shadow_pipeline_before(pSlot->sequence, pAccepted->sequence)) {
+			/* sent before, applied after */
+			if(pSlot->version > pAccepted->version) {
+				isOverwritten = true;
+			}
+		} else if(pSlot->version < pAccepted->version) {
+			/* sent after, applied before */
+			pSlot->state = IOT_SHADOW_PIPELINE_REAPPLY;
+			pSlot->isVersionKnown = false;
+			pPipeline->stats.reordered++;
+		}
+	}
+
+	if(isOverwritten) {
+		pAccepted->state = IOT_SHADOW_PIPELINE_REAPPLY;
+		pAccepted->isVersionKnown = false;
+		pPipeline->stats.reordered++;
+	}
+}
+
+static void _aws_iot_shadow_pipeline_on_response(const char *pThingName, ShadowActions_t action,
+												 Shadow_Ack_Status_t status, const char *pReceivedJsonDocument,
+												 void *pContextData) {
+	IoT_Shadow_Pipeline_Slot_t *pSlot = (IoT_Shadow_Pipeline_Slot_t *) pContextData;
+	AWS_IoT_Shadow_Pipeline_t *pPipeline = pSlot->pPipeline;
+	fpActionCallback_t callback;
+	void *pCallbackContext;
+
+	_aws_iot_shadow_pipeline_lock(pPipeline);
+
+	if(IOT_SHADOW_PIPELINE_IN_FLIGHT != pSlot->state) {
+		/* dropped by aws_iot_shadow_pipeline_deinit() */
+		_aws_iot_shadow_pipeline_unlock(pPipeline);
+		return;
+	}
+
+	callback = pSlot->callback;
+	pCallbackContext = pSlot->pCallbackContext;
+	pSlot->state = IOT_SHADOW_PIPELINE_DONE;
+	/* reported once, not again when the document is sent again */
+	pSlot->callback = NULL;
+
+	switch(status) {
+		case SHADOW_ACK_ACCEPTED:
+			pPipeline->stats.accepted++;
+			pSlot->isVersionKnown = _aws_iot_shadow_pipeline_get_version(pPipeline, pReceivedJsonDocument,
+																		 &(pSlot->version));
+			if(pSlot->isVersionKnown) {
+				_aws_iot_shadow_pipeline_order(pPipeline, pSlot);
+			} else {
+				pPipeline->stats.noVersion++;
+			}
+			break;
+		case SHADOW_ACK_REJECTED:
+			pPipeline->stats.rejected++;
+			break;
+		default:
+			pPipeline->stats.timeouts++;
+			break;
+	}
+
+	_aws_iot_shadow_pipeline_retire(pPipeline);
+
+	_aws_iot_shadow_pipeline_unlock(pPipeline);
+
+	if(NULL != callback) {
+		callback(pThingName, action, status, pReceivedJsonDocument, pCallbackContext);
+	}
+}
+
+static IoT_Error_t _aws_iot_shadow_pipeline_send(AWS_IoT_Shadow_Pipeline_t *pPipeline,
+												 IoT_Shadow_Pipeline_Slot_t *pSlot) {
+	if(NULL != pPipeline->params.pDemux) {
+		return aws_iot_shadow_demux_update(pPipeline->params.pDemux, pSlot->document,
+										   _aws_iot_shadow_pipeline_on_response, pSlot, pSlot->timeout_seconds);
+	}
+	return aws_iot_shadow_update(pPipeline->pClient, pPipeline->pThingName, pSlot->document,
+								 _aws_iot_shadow_pipeline_on_response, pSlot, pSlot->timeout_seconds, true);
+}
+
+/* Counts the updates in flight into the counters. Called with the lock held. */
+static uint8_t _aws_iot_shadow_pipeline_count(AWS_IoT_Shadow_Pipeline_t *pPipeline) {
+	uint8_t count = 0;
+	uint8_t i;
+
+	for(i = 0; i < AWS_IOT_SHADOW_PIPELINE_MAX_DEPTH; i++) {
+		if(IOT_SHADOW_PIPELINE_IN_FLIGHT == pPipeline->slots[i].state) {
+			count++;
+		}
+	}
+	if(count > pPipeline->stats.maxInFlight) {
+		pPipeline->stats.maxInFlight = count;
+	}
+	return count;
+}
+
+IoT_Error_t aws_iot_shadow_pipeline_init(AWS_IoT_Shadow_Pipeline_t *pPipeline, AWS_IoT_Client *pClient,
+										 const char *pThingName, const IoT_Shadow_Pipeline_Params_t *pParams) {
+	IoT_Error_t rc = SUCCESS;
+	uint8_t i;
+
+	FUNC_ENTRY;
+
+	if(NULL == pPipeline || NULL == pClient) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	if(NULL == pParams) {
+		pParams = &iotShadowPipelineParamsDefault;
+	}
+
+	if(NULL == pThingName && NULL == pParams->pDemux) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	if(0 == pParams->depth || AWS_IOT_SHADOW_PIPELINE_MAX_DEPTH < pParams->depth) {
+		FUNC_EXIT_RC(MAX_SIZE_ERROR);
+	}
+
+	memset(pPipeline, 0, sizeof(AWS_IoT_Shadow_Pipeline_t));
+	pPipeline->pClient = pClient;
+	pPipeline->pThingName = pThingName;
+	pPipeline->params = *pParams;
+	for(i = 0; i < AWS_IOT_SHADOW_PIPELINE_MAX_DEPTH; i++) {
+		pPipeline->slots[i].pPipeline = pPipeline;
+	}
+
+#ifdef _ENABLE_THREAD_SUPPORT_
+	rc = aws_iot_thread_mutex_init(&(pPipeline->lock));
+#endif
+
+	FUNC_EXIT_RC(rc);
+}
+
+IoT_Error_t aws_iot_shadow_pipeline_deinit(AWS_IoT_Shadow_Pipeline_t *pPipeline) {
+	uint8_t i;
+
+	FUNC_ENTRY;
+
+	if(NULL == pPipeline || NULL == pPipeline->pClient) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	_aws_iot_shadow_pipeline_lock(pPipeline);
+	for(i = 0; i < AWS_IOT_SHADOW_PIPELINE_MAX_DEPTH; i++) {
+		pPipeline->slots[i].state = IOT_SHADOW_PIPELINE_FREE;
+	}
+	_aws_iot_shadow_pipeline_unlock(pPipeline);
+
+#ifdef _ENABLE_THREAD_SUPPORT_
+	(void) aws_iot_thread_mutex_destroy(&(pPipeline->lock));
+#endif
+	pPipeline->pClient = NULL;
+
+	FUNC_EXIT_RC(SUCCESS);
+}
+
+IoT_Error_t aws_iot_shadow_pipeline_update(AWS_IoT_Shadow_Pipeline_t *pPipeline, const char *pJsonString,
+										   fpActionCallback_t callback, void *pContextData, uint8_t timeout_seconds) {
+	IoT_Shadow_Pipeline_Slot_t *pSlot = NULL;
+	size_t len;
+	IoT_Error_t rc;
+	uint8_t i;
+
+	FUNC_ENTRY;
+
+	if(NULL == pPipeline || NULL == pPipeline->pClient || NULL == pJsonString) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	len = strlen(pJsonString);
+	if(sizeof(pSlot->document) <= len) {
+		FUNC_EXIT_RC(MAX_SIZE_ERROR);
+	}
+
+	/* set before the send, the response may come before it returns */
+	_aws_iot_shadow_pipeline_lock(pPipeline);
+	for(i = 0; i < pPipeline->params.depth && NULL == pSlot; i++) {
+		if(IOT_SHADOW_PIPELINE_FREE == pPipeline->slots[i].state) {
+			pSlot = &(pPipeline->slots[i]);
+		}
+	}
+	if(NULL == pSlot) {
+		pPipeline->stats.full++;
+		_aws_iot_shadow_pipeline_unlock(pPipeline);
+		FUNC_EXIT_RC(SHADOW_PIPELINE_FULL_ERROR);
+	}
+	memcpy(pSlot->document, pJsonString, len + 1);
+	pSlot->state = IOT_SHADOW_PIPELINE_IN_FLIGHT;
+	pSlot->sequence = pPipeline->nextSequence++;
+	pSlot->isVersionKnown = false;
+	pSlot->callback = callback;
+	pSlot->pCallbackContext = pContextData;
+	pSlot->timeout_seconds = timeout_seconds;
+	_aws_iot_shadow_pipeline_unlock(pPipeline);
+
+	rc = _aws_iot_shadow_pipeline_send(pPipeline, pSlot);
+
+	_aws_iot_shadow_pipeline_lock(pPipeline);
+	if(SUCCESS != rc) {
+		pSlot->state = IOT_SHADOW_PIPELINE_FREE;
+	} else {
+		pPipeline->stats.sent++;
+		(void) _aws_iot_shadow_pipeline_count(pPipeline);
+	}
+	_aws_iot_shadow_pipeline_unlock(pPipeline);
+
+	FUNC_EXIT_RC(rc);
+}
+
+IoT_Error_t aws_iot_shadow_pipeline_poll(AWS_IoT_Shadow_Pipeline_t *pPipeline) {
+	IoT_Shadow_Pipeline_Slot_t *pSlot;
+	IoT_Error_t rc = SUCCESS;
+	uint8_t i;
+
+	FUNC_ENTRY;
+
+	if(NULL == pPipeline || NULL == pPipeline->pClient) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	while(SUCCESS == rc) {
+		/* in the order they were first sent, so the last one still wins */
+		pSlot = NULL;
+		_aws_iot_shadow_pipeline_lock(pPipeline);
+		for(i = 0; i < AWS_IOT_SHADOW_PIPELINE_MAX_DEPTH; i++) {
+			if(IOT_SHADOW_PIPELINE_REAPPLY == pPipeline->slots[i].state &&
+			   (NULL == pSlot || _aws_iot_shadow_pipeline_before(pPipeline->slots[i].sequence, pSlot->sequence))) {
+				pSlot = &(pPipeline->slots[i]);
+			}
+		}
+		if(NULL != pSlot) {
+			pSlot->state = IOT_SHADOW_PIPELINE_IN_FLIGHT;
+			pSlot->sequence = pPipeline->nextSequence++;
+		}
+		_aws_iot_shadow_pipeline_unlock(pPipeline);
+
+		if(NULL == pSlot) {
+			break;
+		}
+
+		rc = _aws_iot_shadow_pipeline_send(pPipeline, pSlot);
+
+		_aws_iot_shadow_pipeline_lock(pPipeline);
+		if(SUCCESS != rc) {
+			pSlot->state = IOT_SHADOW_PIPELINE_REAPPLY;
+		} else {
+			pPipeline->stats.reapplied++;
+			(void) _aws_iot_shadow_pipeline_count(pPipeline);
+		}
+		_aws_iot_shadow_pipeline_unlock(pPipeline);
+	}
+
+	FUNC_EXIT_RC(rc);
+}
+
+uint8_t aws_iot_shadow_pipeline_in_flight(AWS_IoT_Shadow_Pipeline_t *pPipeline) {
+	uint8_t count;
+
+	_aws_iot_shadow_pipeline_lock(pPipeline);
+	count = _aws_iot_shadow_pipeline_count(pPipeline);
+	_aws_iot_shadow_pipeline_unlock(pPipeline);
+
+	return count;
+}
+
+void aws_iot_shadow_pipeline_get_stats(const AWS_IoT_Shadow_Pipeline_t *pPipeline,
+									   IoT_Shadow_Pipeline_Stats_t *pStats) {
+	*pStats = pPipeline->stats;
+}
+
+#ifdef __cplusplus
+}
+#endif
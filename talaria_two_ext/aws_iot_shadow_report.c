@@ -0,0 +1,229 @@
+/**
+  *****************************************************************************
+  * @file   aws_iot_shadow_report.c
+  *
+  *****************************************************************************
+  * @attention
+  *
+  *
+  *  Copyright (c) 2022, InnoPhase, Inc.
+  *
+  *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  *  POSSIBILITY OF SUCH DAMAGE.
+  *
+  *****************************************************************************
+  */
+
+/**
+ * @file aws_iot_shadow_report.c
+ * @brief Change-driven reporting of shadow attributes
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <string.h>
+
+#include "aws_iot_log.h"
+#include "aws_iot_mqtt_client_tap.h"
+#include "aws_iot_shadow_report.h"
+
+const IoT_Shadow_Report_Policy_t iotShadowReportPolicyDefault = {0.0f, 0.0f, 0, 0};
+
+/* FNV-1a */
+static uint32_t _aws_iot_shadow_report_hash(const char *pString) {
+	uint32_t hash = 2166136261u;
+
+	while('\0' != *pString) {
+		hash ^= (uint8_t) *pString++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/* Reads a number or boolean attribute, false for other types */
+static bool _aws_iot_shadow_report_number(const jsonStruct_t *pStruct, double *pValue) {
+	switch(pStruct->type) {
+		case SHADOW_JSON_INT32:
+			*pValue = *(const int32_t *) pStruct->pData;
+			return true;
+		case SHADOW_JSON_INT16:
+			*pValue = *(const int16_t *) pStruct->pData;
+			return true;
+		case SHADOW_JSON_INT8:
+			*pValue = *(const int8_t *) pStruct->pData;
+			return true;
+		case SHADOW_JSON_UINT32:
+			*pValue = *(const uint32_t *) pStruct->pData;
+			return true;
+		case SHADOW_JSON_UINT16:
+			*pValue = *(const uint16_t *) pStruct->pData;
+			return true;
+		case SHADOW_JSON_UINT8:
+			*pValue = *(const uint8_t *) pStruct->pData;
+			return true;
+		case SHADOW_JSON_FLOAT:
+			*pValue = *(const float *) pStruct->pData;
+			return true;
+		case SHADOW_JSON_DOUBLE:
+			*pValue = *(const double *) pStruct->pData;
+			return true;
+		case SHADOW_JSON_BOOL:
+			*pValue = *(const bool *) pStruct->pData ? 1.0 : 0.0;
+			return true;
+		default:
+			return false;
+	}
+}
+
+/* Whether the current value of the attribute moved from the last reported one by its deadband */
+static bool _aws_iot_shadow_report_is_changed(const IoT_Shadow_Report_Attribute_t *pAttribute, double value,
+											  uint32_t hash) {
+	double change;
+	double threshold;
+
+	if(SHADOW_JSON_STRING == pAttribute->pStruct->type) {
+		return hash != pAttribute->lastHash;
+	}
+	if(SHADOW_JSON_OBJECT == pAttribute->pStruct->type) {
+		return true;
+	}
+	if(value == pAttribute->lastValue) {
+		return false;
+	}
+
+	change = value - pAttribute->lastValue;
+	if(0 > change) {
+		change = -change;
+	}
+	threshold = (0 > pAttribute->lastValue) ? -pAttribute->lastValue : pAttribute->lastValue;
+	threshold *= pAttribute->policy.relativeDeadband;
+	if(pAttribute->policy.absoluteDeadband > threshold) {
+		threshold = pAttribute->policy.absoluteDeadband;
+	}
+	return change >= threshold;
+}
+
+IoT_Error_t aws_iot_shadow_report_init(AWS_IoT_Shadow_Reporter_t *pReporter) {
+	FUNC_ENTRY;
+
+	if(NULL == pReporter) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	memset(pReporter, 0, sizeof(AWS_IoT_Shadow_Reporter_t));
+
+	FUNC_EXIT_RC(SUCCESS);
+}
+
+IoT_Error_t aws_iot_shadow_report_add(AWS_IoT_Shadow_Reporter_t *pReporter, jsonStruct_t *pStruct,
+									  const IoT_Shadow_Report_Policy_t *pPolicy) {
+	IoT_Shadow_Report_Attribute_t *pAttribute;
+
+	FUNC_ENTRY;
+
+	if(NULL == pReporter || NULL == pStruct || NULL == pStruct->pKey || NULL == pStruct->pData) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	if(AWS_IOT_SHADOW_REPORT_MAX_ATTRIBUTES <= pReporter->attributeCount) {
+		FUNC_EXIT_RC(MAX_SIZE_ERROR);
+	}
+
+	pAttribute = &(pReporter->attributes[pReporter->attributeCount++]);
+	memset(pAttribute, 0, sizeof(IoT_Shadow_Report_Attribute_t));
+	pAttribute->pStruct = pStruct;
+	pAttribute->policy = (NULL != pPolicy) ? *pPolicy : iotShadowReportPolicyDefault;
+	/* nothing reported yet */
+	pAttribute->isForced = true;
+
+	FUNC_EXIT_RC(SUCCESS);
+}
+
+IoT_Error_t aws_iot_shadow_report_force(AWS_IoT_Shadow_Reporter_t *pReporter, jsonStruct_t *pStruct) {
+	IoT_Error_t rc = FAILURE;
+	uint8_t i;
+
+	FUNC_ENTRY;
+
+	if(NULL == pReporter) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	for(i = 0; i < pReporter->attributeCount; i++) {
+		if(NULL == pStruct || pStruct == pReporter->attributes[i].pStruct) {
+			pReporter->attributes[i].isForced = true;
+			rc = SUCCESS;
+		}
+	}
+
+	FUNC_EXIT_RC(rc);
+}
+
+uint8_t aws_iot_shadow_report_select(AWS_IoT_Shadow_Reporter_t *pReporter, jsonStruct_t **pSelected,
+									 uint8_t maxSelected) {
+	IoT_Shadow_Report_Attribute_t *pAttribute;
+	uint32_t now_ms = aws_iot_mqtt_tap_now_ms();
+	uint32_t elapsed_ms;
+	double value = 0.0;
+	uint32_t hash = 0;
+	uint8_t count = 0;
+	bool isSelected;
+	uint8_t i;
+
+	for(i = 0; i < pReporter->attributeCount && count < maxSelected; i++) {
+		pAttribute = &(pReporter->attributes[i]);
+		pReporter->stats.checked++;
+
+		if(SHADOW_JSON_STRING == pAttribute->pStruct->type) {
+			hash = _aws_iot_shadow_report_hash((const char *) pAttribute->pStruct->pData);
+		} else {
+			(void) _aws_iot_shadow_report_number(pAttribute->pStruct, &value);
+		}
+		elapsed_ms = now_ms - pAttribute->lastReport_ms;
+
+		isSelected = true;
+		if(pAttribute->isForced) {
+			pReporter->stats.forced++;
+		} else if(0 < pAttribute->policy.maxSilence_ms && elapsed_ms >= pAttribute->policy.maxSilence_ms) {
+			pReporter->stats.heartbeats++;
+		} else if(!_aws_iot_shadow_report_is_changed(pAttribute, value, hash)) {
+			pReporter->stats.suppressed++;
+			isSelected = false;
+		} else if(elapsed_ms < pAttribute->policy.minInterval_ms) {
+			/* the last reported value is kept, the change is seen again at the next reading */
+			pReporter->stats.held++;
+			isSelected = false;
+		} else {
+			pReporter->stats.changed++;
+		}
+
+		if(isSelected) {
+			pAttribute->isForced = false;
+			pAttribute->lastValue = value;
+			pAttribute->lastHash = hash;
+			pAttribute->lastReport_ms = now_ms;
+			pSelected[count++] = pAttribute->pStruct;
+		}
+	}
+
+	return count;
+}
+
+void aws_iot_shadow_report_get_stats(const AWS_IoT_Shadow_Reporter_t *pReporter, IoT_Shadow_Report_Stats_t *pStats) {
+	*pStats = pReporter->stats;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,192 @@
+/**
+  *****************************************************************************
+  * @file   aws_iot_thing_topics.c
+  *
+  *****************************************************************************
+  * @attention
+  *
+  *
+  *  Copyright (c) 2022, InnoPhase, Inc.
+  *
+  *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  *  POSSIBILITY OF SUCH DAMAGE.
+  *
+  *****************************************************************************
+  */
+
+/**
+ * @file aws_iot_thing_topics.c
+ * @brief Shadow and jobs topics of a thing, built once
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <string.h>
+
+#include "aws_iot_log.h"
+#include "aws_iot_thing_topics.h"
+
+#define THING_TOPICS_PREFIX "$aws/things/"
+#define THING_TOPICS_SHADOW "/shadow/"
+#define THING_TOPICS_NAMED  "name/"
+#define THING_TOPICS_JOBS   "/jobs/"
+
+/* in the order of IoT_Thing_Topic_Id_t */
+static const char *const topicSuffixes[IOT_THING_TOPIC_COUNT] = {
+	"update",
+	"get",
+	"delete",
+	"update/accepted",
+	"update/rejected",
+	"get/accepted",
+	"get/rejected",
+	"delete/accepted",
+	"delete/rejected",
+	"update/delta",
+	"update/documents",
+	"+/+",
+	"notify",
+	"notify-next",
+	"get",
+	"get/+",
+	"start-next",
+	"start-next/+",
+	"$next/get",
+	"$next/get/+",
+	"+/update/accepted",
+	"+/update/rejected",
+};
+
+/* A name is a topic level */
+static IoT_Error_t _aws_iot_thing_topics_check_name(const char *pName, size_t maxLen, size_t *pLen) {
+	*pLen = strlen(pName);
+	if(0 == *pLen || maxLen < *pLen) {
+		return MAX_SIZE_ERROR;
+	}
+	if(*pLen != strcspn(pName, "/+#")) {
+		return FAILURE;
+	}
+	return SUCCESS;
+}
+
+/* Appends pPart to the topic being built at *pAt */
+static void _aws_iot_thing_topics_append(AWS_IoT_Thing_Topics_t *pTopics, size_t *pAt, const char *pPart,
+										 size_t partLen) {
+	memcpy(&(pTopics->pool[*pAt]), pPart, partLen);
+	*pAt += partLen;
+}
+
+IoT_Error_t aws_iot_thing_topics_init(AWS_IoT_Thing_Topics_t *pTopics, const char *pThingName,
+									  const char *pShadowName) {
+	IoT_Error_t rc;
+	size_t thingNameLen;
+	size_t shadowNameLen = 0;
+	size_t suffixLen;
+	size_t len;
+	size_t start;
+	size_t at = 0;
+	uint8_t i;
+
+	FUNC_ENTRY;
+
+	if(NULL == pTopics || NULL == pThingName) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	rc = _aws_iot_thing_topics_check_name(pThingName, MAX_SIZE_OF_THING_NAME, &thingNameLen);
+	if(SUCCESS == rc && NULL != pShadowName) {
+		rc = _aws_iot_thing_topics_check_name(pShadowName, AWS_IOT_THING_TOPICS_MAX_SHADOW_NAME, &shadowNameLen);
+	}
+	if(SUCCESS != rc) {
+		FUNC_EXIT_RC(rc);
+	}
+
+	memset(pTopics, 0, sizeof(AWS_IoT_Thing_Topics_t));
+	memcpy(pTopics->thingName, pThingName, thingNameLen);
+	pTopics->thingNameLen = (uint16_t) thingNameLen;
+	if(0 < shadowNameLen) {
+		memcpy(pTopics->shadowName, pShadowName, shadowNameLen);
+	}
+
+	for(i = 0; i < IOT_THING_TOPIC_COUNT; i++) {
+		suffixLen = strlen(topicSuffixes[i]);
+		if(IOT_THING_TOPIC_SHADOW_COUNT > i) {
+			len = strlen(THING_TOPICS_SHADOW) + ((0 < shadowNameLen) ? strlen(THING_TOPICS_NAMED) + shadowNameLen + 1 : 0);
+		} else {
+			len = strlen(THING_TOPICS_JOBS);
+		}
+		len += strlen(THING_TOPICS_PREFIX) + thingNameLen + suffixLen;
+		/* the pool is sized for the longest names */
+		if(sizeof(pTopics->pool) <= at + len) {
+			IOT_ERROR("Thing topics pool too small for topic %u", (unsigned) i);
+			FUNC_EXIT_RC(MAX_SIZE_ERROR);
+		}
+
+		start = at;
+		_aws_iot_thing_topics_append(pTopics, &at, THING_TOPICS_PREFIX, strlen(THING_TOPICS_PREFIX));
+		_aws_iot_thing_topics_append(pTopics, &at, pTopics->thingName, thingNameLen);
+		if(IOT_THING_TOPIC_SHADOW_COUNT > i) {
+			_aws_iot_thing_topics_append(pTopics, &at, THING_TOPICS_SHADOW, strlen(THING_TOPICS_SHADOW));
+			if(0 < shadowNameLen) {
+				_aws_iot_thing_topics_append(pTopics, &at, THING_TOPICS_NAMED, strlen(THING_TOPICS_NAMED));
+				_aws_iot_thing_topics_append(pTopics, &at, pTopics->shadowName, shadowNameLen);
+				_aws_iot_thing_topics_append(pTopics, &at, "/", 1);
+			}
+		} else {
+			_aws_iot_thing_topics_append(pTopics, &at, THING_TOPICS_JOBS, strlen(THING_TOPICS_JOBS));
+			pTopics->jobsPrefixLen = (uint16_t) (at - start);
+		}
+		_aws_iot_thing_topics_append(pTopics, &at, topicSuffixes[i], suffixLen);
+		pTopics->pool[at++] = '\0';
+
+		pTopics->topics[i].pTopic = &(pTopics->pool[start]);
+		pTopics->topics[i].topicLen = (uint16_t) len;
+	}
+
+	FUNC_EXIT_RC(SUCCESS);
+}
+
+IoT_Error_t aws_iot_thing_topics_job(const AWS_IoT_Thing_Topics_t *pTopics, const char *pJobId, const char *pAction,
+									 char *pBuffer, size_t bufferSize, uint16_t *pTopicLen) {
+	size_t jobIdLen;
+	size_t actionLen;
+	size_t len;
+
+	FUNC_ENTRY;
+
+	if(NULL == pTopics || NULL == pJobId || NULL == pAction || NULL == pBuffer || NULL == pTopicLen) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	jobIdLen = strlen(pJobId);
+	actionLen = strlen(pAction);
+	len = pTopics->jobsPrefixLen + jobIdLen + 1 + actionLen;
+	if(bufferSize <= len) {
+		FUNC_EXIT_RC(MAX_SIZE_ERROR);
+	}
+
+	/* every jobs topic of the table starts with the prefix */
+	memcpy(pBuffer, pTopics->topics[IOT_THING_TOPIC_JOBS_GET].pTopic, pTopics->jobsPrefixLen);
+	memcpy(&(pBuffer[pTopics->jobsPrefixLen]), pJobId, jobIdLen);
+	pBuffer[pTopics->jobsPrefixLen + jobIdLen] = '/';
+	memcpy(&(pBuffer[pTopics->jobsPrefixLen + jobIdLen + 1]), pAction, actionLen);
+	pBuffer[len] = '\0';
+	*pTopicLen = (uint16_t) len;
+
+	FUNC_EXIT_RC(SUCCESS);
+}
+
+#ifdef __cplusplus
+}
+#endif
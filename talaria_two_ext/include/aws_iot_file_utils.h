@@ -0,0 +1,136 @@
+/**
+  *****************************************************************************
+  * @file   aws_iot_file_utils.h
+  *
+  *****************************************************************************
+  * @attention
+  *
+  *
+  *  Copyright (c) 2022, InnoPhase, Inc.
+  *
+  *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  *  POSSIBILITY OF SUCH DAMAGE.
+  *
+  *****************************************************************************
+  */
+
+/**
+ * @file aws_iot_file_utils.h
+ * @brief Writes to the Talaria file system for the persistent extensions
+ *
+ * The Talaria file system utilities (fs_utils.h) read a whole file with
+ * utils_file_get(). These helpers add the writes the outbox and the shadow
+ * mirror need: appending a record, reading a record back at its offset, and
+ * replacing a file whole.
+ *
+ * A replacement is written to <path>.tmp, which is then renamed over the
+ * file. A file system that does not rename over an existing file gets the
+ * live file moved to <path>.bak first, and the backup is only removed once
+ * the new file is in place. The live file is never deleted before its
+ * replacement is complete, and aws_iot_file_recover() puts back whichever
+ * copy a reset left behind.
+ */
+
+#ifndef AWS_IOT_SDK_SRC_IOT_FILE_UTILS_H_
+#define AWS_IOT_SDK_SRC_IOT_FILE_UTILS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "aws_iot_config.h"
+#include "aws_iot_error.h"
+
+/** Longest file path, excluding the terminating NULL byte. */
+#ifndef AWS_IOT_FILE_MAX_PATH_LEN
+#define AWS_IOT_FILE_MAX_PATH_LEN 64
+#endif
+
+/**
+ * @brief File being replaced
+ *
+ * Lives from aws_iot_file_replace_begin() to aws_iot_file_replace_commit()
+ * or aws_iot_file_replace_abort().
+ */
+typedef struct {
+	const char *pPath;
+	char tmpPath[AWS_IOT_FILE_MAX_PATH_LEN + 5];
+	int fd;
+} IoT_File_Replace_t;
+
+/**
+ * @brief Append data to a file, creating it if needed
+ *
+ * The file is closed before the call returns, so the data is committed.
+ */
+IoT_Error_t aws_iot_file_append(const char *pPath, const void *pData, size_t len);
+
+/**
+ * @brief Open a file for aws_iot_file_read_at()
+ *
+ * @param pPath File path
+ * @param pFd Set to the file descriptor, to be closed with aws_iot_file_close()
+ * @return SUCCESS, or FAILURE if the file cannot be opened
+ */
+IoT_Error_t aws_iot_file_open(const char *pPath, int *pFd);
+
+/**
+ * @brief Read exactly len bytes at offset
+ */
+IoT_Error_t aws_iot_file_read_at(int fd, uint32_t offset, void *pBuffer, size_t len);
+
+void aws_iot_file_close(int fd);
+
+/**
+ * @brief Start writing the replacement of a file
+ *
+ * The file itself is not touched until aws_iot_file_replace_commit().
+ */
+IoT_Error_t aws_iot_file_replace_begin(IoT_File_Replace_t *pReplace, const char *pPath);
+
+IoT_Error_t aws_iot_file_replace_write(IoT_File_Replace_t *pReplace, const void *pData, size_t len);
+
+/**
+ * @brief Put the replacement in place of the file
+ *
+ * @return SUCCESS, or FAILURE with the previous file kept, or restored by
+ *         aws_iot_file_recover() if a reset interrupts the swap
+ */
+IoT_Error_t aws_iot_file_replace_commit(IoT_File_Replace_t *pReplace);
+
+/**
+ * @brief Drop the replacement, the file is left as it was
+ */
+void aws_iot_file_replace_abort(IoT_File_Replace_t *pReplace);
+
+/**
+ * @brief Replace a file with len bytes, see aws_iot_file_replace_commit()
+ */
+IoT_Error_t aws_iot_file_replace(const char *pPath, const void *pData, size_t len);
+
+/**
+ * @brief Finish or undo a replacement a reset interrupted
+ *
+ * Call it before reading the file. When the file is missing, the complete
+ * replacement or the backup left by aws_iot_file_replace_commit() is put in
+ * its place. Leftover copies are then removed.
+ */
+void aws_iot_file_recover(const char *pPath);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AWS_IOT_SDK_SRC_IOT_FILE_UTILS_H_ */
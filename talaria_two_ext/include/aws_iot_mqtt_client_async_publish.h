@@ -0,0 +1,349 @@
+/**
+  *****************************************************************************
+  * @file   aws_iot_mqtt_client_async_publish.h
+  *
+  *****************************************************************************
+  * @attention
+  *
+  *
+  *  Copyright (c) 2022, InnoPhase, Inc.
+  *
+  *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  *  POSSIBILITY OF SUCH DAMAGE.
+  *
+  *****************************************************************************
+  */
+
+/**
+ * @file aws_iot_mqtt_client_async_publish.h
+ * @brief Non-blocking QoS1 publish with several messages in flight
+ *
+ * aws_iot_mqtt_publish() with QoS1 blocks until the PUBACK arrives, so a
+ * client can never have more than one message per round trip outstanding.
+ * The async publisher serializes the PUBLISH itself, writes it to the network
+ * and returns at once. Up to windowSize messages can wait for their PUBACK at
+ * the same time. Acks are seen through the packet tap
+ * (aws_iot_mqtt_client_tap.h) while aws_iot_mqtt_yield() reads the socket.
+ *
+ * aws_iot_mqtt_async_publish_poll() must be called regularly, typically right
+ * after each aws_iot_mqtt_yield(). It runs the completion handlers, in the
+ * caller's thread, and retransmits unacknowledged messages with the DUP flag.
+ * The retransmission interval is retry_ms, or the adaptive timeout of an RTT
+ * estimator (aws_iot_mqtt_client_rtt.h) set with
+ * aws_iot_mqtt_async_publish_set_rtt(), doubled at each retransmission.
+ *
+ * aws_iot_mqtt_async_publish_fragments() sends payloads held in caller-owned
+ * fragments: only the fixed header, topic and packet id are serialized into
+ * the slot, and the fragments are written straight to the network after it.
+ * The payload is not bounded by AWS_IOT_MQTT_TX_BUF_LEN or by
+ * AWS_IOT_MQTT_ASYNC_PUBLISH_MAX_PACKET_LEN.
+ *
+ * For a topic published to over and over, aws_iot_mqtt_publish_prepare()
+ * serializes the fixed header byte and the topic once into an
+ * IoT_Prepared_Publish_t. aws_iot_mqtt_async_publish_prepared() then only
+ * writes the remaining length and packet id in front of the payload.
+ *
+ * The SDK does not check the packet id of the PUBACK it waits for, so a
+ * synchronous QoS1 aws_iot_mqtt_publish() must not be issued on the same
+ * client while async publishes are in flight. QoS0 publishes are fine.
+ */
+
+#ifndef AWS_IOT_SDK_SRC_IOT_MQTT_CLIENT_ASYNC_PUBLISH_H_
+#define AWS_IOT_SDK_SRC_IOT_MQTT_CLIENT_ASYNC_PUBLISH_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "aws_iot_config.h"
+#include "aws_iot_mqtt_client_interface.h"
+#include "aws_iot_mqtt_client_tap.h"
+#include "aws_iot_mqtt_client_rtt.h"
+
+/** Largest window that can be configured. Each slot holds a copy of the serialized packet. */
+#ifndef AWS_IOT_MQTT_ASYNC_PUBLISH_MAX_WINDOW
+#define AWS_IOT_MQTT_ASYNC_PUBLISH_MAX_WINDOW 4
+#endif
+
+/** Largest serialized PUBLISH packet, fixed header included. */
+#ifndef AWS_IOT_MQTT_ASYNC_PUBLISH_MAX_PACKET_LEN
+#define AWS_IOT_MQTT_ASYNC_PUBLISH_MAX_PACKET_LEN AWS_IOT_MQTT_TX_BUF_LEN
+#endif
+
+/** Payload fragments of one aws_iot_mqtt_async_publish_fragments() message. */
+#ifndef AWS_IOT_MQTT_ASYNC_PUBLISH_MAX_FRAGMENTS
+#define AWS_IOT_MQTT_ASYNC_PUBLISH_MAX_FRAGMENTS 4
+#endif
+
+/** Time without PUBACK after which a message is sent again. */
+#ifndef AWS_IOT_MQTT_ASYNC_PUBLISH_RETRY_MS
+#define AWS_IOT_MQTT_ASYNC_PUBLISH_RETRY_MS 5000
+#endif
+
+/** Retransmissions before a message is reported as timed out. */
+#ifndef AWS_IOT_MQTT_ASYNC_PUBLISH_MAX_RETRIES
+#define AWS_IOT_MQTT_ASYNC_PUBLISH_MAX_RETRIES 3
+#endif
+
+/** Longest topic of an IoT_Prepared_Publish_t. */
+#ifndef AWS_IOT_MQTT_PREPARED_PUBLISH_MAX_TOPIC_LEN
+#define AWS_IOT_MQTT_PREPARED_PUBLISH_MAX_TOPIC_LEN 128
+#endif
+
+/** Returned by aws_iot_mqtt_async_publish() when windowSize messages are already in flight. */
+#define MQTT_ASYNC_PUBLISH_WINDOW_FULL_ERROR MQTT_CLIENT_NOT_IDLE_ERROR
+
+typedef enum {
+	IOT_ASYNC_PUBLISH_ACKED,   ///< PUBACK received
+	IOT_ASYNC_PUBLISH_TIMEOUT, ///< No PUBACK after the last retransmission
+	IOT_ASYNC_PUBLISH_ABORTED, ///< Dropped by aws_iot_mqtt_async_publish_abort_all()
+} IoT_Async_Publish_Status_t;
+
+/**
+ * @brief Completion handler
+ *
+ * Called from aws_iot_mqtt_async_publish_poll() once per message. It may
+ * publish again.
+ */
+typedef void (*iot_async_publish_complete_handler)(AWS_IoT_Client *pClient, uint16_t packetId,
+												   IoT_Async_Publish_Status_t status, void *pData);
+
+/**
+ * @brief Async publisher parameters
+ */
+typedef struct {
+	uint8_t windowSize;   ///< Messages in flight, 1 to AWS_IOT_MQTT_ASYNC_PUBLISH_MAX_WINDOW
+	uint32_t retry_ms;    ///< Retransmission interval, unless an RTT estimator is set
+	uint8_t maxRetries;   ///< Retransmissions before timing out
+	uint32_t writeTimeout_ms; ///< Max time spent writing one packet
+} IoT_Async_Publish_Params_t;
+
+extern const IoT_Async_Publish_Params_t iotAsyncPublishParamsDefault;
+
+/**
+ * @brief Async publisher counters
+ */
+typedef struct {
+	uint32_t published;     ///< Messages accepted into the window
+	uint32_t acked;         ///< Messages completed with IOT_ASYNC_PUBLISH_ACKED
+	uint32_t retransmitted; ///< Packets sent again with the DUP flag
+	uint32_t timedOut;      ///< Messages completed with IOT_ASYNC_PUBLISH_TIMEOUT
+	uint32_t windowFull;    ///< Publishes refused because the window was full
+} IoT_Async_Publish_Stats_t;
+
+/**
+ * @brief Caller-owned piece of a payload
+ */
+typedef struct {
+	const void *pData;
+	size_t len;
+} IoT_Publish_Fragment_t;
+
+/**
+ * @brief Topic, QoS and flags of a message serialized once for many publishes
+ */
+typedef struct {
+	unsigned char header;          ///< Fixed header byte: packet type, QoS and retain flag
+	QoS qos;
+	uint16_t topicNameLen;
+	uint16_t topicLen;             ///< Bytes used in topic
+	unsigned char topic[2 + AWS_IOT_MQTT_PREPARED_PUBLISH_MAX_TOPIC_LEN]; ///< Length-prefixed topic name as sent
+} IoT_Prepared_Publish_t;
+
+typedef enum {
+	IOT_ASYNC_PUBLISH_SLOT_FREE,
+	IOT_ASYNC_PUBLISH_SLOT_IN_FLIGHT,
+	IOT_ASYNC_PUBLISH_SLOT_RESEND,   ///< Connection restarted, send again at the next poll
+	IOT_ASYNC_PUBLISH_SLOT_DONE,     ///< Completed, handler runs at the next poll
+} IoT_Async_Publish_Slot_State_t;
+
+typedef struct {
+	IoT_Async_Publish_Slot_State_t state;
+	IoT_Async_Publish_Status_t status;
+	iot_async_publish_complete_handler handler;
+	void *pHandlerData;
+	uint16_t packetId;
+	uint32_t sentAt_ms;
+	uint8_t retries;
+	size_t packetLen;
+	unsigned char packet[AWS_IOT_MQTT_ASYNC_PUBLISH_MAX_PACKET_LEN]; ///< Whole packet, or its header if fragmentCount != 0
+	uint8_t fragmentCount;
+	IoT_Publish_Fragment_t fragments[AWS_IOT_MQTT_ASYNC_PUBLISH_MAX_FRAGMENTS];
+} IoT_Async_Publish_Slot_t;
+
+/**
+ * @brief Async publisher state
+ *
+ * Allocated by the application, one per MQTT client. packetIds is kept apart
+ * from the slots so matching a PUBACK only scans a few bytes.
+ */
+typedef struct {
+	AWS_IoT_Client *pClient;
+	IoT_Async_Publish_Params_t params;
+	uint16_t packetIds[AWS_IOT_MQTT_ASYNC_PUBLISH_MAX_WINDOW]; ///< Id awaiting a PUBACK per slot, 0 if none
+	IoT_Async_Publish_Slot_t slots[AWS_IOT_MQTT_ASYNC_PUBLISH_MAX_WINDOW];
+	IoT_Tap_Observer_t observer;
+	AWS_IoT_Rtt_t *pRtt;  ///< Source of the retransmission timeout, NULL for retry_ms
+#ifdef _ENABLE_THREAD_SUPPORT_
+	IoT_Mutex_t lock;
+#endif
+	IoT_Async_Publish_Stats_t stats;
+} AWS_IoT_Async_Publisher_t;
+
+/**
+ * @brief Initialize an async publisher
+ *
+ * The client must already be initialized. The packet tap is attached to it.
+ *
+ * @param pPublisher Async publisher state
+ * @param pClient MQTT client
+ * @param pParams Parameters, NULL selects the defaults
+ * @return An IoT Error Type defining successful/failed initialization
+ */
+IoT_Error_t aws_iot_mqtt_async_publish_init(AWS_IoT_Async_Publisher_t *pPublisher, AWS_IoT_Client *pClient,
+											const IoT_Async_Publish_Params_t *pParams);
+
+/**
+ * @brief Release the publisher. Messages still in flight are aborted.
+ */
+IoT_Error_t aws_iot_mqtt_async_publish_deinit(AWS_IoT_Async_Publisher_t *pPublisher);
+
+/**
+ * @brief Publish a QoS1 message without waiting for the PUBACK
+ *
+ * The qos field of pParams is ignored. The topic and payload are copied, so
+ * the caller may reuse its buffers as soon as this returns.
+ *
+ * @param pPublisher Async publisher state
+ * @param pTopicName Topic name
+ * @param topicNameLen Length of the topic name
+ * @param pParams Payload and flags of the message
+ * @param handler Completion handler, may be NULL
+ * @param pHandlerData Passed back to handler
+ * @param pPacketId Optional, receives the packet id of the message
+ * @return SUCCESS, MQTT_ASYNC_PUBLISH_WINDOW_FULL_ERROR or an error from the network
+ */
+IoT_Error_t aws_iot_mqtt_async_publish(AWS_IoT_Async_Publisher_t *pPublisher, const char *pTopicName,
+									   uint16_t topicNameLen, IoT_Publish_Message_Params *pParams,
+									   iot_async_publish_complete_handler handler, void *pHandlerData,
+									   uint16_t *pPacketId);
+
+/**
+ * @brief Publish a message whose payload is made of caller-owned fragments, without copying it
+ *
+ * The fragments are sent back to back as the payload of a single PUBLISH.
+ * The payload field of pParams is ignored.
+ *
+ * With QOS1 the message takes a slot of the window like
+ * aws_iot_mqtt_async_publish() and the fragments are written again on
+ * retransmission: the fragment buffers must stay valid and unchanged until
+ * the completion handler has been called, whatever the status. With QOS0
+ * the fragments are written before this returns and the handler is not
+ * called.
+ *
+ * @param pPublisher Async publisher state
+ * @param pTopicName Topic name
+ * @param topicNameLen Length of the topic name
+ * @param pParams QoS and flags of the message
+ * @param pFragments Payload fragments, the array itself is copied
+ * @param fragmentCount Number of fragments, up to AWS_IOT_MQTT_ASYNC_PUBLISH_MAX_FRAGMENTS
+ * @param handler Completion handler, may be NULL
+ * @param pHandlerData Passed back to handler
+ * @param pPacketId Optional, receives the packet id of a QOS1 message
+ * @return SUCCESS, MQTT_ASYNC_PUBLISH_WINDOW_FULL_ERROR or an error from the network
+ */
+IoT_Error_t aws_iot_mqtt_async_publish_fragments(AWS_IoT_Async_Publisher_t *pPublisher, const char *pTopicName,
+												 uint16_t topicNameLen, IoT_Publish_Message_Params *pParams,
+												 const IoT_Publish_Fragment_t *pFragments, uint8_t fragmentCount,
+												 iot_async_publish_complete_handler handler, void *pHandlerData,
+												 uint16_t *pPacketId);
+
+/**
+ * @brief Serialize the topic, QoS and retain flag of the messages published with aws_iot_mqtt_async_publish_prepared()
+ *
+ * @param pPrepared Receives the serialized topic and header
+ * @param pTopicName Topic name, copied
+ * @param topicNameLen Length of the topic name, up to AWS_IOT_MQTT_PREPARED_PUBLISH_MAX_TOPIC_LEN
+ * @param qos QOS0 or QOS1
+ * @param isRetained Retain flag of the messages
+ * @return SUCCESS, NULL_VALUE_ERROR or MAX_SIZE_ERROR
+ */
+IoT_Error_t aws_iot_mqtt_publish_prepare(IoT_Prepared_Publish_t *pPrepared, const char *pTopicName,
+										 uint16_t topicNameLen, QoS qos, bool isRetained);
+
+/**
+ * @brief Publish a payload with a prepared topic
+ *
+ * QOS1 messages take a slot of the window like aws_iot_mqtt_async_publish(),
+ * the payload is copied. QOS0 messages are written before this returns,
+ * straight from the prepared topic and the payload, and the handler is not
+ * called.
+ *
+ * @param pPublisher Async publisher state
+ * @param pPrepared Prepared by aws_iot_mqtt_publish_prepare(), only read
+ * @param pPayload Payload of the message
+ * @param payloadLen Length of the payload
+ * @param handler Completion handler, may be NULL
+ * @param pHandlerData Passed back to handler
+ * @param pPacketId Optional, receives the packet id of a QOS1 message
+ * @return SUCCESS, MQTT_ASYNC_PUBLISH_WINDOW_FULL_ERROR or an error from the network
+ */
+IoT_Error_t aws_iot_mqtt_async_publish_prepared(AWS_IoT_Async_Publisher_t *pPublisher,
+												const IoT_Prepared_Publish_t *pPrepared, const void *pPayload,
+												size_t payloadLen, iot_async_publish_complete_handler handler,
+												void *pHandlerData, uint16_t *pPacketId);
+
+/**
+ * @brief Retransmit on the adaptive timeout of an RTT estimator instead of retry_ms
+ *
+ * The estimator must be initialized on the same client. NULL goes back to retry_ms.
+ */
+void aws_iot_mqtt_async_publish_set_rtt(AWS_IoT_Async_Publisher_t *pPublisher, AWS_IoT_Rtt_t *pRtt);
+
+/**
+ * @brief Run completion handlers and retransmit overdue messages
+ *
+ * @param pPublisher Async publisher state
+ * @return SUCCESS or the error of a failed retransmission
+ */
+IoT_Error_t aws_iot_mqtt_async_publish_poll(AWS_IoT_Async_Publisher_t *pPublisher);
+
+/**
+ * @brief Complete every message in flight with IOT_ASYNC_PUBLISH_ABORTED
+ */
+void aws_iot_mqtt_async_publish_abort_all(AWS_IoT_Async_Publisher_t *pPublisher);
+
+/**
+ * @brief Number of messages waiting for their PUBACK
+ */
+uint8_t aws_iot_mqtt_async_publish_in_flight(const AWS_IoT_Async_Publisher_t *pPublisher);
+
+/**
+ * @brief true if another message can be published right now
+ */
+bool aws_iot_mqtt_async_publish_can_publish(const AWS_IoT_Async_Publisher_t *pPublisher);
+
+/**
+ * @brief Copy the async publisher counters
+ */
+void aws_iot_mqtt_async_publish_get_stats(const AWS_IoT_Async_Publisher_t *pPublisher,
+										  IoT_Async_Publish_Stats_t *pStats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AWS_IOT_SDK_SRC_IOT_MQTT_CLIENT_ASYNC_PUBLISH_H_ */
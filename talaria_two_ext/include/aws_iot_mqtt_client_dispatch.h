@@ -0,0 +1,428 @@
+/**
+  *****************************************************************************
+  * @file   aws_iot_mqtt_client_dispatch.h
+  *
+  *****************************************************************************
+  * @attention
+  *
+  *
+  *  Copyright (c) 2022, InnoPhase, Inc.
+  *
+  *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  *  POSSIBILITY OF SUCH DAMAGE.
+  *
+  *****************************************************************************
+  */
+
+/**
+ * @file aws_iot_mqtt_client_dispatch.h
+ * @brief Topic-filter trie for subscription dispatch
+ *
+ * The MQTT client matches every inbound publish against each entry of its
+ * fixed array of AWS_IOT_MQTT_NUM_SUBSCRIBE_HANDLERS handlers, one wildcard
+ * string match per entry. The dispatcher keeps its own subscriptions in a
+ * trie with one node per topic level, so the cost of a match depends on the
+ * depth of the topic and not on the number of subscriptions. A node holds any
+ * number of handlers, and '+' and '#' are supported.
+ *
+ * Topic levels and filters are interned in a string pool: the many shadow and
+ * jobs filters sharing "$aws/things/<thingName>/" store those levels once.
+ *
+ * The dispatcher sends its own SUBSCRIBE and UNSUBSCRIBE packets and sees the
+ * inbound publishes through the packet tap (aws_iot_mqtt_client_tap.h), so
+ * its subscriptions do not use any of the client's handler slots. Publishes
+ * are delivered from within aws_iot_mqtt_yield(), while the client reads the
+ * packet with its read mutex held, and not after the read as the client's
+ * own handlers are. Handlers, stream handlers included, may publish with
+ * QoS0 or through the async publisher, and may add subscriptions to the
+ * dispatcher, which sends them from aws_iot_mqtt_dispatch_poll(). They must
+ * not wait for an ack: a QoS1 aws_iot_mqtt_publish(), aws_iot_mqtt_subscribe()
+ * or aws_iot_mqtt_dispatch_subscribe_batch() with a timeout reads from the
+ * client again and blocks on its read mutex.
+ *
+ * Stream handlers, registered with aws_iot_mqtt_dispatch_subscribe_stream(),
+ * receive the payload in chunks of AWS_IOT_MQTT_DISPATCH_CHUNK_LEN bytes as it
+ * is read from the network, so publishes larger than AWS_IOT_MQTT_RX_BUF_LEN,
+ * which the client reads and discards, can still be consumed. The whole
+ * message is never held in RAM. The dispatcher acknowledges the QoS1
+ * publishes the client discarded.
+ *
+ * aws_iot_mqtt_dispatch_poll() must be called regularly, typically after each
+ * aws_iot_mqtt_yield(). It sends subscriptions that are pending, including the
+ * ones to restore after the client reconnected without a persistent session.
+ */
+
+#ifndef AWS_IOT_SDK_SRC_IOT_MQTT_CLIENT_DISPATCH_H_
+#define AWS_IOT_SDK_SRC_IOT_MQTT_CLIENT_DISPATCH_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "aws_iot_config.h"
+#include "aws_iot_mqtt_client_interface.h"
+#include "aws_iot_mqtt_client_tap.h"
+
+/** Topic filters subscribed at the same time. */
+#ifndef AWS_IOT_MQTT_DISPATCH_MAX_SUBSCRIPTIONS
+#define AWS_IOT_MQTT_DISPATCH_MAX_SUBSCRIPTIONS 32
+#endif
+
+/** Handlers registered at the same time, over all filters. */
+#ifndef AWS_IOT_MQTT_DISPATCH_MAX_HANDLERS
+#define AWS_IOT_MQTT_DISPATCH_MAX_HANDLERS 32
+#endif
+
+/** Trie nodes, one per distinct topic level prefix. */
+#ifndef AWS_IOT_MQTT_DISPATCH_MAX_NODES
+#define AWS_IOT_MQTT_DISPATCH_MAX_NODES 96
+#endif
+
+/** Bytes of the string pool holding the interned levels and filters. */
+#ifndef AWS_IOT_MQTT_DISPATCH_POOL_LEN
+#define AWS_IOT_MQTT_DISPATCH_POOL_LEN 1024
+#endif
+
+/** Distinct strings in the pool. */
+#ifndef AWS_IOT_MQTT_DISPATCH_MAX_STRINGS
+#define AWS_IOT_MQTT_DISPATCH_MAX_STRINGS 96
+#endif
+
+/** Handlers called for a single publish. */
+#ifndef AWS_IOT_MQTT_DISPATCH_MAX_MATCHES
+#define AWS_IOT_MQTT_DISPATCH_MAX_MATCHES 8
+#endif
+
+/** Largest publish packet body delivered. Larger publishes are dropped. */
+#ifndef AWS_IOT_MQTT_DISPATCH_RX_BUF_LEN
+#define AWS_IOT_MQTT_DISPATCH_RX_BUF_LEN AWS_IOT_MQTT_RX_BUF_LEN
+#endif
+
+/** Payload bytes given to stream handlers at a time. Only the last chunk of a message is shorter. */
+#ifndef AWS_IOT_MQTT_DISPATCH_CHUNK_LEN
+#define AWS_IOT_MQTT_DISPATCH_CHUNK_LEN 256
+#endif
+
+/** PUBACKs of discarded QoS1 publishes waiting for the next poll. Beyond it they are sent from the reading thread. */
+#ifndef AWS_IOT_MQTT_DISPATCH_MAX_PENDING_ACKS
+#define AWS_IOT_MQTT_DISPATCH_MAX_PENDING_ACKS 4
+#endif
+
+/** Time to wait for a SUBACK before sending the SUBSCRIBE again. */
+#ifndef AWS_IOT_MQTT_DISPATCH_SUBACK_TIMEOUT_MS
+#define AWS_IOT_MQTT_DISPATCH_SUBACK_TIMEOUT_MS 5000
+#endif
+
+#define IOT_DISPATCH_NONE 0xFFFF
+
+typedef enum {
+	IOT_DISPATCH_SUB_FREE,
+	IOT_DISPATCH_SUB_PENDING,    ///< SUBSCRIBE not sent yet, or sent again at the next poll
+	IOT_DISPATCH_SUB_REQUESTED,  ///< SUBSCRIBE sent, waiting for the SUBACK
+	IOT_DISPATCH_SUB_ACTIVE,     ///< Granted by the broker
+	IOT_DISPATCH_SUB_REJECTED,   ///< Refused by the broker
+} IoT_Dispatch_Sub_State_t;
+
+/**
+ * @brief Dispatcher counters
+ */
+typedef struct {
+	uint32_t dispatched;  ///< Publishes that matched at least one handler
+	uint32_t unmatched;   ///< Publishes that matched no handler
+	uint32_t dropped;     ///< Publishes too large for AWS_IOT_MQTT_DISPATCH_RX_BUF_LEN and not streamed
+	uint32_t streamed;    ///< Publishes given to stream handlers
+	uint32_t handlerCalls;
+	uint32_t rejected;    ///< Subscriptions refused by the broker
+	uint32_t subscribePackets; ///< SUBSCRIBE packets sent, each carrying one or more filters
+	uint32_t ackOverflows; ///< PUBACKs sent at once because AWS_IOT_MQTT_DISPATCH_MAX_PENDING_ACKS were waiting
+} IoT_Dispatch_Stats_t;
+
+/**
+ * @brief Piece of a publish given to a stream handler
+ *
+ * Chunks come in order. The last one has offset + payloadLen == totalLen,
+ * or isAborted set if the connection was lost before the end of the message.
+ */
+typedef struct {
+	const char *pTopicName;
+	uint16_t topicNameLen;
+	QoS qos;
+	uint8_t isRetained;
+	uint8_t isDup;
+	uint16_t id;
+	const unsigned char *pPayload;
+	size_t payloadLen;
+	uint32_t offset;      ///< Offset of pPayload within the whole payload
+	uint32_t totalLen;    ///< Length of the whole payload
+	bool isAborted;
+} IoT_Dispatch_Chunk_t;
+
+/**
+ * @brief Stream handler
+ *
+ * Called in the thread reading the socket, from within aws_iot_mqtt_yield()
+ * or the receive task. It must not call the client.
+ */
+typedef void (*iot_dispatch_stream_handler)(AWS_IoT_Client *pClient, const IoT_Dispatch_Chunk_t *pChunk, void *pData);
+
+typedef struct {
+	uint16_t offset;
+	uint16_t len;
+} IoT_Dispatch_String_t;
+
+typedef struct {
+	uint16_t level;        ///< Index of the interned level string
+	uint16_t firstChild;   ///< Children other than '+' and '#'
+	uint16_t nextSibling;
+	uint16_t plusChild;
+	uint16_t hashChild;
+	uint16_t firstHandler;
+} IoT_Dispatch_Node_t;
+
+typedef struct {
+	pApplicationHandler_t handler;              ///< NULL for a stream handler
+	iot_dispatch_stream_handler streamHandler;
+	void *pHandlerData;
+	uint16_t node;
+	uint16_t next;
+} IoT_Dispatch_Handler_t;
+
+typedef struct {
+	pApplicationHandler_t handler;
+	iot_dispatch_stream_handler streamHandler;
+	void *pHandlerData;
+} IoT_Dispatch_Match_t;
+
+typedef enum {
+	IOT_DISPATCH_STREAM_IDLE,     ///< No publish being read
+	IOT_DISPATCH_STREAM_HEADER,   ///< Waiting for the topic and packet id
+	IOT_DISPATCH_STREAM_PAYLOAD,  ///< Giving the payload to streamMatches
+	IOT_DISPATCH_STREAM_SKIP,     ///< No stream handler for this publish
+} IoT_Dispatch_Stream_State_t;
+
+typedef struct {
+	IoT_Dispatch_Sub_State_t state;
+	uint16_t filter;       ///< Index of the interned filter string
+	uint16_t node;         ///< Node of the last level of the filter
+	uint16_t packetId;     ///< Of the outstanding SUBSCRIBE
+	uint32_t sentAt_ms;
+	QoS qos;
+	uint8_t batchIndex;    ///< Position of the filter in its SUBSCRIBE, and of its code in the SUBACK
+	uint8_t grantedQos;    ///< SUBACK return code, 0x80 if refused
+} IoT_Dispatch_Subscription_t;
+
+/**
+ * @brief One entry of aws_iot_mqtt_dispatch_subscribe_batch()
+ *
+ * state and grantedQos are filled in by the call.
+ */
+typedef struct {
+	const char *pTopicFilter;
+	uint16_t topicFilterLen;
+	QoS qos;
+	pApplicationHandler_t handler;
+	void *pHandlerData;
+	IoT_Dispatch_Sub_State_t state;
+	uint8_t grantedQos;
+} IoT_Dispatch_Filter_t;
+
+/**
+ * @brief Dispatcher state
+ *
+ * Allocated by the application, one per MQTT client. Nodes and interned
+ * strings are never released, they are reused when a filter is subscribed
+ * again.
+ */
+typedef struct {
+	AWS_IoT_Client *pClient;
+	IoT_Tap_Observer_t observer;
+#ifdef _ENABLE_THREAD_SUPPORT_
+	IoT_Mutex_t lock;
+#endif
+	char pool[AWS_IOT_MQTT_DISPATCH_POOL_LEN];
+	uint16_t poolLen;
+	IoT_Dispatch_String_t strings[AWS_IOT_MQTT_DISPATCH_MAX_STRINGS];
+	uint16_t stringCount;
+	IoT_Dispatch_Node_t nodes[AWS_IOT_MQTT_DISPATCH_MAX_NODES];
+	uint16_t nodeCount;
+	IoT_Dispatch_Handler_t handlers[AWS_IOT_MQTT_DISPATCH_MAX_HANDLERS];
+	uint16_t freeHandler;
+	IoT_Dispatch_Subscription_t subscriptions[AWS_IOT_MQTT_DISPATCH_MAX_SUBSCRIPTIONS];
+	unsigned char rxBuf[AWS_IOT_MQTT_DISPATCH_RX_BUF_LEN];
+	bool isRxDropped;
+	IoT_Dispatch_Stream_State_t streamState;
+	IoT_Dispatch_Chunk_t chunk;
+	IoT_Dispatch_Match_t streamMatches[AWS_IOT_MQTT_DISPATCH_MAX_MATCHES];
+	uint8_t streamMatchCount;
+	uint32_t streamHeaderLen;
+	unsigned char chunkBuf[AWS_IOT_MQTT_DISPATCH_CHUNK_LEN];
+	uint16_t pubackIds[AWS_IOT_MQTT_DISPATCH_MAX_PENDING_ACKS];
+	uint8_t pubackCount;
+	unsigned char txBuf[AWS_IOT_MQTT_TX_BUF_LEN];
+	IoT_Dispatch_Stats_t stats;
+} AWS_IoT_Dispatcher_t;
+
+/**
+ * @brief Initialize a dispatcher
+ *
+ * The client must already be initialized. The packet tap is attached to it.
+ *
+ * @param pDispatcher Dispatcher state
+ * @param pClient MQTT client
+ * @return An IoT Error Type defining successful/failed initialization
+ */
+IoT_Error_t aws_iot_mqtt_dispatch_init(AWS_IoT_Dispatcher_t *pDispatcher, AWS_IoT_Client *pClient);
+
+/**
+ * @brief Release the dispatcher. Subscriptions are left on the broker.
+ */
+IoT_Error_t aws_iot_mqtt_dispatch_deinit(AWS_IoT_Dispatcher_t *pDispatcher);
+
+/**
+ * @brief Add a handler for a topic filter
+ *
+ * The first handler of a filter subscribes to it. The SUBSCRIBE is sent at
+ * once if the client is connected, otherwise by the next poll after the
+ * connection is up; this call does not wait for the SUBACK. Several handlers
+ * may be registered on one filter.
+ *
+ * @param pDispatcher Dispatcher state
+ * @param pTopicFilter Topic filter, copied into the string pool
+ * @param topicFilterLen Length of the topic filter
+ * @param qos Requested QoS. A higher QoS on an existing filter subscribes again.
+ * @param handler Called for each matching publish
+ * @param pHandlerData Passed back to handler
+ * @return An IoT Error Type defining successful/failed registration
+ */
+IoT_Error_t aws_iot_mqtt_dispatch_subscribe(AWS_IoT_Dispatcher_t *pDispatcher, const char *pTopicFilter,
+											uint16_t topicFilterLen, QoS qos, pApplicationHandler_t handler,
+											void *pHandlerData);
+
+/**
+ * @brief Add a stream handler for a topic filter
+ *
+ * Same as aws_iot_mqtt_dispatch_subscribe(), but matching publishes are
+ * given to the handler in chunks while they are read, whatever their size.
+ *
+ * @param pDispatcher Dispatcher state
+ * @param pTopicFilter Topic filter, copied into the string pool
+ * @param topicFilterLen Length of the topic filter
+ * @param qos Requested QoS
+ * @param handler Called for each chunk of a matching publish
+ * @param pHandlerData Passed back to handler
+ * @return An IoT Error Type defining successful/failed registration
+ */
+IoT_Error_t aws_iot_mqtt_dispatch_subscribe_stream(AWS_IoT_Dispatcher_t *pDispatcher, const char *pTopicFilter,
+												   uint16_t topicFilterLen, QoS qos,
+												   iot_dispatch_stream_handler handler, void *pHandlerData);
+
+/**
+ * @brief Add handlers for several topic filters in one round-trip
+ *
+ * All the filters are registered first, then the ones not yet granted go out
+ * together in as few SUBSCRIBE packets as AWS_IOT_MQTT_TX_BUF_LEN allows,
+ * usually one. The call then yields the client until every filter has its
+ * SUBACK return code or timeout_ms runs out, and reports each result in the
+ * filter's state and grantedQos. With timeout_ms 0 it returns as soon as the
+ * packet is sent, like aws_iot_mqtt_dispatch_subscribe().
+ *
+ * It calls aws_iot_mqtt_yield() and so must not be used with a timeout while
+ * another thread, such as the rx task, is reading the client.
+ *
+ * @param pDispatcher Dispatcher state
+ * @param pFilters Filters to subscribe
+ * @param count Number of filters
+ * @param timeout_ms Max time spent waiting for the SUBACKs
+ * @return SUCCESS if all the filters were granted, FAILURE if any was refused,
+ *         MQTT_REQUEST_TIMEOUT_ERROR if a SUBACK did not come. Nothing is
+ *         registered if an error prevented a filter from being added.
+ */
+IoT_Error_t aws_iot_mqtt_dispatch_subscribe_batch(AWS_IoT_Dispatcher_t *pDispatcher, IoT_Dispatch_Filter_t *pFilters,
+												  uint8_t count, uint32_t timeout_ms);
+
+/**
+ * @brief Remove a handler
+ *
+ * The filter is unsubscribed when its last handler is removed.
+ *
+ * @param pDispatcher Dispatcher state
+ * @param pTopicFilter Topic filter given to aws_iot_mqtt_dispatch_subscribe()
+ * @param topicFilterLen Length of the topic filter
+ * @param handler Handler to remove, NULL removes all the handlers of the filter
+ * @param pHandlerData Handler data the handler was registered with
+ * @return An IoT Error Type defining successful/failed removal
+ */
+IoT_Error_t aws_iot_mqtt_dispatch_unsubscribe(AWS_IoT_Dispatcher_t *pDispatcher, const char *pTopicFilter,
+											  uint16_t topicFilterLen, pApplicationHandler_t handler,
+											  void *pHandlerData);
+
+/**
+ * @brief Remove a stream handler, unsubscribing the filter with its last handler
+ */
+IoT_Error_t aws_iot_mqtt_dispatch_unsubscribe_stream(AWS_IoT_Dispatcher_t *pDispatcher, const char *pTopicFilter,
+													 uint16_t topicFilterLen, iot_dispatch_stream_handler handler,
+													 void *pHandlerData);
+
+/**
+ * @brief Send pending subscriptions and retry the ones whose SUBACK did not come
+ *
+ * Also sends the PUBACKs of QoS1 publishes that were too large for the client.
+ *
+ * @param pDispatcher Dispatcher state
+ * @return SUCCESS or the error of a failed SUBSCRIBE
+ */
+IoT_Error_t aws_iot_mqtt_dispatch_poll(AWS_IoT_Dispatcher_t *pDispatcher);
+
+/**
+ * @brief State of the subscription to a topic filter, IOT_DISPATCH_SUB_FREE if there is none
+ */
+IoT_Dispatch_Sub_State_t aws_iot_mqtt_dispatch_get_state(AWS_IoT_Dispatcher_t *pDispatcher, const char *pTopicFilter,
+														 uint16_t topicFilterLen);
+
+/**
+ * @brief Deliver a publish to the matching handlers
+ *
+ * Used internally for publishes seen by the tap. Exposed so the matcher can be
+ * driven directly, e.g. by the benchmark.
+ *
+ * @return Number of handlers called
+ */
+uint8_t aws_iot_mqtt_dispatch_deliver(AWS_IoT_Dispatcher_t *pDispatcher, const char *pTopicName, uint16_t topicNameLen,
+									  IoT_Publish_Message_Params *pParams);
+
+/**
+ * @brief Copy the dispatcher counters
+ */
+void aws_iot_mqtt_dispatch_get_stats(const AWS_IoT_Dispatcher_t *pDispatcher, IoT_Dispatch_Stats_t *pStats);
+
+#ifdef AWS_IOT_MQTT_DISPATCH_BENCHMARK
+/**
+ * @brief Compare trie dispatch with a linear scan of wildcard filters
+ *
+ * Subscribes a realistic mix of shadow, jobs and telemetry filters to a
+ * dispatcher that is never connected, then times the matching of inbound
+ * topics with both methods and prints the results.
+ *
+ * @param iterations Number of passes over the topic set
+ */
+void aws_iot_mqtt_dispatch_benchmark(uint32_t iterations);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AWS_IOT_SDK_SRC_IOT_MQTT_CLIENT_DISPATCH_H_ */
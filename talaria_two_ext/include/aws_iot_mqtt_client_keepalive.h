@@ -0,0 +1,199 @@
+/**
+  *****************************************************************************
+  * @file   aws_iot_mqtt_client_keepalive.h
+  *
+  *****************************************************************************
+  * @attention
+  *
+  *
+  *  Copyright (c) 2022, InnoPhase, Inc.
+  *
+  *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  *  POSSIBILITY OF SUCH DAMAGE.
+  *
+  *****************************************************************************
+  */
+
+/**
+ * @file aws_iot_mqtt_client_keepalive.h
+ * @brief Adaptive MQTT keepalive
+ *
+ * The MQTT client sends a PINGREQ every keepAliveIntervalInSec, even right
+ * after a publish went out, and a too long interval lets a NAT or access
+ * point drop the idle connection without anybody noticing until the next
+ * ping fails.
+ *
+ * The adaptive keepalive takes over the pings of a client:
+ * - Every outbound packet, seen through the packet tap
+ *   (aws_iot_mqtt_client_tap.h), restarts the idle period, so no PINGREQ is
+ *   sent while the client publishes.
+ * - The idle period before a ping is learned. It starts at initialInterval_ms
+ *   and grows by step_ms after probeAfter pings in a row got their PINGRESP.
+ *   A ping that gets no answer means the path dropped the connection while
+ *   idle: the idle time it followed becomes the ceiling (less one step) and
+ *   the interval falls back below it. The interval stays within
+ *   [minInterval_ms, maxInterval_ms], and below the CONNECT keepalive.
+ * - With a wake period set, pings are moved to the wake-ups of the device
+ *   (DTIM listen interval or application suspend schedule), so they do not
+ *   wake the radio on their own.
+ *
+ * aws_iot_mqtt_keepalive_poll() must be called regularly, from the thread
+ * calling aws_iot_mqtt_yield() or with the client locked against it. If it
+ * stops being called, the client falls back to its own pings. An unanswered
+ * ping is reported to the client as an outstanding ping, so the client's own
+ * disconnect and auto-reconnect handling runs.
+ */
+
+#ifndef AWS_IOT_SDK_SRC_IOT_MQTT_CLIENT_KEEPALIVE_H_
+#define AWS_IOT_SDK_SRC_IOT_MQTT_CLIENT_KEEPALIVE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "aws_iot_config.h"
+#include "aws_iot_mqtt_client_interface.h"
+#include "aws_iot_mqtt_client_tap.h"
+
+/** Shortest idle period before a ping. */
+#ifndef AWS_IOT_MQTT_KEEPALIVE_MIN_INTERVAL_MS
+#define AWS_IOT_MQTT_KEEPALIVE_MIN_INTERVAL_MS 30000
+#endif
+
+/** Longest idle period before a ping, further bounded by the CONNECT keepalive. */
+#ifndef AWS_IOT_MQTT_KEEPALIVE_MAX_INTERVAL_MS
+#define AWS_IOT_MQTT_KEEPALIVE_MAX_INTERVAL_MS 1140000
+#endif
+
+/** Idle period used on the first connection. */
+#ifndef AWS_IOT_MQTT_KEEPALIVE_INITIAL_INTERVAL_MS
+#define AWS_IOT_MQTT_KEEPALIVE_INITIAL_INTERVAL_MS 60000
+#endif
+
+/** Increase of the idle period when probing. */
+#ifndef AWS_IOT_MQTT_KEEPALIVE_STEP_MS
+#define AWS_IOT_MQTT_KEEPALIVE_STEP_MS 30000
+#endif
+
+/** Pings answered in a row before a longer idle period is tried. */
+#ifndef AWS_IOT_MQTT_KEEPALIVE_PROBE_AFTER
+#define AWS_IOT_MQTT_KEEPALIVE_PROBE_AFTER 3
+#endif
+
+/** Time to wait for a PINGRESP. */
+#ifndef AWS_IOT_MQTT_KEEPALIVE_RESPONSE_TIMEOUT_MS
+#define AWS_IOT_MQTT_KEEPALIVE_RESPONSE_TIMEOUT_MS 10000
+#endif
+
+/**
+ * @brief Adaptive keepalive parameters
+ */
+typedef struct {
+	uint32_t minInterval_ms;
+	uint32_t maxInterval_ms;
+	uint32_t initialInterval_ms;
+	uint32_t step_ms;
+	uint8_t probeAfter;
+	uint32_t responseTimeout_ms;
+	uint32_t wakePeriod_ms;    ///< Period of the device wake-ups pings are aligned to, 0 for none
+} IoT_Keepalive_Params_t;
+
+extern const IoT_Keepalive_Params_t iotKeepaliveParamsDefault;
+
+/**
+ * @brief Adaptive keepalive counters
+ */
+typedef struct {
+	uint32_t pingsSent;
+	uint32_t pingsAnswered;
+	uint32_t pingTimeouts;   ///< Pings without PINGRESP, each one lowers the ceiling
+	uint32_t interval_ms;    ///< Idle period currently used
+	uint32_t ceiling_ms;     ///< Longest idle period known to survive
+} IoT_Keepalive_Stats_t;
+
+/**
+ * @brief Adaptive keepalive state
+ *
+ * Allocated by the application, one per MQTT client. The learned interval
+ * is kept across reconnects.
+ */
+typedef struct {
+	AWS_IoT_Client *pClient;
+	IoT_Keepalive_Params_t params;
+	IoT_Tap_Observer_t observer;
+	uint32_t interval_ms;
+	uint32_t ceiling_ms;
+	uint8_t answeredInRow;
+	uint32_t lastTx_ms;        ///< Last outbound packet
+	uint32_t pingSentAt_ms;
+	uint32_t pingIdle_ms;      ///< Idle time the outstanding ping followed
+	bool isPingOutstanding;
+	bool isTimeoutReported;
+	uint32_t wakeAnchor_ms;
+	IoT_Keepalive_Stats_t stats;
+} AWS_IoT_Keepalive_t;
+
+/**
+ * @brief Initialize the adaptive keepalive of a client
+ *
+ * The client must already be initialized. The packet tap is attached to it.
+ *
+ * @param pKeepalive Keepalive state
+ * @param pClient MQTT client
+ * @param pParams Parameters, NULL selects the defaults
+ * @return An IoT Error Type defining successful/failed initialization
+ */
+IoT_Error_t aws_iot_mqtt_keepalive_init(AWS_IoT_Keepalive_t *pKeepalive, AWS_IoT_Client *pClient,
+										const IoT_Keepalive_Params_t *pParams);
+
+/**
+ * @brief Give the pings back to the client
+ */
+IoT_Error_t aws_iot_mqtt_keepalive_deinit(AWS_IoT_Keepalive_t *pKeepalive);
+
+/**
+ * @brief Align pings to a wake-up schedule
+ *
+ * @param pKeepalive Keepalive state
+ * @param anchor_ms A wake-up time, in aws_iot_mqtt_tap_now_ms() time
+ * @param period_ms Period of the wake-ups, 0 disables the alignment
+ */
+void aws_iot_mqtt_keepalive_set_wake_schedule(AWS_IoT_Keepalive_t *pKeepalive, uint32_t anchor_ms,
+											  uint32_t period_ms);
+
+/**
+ * @brief Send a PINGREQ when the idle period is over
+ *
+ * @param pKeepalive Keepalive state
+ * @return SUCCESS or the error of a failed PINGREQ
+ */
+IoT_Error_t aws_iot_mqtt_keepalive_poll(AWS_IoT_Keepalive_t *pKeepalive);
+
+/**
+ * @brief Milliseconds until the next ping is due, for the application to plan its sleep
+ */
+uint32_t aws_iot_mqtt_keepalive_time_to_ping(const AWS_IoT_Keepalive_t *pKeepalive);
+
+/**
+ * @brief Copy the keepalive counters
+ */
+void aws_iot_mqtt_keepalive_get_stats(const AWS_IoT_Keepalive_t *pKeepalive, IoT_Keepalive_Stats_t *pStats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AWS_IOT_SDK_SRC_IOT_MQTT_CLIENT_KEEPALIVE_H_ */
@@ -0,0 +1,224 @@
+/**
+  *****************************************************************************
+  * @file   aws_iot_mqtt_client_outbox.h
+  *
+  *****************************************************************************
+  * @attention
+  *
+  *
+  *  Copyright (c) 2022, InnoPhase, Inc.
+  *
+  *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  *  POSSIBILITY OF SUCH DAMAGE.
+  *
+  *****************************************************************************
+  */
+
+/**
+ * @file aws_iot_mqtt_client_outbox.h
+ * @brief Persistent QoS1 outbox for store-and-forward while offline
+ *
+ * Every message handed to aws_iot_mqtt_outbox_publish() is first appended to
+ * a log file in the Talaria file system, then sent through an async publisher
+ * (aws_iot_mqtt_client_async_publish.h) whenever the client is connected. A
+ * PUBACK appends an ack record for the message. Messages not acked yet survive
+ * a disconnect, a reboot or a suspend, and are replayed in their original
+ * order once the client is connected again.
+ *
+ * Acked records are dropped from the log by a compaction pass that rewrites
+ * the live records to a new file, see aws_iot_file_utils.h. It runs from
+ * aws_iot_mqtt_outbox_poll() once dead records make up half of the log. A
+ * message evicted to make room gets an ack record like a delivered one, so
+ * a full outbox costs one small append per new message rather than a
+ * rewrite of the log.
+ *
+ * Log record layout, all integers little endian:
+ *
+ *     magic(1) type(1) flags(1) checksum(1) seq(4) topicLen(2) payloadLen(2) topic payload
+ *
+ * A record cut short by a power loss fails its checksum and ends the log.
+ */
+
+#ifndef AWS_IOT_SDK_SRC_IOT_MQTT_CLIENT_OUTBOX_H_
+#define AWS_IOT_SDK_SRC_IOT_MQTT_CLIENT_OUTBOX_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "aws_iot_config.h"
+#include "aws_iot_file_utils.h"
+#include "aws_iot_mqtt_client_interface.h"
+#include "aws_iot_mqtt_client_async_publish.h"
+#include "aws_iot_mqtt_client_scheduler.h"
+
+/** Most messages the outbox can hold, acked or not. */
+#ifndef AWS_IOT_MQTT_OUTBOX_MAX_MESSAGES
+#define AWS_IOT_MQTT_OUTBOX_MAX_MESSAGES 32
+#endif
+
+/** Default size limit of the log file. */
+#ifndef AWS_IOT_MQTT_OUTBOX_MAX_FILE_SIZE
+#define AWS_IOT_MQTT_OUTBOX_MAX_FILE_SIZE 16384
+#endif
+
+/** Longest log record, header included. */
+#ifndef AWS_IOT_MQTT_OUTBOX_MAX_RECORD_LEN
+#define AWS_IOT_MQTT_OUTBOX_MAX_RECORD_LEN AWS_IOT_MQTT_ASYNC_PUBLISH_MAX_PACKET_LEN
+#endif
+
+/** Longest log file path, excluding the terminating NULL byte. */
+#ifndef AWS_IOT_MQTT_OUTBOX_MAX_PATH_LEN
+#define AWS_IOT_MQTT_OUTBOX_MAX_PATH_LEN AWS_IOT_FILE_MAX_PATH_LEN
+#endif
+
+#define AWS_IOT_MQTT_OUTBOX_RECORD_HEADER_LEN 12
+
+/** Returned by aws_iot_mqtt_outbox_publish() when the outbox is full and IOT_OUTBOX_REJECT_NEW is selected. */
+#define MQTT_OUTBOX_FULL_ERROR FAILURE
+
+typedef enum {
+	IOT_OUTBOX_DROP_OLDEST, ///< Make room by discarding the oldest message, acked or not
+	IOT_OUTBOX_REJECT_NEW,  ///< Keep the stored messages and refuse the new one
+} IoT_Outbox_Eviction_t;
+
+/**
+ * @brief Outbox parameters
+ */
+typedef struct {
+	const char *pFilePath;          ///< Log file, e.g. MOUNT_PATH "aws_outbox"
+	uint16_t maxMessages;           ///< 1 to AWS_IOT_MQTT_OUTBOX_MAX_MESSAGES
+	uint32_t maxFileSize;           ///< Size limit of the unacked records, the log may reach twice as much before compaction
+	IoT_Outbox_Eviction_t eviction; ///< What to do when a limit is reached
+} IoT_Outbox_Params_t;
+
+extern const IoT_Outbox_Params_t iotOutboxParamsDefault;
+
+/**
+ * @brief Outbox counters
+ */
+typedef struct {
+	uint32_t stored;      ///< Messages appended to the log
+	uint32_t delivered;   ///< Messages acked by the broker
+	uint32_t replayed;    ///< Messages found unacked in the log at init
+	uint32_t evicted;     ///< Messages discarded to make room
+	uint32_t rejected;    ///< Messages refused because the outbox was full
+	uint32_t compactions; ///< Times the log was rewritten
+} IoT_Outbox_Stats_t;
+
+typedef enum {
+	IOT_OUTBOX_ENTRY_PENDING, ///< Waiting to be sent
+	IOT_OUTBOX_ENTRY_SENDING, ///< Handed to the async publisher
+	IOT_OUTBOX_ENTRY_ACKED,   ///< Delivered, removed at the next compaction
+} IoT_Outbox_Entry_State_t;
+
+typedef struct {
+	uint32_t seq;
+	uint32_t offset;    ///< Offset of the record in the log file
+	uint16_t recordLen;
+	uint16_t packetId;  ///< Valid while SENDING
+	IoT_Outbox_Entry_State_t state;
+} IoT_Outbox_Entry_t;
+
+/**
+ * @brief Outbox state
+ *
+ * Allocated by the application. entries is a ring in sequence order.
+ */
+typedef struct {
+	IoT_Outbox_Params_t params;
+	AWS_IoT_Async_Publisher_t *pPublisher;
+	AWS_IoT_Scheduler_t *pScheduler; ///< Paces the sending on its bulk lane, may be NULL
+	IoT_Outbox_Entry_t entries[AWS_IOT_MQTT_OUTBOX_MAX_MESSAGES];
+	uint16_t first;
+	uint16_t count;
+	uint32_t nextSeq;
+	uint32_t fileSize;
+	uint32_t deadBytes;   ///< Bytes of acked and ack records in the log
+	unsigned char record[AWS_IOT_MQTT_OUTBOX_MAX_RECORD_LEN];
+	IoT_Outbox_Stats_t stats;
+} AWS_IoT_Outbox_t;
+
+/**
+ * @brief Open the outbox and load the messages left in its log
+ *
+ * The file system must be mounted. Unacked messages found in the log are
+ * queued for sending, before any message published later.
+ *
+ * @param pOutbox Outbox state
+ * @param pParams Parameters, NULL selects the defaults
+ * @return An IoT Error Type defining successful/failed initialization
+ */
+IoT_Error_t aws_iot_mqtt_outbox_init(AWS_IoT_Outbox_t *pOutbox, const IoT_Outbox_Params_t *pParams);
+
+/**
+ * @brief Set the async publisher messages are sent through
+ *
+ * May be called again after the client was re-created. NULL stops sending,
+ * messages are then only stored. Messages handed to the previous publisher
+ * and not acked yet are sent again.
+ */
+void aws_iot_mqtt_outbox_set_publisher(AWS_IoT_Outbox_t *pOutbox, AWS_IoT_Async_Publisher_t *pPublisher);
+
+/**
+ * @brief Send stored messages on the bulk lane of a publish scheduler
+ *
+ * A message is only handed to the async publisher once the scheduler admits
+ * it. Until then it waits in the log, in order. The scheduler must be on the
+ * client of the publisher. NULL sends as fast as the window allows.
+ */
+void aws_iot_mqtt_outbox_set_scheduler(AWS_IoT_Outbox_t *pOutbox, AWS_IoT_Scheduler_t *pScheduler);
+
+/**
+ * @brief Store a QoS1 message and send it as soon as possible
+ *
+ * Works while disconnected. The qos and isDup fields of pParams are ignored.
+ *
+ * @param pOutbox Outbox state
+ * @param pTopicName Topic name
+ * @param topicNameLen Length of the topic name
+ * @param pParams Payload and flags of the message
+ * @return SUCCESS, MQTT_OUTBOX_FULL_ERROR or an error from the file system
+ */
+IoT_Error_t aws_iot_mqtt_outbox_publish(AWS_IoT_Outbox_t *pOutbox, const char *pTopicName, uint16_t topicNameLen,
+										IoT_Publish_Message_Params *pParams);
+
+/**
+ * @brief Send stored messages, record acks and compact the log
+ *
+ * Polls the async publisher too, so it replaces aws_iot_mqtt_async_publish_poll()
+ * in the application loop.
+ *
+ * @param pOutbox Outbox state
+ * @return SUCCESS or the first error met
+ */
+IoT_Error_t aws_iot_mqtt_outbox_poll(AWS_IoT_Outbox_t *pOutbox);
+
+/**
+ * @brief Number of messages not acked yet
+ */
+uint16_t aws_iot_mqtt_outbox_pending(const AWS_IoT_Outbox_t *pOutbox);
+
+/**
+ * @brief Copy the outbox counters
+ */
+void aws_iot_mqtt_outbox_get_stats(const AWS_IoT_Outbox_t *pOutbox, IoT_Outbox_Stats_t *pStats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AWS_IOT_SDK_SRC_IOT_MQTT_CLIENT_OUTBOX_H_ */
@@ -0,0 +1,216 @@
+/**
+  *****************************************************************************
+  * @file   aws_iot_mqtt_client_reconnect.h
+  *
+  *****************************************************************************
+  * @attention
+  *
+  *
+  *  Copyright (c) 2022, InnoPhase, Inc.
+  *
+  *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  *  POSSIBILITY OF SUCH DAMAGE.
+  *
+  *****************************************************************************
+  */
+
+/**
+ * @file aws_iot_mqtt_client_reconnect.h
+ * @brief Reconnect state machine with full-jitter backoff and link awareness
+ *
+ * The auto-reconnect of the SDK runs inside aws_iot_mqtt_yield(): each call
+ * sleeps or makes a blocking connect attempt, the backoff doubles between
+ * AWS_IOT_MQTT_MIN_RECONNECT_WAIT_INTERVAL and
+ * AWS_IOT_MQTT_MAX_RECONNECT_WAIT_INTERVAL without randomization, and the
+ * application only sees NETWORK_ATTEMPTING_RECONNECT. After an outage all
+ * the devices behind an access point retry on the same schedule.
+ *
+ * The reconnect state machine takes over from it:
+ * - The delay before each attempt is drawn uniformly between 0 and the
+ *   exponential backoff ("full jitter"), so devices that lost the
+ *   connection together spread their attempts.
+ * - No attempt is made while the Wi-Fi link is down. When the link comes
+ *   back an attempt is made right away, with the backoff reset.
+ * - aws_iot_mqtt_reconnect_poll() never waits. With isAttemptInThread the
+ *   TLS handshake runs on a worker thread, so the application loop keeps
+ *   running while the attempt lasts. The worker is created by the first
+ *   attempt and serves every later one until the deinit.
+ * - Each attempt is reported with its number, the delay before it, its
+ *   duration and its result.
+ *
+ * Attempts reconnect with the connect parameters of the last connect and
+ * restore the subscriptions of the client, like aws_iot_mqtt_attempt_reconnect().
+ */
+
+#ifndef AWS_IOT_SDK_SRC_IOT_MQTT_CLIENT_RECONNECT_H_
+#define AWS_IOT_SDK_SRC_IOT_MQTT_CLIENT_RECONNECT_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "aws_iot_config.h"
+#include "aws_iot_mqtt_client_interface.h"
+#include "threads_interface.h"
+
+/** Stack of the thread running the attempts. The TLS handshake runs on it. */
+#ifndef AWS_IOT_MQTT_RECONNECT_STACK_SIZE
+#define AWS_IOT_MQTT_RECONNECT_STACK_SIZE 6144
+#endif
+
+#ifndef AWS_IOT_MQTT_RECONNECT_PRIORITY
+#define AWS_IOT_MQTT_RECONNECT_PRIORITY IOT_THREAD_DEFAULT_PRIORITY
+#endif
+
+typedef enum {
+	IOT_RECONNECT_STATE_CONNECTED,  ///< The client is connected, or connected by the application
+	IOT_RECONNECT_STATE_LINK_DOWN,  ///< Disconnected, waiting for the link to come back
+	IOT_RECONNECT_STATE_BACKOFF,    ///< Disconnected, waiting for the next attempt
+	IOT_RECONNECT_STATE_CONNECTING, ///< An attempt is running on its thread
+} IoT_Reconnect_State_t;
+
+/**
+ * @brief One reconnect attempt
+ */
+typedef struct {
+	uint32_t number;       ///< Attempts since the connection was lost, from 1
+	uint32_t backoff_ms;   ///< Delay drawn before the attempt, 0 when triggered by the link
+	uint32_t duration_ms;  ///< Time taken by the attempt
+	uint32_t outage_ms;    ///< Time since the connection was lost, at the end of the attempt
+	bool isLinkTriggered;  ///< Made as soon as the link came back
+	IoT_Error_t rc;        ///< SUCCESS, or the error of aws_iot_mqtt_connect() or aws_iot_mqtt_resubscribe()
+} IoT_Reconnect_Attempt_t;
+
+/**
+ * @brief Attempt handler
+ *
+ * Called by aws_iot_mqtt_reconnect_poll() after each attempt.
+ */
+typedef void (*iot_reconnect_attempt_handler)(AWS_IoT_Client *pClient, const IoT_Reconnect_Attempt_t *pAttempt,
+											  void *pData);
+
+/**
+ * @brief Reconnect parameters
+ */
+typedef struct {
+	uint32_t minBackoff_ms;   ///< Upper bound of the first delay
+	uint32_t maxBackoff_ms;   ///< Upper bound of any delay
+	bool isAttemptInThread;   ///< Run the attempts on their own thread, needs _ENABLE_THREAD_SUPPORT_
+	iot_reconnect_attempt_handler handler; ///< May be NULL
+	void *pHandlerData;
+} IoT_Reconnect_Params_t;
+
+extern const IoT_Reconnect_Params_t iotReconnectParamsDefault;
+
+/**
+ * @brief Reconnect counters
+ */
+typedef struct {
+	uint32_t disconnects;
+	uint32_t attempts;
+	uint32_t successes;
+	uint32_t linkDowns;
+	uint32_t linkUps;
+	uint32_t lastOutage_ms;     ///< From the loss of the connection to the successful attempt
+	uint32_t longestOutage_ms;
+	uint32_t longestAttempt_ms;
+	IoT_Error_t lastRc;         ///< Result of the last attempt
+} IoT_Reconnect_Stats_t;
+
+/**
+ * @brief Reconnect state
+ *
+ * Allocated by the application, one per MQTT client.
+ */
+typedef struct {
+	AWS_IoT_Client *pClient;
+	IoT_Reconnect_Params_t params;
+#ifdef _ENABLE_THREAD_SUPPORT_
+	IoT_Mutex_t lock;
+	IoT_Thread_t thread;
+	IoT_Semaphore_t wake;     ///< Posted for each attempt, and to stop the worker
+	volatile bool isWorkerRunning;
+	volatile bool isStopRequested;
+#endif
+	IoT_Reconnect_State_t state;
+	bool isLinkUp;
+	bool isLinkUpPending;     ///< The link came back since the last poll
+	bool isWorkerDone;        ///< The worker has the result of an attempt
+	bool isReconnected;       ///< Reported by the next poll
+	IoT_Error_t workerRc;
+	uint8_t backoffExp;
+	uint32_t random;
+	uint32_t lostAt_ms;
+	uint32_t nextAttempt_ms;
+	uint32_t attemptStart_ms;
+	IoT_Reconnect_Attempt_t attempt;
+	IoT_Reconnect_Stats_t stats;
+} AWS_IoT_Reconnect_t;
+
+/**
+ * @brief Take over the reconnects of a client
+ *
+ * Disables the auto-reconnect of the client. The link is assumed up.
+ *
+ * @param pReconnect Reconnect state
+ * @param pClient MQTT client, connected
+ * @param pParams Parameters, NULL selects the defaults
+ * @return An IoT Error Type defining successful/failed initialization
+ */
+IoT_Error_t aws_iot_mqtt_reconnect_init(AWS_IoT_Reconnect_t *pReconnect, AWS_IoT_Client *pClient,
+										const IoT_Reconnect_Params_t *pParams);
+
+/**
+ * @brief Stop reconnecting. Waits for a running attempt to end and for the worker to exit.
+ */
+IoT_Error_t aws_iot_mqtt_reconnect_deinit(AWS_IoT_Reconnect_t *pReconnect);
+
+/**
+ * @brief Report the state of the Wi-Fi link
+ *
+ * Can be called from the WCM notification callback: down on
+ * WCM_NOTIFY_MSG_LINK_DOWN, up on WCM_NOTIFY_MSG_CONNECTED.
+ */
+void aws_iot_mqtt_reconnect_set_link(AWS_IoT_Reconnect_t *pReconnect, bool isUp);
+
+/**
+ * @brief Run the state machine
+ *
+ * Call it from the application loop, in place of relying on
+ * aws_iot_mqtt_yield() to reconnect. Returns at once, except for an attempt
+ * made without isAttemptInThread.
+ *
+ * @param pReconnect Reconnect state
+ * @return SUCCESS while connected, NETWORK_RECONNECTED once after a
+ *         successful attempt, NETWORK_ATTEMPTING_RECONNECT while disconnected
+ */
+IoT_Error_t aws_iot_mqtt_reconnect_poll(AWS_IoT_Reconnect_t *pReconnect);
+
+/**
+ * @brief Current state
+ */
+IoT_Reconnect_State_t aws_iot_mqtt_reconnect_get_state(AWS_IoT_Reconnect_t *pReconnect);
+
+/**
+ * @brief Copy the reconnect counters
+ */
+void aws_iot_mqtt_reconnect_get_stats(AWS_IoT_Reconnect_t *pReconnect, IoT_Reconnect_Stats_t *pStats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AWS_IOT_SDK_SRC_IOT_MQTT_CLIENT_RECONNECT_H_ */
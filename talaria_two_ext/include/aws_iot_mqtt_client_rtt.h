@@ -0,0 +1,171 @@
+/**
+  *****************************************************************************
+  * @file   aws_iot_mqtt_client_rtt.h
+  *
+  *****************************************************************************
+  * @attention
+  *
+  *
+  *  Copyright (c) 2022, InnoPhase, Inc.
+  *
+  *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  *  POSSIBILITY OF SUCH DAMAGE.
+  *
+  *****************************************************************************
+  */
+
+/**
+ * @file aws_iot_mqtt_client_rtt.h
+ * @brief Round-trip time estimator and adaptive retransmission timeout
+ *
+ * The estimator times the request/ack pairs of a client through the packet
+ * tap (aws_iot_mqtt_client_tap.h): a QoS1 PUBLISH and its PUBACK, a SUBSCRIBE
+ * and its SUBACK. From the samples it keeps a smoothed RTT and RTT variance
+ * and derives a retransmission timeout the way TCP does (RFC 6298):
+ *
+ *     SRTT   = 7/8 SRTT + 1/8 R
+ *     RTTVAR = 3/4 RTTVAR + 1/4 |SRTT - R|
+ *     RTO    = SRTT + 4 RTTVAR, within [minRto_ms, maxRto_ms]
+ *
+ * The ack of a request that was sent more than once says nothing about which
+ * copy it answers, so it gives no sample (Karn's algorithm). Retransmissions
+ * double the timeout, see aws_iot_mqtt_rtt_backoff_ms().
+ *
+ * Acks are timed when the client reads them, so the RTT includes the time
+ * the application takes to call aws_iot_mqtt_yield(). That is also the
+ * delay a retransmission timer checked after each yield sees.
+ *
+ * The async publisher (aws_iot_mqtt_client_async_publish.h) retransmits on
+ * this timeout once given the estimator with aws_iot_mqtt_async_publish_set_rtt().
+ */
+
+#ifndef AWS_IOT_SDK_SRC_IOT_MQTT_CLIENT_RTT_H_
+#define AWS_IOT_SDK_SRC_IOT_MQTT_CLIENT_RTT_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "aws_iot_config.h"
+#include "aws_iot_mqtt_client_interface.h"
+#include "aws_iot_mqtt_client_tap.h"
+
+/** Requests timed at the same time. The oldest is dropped when a new one does not fit. */
+#ifndef AWS_IOT_MQTT_RTT_MAX_PENDING
+#define AWS_IOT_MQTT_RTT_MAX_PENDING 8
+#endif
+
+/** Timeout used until the first sample */
+#ifndef AWS_IOT_MQTT_RTT_INITIAL_RTO_MS
+#define AWS_IOT_MQTT_RTT_INITIAL_RTO_MS 3000
+#endif
+
+#ifndef AWS_IOT_MQTT_RTT_MIN_RTO_MS
+#define AWS_IOT_MQTT_RTT_MIN_RTO_MS 500
+#endif
+
+/** Upper bound of the timeout, backoff included */
+#ifndef AWS_IOT_MQTT_RTT_MAX_RTO_MS
+#define AWS_IOT_MQTT_RTT_MAX_RTO_MS 20000
+#endif
+
+/**
+ * @brief Estimator parameters
+ */
+typedef struct {
+	uint32_t initialRto_ms;
+	uint32_t minRto_ms;
+	uint32_t maxRto_ms;
+} IoT_Rtt_Params_t;
+
+extern const IoT_Rtt_Params_t iotRttParamsDefault;
+
+/**
+ * @brief Round-trip statistics
+ */
+typedef struct {
+	uint32_t samples;
+	uint32_t ambiguous;   ///< Acks of retransmitted requests, not sampled
+	uint32_t lastRtt_ms;
+	uint32_t minRtt_ms;
+	uint32_t maxRtt_ms;
+	uint32_t srtt_ms;     ///< Smoothed RTT, 0 before the first sample
+	uint32_t rttvar_ms;   ///< RTT variance
+	uint32_t rto_ms;      ///< Current retransmission timeout
+} IoT_Rtt_Stats_t;
+
+typedef struct {
+	uint16_t packetId;        ///< 0 if the entry is free
+	uint8_t type;             ///< IOT_TAP_PUBLISH or IOT_TAP_SUBSCRIBE
+	bool isRetransmitted;
+	uint32_t sentAt_ms;
+} IoT_Rtt_Pending_t;
+
+/**
+ * @brief Estimator state
+ *
+ * Allocated by the application, one per MQTT client.
+ */
+typedef struct {
+	AWS_IoT_Client *pClient;
+	IoT_Rtt_Params_t params;
+	IoT_Tap_Observer_t observer;
+#ifdef _ENABLE_THREAD_SUPPORT_
+	IoT_Mutex_t lock;
+#endif
+	IoT_Rtt_Pending_t pending[AWS_IOT_MQTT_RTT_MAX_PENDING];
+	uint32_t srtt_x8;         ///< SRTT in 1/8 ms
+	uint32_t rttvar_x4;       ///< RTTVAR in 1/4 ms
+	IoT_Rtt_Stats_t stats;
+} AWS_IoT_Rtt_t;
+
+/**
+ * @brief Start timing the requests of a client
+ *
+ * The client must already be initialized. The packet tap is attached to it.
+ *
+ * @param pRtt Estimator state
+ * @param pClient MQTT client
+ * @param pParams Parameters, NULL selects the defaults
+ * @return An IoT Error Type defining successful/failed initialization
+ */
+IoT_Error_t aws_iot_mqtt_rtt_init(AWS_IoT_Rtt_t *pRtt, AWS_IoT_Client *pClient, const IoT_Rtt_Params_t *pParams);
+
+/**
+ * @brief Stop timing
+ */
+IoT_Error_t aws_iot_mqtt_rtt_deinit(AWS_IoT_Rtt_t *pRtt);
+
+/**
+ * @brief Current retransmission timeout
+ */
+uint32_t aws_iot_mqtt_rtt_get_rto_ms(AWS_IoT_Rtt_t *pRtt);
+
+/**
+ * @brief Timeout of a request already sent retries + 1 times: the RTO doubled retries times, up to maxRto_ms
+ */
+uint32_t aws_iot_mqtt_rtt_backoff_ms(AWS_IoT_Rtt_t *pRtt, uint8_t retries);
+
+/**
+ * @brief Copy the round-trip statistics
+ */
+void aws_iot_mqtt_rtt_get_stats(AWS_IoT_Rtt_t *pRtt, IoT_Rtt_Stats_t *pStats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AWS_IOT_SDK_SRC_IOT_MQTT_CLIENT_RTT_H_ */
@@ -0,0 +1,286 @@
+/**
+  *****************************************************************************
+  * @file   aws_iot_mqtt_client_rx_task.h
+  *
+  *****************************************************************************
+  * @attention
+  *
+  *
+  *  Copyright (c) 2022, InnoPhase, Inc.
+  *
+  *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  *  POSSIBILITY OF SUCH DAMAGE.
+  *
+  *****************************************************************************
+  */
+
+/**
+ * @file aws_iot_mqtt_client_rx_task.h
+ * @brief Dedicated MQTT receive task
+ *
+ * The receive task owns the socket reads of an MQTT client: it calls
+ * aws_iot_mqtt_yield() in its own thread and copies every publish received on
+ * a topic subscribed through aws_iot_mqtt_rx_task_subscribe() into a bounded
+ * single-producer/single-consumer ring. The application drains the ring at its
+ * own pace with aws_iot_mqtt_rx_task_peek() / aws_iot_mqtt_rx_task_release(),
+ * so slow application code never delays keepalive handling.
+ *
+ * A QoS0 message received while the ring is full is dropped. A QoS1 message
+ * never is: its PUBACK is sent when the receive callback returns, so the task
+ * waits in the callback, holding the client lock, until the consumer releases
+ * a descriptor. Meanwhile aws_iot_mqtt_rx_task_lock() and
+ * aws_iot_mqtt_rx_task_stop() return MUTEX_LOCK_ERROR instead of waiting: the
+ * consumer drains the ring and calls them again.
+ *
+ * Any other call on the client (publish, subscribe, disconnect ...) must be
+ * made between aws_iot_mqtt_rx_task_lock() and aws_iot_mqtt_rx_task_unlock()
+ * while the task is running.
+ */
+
+#ifndef AWS_IOT_SDK_SRC_IOT_MQTT_CLIENT_RX_TASK_H_
+#define AWS_IOT_SDK_SRC_IOT_MQTT_CLIENT_RX_TASK_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "aws_iot_config.h"
+#include "aws_iot_mqtt_client_interface.h"
+#include "threads_interface.h"
+
+#ifndef _ENABLE_THREAD_SUPPORT_
+#error "aws_iot_mqtt_client_rx_task requires _ENABLE_THREAD_SUPPORT_"
+#endif
+
+/** Number of message descriptors in the ring. Must be a power of two. */
+#ifndef AWS_IOT_MQTT_RX_TASK_QUEUE_DEPTH
+#define AWS_IOT_MQTT_RX_TASK_QUEUE_DEPTH 8
+#endif
+
+/** Longest topic name stored in a descriptor, excluding the terminating NULL byte. */
+#ifndef AWS_IOT_MQTT_RX_TASK_MAX_TOPIC_LEN
+#define AWS_IOT_MQTT_RX_TASK_MAX_TOPIC_LEN 64
+#endif
+
+/** Longest payload stored in a descriptor. Longer payloads are truncated and flagged. */
+#ifndef AWS_IOT_MQTT_RX_TASK_MAX_PAYLOAD_LEN
+#define AWS_IOT_MQTT_RX_TASK_MAX_PAYLOAD_LEN AWS_IOT_MQTT_RX_BUF_LEN
+#endif
+
+/** Ring fill level at which backpressure is asserted. It is released again when the ring is half empty. */
+#ifndef AWS_IOT_MQTT_RX_TASK_HIGH_WATERMARK
+#define AWS_IOT_MQTT_RX_TASK_HIGH_WATERMARK ((AWS_IOT_MQTT_RX_TASK_QUEUE_DEPTH * 3) / 4)
+#endif
+
+/** Max time a single aws_iot_mqtt_yield() call made by the task waits for data. */
+#ifndef AWS_IOT_MQTT_RX_TASK_YIELD_TIMEOUT_MS
+#define AWS_IOT_MQTT_RX_TASK_YIELD_TIMEOUT_MS 100
+#endif
+
+/** Pause between two yields, giving the application a chance to take the client lock. */
+#ifndef AWS_IOT_MQTT_RX_TASK_IDLE_MS
+#define AWS_IOT_MQTT_RX_TASK_IDLE_MS 10
+#endif
+
+/** Max time socket reads are held back while the ring is above the high watermark. Reads stay held back while it is full. */
+#ifndef AWS_IOT_MQTT_RX_TASK_MAX_STALL_MS
+#define AWS_IOT_MQTT_RX_TASK_MAX_STALL_MS 1000
+#endif
+
+#ifndef AWS_IOT_MQTT_RX_TASK_STACK_SIZE
+#define AWS_IOT_MQTT_RX_TASK_STACK_SIZE 2048
+#endif
+
+#ifndef AWS_IOT_MQTT_RX_TASK_PRIORITY
+#define AWS_IOT_MQTT_RX_TASK_PRIORITY IOT_THREAD_DEFAULT_PRIORITY
+#endif
+
+/**
+ * @brief Received message descriptor
+ *
+ * A copy of one publish received by the task. The descriptor stays valid until
+ * it is handed back with aws_iot_mqtt_rx_task_release().
+ */
+typedef struct {
+	char topicName[AWS_IOT_MQTT_RX_TASK_MAX_TOPIC_LEN + 1]; ///< NULL terminated topic name
+	uint16_t topicNameLen;                                  ///< Length of the topic name
+	unsigned char payload[AWS_IOT_MQTT_RX_TASK_MAX_PAYLOAD_LEN]; ///< Payload bytes
+	size_t payloadLen;                                      ///< Number of valid bytes in payload
+	QoS qos;                                                ///< QoS the message was delivered with
+	uint8_t isRetained;                                     ///< Retained flag of the message
+	uint8_t isDup;                                          ///< DUP flag of the message
+	uint16_t id;                                            ///< Packet identifier, QoS1 only
+	bool isTruncated;                                       ///< true if topic or payload did not fit
+} IoT_Rx_Message_t;
+
+/**
+ * @brief Receive task counters
+ */
+typedef struct {
+	uint32_t received;       ///< Messages placed in the ring
+	uint32_t dropped;        ///< QoS0 messages lost because the ring was full
+	uint32_t waits;          ///< Times a QoS1 message waited in the receive callback for room in the ring
+	uint32_t truncated;      ///< Messages whose topic or payload had to be truncated
+	uint32_t stalls;         ///< Times reading was held back because of backpressure
+	uint32_t highWatermark;  ///< Highest ring fill level seen
+} IoT_Rx_Task_Stats_t;
+
+/**
+ * @brief Backpressure notification
+ *
+ * Called from the receive task when the ring crosses the high watermark
+ * (isAsserted true) and when it drains below half (isAsserted false).
+ */
+typedef void (*iot_rx_task_backpressure_handler)(AWS_IoT_Client *pClient, bool isAsserted, void *pData);
+
+/**
+ * @brief Receive task parameters
+ */
+typedef struct {
+	iot_rx_task_backpressure_handler backpressureHandler; ///< Optional, may be NULL
+	void *backpressureHandlerData;                        ///< Passed back to backpressureHandler
+	uint32_t yieldTimeout_ms;                             ///< 0 selects AWS_IOT_MQTT_RX_TASK_YIELD_TIMEOUT_MS
+} IoT_Rx_Task_Params_t;
+
+extern const IoT_Rx_Task_Params_t iotRxTaskParamsDefault;
+
+/**
+ * @brief Receive task state
+ *
+ * Allocated by the application, one per MQTT client.
+ */
+typedef struct {
+	AWS_IoT_Client *pClient;
+	IoT_Rx_Task_Params_t params;
+	IoT_Thread_t thread;
+	IoT_Mutex_t clientLock;
+	IoT_Rx_Message_t ring[AWS_IOT_MQTT_RX_TASK_QUEUE_DEPTH];
+	volatile uint32_t head;          ///< Written by the receive task only
+	volatile uint32_t tail;          ///< Written by the consumer only
+	volatile bool isRunning;
+	volatile bool isStopRequested;
+	volatile bool isBackpressured;
+	volatile bool isWaitingForRoom;  ///< A QoS1 message waits in the receive callback for a free descriptor
+	volatile IoT_Error_t lastYieldRc; ///< Last value returned by aws_iot_mqtt_yield()
+	IoT_Rx_Task_Stats_t stats;
+} AWS_IoT_Rx_Task_t;
+
+/**
+ * @brief Initialize a receive task for a client
+ *
+ * The client must already be initialized. The task is not started.
+ *
+ * @param pRxTask Receive task state
+ * @param pClient MQTT client whose socket reads the task will own
+ * @param pParams Task parameters, NULL selects the defaults
+ * @return An IoT Error Type defining successful/failed initialization
+ */
+IoT_Error_t aws_iot_mqtt_rx_task_init(AWS_IoT_Rx_Task_t *pRxTask, AWS_IoT_Client *pClient,
+									  const IoT_Rx_Task_Params_t *pParams);
+
+/**
+ * @brief Start the receive task
+ *
+ * From now on the application must not call aws_iot_mqtt_yield() itself.
+ *
+ * @param pRxTask Receive task state
+ * @return An IoT Error Type defining successful/failed start
+ */
+IoT_Error_t aws_iot_mqtt_rx_task_start(AWS_IoT_Rx_Task_t *pRxTask);
+
+/**
+ * @brief Stop the receive task
+ *
+ * Blocks until the task has left its loop. Messages still in the ring can be drained afterwards.
+ *
+ * @param pRxTask Receive task state
+ * @return SUCCESS once the task has stopped, MUTEX_LOCK_ERROR while a QoS1
+ *         message waits for room in the ring: drain it and call again
+ */
+IoT_Error_t aws_iot_mqtt_rx_task_stop(AWS_IoT_Rx_Task_t *pRxTask);
+
+/**
+ * @brief Subscribe to a topic and deliver its messages through the ring
+ *
+ * @param pRxTask Receive task state
+ * @param pTopicName Topic filter, must stay valid while subscribed
+ * @param topicNameLen Length of the topic filter
+ * @param qos Requested QoS
+ * @return An IoT Error Type defining successful/failed subscription
+ */
+IoT_Error_t aws_iot_mqtt_rx_task_subscribe(AWS_IoT_Rx_Task_t *pRxTask, const char *pTopicName,
+										   uint16_t topicNameLen, QoS qos);
+
+/**
+ * @brief Get the oldest message in the ring without removing it
+ *
+ * Must only be called from the single consumer thread.
+ *
+ * @param pRxTask Receive task state
+ * @return Oldest message or NULL if the ring is empty
+ */
+IoT_Rx_Message_t *aws_iot_mqtt_rx_task_peek(AWS_IoT_Rx_Task_t *pRxTask);
+
+/**
+ * @brief Hand the message returned by aws_iot_mqtt_rx_task_peek() back to the ring
+ *
+ * @param pRxTask Receive task state
+ */
+void aws_iot_mqtt_rx_task_release(AWS_IoT_Rx_Task_t *pRxTask);
+
+/**
+ * @brief Number of messages waiting in the ring
+ */
+uint32_t aws_iot_mqtt_rx_task_pending(const AWS_IoT_Rx_Task_t *pRxTask);
+
+/**
+ * @brief true while the ring is above the high watermark and reads are being held back
+ */
+bool aws_iot_mqtt_rx_task_is_backpressured(const AWS_IoT_Rx_Task_t *pRxTask);
+
+/**
+ * @brief Last return code of aws_iot_mqtt_yield() in the task
+ *
+ * Lets the application see NETWORK_ATTEMPTING_RECONNECT, NETWORK_RECONNECTED
+ * and fatal errors the same way it would with its own yield loop.
+ */
+IoT_Error_t aws_iot_mqtt_rx_task_get_status(const AWS_IoT_Rx_Task_t *pRxTask);
+
+/**
+ * @brief Copy the receive task counters
+ */
+void aws_iot_mqtt_rx_task_get_stats(const AWS_IoT_Rx_Task_t *pRxTask, IoT_Rx_Task_Stats_t *pStats);
+
+/**
+ * @brief Take exclusive use of the client
+ *
+ * Must be held around any other call made on the client while the task is running.
+ *
+ * @return SUCCESS once the lock is held, MUTEX_LOCK_ERROR while a QoS1
+ *         message waits for room in the ring: drain it and call again
+ */
+IoT_Error_t aws_iot_mqtt_rx_task_lock(AWS_IoT_Rx_Task_t *pRxTask);
+
+/**
+ * @brief Give back exclusive use of the client
+ */
+IoT_Error_t aws_iot_mqtt_rx_task_unlock(AWS_IoT_Rx_Task_t *pRxTask);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AWS_IOT_SDK_SRC_IOT_MQTT_CLIENT_RX_TASK_H_ */
@@ -0,0 +1,272 @@
+/**
+  *****************************************************************************
+  * @file   aws_iot_mqtt_client_scheduler.h
+  *
+  *****************************************************************************
+  * @attention
+  *
+  *
+  *  Copyright (c) 2022, InnoPhase, Inc.
+  *
+  *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  *  POSSIBILITY OF SUCH DAMAGE.
+  *
+  *****************************************************************************
+  */
+
+/**
+ * @file aws_iot_mqtt_client_scheduler.h
+ * @brief Token-bucket publish scheduler with priority lanes
+ *
+ * AWS IoT limits the publishes a single connection may send per second and
+ * the bytes it may send per second, and throttles a client that goes over.
+ * Nothing in the client keeps within them: a burst of telemetry, or a
+ * backlog replayed by the outbox (aws_iot_mqtt_client_outbox.h) after a
+ * reconnect, uses them up and shadow reports queue up behind it.
+ *
+ * The scheduler refills two token buckets per connection, one counted in
+ * publishes and one in bytes, and charges every PUBLISH written to the
+ * network, whichever API sent it. It sees them through the packet tap
+ * (aws_iot_mqtt_client_tap.h), so the publishes of the shadow and jobs
+ * clients of the SDK are counted without going through the scheduler, and
+ * retransmissions are counted too.
+ *
+ * Messages are sent on one of two lanes:
+ * - Control (shadow, jobs) may use the whole bucket.
+ * - Bulk (telemetry) is only sent while more than controlReserve publishes
+ *   are left in the bucket, so control traffic always finds tokens and
+ *   telemetry fills the rest of the capacity.
+ *
+ * A message over budget is deferred rather than sent. Messages published with
+ * aws_iot_mqtt_scheduler_publish() are then copied into a small queue and
+ * sent by aws_iot_mqtt_scheduler_poll() as tokens come back, control first,
+ * each lane in order. When the lane has no queue slot left the message is
+ * refused with MQTT_SCHEDULER_QUEUE_FULL_ERROR and stays with the caller,
+ * which publishes it again later or drops it. The outbox keeps its messages
+ * in its log instead, and asks aws_iot_mqtt_scheduler_admit() before sending
+ * each of them, see aws_iot_mqtt_outbox_set_scheduler().
+ */
+
+#ifndef AWS_IOT_SDK_SRC_IOT_MQTT_CLIENT_SCHEDULER_H_
+#define AWS_IOT_SDK_SRC_IOT_MQTT_CLIENT_SCHEDULER_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "aws_iot_config.h"
+#include "aws_iot_mqtt_client_interface.h"
+#include "aws_iot_mqtt_client_tap.h"
+#include "aws_iot_mqtt_client_async_publish.h"
+
+/** Deferred messages held at the same time, both lanes together. */
+#ifndef AWS_IOT_MQTT_SCHEDULER_MAX_QUEUED
+#define AWS_IOT_MQTT_SCHEDULER_MAX_QUEUED 4
+#endif
+
+/** Queue slots bulk messages cannot take, kept for control messages. */
+#ifndef AWS_IOT_MQTT_SCHEDULER_CONTROL_SLOTS
+#define AWS_IOT_MQTT_SCHEDULER_CONTROL_SLOTS 1
+#endif
+
+/** Largest topic plus payload of a deferred message. */
+#ifndef AWS_IOT_MQTT_SCHEDULER_MAX_MESSAGE_LEN
+#define AWS_IOT_MQTT_SCHEDULER_MAX_MESSAGE_LEN AWS_IOT_MQTT_TX_BUF_LEN
+#endif
+
+/** Default publish rate, the per-connection limit of AWS IoT. */
+#ifndef AWS_IOT_MQTT_SCHEDULER_PUBLISH_RATE
+#define AWS_IOT_MQTT_SCHEDULER_PUBLISH_RATE 100
+#endif
+
+/** Default byte rate, the per-connection limit of AWS IoT. */
+#ifndef AWS_IOT_MQTT_SCHEDULER_BYTE_RATE
+#define AWS_IOT_MQTT_SCHEDULER_BYTE_RATE (512 * 1024)
+#endif
+
+/** Returned by aws_iot_mqtt_scheduler_publish() when the lane has no queue slot left. */
+#define MQTT_SCHEDULER_QUEUE_FULL_ERROR MQTT_CLIENT_NOT_IDLE_ERROR
+
+typedef enum {
+	IOT_SCHEDULER_LANE_CONTROL, ///< Shadow and jobs requests, latency sensitive
+	IOT_SCHEDULER_LANE_BULK,    ///< Telemetry, sent with the capacity left
+	IOT_SCHEDULER_LANE_COUNT,
+} IoT_Scheduler_Lane_t;
+
+/**
+ * @brief Scheduler parameters
+ *
+ * A rate of 0 disables the bucket. A burst of 0 selects one second worth of the rate.
+ */
+typedef struct {
+	uint32_t publishRate;    ///< Publishes per second
+	uint32_t publishBurst;   ///< Publishes the bucket holds
+	uint32_t byteRate;       ///< Bytes per second, whole packets counted
+	uint32_t byteBurst;      ///< Bytes the bucket holds
+	uint32_t controlReserve; ///< Publishes left to the control lane
+	AWS_IoT_Async_Publisher_t *pPublisher; ///< Sends QOS1 messages without blocking, NULL allows QOS0 only
+} IoT_Scheduler_Params_t;
+
+extern const IoT_Scheduler_Params_t iotSchedulerParamsDefault;
+
+/**
+ * @brief Counters of one lane
+ */
+typedef struct {
+	uint32_t sent;         ///< Messages sent through the scheduler, at once or later
+	uint32_t deferred;     ///< Messages queued, or held back by aws_iot_mqtt_scheduler_admit(), for lack of tokens
+	uint32_t queueFull;    ///< Messages refused with MQTT_SCHEDULER_QUEUE_FULL_ERROR
+	uint32_t maxDelay_ms;  ///< Longest time a message waited in the queue
+} IoT_Scheduler_Lane_Stats_t;
+
+/**
+ * @brief Scheduler counters
+ */
+typedef struct {
+	uint32_t charged;      ///< PUBLISH packets written to the network, by any API
+	uint32_t chargedBytes;
+	IoT_Scheduler_Lane_Stats_t lanes[IOT_SCHEDULER_LANE_COUNT];
+} IoT_Scheduler_Stats_t;
+
+typedef struct {
+	bool isUsed;
+	IoT_Scheduler_Lane_t lane;
+	uint32_t seq;           ///< Order of arrival
+	uint32_t queuedAt_ms;
+	QoS qos;
+	uint8_t isRetained;
+	iot_async_publish_complete_handler handler;
+	void *pHandlerData;
+	uint16_t topicNameLen;
+	size_t payloadLen;
+	unsigned char data[AWS_IOT_MQTT_SCHEDULER_MAX_MESSAGE_LEN]; ///< Topic then payload
+} IoT_Scheduler_Message_t;
+
+/**
+ * @brief Scheduler state
+ *
+ * Allocated by the application, one per MQTT client. Bucket levels are kept
+ * in thousandths so that refills of a few milliseconds are not lost.
+ */
+typedef struct {
+	AWS_IoT_Client *pClient;
+	IoT_Scheduler_Params_t params;
+	IoT_Tap_Observer_t observer;
+#ifdef _ENABLE_THREAD_SUPPORT_
+	IoT_Mutex_t lock;
+#endif
+	int64_t publishTokens_x1000;
+	int64_t byteTokens_x1000;
+	uint32_t refilledAt_ms;
+	uint32_t nextSeq;
+	bool isAdmitRefused[IOT_SCHEDULER_LANE_COUNT]; ///< The last aws_iot_mqtt_scheduler_admit() of the lane was refused
+	IoT_Scheduler_Message_t queue[AWS_IOT_MQTT_SCHEDULER_MAX_QUEUED];
+	IoT_Scheduler_Stats_t stats;
+} AWS_IoT_Scheduler_t;
+
+/**
+ * @brief Initialize a scheduler
+ *
+ * The client must already be initialized. The packet tap is attached to it.
+ * Both buckets start full.
+ *
+ * @param pScheduler Scheduler state
+ * @param pClient MQTT client
+ * @param pParams Parameters, NULL selects the defaults
+ * @return An IoT Error Type defining successful/failed initialization
+ */
+IoT_Error_t aws_iot_mqtt_scheduler_init(AWS_IoT_Scheduler_t *pScheduler, AWS_IoT_Client *pClient,
+										const IoT_Scheduler_Params_t *pParams);
+
+/**
+ * @brief Release the scheduler
+ *
+ * Deferred messages are dropped, the handlers of QOS1 ones are called with
+ * IOT_ASYNC_PUBLISH_ABORTED.
+ */
+IoT_Error_t aws_iot_mqtt_scheduler_deinit(AWS_IoT_Scheduler_t *pScheduler);
+
+/**
+ * @brief Whether a message of the lane may be sent now
+ *
+ * Nothing is charged, the PUBLISH is when it is written. The caller is
+ * expected to ask again for the same message until it is admitted, so only
+ * the first of a run of false answers counts as a deferred message of the
+ * lane.
+ *
+ * @param pScheduler Scheduler state
+ * @param lane Lane of the message
+ * @param topicNameLen Length of the topic name
+ * @param payloadLen Length of the payload
+ * @param qos QoS of the message
+ * @return true if the buckets hold enough tokens for the lane
+ */
+bool aws_iot_mqtt_scheduler_admit(AWS_IoT_Scheduler_t *pScheduler, IoT_Scheduler_Lane_t lane,
+								  uint16_t topicNameLen, size_t payloadLen, QoS qos);
+
+/**
+ * @brief Publish a message now if the lane has the tokens, or defer it
+ *
+ * A message is sent at once when nothing is queued ahead of it on its lane
+ * and the lane is admitted. Otherwise the topic and payload are copied and
+ * the message is sent by aws_iot_mqtt_scheduler_poll().
+ *
+ * QOS1 messages go through params.pPublisher, and handler is its completion
+ * handler. Without a publisher they are refused with FAILURE, since
+ * aws_iot_mqtt_publish() would block the poll until the PUBACK. handler is
+ * not called for QOS0 messages.
+ *
+ * @param pScheduler Scheduler state
+ * @param lane Lane of the message
+ * @param pTopicName Topic name
+ * @param topicNameLen Length of the topic name
+ * @param pParams QoS, flags and payload of the message
+ * @param handler Completion handler, may be NULL
+ * @param pHandlerData Passed back to handler
+ * @return SUCCESS if sent or deferred, MQTT_SCHEDULER_QUEUE_FULL_ERROR, FAILURE for a QOS1
+ *         message without a publisher, or an error from the client
+ */
+IoT_Error_t aws_iot_mqtt_scheduler_publish(AWS_IoT_Scheduler_t *pScheduler, IoT_Scheduler_Lane_t lane,
+										   const char *pTopicName, uint16_t topicNameLen,
+										   IoT_Publish_Message_Params *pParams,
+										   iot_async_publish_complete_handler handler, void *pHandlerData);
+
+/**
+ * @brief Send the deferred messages the buckets allow
+ *
+ * Call it after aws_iot_mqtt_yield(), from the thread that publishes.
+ * Does nothing while the client is disconnected.
+ *
+ * @param pScheduler Scheduler state
+ * @return SUCCESS or the error of a failed send, the message stays queued
+ */
+IoT_Error_t aws_iot_mqtt_scheduler_poll(AWS_IoT_Scheduler_t *pScheduler);
+
+/**
+ * @brief Number of deferred messages of a lane
+ */
+uint8_t aws_iot_mqtt_scheduler_queued(AWS_IoT_Scheduler_t *pScheduler, IoT_Scheduler_Lane_t lane);
+
+/**
+ * @brief Copy the scheduler counters
+ */
+void aws_iot_mqtt_scheduler_get_stats(AWS_IoT_Scheduler_t *pScheduler, IoT_Scheduler_Stats_t *pStats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AWS_IOT_SDK_SRC_IOT_MQTT_CLIENT_SCHEDULER_H_ */
@@ -0,0 +1,151 @@
+/**
+  *****************************************************************************
+  * @file   aws_iot_mqtt_client_session.h
+  *
+  *****************************************************************************
+  * @attention
+  *
+  *
+  *  Copyright (c) 2022, InnoPhase, Inc.
+  *
+  *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  *  POSSIBILITY OF SUCH DAMAGE.
+  *
+  *****************************************************************************
+  */
+
+/**
+ * @file aws_iot_mqtt_client_session.h
+ * @brief Persistent MQTT session across reconnects
+ *
+ * With a clean session every reconnect starts from nothing: the broker has
+ * dropped the subscriptions and the QoS1 messages sent while the device was
+ * away, so the application subscribes again and resyncs its state, a burst
+ * of round-trips after each network drop.
+ *
+ * In persistent mode the client reconnects with the clean session flag
+ * cleared and the session tracker reads the session present flag of every
+ * CONNACK through the packet tap (aws_iot_mqtt_client_tap.h):
+ * - The dispatcher (aws_iot_mqtt_client_dispatch.h) keeps its subscription
+ *   table as granted and sends no SUBSCRIBE when the session is present.
+ * - The broker delivers the QoS1 messages it queued for the subscriptions,
+ *   e.g. shadow deltas subscribed with QOS1 (aws_iot_shadow_demux.h).
+ * - The application is told by an event whether the session was resumed,
+ *   and can skip its resync traffic when it was.
+ *
+ * aws_iot_shadow_connect() always connects with a clean session. Initialized
+ * after it, the tracker switches the automatic reconnects of the client to
+ * persistent sessions. With aws_iot_mqtt_connect(), isCleanSession is simply
+ * set to false in the connect parameters.
+ *
+ * Subscriptions made with aws_iot_mqtt_subscribe() are still renewed by the
+ * client after each reconnect. Only the dispatcher's are spared.
+ */
+
+#ifndef AWS_IOT_SDK_SRC_IOT_MQTT_CLIENT_SESSION_H_
+#define AWS_IOT_SDK_SRC_IOT_MQTT_CLIENT_SESSION_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "aws_iot_config.h"
+#include "aws_iot_mqtt_client_interface.h"
+#include "aws_iot_mqtt_client_tap.h"
+
+typedef enum {
+	IOT_SESSION_EVENT_NEW,     ///< The broker holds no state for the client. Subscriptions are renewed, state must be resynced.
+	IOT_SESSION_EVENT_RESUMED, ///< Subscriptions and queued QoS1 messages were kept by the broker
+} IoT_Session_Event_t;
+
+typedef void (*iot_session_event_handler)(AWS_IoT_Client *pClient, IoT_Session_Event_t event, void *pData);
+
+/**
+ * @brief Session tracker parameters
+ */
+typedef struct {
+	bool isPersistent;                 ///< Reconnect without clean session
+	iot_session_event_handler handler; ///< Called by aws_iot_mqtt_session_poll() after each CONNACK, may be NULL
+	void *pHandlerData;
+} IoT_Session_Params_t;
+
+extern const IoT_Session_Params_t iotSessionParamsDefault;
+
+/**
+ * @brief Session tracker counters
+ */
+typedef struct {
+	uint32_t connacks;
+	uint32_t resumed;   ///< CONNACKs with the session present flag
+} IoT_Session_Stats_t;
+
+/**
+ * @brief Session tracker state
+ *
+ * Allocated by the application, one per MQTT client.
+ */
+typedef struct {
+	AWS_IoT_Client *pClient;
+	IoT_Session_Params_t params;
+	IoT_Tap_Observer_t observer;
+	bool isResumed;        ///< Session present flag of the last CONNACK
+	bool isEventPending;   ///< A CONNACK came since the last poll
+	IoT_Session_Stats_t stats;
+} AWS_IoT_Session_t;
+
+/**
+ * @brief Track the session of a client
+ *
+ * The client must already be initialized. The packet tap is attached to it.
+ *
+ * @param pSession Session tracker state
+ * @param pClient MQTT client
+ * @param pParams Parameters, NULL selects the defaults
+ * @return An IoT Error Type defining successful/failed initialization
+ */
+IoT_Error_t aws_iot_mqtt_session_init(AWS_IoT_Session_t *pSession, AWS_IoT_Client *pClient,
+									  const IoT_Session_Params_t *pParams);
+
+/**
+ * @brief Stop tracking. Reconnects keep the session mode they had.
+ */
+IoT_Error_t aws_iot_mqtt_session_deinit(AWS_IoT_Session_t *pSession);
+
+/**
+ * @brief Call the event handler if a CONNACK came since the last poll
+ *
+ * Call it after aws_iot_mqtt_yield(), from the same thread.
+ *
+ * @param pSession Session tracker state
+ * @return true if a CONNACK came since the last poll
+ */
+bool aws_iot_mqtt_session_poll(AWS_IoT_Session_t *pSession);
+
+/**
+ * @brief Whether the last connection resumed a session kept by the broker
+ */
+bool aws_iot_mqtt_session_is_resumed(const AWS_IoT_Session_t *pSession);
+
+/**
+ * @brief Copy the session counters
+ */
+void aws_iot_mqtt_session_get_stats(const AWS_IoT_Session_t *pSession, IoT_Session_Stats_t *pStats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AWS_IOT_SDK_SRC_IOT_MQTT_CLIENT_SESSION_H_ */
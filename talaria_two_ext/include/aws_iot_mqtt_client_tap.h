@@ -0,0 +1,180 @@
+/**
+  *****************************************************************************
+  * @file   aws_iot_mqtt_client_tap.h
+  *
+  *****************************************************************************
+  * @attention
+  *
+  *
+  *  Copyright (c) 2022, InnoPhase, Inc.
+  *
+  *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  *  POSSIBILITY OF SUCH DAMAGE.
+  *
+  *****************************************************************************
+  */
+
+/**
+ * @file aws_iot_mqtt_client_tap.h
+ * @brief MQTT packet tap on the network layer of a client
+ *
+ * The tap interposes on the read, write, connect and disconnect functions of
+ * the client's Network stack and decodes the MQTT packet stream flowing in
+ * both directions. Registered observers are told about every packet without
+ * any change to the MQTT client itself. This is how the extensions in this
+ * directory see PUBACKs, SUBACKs and CONNACKs that aws_iot_mqtt_yield()
+ * consumes silently.
+ *
+ * Observers run in the thread doing the network I/O, with the client's TLS
+ * read or write mutex held. They must be short and must not call back into
+ * the client.
+ */
+
+#ifndef AWS_IOT_SDK_SRC_IOT_MQTT_CLIENT_TAP_H_
+#define AWS_IOT_SDK_SRC_IOT_MQTT_CLIENT_TAP_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "aws_iot_config.h"
+#include "aws_iot_mqtt_client_interface.h"
+
+/** Number of clients that can have a tap attached at the same time. */
+#ifndef AWS_IOT_MQTT_TAP_MAX_CLIENTS
+#define AWS_IOT_MQTT_TAP_MAX_CLIENTS 2
+#endif
+
+/** Leading bytes of each packet body kept for IOT_TAP_EVENT_PACKET_END. Large enough for a publish topic and packet id. */
+#ifndef AWS_IOT_MQTT_TAP_PREFIX_LEN
+#define AWS_IOT_MQTT_TAP_PREFIX_LEN 128
+#endif
+
+/** MQTT control packet types, as found in the upper nibble of the fixed header */
+#define IOT_TAP_PACKET_TYPE(header) ((uint8_t) ((header) >> 4))
+#define IOT_TAP_CONNECT     1
+#define IOT_TAP_CONNACK     2
+#define IOT_TAP_PUBLISH     3
+#define IOT_TAP_PUBACK      4
+#define IOT_TAP_SUBSCRIBE   8
+#define IOT_TAP_SUBACK      9
+#define IOT_TAP_UNSUBSCRIBE 10
+#define IOT_TAP_UNSUBACK    11
+#define IOT_TAP_PINGREQ     12
+#define IOT_TAP_PINGRESP    13
+#define IOT_TAP_DISCONNECT  14
+
+typedef enum {
+	IOT_TAP_INBOUND = 0,  ///< Bytes read from the network
+	IOT_TAP_OUTBOUND = 1, ///< Bytes written to the network
+} IoT_Tap_Direction_t;
+
+typedef enum {
+	IOT_TAP_EVENT_CONNECTED,    ///< The network connect succeeded. Packet decoding restarts
+	IOT_TAP_EVENT_DISCONNECTED, ///< The network was disconnected by the client
+	IOT_TAP_EVENT_PACKET_BEGIN, ///< Fixed header and remaining length of a packet are known
+	IOT_TAP_EVENT_PACKET_DATA,  ///< A chunk of the packet body went through
+	IOT_TAP_EVENT_PACKET_END,   ///< The packet is complete
+} IoT_Tap_Event_Type_t;
+
+/**
+ * @brief Tap event
+ *
+ * For IOT_TAP_EVENT_PACKET_DATA, pData/dataLen is the chunk at offset of the body.
+ * For IOT_TAP_EVENT_PACKET_END, pData/dataLen is the first AWS_IOT_MQTT_TAP_PREFIX_LEN
+ * bytes (at most) of the body.
+ */
+typedef struct {
+	IoT_Tap_Event_Type_t type;
+	IoT_Tap_Direction_t direction;
+	uint8_t header;             ///< Fixed header byte
+	uint32_t remainingLength;   ///< Length of the packet body
+	uint32_t offset;            ///< Offset of pData within the body
+	const unsigned char *pData;
+	size_t dataLen;
+	uint32_t timestamp_ms;      ///< Time at which the event was seen
+} IoT_Tap_Event_t;
+
+typedef void (*iot_tap_event_handler)(AWS_IoT_Client *pClient, const IoT_Tap_Event_t *pEvent, void *pData);
+
+/**
+ * @brief Tap observer
+ *
+ * Allocated by the caller and linked into the tap by aws_iot_mqtt_tap_add_observer().
+ * It must stay valid until it is removed.
+ */
+typedef struct _IoT_Tap_Observer {
+	iot_tap_event_handler handler;
+	void *pHandlerData;
+	struct _IoT_Tap_Observer *pNext;
+} IoT_Tap_Observer_t;
+
+/**
+ * @brief Attach the tap to a client
+ *
+ * Must be called after aws_iot_mqtt_init() (or aws_iot_shadow_init()), which sets up
+ * the Network stack. Attaching twice is harmless.
+ *
+ * @param pClient MQTT client
+ * @return An IoT Error Type defining successful/failed attach
+ */
+IoT_Error_t aws_iot_mqtt_tap_attach(AWS_IoT_Client *pClient);
+
+/**
+ * @brief Detach the tap and restore the original Network functions
+ */
+IoT_Error_t aws_iot_mqtt_tap_detach(AWS_IoT_Client *pClient);
+
+/**
+ * @brief Add an observer, attaching the tap first if needed
+ */
+IoT_Error_t aws_iot_mqtt_tap_add_observer(AWS_IoT_Client *pClient, IoT_Tap_Observer_t *pObserver);
+
+/**
+ * @brief Remove an observer
+ */
+IoT_Error_t aws_iot_mqtt_tap_remove_observer(AWS_IoT_Client *pClient, IoT_Tap_Observer_t *pObserver);
+
+/**
+ * @brief Write a complete buffer to the client's network, through the tap
+ *
+ * Takes the client's TLS write mutex, so it is safe to use from any thread
+ * while another thread is inside aws_iot_mqtt_yield().
+ *
+ * @param pClient MQTT client
+ * @param pBuf Bytes to write
+ * @param len Number of bytes to write
+ * @param timeout_ms Max time spent writing
+ * @return An IoT Error Type defining successful/failed write
+ */
+IoT_Error_t aws_iot_mqtt_tap_write(AWS_IoT_Client *pClient, const unsigned char *pBuf, size_t len, uint32_t timeout_ms);
+
+/**
+ * @brief Write several buffers back to back as one packet, under a single hold of the write mutex
+ */
+IoT_Error_t aws_iot_mqtt_tap_writev(AWS_IoT_Client *pClient, const unsigned char *const *ppBufs, const size_t *pLens,
+									uint8_t count, uint32_t timeout_ms);
+
+/**
+ * @brief Milliseconds since boot, the time base used in tap events
+ */
+uint32_t aws_iot_mqtt_tap_now_ms(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AWS_IOT_SDK_SRC_IOT_MQTT_CLIENT_TAP_H_ */
@@ -0,0 +1,267 @@
+/**
+  *****************************************************************************
+  * @file   aws_iot_mqtt_client_v5.h
+  *
+  *****************************************************************************
+  * @attention
+  *
+  *
+  *  Copyright (c) 2022, InnoPhase, Inc.
+  *
+  *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  *  POSSIBILITY OF SUCH DAMAGE.
+  *
+  *****************************************************************************
+  */
+
+/**
+ * @file aws_iot_mqtt_client_v5.h
+ * @brief MQTT 5 on the wire for the MQTT 3.1.1 client
+ *
+ * The MQTT client of the SDK only speaks MQTT 3.1.1. The v5 adapter sits
+ * between the client and its TLS connection and translates the packet
+ * stream in both directions, so the broker talks MQTT 5 while the client,
+ * and the extensions watching it through the packet tap
+ * (aws_iot_mqtt_client_tap.h), keep seeing MQTT 3.1.1 packets:
+ *
+ * - CONNECT goes out with protocol level 5, the session expiry interval
+ *   when the client connects without clean session, and the receive
+ *   maximum the client accepts.
+ * - PUBLISH goes out with a topic alias. The first message on a topic
+ *   carries the topic and sets the alias, the next ones carry an empty
+ *   topic and the alias only. Up to AWS_IOT_MQTT5_MAX_TOPIC_ALIASES topics,
+ *   within the topic alias maximum of the broker, least recently used
+ *   first out.
+ * - CONNACK, PUBLISH, PUBACK, SUBACK and UNSUBACK come in with their
+ *   properties stripped. The reason codes that MQTT 3.1.1 cannot carry are
+ *   counted and reported to the reason handler.
+ * - A DISCONNECT from the broker is reported and closes the connection
+ *   like a TLS error, so the client reconnects if enabled.
+ *
+ * The receive maximum of the broker, the number of QoS1 messages it takes
+ * in flight, is tracked against the QoS1 publishes waiting for their
+ * PUBACK, see aws_iot_mqtt_v5_can_publish().
+ *
+ * The adapter must be attached after aws_iot_mqtt_init() (or
+ * aws_iot_shadow_init()) and before the connect and before any extension
+ * attaches the packet tap, so the tap sits above it.
+ */
+
+#ifndef AWS_IOT_SDK_SRC_IOT_MQTT_CLIENT_V5_H_
+#define AWS_IOT_SDK_SRC_IOT_MQTT_CLIENT_V5_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "aws_iot_config.h"
+#include "aws_iot_mqtt_client_interface.h"
+
+/** Number of clients that can have the adapter attached at the same time. */
+#ifndef AWS_IOT_MQTT5_MAX_CLIENTS
+#define AWS_IOT_MQTT5_MAX_CLIENTS 1
+#endif
+
+/** Topics that can have an alias at the same time. */
+#ifndef AWS_IOT_MQTT5_MAX_TOPIC_ALIASES
+#define AWS_IOT_MQTT5_MAX_TOPIC_ALIASES 4
+#endif
+
+/** Longest topic that gets an alias. */
+#ifndef AWS_IOT_MQTT5_MAX_ALIAS_TOPIC_LEN
+#define AWS_IOT_MQTT5_MAX_ALIAS_TOPIC_LEN 128
+#endif
+
+/** Packet headers translated at once: a whole CONNECT, or the topic, packet id and properties of a PUBLISH. */
+#ifndef AWS_IOT_MQTT5_HEADER_BUF_LEN
+#define AWS_IOT_MQTT5_HEADER_BUF_LEN 512
+#endif
+
+/** QoS1 publishes tracked against the receive maximum of the broker. */
+#ifndef AWS_IOT_MQTT5_MAX_IN_FLIGHT
+#define AWS_IOT_MQTT5_MAX_IN_FLIGHT 16
+#endif
+
+/** QoS1 messages the broker may send to the client before their PUBACK. */
+#ifndef AWS_IOT_MQTT5_RECEIVE_MAXIMUM
+#define AWS_IOT_MQTT5_RECEIVE_MAXIMUM 8
+#endif
+
+/** Session expiry interval sent when the client connects without clean session. */
+#ifndef AWS_IOT_MQTT5_SESSION_EXPIRY_S
+#define AWS_IOT_MQTT5_SESSION_EXPIRY_S 3600
+#endif
+
+/** Reason codes of MQTT 5 */
+#define IOT_MQTT5_RC_SUCCESS                    0x00
+#define IOT_MQTT5_RC_NO_MATCHING_SUBSCRIBERS    0x10
+#define IOT_MQTT5_RC_UNSPECIFIED_ERROR          0x80
+#define IOT_MQTT5_RC_PROTOCOL_ERROR             0x82
+#define IOT_MQTT5_RC_UNSUPPORTED_VERSION        0x84
+#define IOT_MQTT5_RC_CLIENT_ID_NOT_VALID        0x85
+#define IOT_MQTT5_RC_BAD_USER_NAME_OR_PASSWORD  0x86
+#define IOT_MQTT5_RC_NOT_AUTHORIZED             0x87
+#define IOT_MQTT5_RC_SERVER_UNAVAILABLE         0x88
+#define IOT_MQTT5_RC_SERVER_BUSY                0x89
+#define IOT_MQTT5_RC_BANNED                     0x8A
+#define IOT_MQTT5_RC_KEEP_ALIVE_TIMEOUT         0x8D
+#define IOT_MQTT5_RC_SESSION_TAKEN_OVER         0x8E
+#define IOT_MQTT5_RC_TOPIC_NAME_INVALID         0x90
+#define IOT_MQTT5_RC_RECEIVE_MAXIMUM_EXCEEDED   0x93
+#define IOT_MQTT5_RC_TOPIC_ALIAS_INVALID        0x94
+#define IOT_MQTT5_RC_PACKET_TOO_LARGE           0x95
+#define IOT_MQTT5_RC_QUOTA_EXCEEDED             0x97
+#define IOT_MQTT5_RC_PAYLOAD_FORMAT_INVALID     0x99
+
+/**
+ * @brief Reason handler
+ *
+ * Called for every reason code of 0x80 or above, and for DISCONNECT, in the
+ * thread reading the socket with the TLS read mutex held. It must be short
+ * and must not call back into the client.
+ *
+ * @param pClient MQTT client
+ * @param packetType IOT_TAP_* type of the packet carrying the reason code
+ * @param packetId Packet id of the acked request, 0 for CONNACK and DISCONNECT
+ * @param reasonCode MQTT 5 reason code
+ * @param pData pReasonHandlerData of the parameters
+ */
+typedef void (*iot_mqtt_v5_reason_handler)(AWS_IoT_Client *pClient, uint8_t packetType, uint16_t packetId,
+										   uint8_t reasonCode, void *pData);
+
+/**
+ * @brief v5 adapter parameters
+ */
+typedef struct {
+	uint32_t sessionExpiryInterval_s; ///< Sent without clean session. 0 ends the session at disconnect.
+	uint16_t receiveMaximum;          ///< QoS1 messages the broker may send before their PUBACK, 0 for no limit
+	uint8_t maxTopicAliases;          ///< Aliases used, up to AWS_IOT_MQTT5_MAX_TOPIC_ALIASES, 0 disables them
+	iot_mqtt_v5_reason_handler reasonHandler; ///< May be NULL
+	void *pReasonHandlerData;
+} IoT_Mqtt5_Params_t;
+
+extern const IoT_Mqtt5_Params_t iotMqtt5ParamsDefault;
+
+/**
+ * @brief v5 adapter counters
+ */
+typedef struct {
+	uint32_t aliasedPublishes;   ///< PUBLISH sent with an empty topic and an alias
+	uint32_t aliasBytesSaved;    ///< Topic bytes not sent thanks to the aliases
+	uint32_t reasonErrors;       ///< Reason codes of 0x80 or above in CONNACK, PUBACK, SUBACK and UNSUBACK
+	uint32_t serverDisconnects;  ///< DISCONNECT packets from the broker
+	uint32_t quotaExceeded;      ///< QoS1 PUBLISH sent beyond the receive maximum of the broker
+	uint8_t lastReasonCode;      ///< Last reason code of 0x80 or above, or of a DISCONNECT
+} IoT_Mqtt5_Stats_t;
+
+typedef struct {
+	uint16_t topicLen;           ///< 0 if the alias is not assigned
+	uint32_t lastUsed;
+	char topic[AWS_IOT_MQTT5_MAX_ALIAS_TOPIC_LEN];
+} IoT_Mqtt5_Alias_t;
+
+/**
+ * @brief Translation of the packet stream in one direction
+ */
+typedef struct {
+	uint8_t state;
+	uint8_t header;
+	uint8_t lengthBytes;
+	uint32_t multiplier;
+	uint32_t remainingLength;
+	uint32_t need;               ///< Bytes of the packet body to collect in buf before translating it
+	uint32_t passLen;            ///< Bytes of the packet body left to pass through unchanged
+	size_t bufLen;
+	unsigned char buf[AWS_IOT_MQTT5_HEADER_BUF_LEN];
+	size_t xlatLen;              ///< Translated bytes in xlat
+	size_t xlatPos;              ///< Translated bytes already handed over
+	unsigned char xlat[AWS_IOT_MQTT5_HEADER_BUF_LEN + 16];
+} IoT_Mqtt5_Stream_t;
+
+/**
+ * @brief v5 adapter state
+ *
+ * Allocated by the application, one per MQTT client.
+ */
+typedef struct {
+	AWS_IoT_Client *pClient;
+	IoT_Mqtt5_Params_t params;
+#ifdef _ENABLE_THREAD_SUPPORT_
+	IoT_Mutex_t lock;
+#endif
+	IoT_Error_t (*connect)(Network *, TLSConnectParams *);
+	IoT_Error_t (*read)(Network *, unsigned char *, size_t, Timer *, size_t *);
+	IoT_Error_t (*write)(Network *, unsigned char *, size_t, Timer *, size_t *);
+	IoT_Mqtt5_Stream_t in;
+	IoT_Mqtt5_Stream_t out;
+	uint16_t serverReceiveMaximum;
+	uint16_t serverTopicAliasMaximum;
+	IoT_Mqtt5_Alias_t aliases[AWS_IOT_MQTT5_MAX_TOPIC_ALIASES];
+	uint32_t aliasClock;
+	uint16_t inFlight[AWS_IOT_MQTT5_MAX_IN_FLIGHT]; ///< Packet ids of QoS1 PUBLISH waiting for a PUBACK, 0 if free
+	IoT_Mqtt5_Stats_t stats;
+} AWS_IoT_Mqtt5_t;
+
+/**
+ * @brief Speak MQTT 5 on the network connection of a client
+ *
+ * @param pMqtt5 Adapter state
+ * @param pClient MQTT client, initialized and not yet connected
+ * @param pParams Parameters, NULL selects the defaults
+ * @return An IoT Error Type defining successful/failed attach
+ */
+IoT_Error_t aws_iot_mqtt_v5_attach(AWS_IoT_Mqtt5_t *pMqtt5, AWS_IoT_Client *pClient, const IoT_Mqtt5_Params_t *pParams);
+
+/**
+ * @brief Go back to MQTT 3.1.1 from the next connect
+ *
+ * The packet tap must be detached first.
+ */
+IoT_Error_t aws_iot_mqtt_v5_detach(AWS_IoT_Mqtt5_t *pMqtt5);
+
+/**
+ * @brief true if a QoS1 message can be published without exceeding the receive maximum of the broker
+ */
+bool aws_iot_mqtt_v5_can_publish(AWS_IoT_Mqtt5_t *pMqtt5);
+
+/**
+ * @brief Receive maximum announced by the broker in its last CONNACK, 65535 if none
+ */
+uint16_t aws_iot_mqtt_v5_get_receive_maximum(AWS_IoT_Mqtt5_t *pMqtt5);
+
+/**
+ * @brief Copy the adapter counters
+ */
+void aws_iot_mqtt_v5_get_stats(AWS_IoT_Mqtt5_t *pMqtt5, IoT_Mqtt5_Stats_t *pStats);
+
+#ifdef AWS_IOT_MQTT5_LOOPBACK
+/**
+ * @brief Check the translation against a broker stand-in, without network
+ *
+ * Runs a client with the adapter attached over an in-memory MQTT 5 broker
+ * that answers CONNECT, SUBSCRIBE and PUBLISH the way AWS IoT Core does,
+ * and prints whether each exchange translated as expected.
+ *
+ * @return Number of failed checks
+ */
+uint32_t aws_iot_mqtt_v5_loopback_check(void);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AWS_IOT_SDK_SRC_IOT_MQTT_CLIENT_V5_H_ */
@@ -0,0 +1,154 @@
+/**
+  *****************************************************************************
+  * @file   aws_iot_shadow_acks.h
+  *
+  *****************************************************************************
+  * @attention
+  *
+  *
+  *  Copyright (c) 2022, InnoPhase, Inc.
+  *
+  *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  *  POSSIBILITY OF SUCH DAMAGE.
+  *
+  *****************************************************************************
+  */
+
+/**
+ * @file aws_iot_shadow_acks.h
+ * @brief Shadow requests waiting for their response
+ *
+ * The shadow client of the SDK keeps the requests waiting for a response in
+ * MAX_ACKS_TO_COMEIN_AT_ANY_GIVEN_TIME records, each with its own copy of
+ * the thing name, and scans them all for every accepted or rejected
+ * response and again at every yield for the timeouts. Both scans grow with
+ * the number of requests in flight.
+ *
+ * The ack table finds the request of a response through a hash index of
+ * the clientTokens, with open addressing, and keeps the requests in a
+ * min-heap by deadline. A response costs a hash of its clientToken and
+ * usually one comparison, a poll with nothing expired one comparison with
+ * the earliest deadline. The clientToken is given as a pointer and a
+ * length, so a jsmn token is looked up in place.
+ *
+ * A table serves one shadow, which keeps the thing name once for all its
+ * requests. It is not locked, its owner locks it.
+ */
+
+#ifndef AWS_IOT_SDK_SRC_IOT_SHADOW_ACKS_H_
+#define AWS_IOT_SDK_SRC_IOT_SHADOW_ACKS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "aws_iot_config.h"
+#include "aws_iot_error.h"
+#include "aws_iot_shadow_interface.h"
+
+/** Requests waiting for their response at the same time. */
+#ifndef AWS_IOT_SHADOW_ACKS_MAX
+#define AWS_IOT_SHADOW_ACKS_MAX MAX_ACKS_TO_COMEIN_AT_ANY_GIVEN_TIME
+#endif
+
+/** log2 of the size of the hash index, which keeps at least half of its entries free. */
+#ifndef AWS_IOT_SHADOW_ACKS_INDEX_BITS
+#define AWS_IOT_SHADOW_ACKS_INDEX_BITS 5
+#endif
+
+#if (1 << AWS_IOT_SHADOW_ACKS_INDEX_BITS) < 2 * (AWS_IOT_SHADOW_ACKS_MAX)
+#error "AWS_IOT_SHADOW_ACKS_INDEX_BITS too small for AWS_IOT_SHADOW_ACKS_MAX"
+#endif
+
+#if (AWS_IOT_SHADOW_ACKS_MAX) >= UINT16_MAX
+#error "AWS_IOT_SHADOW_ACKS_MAX must be below UINT16_MAX"
+#endif
+
+/**
+ * @brief A request waiting for its response
+ */
+typedef struct {
+	ShadowActions_t action;
+	char clientToken[MAX_SIZE_CLIENT_TOKEN_CLIENT_SEQUENCE];
+	fpActionCallback_t callback;
+	void *pCallbackContext;
+	uint32_t deadline_ms;
+} IoT_Shadow_Ack_t;
+
+typedef struct {
+	IoT_Shadow_Ack_t ack;
+	uint32_t hash;
+	uint16_t tokenLen;
+	uint16_t heapPos;
+} IoT_Shadow_Ack_Slot_t;
+
+/**
+ * @brief Ack table state
+ *
+ * Allocated by the application, or by the module using it.
+ */
+typedef struct {
+	IoT_Shadow_Ack_Slot_t slots[AWS_IOT_SHADOW_ACKS_MAX];
+	uint16_t freeSlots[AWS_IOT_SHADOW_ACKS_MAX];
+	uint16_t freeCount;
+	uint16_t index[1 << AWS_IOT_SHADOW_ACKS_INDEX_BITS];  ///< Slot + 1 by clientToken hash, 0 if free
+	uint16_t heap[AWS_IOT_SHADOW_ACKS_MAX];                ///< Slots by deadline, earliest first
+	uint16_t count;
+} AWS_IoT_Shadow_Acks_t;
+
+/**
+ * @brief Initialize an empty ack table
+ */
+IoT_Error_t aws_iot_shadow_acks_init(AWS_IoT_Shadow_Acks_t *pAcks);
+
+/**
+ * @brief Add a request
+ *
+ * @param pAcks Ack table state
+ * @param pAck Request, copied. Its clientToken must be terminated.
+ * @return SUCCESS, FAILURE if a request with the same clientToken is waiting, or
+ *         MAX_SIZE_ERROR if AWS_IOT_SHADOW_ACKS_MAX requests are waiting
+ */
+IoT_Error_t aws_iot_shadow_acks_add(AWS_IoT_Shadow_Acks_t *pAcks, const IoT_Shadow_Ack_t *pAck);
+
+/**
+ * @brief Remove the request of a response
+ *
+ * @param pAcks Ack table state
+ * @param action Action of the response
+ * @param pClientToken clientToken of the response, not necessarily terminated
+ * @param tokenLen Length of pClientToken
+ * @param pAck Receives the request
+ * @return true if a request of action was waiting under pClientToken
+ */
+bool aws_iot_shadow_acks_take(AWS_IoT_Shadow_Acks_t *pAcks, ShadowActions_t action, const char *pClientToken,
+							  size_t tokenLen, IoT_Shadow_Ack_t *pAck);
+
+/**
+ * @brief Remove the request with the earliest deadline if it is past
+ *
+ * @param pAcks Ack table state
+ * @param now_ms Current time
+ * @param pAck Receives the request
+ * @return true if a request timed out, call again for the next one
+ */
+bool aws_iot_shadow_acks_take_expired(AWS_IoT_Shadow_Acks_t *pAcks, uint32_t now_ms, IoT_Shadow_Ack_t *pAck);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AWS_IOT_SDK_SRC_IOT_SHADOW_ACKS_H_ */
@@ -0,0 +1,221 @@
+/**
+  *****************************************************************************
+  * @file   aws_iot_shadow_batch.h
+  *
+  *****************************************************************************
+  * @attention
+  *
+  *
+  *  Copyright (c) 2022, InnoPhase, Inc.
+  *
+  *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  *  POSSIBILITY OF SUCH DAMAGE.
+  *
+  *****************************************************************************
+  */
+
+/**
+ * @file aws_iot_shadow_batch.h
+ * @brief Coalesced multi-attribute shadow updates
+ *
+ * An application that updates its shadow one attribute at a time sends one
+ * document per attribute, and since the shadow client allows one update of
+ * a given thing in flight, each one waits for the accepted or rejected
+ * response of the previous one: after a reconnect, resyncing two settings
+ * and reporting the sensor values takes three round-trips in a row.
+ *
+ * The batcher collects the attributes marked dirty, in the reported or the
+ * desired section, and sends them together in one document per coalescing
+ * window. The window starts when the first attribute is marked. Values are
+ * read from the jsonStruct_t when the document is built, so an attribute
+ * marked several times in a window is sent once, with its latest value.
+ *
+ * One document is in flight at a time. Attributes marked while it is are
+ * sent in the next document, after the response, so the updates of an
+ * attribute reach the shadow in the order they were made. A document that
+ * timed out or was rejected has its attributes marked again. When the dirty
+ * attributes do not fit in one document, the last marked ones are dropped
+ * until the others do.
+ *
+ * Documents are sent with aws_iot_shadow_update(), or through a shadow
+ * demultiplexer (aws_iot_shadow_demux.h) when one is given in the
+ * parameters. All calls must be made from the thread that yields the client.
+ */
+
+#ifndef AWS_IOT_SDK_SRC_IOT_SHADOW_BATCH_H_
+#define AWS_IOT_SDK_SRC_IOT_SHADOW_BATCH_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "aws_iot_config.h"
+#include "aws_iot_json_utils.h"
+#include "aws_iot_shadow_interface.h"
+#include "aws_iot_shadow_demux.h"
+
+/** Attributes the batcher can track. At most 8, the arguments passed to aws_iot_shadow_add_reported(). */
+#ifndef AWS_IOT_SHADOW_BATCH_MAX_ATTRIBUTES
+#define AWS_IOT_SHADOW_BATCH_MAX_ATTRIBUTES 8
+#endif
+
+#if AWS_IOT_SHADOW_BATCH_MAX_ATTRIBUTES > 8
+#error "AWS_IOT_SHADOW_BATCH_MAX_ATTRIBUTES must not be above 8"
+#endif
+
+/** Largest update document, clientToken included. */
+#ifndef AWS_IOT_SHADOW_BATCH_MAX_DOCUMENT_LEN
+#define AWS_IOT_SHADOW_BATCH_MAX_DOCUMENT_LEN AWS_IOT_MQTT_TX_BUF_LEN
+#endif
+
+/** Default coalescing window. */
+#ifndef AWS_IOT_SHADOW_BATCH_WINDOW_MS
+#define AWS_IOT_SHADOW_BATCH_WINDOW_MS 200
+#endif
+
+typedef enum {
+	IOT_SHADOW_BATCH_REPORTED = 0x01,
+	IOT_SHADOW_BATCH_DESIRED = 0x02,
+} IoT_Shadow_Batch_Section_t;
+
+/**
+ * @brief Writes a section of an update document, in place of aws_iot_shadow_add_reported() or
+ *        aws_iot_shadow_add_desired()
+ *
+ * E.g. a serializer generated for the attribute table of the application,
+ * which writes each attribute with its own format.
+ *
+ * @param pJsonDocument Document being built
+ * @param maxSizeOfJsonDocument Size of the document buffer
+ * @param section IOT_SHADOW_BATCH_REPORTED or IOT_SHADOW_BATCH_DESIRED
+ * @param pList Attributes to write
+ * @param count Number of attributes in pList
+ * @return SUCCESS or the error of building the document
+ */
+typedef IoT_Error_t (*fpShadowBatchWriter_t)(char *pJsonDocument, size_t maxSizeOfJsonDocument,
+											  IoT_Shadow_Batch_Section_t section, jsonStruct_t **pList,
+											  uint8_t count);
+
+/**
+ * @brief Batcher parameters
+ */
+typedef struct {
+	uint32_t window_ms;           ///< Time from the first mark to the document
+	uint8_t timeout_seconds;      ///< Time to wait for the response of a document
+	fpActionCallback_t callback;  ///< Called with the response of each document, may be NULL
+	void *pCallbackContext;
+	AWS_IoT_Shadow_Demux_t *pDemux; ///< Send through this demultiplexer, NULL for aws_iot_shadow_update()
+	fpShadowBatchWriter_t writer; ///< NULL for aws_iot_shadow_add_reported() and aws_iot_shadow_add_desired()
+} IoT_Shadow_Batch_Params_t;
+
+extern const IoT_Shadow_Batch_Params_t iotShadowBatchParamsDefault;
+
+/**
+ * @brief Batcher counters
+ */
+typedef struct {
+	uint32_t marks;       ///< Calls to aws_iot_shadow_batch_mark()
+	uint32_t coalesced;   ///< Marks of an attribute already waiting in the same section
+	uint32_t documents;   ///< Update documents sent
+	uint32_t accepted;
+	uint32_t rejected;
+	uint32_t timeouts;
+	uint32_t maxAttributes; ///< Most attributes in one document
+	uint32_t dropped;     ///< Attributes dropped because they did not fit in the document
+} IoT_Shadow_Batch_Stats_t;
+
+typedef struct {
+	jsonStruct_t *pStruct;
+	uint8_t dirty;     ///< IoT_Shadow_Batch_Section_t bits waiting for the next document
+	uint8_t inFlight;  ///< Bits sent in the document in flight
+} IoT_Shadow_Batch_Attribute_t;
+
+/**
+ * @brief Batcher state
+ *
+ * Allocated by the application, one per thing.
+ */
+typedef struct {
+	AWS_IoT_Client *pClient;
+	const char *pThingName;
+	IoT_Shadow_Batch_Params_t params;
+	IoT_Shadow_Batch_Attribute_t attributes[AWS_IOT_SHADOW_BATCH_MAX_ATTRIBUTES];
+	uint8_t attributeCount;    ///< In the order they were first marked
+	bool isDirty;
+	bool isInFlight;
+	uint32_t windowStart_ms;
+	char document[AWS_IOT_SHADOW_BATCH_MAX_DOCUMENT_LEN];
+	IoT_Shadow_Batch_Stats_t stats;
+} AWS_IoT_Shadow_Batch_t;
+
+/**
+ * @brief Initialize a batcher
+ *
+ * @param pBatch Batcher state
+ * @param pClient Shadow client, connected or not
+ * @param pThingName Thing name, not copied. Unused with a demultiplexer.
+ * @param pParams Parameters, NULL selects the defaults
+ * @return An IoT Error Type defining successful/failed initialization
+ */
+IoT_Error_t aws_iot_shadow_batch_init(AWS_IoT_Shadow_Batch_t *pBatch, AWS_IoT_Client *pClient,
+									  const char *pThingName, const IoT_Shadow_Batch_Params_t *pParams);
+
+/**
+ * @brief Mark an attribute for the next document
+ *
+ * @param pBatch Batcher state
+ * @param pStruct Attribute, its value is read when the document is built. Must stay valid.
+ * @param section IOT_SHADOW_BATCH_REPORTED, IOT_SHADOW_BATCH_DESIRED or both
+ * @return SUCCESS, or MAX_SIZE_ERROR if AWS_IOT_SHADOW_BATCH_MAX_ATTRIBUTES are already tracked
+ */
+IoT_Error_t aws_iot_shadow_batch_mark(AWS_IoT_Shadow_Batch_t *pBatch, jsonStruct_t *pStruct, uint8_t section);
+
+/**
+ * @brief Send the marked attributes without waiting for the end of the window
+ *
+ * Nothing is sent while a document is in flight, the attributes then go as
+ * soon as its response comes.
+ *
+ * @param pBatch Batcher state
+ * @return SUCCESS or the error of building or sending the document
+ */
+IoT_Error_t aws_iot_shadow_batch_flush(AWS_IoT_Shadow_Batch_t *pBatch);
+
+/**
+ * @brief Send the marked attributes once the window is over
+ *
+ * Call it after each yield.
+ *
+ * @param pBatch Batcher state
+ * @return SUCCESS or the error of building or sending the document
+ */
+IoT_Error_t aws_iot_shadow_batch_poll(AWS_IoT_Shadow_Batch_t *pBatch);
+
+/**
+ * @brief Whether no attribute is waiting and no document is in flight
+ */
+bool aws_iot_shadow_batch_is_idle(const AWS_IoT_Shadow_Batch_t *pBatch);
+
+/**
+ * @brief Copy the batcher counters
+ */
+void aws_iot_shadow_batch_get_stats(const AWS_IoT_Shadow_Batch_t *pBatch, IoT_Shadow_Batch_Stats_t *pStats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AWS_IOT_SDK_SRC_IOT_SHADOW_BATCH_H_ */
@@ -0,0 +1,271 @@
+/**
+  *****************************************************************************
+  * @file   aws_iot_shadow_demux.h
+  *
+  *****************************************************************************
+  * @attention
+  *
+  *
+  *  Copyright (c) 2022, InnoPhase, Inc.
+  *
+  *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  *  POSSIBILITY OF SUCH DAMAGE.
+  *
+  *****************************************************************************
+  */
+
+/**
+ * @file aws_iot_shadow_demux.h
+ * @brief Thing shadow over a single wildcard subscription
+ *
+ * The shadow client of the SDK subscribes to the accepted and rejected topics
+ * of an action the first time the action is used, and register_delta adds the
+ * delta topic: up to seven subscriptions per thing, each with a handler slot
+ * and a static topic buffer, and a SUBSCRIBE round-trip in front of the first
+ * update after every connect.
+ *
+ * The demultiplexer subscribes once, through the dispatcher
+ * (aws_iot_mqtt_client_dispatch.h), to
+ *
+ *     $aws/things/<thingName>/shadow/+/+
+ *
+ * and routes the responses locally by the last two topic levels. The filter
+ * covers get, update and delete accepted/rejected and update/delta, and not
+ * the request topics the device publishes to, so the broker does not echo
+ * the device's own requests back. update/documents also matches and is
+ * dropped.
+ *
+ * The subscription is made once, right after connect, by
+ * aws_iot_shadow_demux_init(). The dispatcher restores it after a reconnect
+ * together with its other filters, so an update never waits for a SUBSCRIBE.
+ *
+ * Requests are matched to their responses by clientToken, with the same
+ * callback and delta semantics as aws_iot_shadow_update() and
+ * aws_iot_shadow_register_delta(). Callbacks run from aws_iot_mqtt_yield(),
+ * timeouts are reported by aws_iot_shadow_demux_poll(). The requests
+ * waiting are kept in an ack table (aws_iot_shadow_acks.h), indexed by
+ * clientToken and ordered by deadline.
+ *
+ * The keys of a delta are looked up in a key index (aws_iot_shadow_keys.h)
+ * of the registered attributes, once each, rather than each attribute being
+ * searched for in the delta.
+ *
+ * The topics and the thing name are those of a topic table
+ * (aws_iot_thing_topics.h), built once for the thing: the requests are
+ * published to its topics as they are, with their lengths. A table built
+ * with a shadow name serves that named shadow instead, over
+ *
+ *     $aws/things/<thingName>/shadow/name/<shadowName>/+/+
+ *
+ * which the filter of the classic shadow does not match, having more
+ * levels. Each named shadow has its own table and demultiplexer, with its own
+ * requests waiting for a response, delta attributes and delta version, and
+ * they all share the dispatcher and the connection. Fast-changing readings
+ * and slow-changing settings kept in separate shadows are updated and
+ * versioned separately, and an update of the readings does not carry or
+ * rewrite the settings.
+ */
+
+#ifndef AWS_IOT_SDK_SRC_IOT_SHADOW_DEMUX_H_
+#define AWS_IOT_SDK_SRC_IOT_SHADOW_DEMUX_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "aws_iot_config.h"
+#include "aws_iot_json_utils.h"
+#include "aws_iot_shadow_interface.h"
+#include "aws_iot_shadow_acks.h"
+#include "aws_iot_shadow_keys.h"
+#include "aws_iot_thing_topics.h"
+#include "aws_iot_mqtt_client_dispatch.h"
+
+/** Delta handlers registered at the same time. */
+#ifndef AWS_IOT_SHADOW_DEMUX_MAX_DELTAS
+#define AWS_IOT_SHADOW_DEMUX_MAX_DELTAS 8
+#endif
+
+/** Time to wait for the SUBACK of the shadow subscription in aws_iot_shadow_demux_init(). */
+#ifndef AWS_IOT_SHADOW_DEMUX_SUBSCRIBE_TIMEOUT_MS
+#define AWS_IOT_SHADOW_DEMUX_SUBSCRIBE_TIMEOUT_MS 10000
+#endif
+
+/**
+ * @brief Called for each attribute of a delta registered with aws_iot_shadow_demux_register_delta_table()
+ *
+ * @param pJsonValue Value of the attribute in the delta, not terminated
+ * @param valueLen Length of pJsonValue
+ * @param pStruct Attribute, its pData already holds the new value except for SHADOW_JSON_OBJECT
+ * @param id Index of the attribute in its table
+ * @param pContext Given at registration
+ */
+typedef void (*fpShadowDemuxDeltaCallback_t)(const char *pJsonValue, uint32_t valueLen, jsonStruct_t *pStruct,
+											  uint8_t id, void *pContext);
+
+/**
+ * @brief Parses the value of an attribute of a table into its pData, in place of the parser of its type
+ */
+typedef IoT_Error_t (*fpShadowDemuxDeltaParser_t)(const char *pJsonString, jsmntok_t *pToken);
+
+/**
+ * @brief Demultiplexer parameters
+ */
+typedef struct {
+	uint32_t subscribeTimeout_ms;   ///< 0 does not wait for the SUBACK
+	bool isDiscardOldDeltaEnabled;  ///< Drop deltas whose version is not above the last one
+	QoS qos;                        ///< QOS1 lets a persistent session keep the deltas sent while offline
+} IoT_Shadow_Demux_Params_t;
+
+extern const IoT_Shadow_Demux_Params_t iotShadowDemuxParamsDefault;
+
+/**
+ * @brief Demultiplexer counters
+ */
+typedef struct {
+	uint32_t accepted;
+	uint32_t rejected;
+	uint32_t timeouts;
+	uint32_t deltas;
+	uint32_t unmatched;   ///< Responses with no request waiting for them
+	uint32_t dropped;     ///< Responses too large for SHADOW_MAX_SIZE_OF_RX_BUFFER or not valid JSON
+	uint32_t ignored;     ///< Other shadow topics, e.g. update/documents
+} IoT_Shadow_Demux_Stats_t;
+
+/**
+ * @brief Demultiplexer state
+ *
+ * Allocated by the application, one per topic table.
+ */
+typedef struct {
+	AWS_IoT_Dispatcher_t *pDispatcher;
+	IoT_Shadow_Demux_Params_t params;
+#ifdef _ENABLE_THREAD_SUPPORT_
+	IoT_Mutex_t lock;
+#endif
+	const AWS_IoT_Thing_Topics_t *pTopics;
+	AWS_IoT_Shadow_Keys_t deltaKeys;
+	fpShadowDemuxDeltaCallback_t deltaCallback;
+	void *pDeltaContext;
+	const fpShadowDemuxDeltaParser_t *pDeltaParsers;
+	uint32_t deltaVersion;       ///< Version of the last delta handled
+	AWS_IoT_Shadow_Acks_t acks;  ///< Requests waiting, at most AWS_IOT_SHADOW_ACKS_MAX
+	uint32_t tokenSequence;      ///< For the clientToken of get and delete
+	char rxBuf[SHADOW_MAX_SIZE_OF_RX_BUFFER];
+	jsmn_parser parser;
+	jsmntok_t tokens[MAX_JSON_TOKEN_EXPECTED];
+	IoT_Shadow_Demux_Stats_t stats;
+} AWS_IoT_Shadow_Demux_t;
+
+/**
+ * @brief Subscribe to the shadow of a topic table, classic or named
+ *
+ * Call it right after the client is connected. Waits up to
+ * params.subscribeTimeout_ms for the SUBACK. If that times out the
+ * demultiplexer is still usable and the dispatcher keeps retrying the
+ * SUBSCRIBE from aws_iot_mqtt_dispatch_poll().
+ *
+ * Callbacks are given the thing name of the table, the context of a
+ * request tells which shadow it was sent to.
+ *
+ * @param pDemux Demultiplexer state
+ * @param pDispatcher Dispatcher of the connected client
+ * @param pTopics Topic table of the thing, must stay valid
+ * @param pParams Parameters, NULL selects the defaults
+ * @return An IoT Error Type defining successful/failed subscription
+ */
+IoT_Error_t aws_iot_shadow_demux_init(AWS_IoT_Shadow_Demux_t *pDemux, AWS_IoT_Dispatcher_t *pDispatcher,
+									  const AWS_IoT_Thing_Topics_t *pTopics, const IoT_Shadow_Demux_Params_t *pParams);
+
+/**
+ * @brief Unsubscribe. Requests still waiting are dropped without callback.
+ */
+IoT_Error_t aws_iot_shadow_demux_deinit(AWS_IoT_Shadow_Demux_t *pDemux);
+
+/**
+ * @brief Call pStruct->cb with the value of pStruct->pKey from each delta, like aws_iot_shadow_register_delta()
+ *
+ * pStruct->pData is updated with the new value before the call, except for SHADOW_JSON_OBJECT.
+ *
+ * @return SUCCESS, FAILURE if the key is already registered, or MAX_SIZE_ERROR if
+ *         AWS_IOT_SHADOW_DEMUX_MAX_DELTAS are already registered
+ */
+IoT_Error_t aws_iot_shadow_demux_register_delta(AWS_IoT_Shadow_Demux_t *pDemux, jsonStruct_t *pStruct);
+
+/**
+ * @brief Register the attributes of a table that have a delta callback, with one callback for all of them
+ *
+ * callback is given the index of the attribute in pTable, and is called
+ * instead of pStruct->cb, which only selects the attributes registered.
+ * Attributes registered one by one before keep their own pStruct->cb.
+ *
+ * @param pDemux Demultiplexer state
+ * @param pTable Attribute table, must stay valid
+ * @param pParsers Parser of each attribute of pTable, e.g. generated with the table. NULL parses
+ *                 by jsonStruct_t type. Must stay valid.
+ * @param count Number of attributes in pTable
+ * @param callback Called for each registered attribute of a delta
+ * @param pContext Passed back to callback
+ * @return SUCCESS, or the error of aws_iot_shadow_demux_register_delta()
+ */
+IoT_Error_t aws_iot_shadow_demux_register_delta_table(AWS_IoT_Shadow_Demux_t *pDemux, jsonStruct_t *pTable,
+													  const fpShadowDemuxDeltaParser_t *pParsers, uint8_t count,
+													  fpShadowDemuxDeltaCallback_t callback, void *pContext);
+
+/**
+ * @brief Publish a shadow update, like aws_iot_shadow_update()
+ *
+ * @param pDemux Demultiplexer state
+ * @param pJsonString Update document. If callback is set it must hold a clientToken,
+ *                    as added by aws_iot_finalize_json_document().
+ * @param callback Called with the response, or SHADOW_ACK_TIMEOUT. May be NULL.
+ * @param pContextData Passed back to callback
+ * @param timeout_seconds Time to wait for the response
+ * @return An IoT Error Type defining successful/failed publish
+ */
+IoT_Error_t aws_iot_shadow_demux_update(AWS_IoT_Shadow_Demux_t *pDemux, const char *pJsonString,
+										fpActionCallback_t callback, void *pContextData, uint8_t timeout_seconds);
+
+/**
+ * @brief Request the shadow document, like aws_iot_shadow_get()
+ */
+IoT_Error_t aws_iot_shadow_demux_get(AWS_IoT_Shadow_Demux_t *pDemux, fpActionCallback_t callback,
+									 void *pContextData, uint8_t timeout_seconds);
+
+/**
+ * @brief Delete the shadow, like aws_iot_shadow_delete()
+ */
+IoT_Error_t aws_iot_shadow_demux_delete(AWS_IoT_Shadow_Demux_t *pDemux, fpActionCallback_t callback,
+										void *pContextData, uint8_t timeout_seconds);
+
+/**
+ * @brief Report requests whose response did not come in time
+ *
+ * @param pDemux Demultiplexer state
+ * @return Number of requests timed out
+ */
+uint8_t aws_iot_shadow_demux_poll(AWS_IoT_Shadow_Demux_t *pDemux);
+
+/**
+ * @brief Copy the demultiplexer counters
+ */
+void aws_iot_shadow_demux_get_stats(const AWS_IoT_Shadow_Demux_t *pDemux, IoT_Shadow_Demux_Stats_t *pStats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AWS_IOT_SDK_SRC_IOT_SHADOW_DEMUX_H_ */
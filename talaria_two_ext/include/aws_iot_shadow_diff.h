@@ -0,0 +1,211 @@
+/**
+  *****************************************************************************
+  * @file   aws_iot_shadow_diff.h
+  *
+  *****************************************************************************
+  * @attention
+  *
+  *
+  *  Copyright (c) 2022, InnoPhase, Inc.
+  *
+  *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  *  POSSIBILITY OF SUCH DAMAGE.
+  *
+  *****************************************************************************
+  */
+
+/**
+ * @file aws_iot_shadow_diff.h
+ * @brief Merge-patch shadow documents against the last accepted state
+ *
+ * aws_iot_shadow_add_reported() and aws_iot_shadow_add_desired() write
+ * every attribute they are given, whether the shadow already holds its
+ * value or not.
+ *
+ * A diff set keeps a snapshot of the values of its attributes as last
+ * accepted by the shadow, and writes into the update document only what
+ * differs from it, as a JSON merge-patch (RFC 7396), which is how the
+ * shadow service merges an update:
+ *
+ *  - a number, boolean or string attribute is written when its text
+ *    differs from the snapshot,
+ *  - a SHADOW_JSON_OBJECT attribute, whose pData holds the JSON text of
+ *    the object, is compared key by key, nested objects included. Only the
+ *    keys that changed are written, and a key no longer in the object is
+ *    written as null, which removes it from the shadow. Arrays and other
+ *    values are compared as text and written whole.
+ *
+ * Values are written with the formats of the SDK and compared as written.
+ * A value whose text is longer than AWS_IOT_SHADOW_DIFF_MAX_VALUE_LEN, or
+ * an object with more than AWS_IOT_SHADOW_DIFF_MAX_TOKENS tokens, has no
+ * snapshot and is written whole every time.
+ *
+ * One document built from a diff set is in flight at a time. Its values
+ * become the snapshot with aws_iot_shadow_diff_commit() once accepted, and
+ * are written again by the next document after
+ * aws_iot_shadow_diff_discard().
+ *
+ * Building with -DAWS_IOT_SHADOW_DIFF_BENCHMARK adds
+ * aws_iot_shadow_diff_benchmark().
+ */
+
+#ifndef AWS_IOT_SDK_SRC_IOT_SHADOW_DIFF_H_
+#define AWS_IOT_SDK_SRC_IOT_SHADOW_DIFF_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "aws_iot_config.h"
+#include "aws_iot_error.h"
+#include "aws_iot_json_utils.h"
+#include "aws_iot_shadow_json_data.h"
+
+/** Attributes a diff set can track. */
+#ifndef AWS_IOT_SHADOW_DIFF_MAX_ATTRIBUTES
+#define AWS_IOT_SHADOW_DIFF_MAX_ATTRIBUTES 8
+#endif
+
+/** Longest value text kept in the snapshot, terminator included. */
+#ifndef AWS_IOT_SHADOW_DIFF_MAX_VALUE_LEN
+#define AWS_IOT_SHADOW_DIFF_MAX_VALUE_LEN 96
+#endif
+
+/** Most tokens of an object attribute compared key by key, nested keys and values included. */
+#ifndef AWS_IOT_SHADOW_DIFF_MAX_TOKENS
+#define AWS_IOT_SHADOW_DIFF_MAX_TOKENS 32
+#endif
+
+/** Returned by aws_iot_shadow_diff_add_patch() while a document is in flight */
+#define SHADOW_DIFF_IN_FLIGHT_ERROR MQTT_CLIENT_NOT_IDLE_ERROR
+
+typedef enum {
+	IOT_SHADOW_DIFF_REPORTED = 0,
+	IOT_SHADOW_DIFF_DESIRED,
+} IoT_Shadow_Diff_Section_t;
+
+/**
+ * @brief Diff set counters
+ */
+typedef struct {
+	uint32_t documents;   ///< Sections written by aws_iot_shadow_diff_add_patch()
+	uint32_t skipped;     ///< Calls with nothing changed, nothing written
+	uint32_t written;     ///< Attributes written, whole or as a patch
+	uint32_t unchanged;   ///< Attributes left out
+	uint32_t fullBytes;   ///< Bytes the sections would take with every attribute written whole
+	uint32_t patchBytes;  ///< Bytes of the sections written
+	uint32_t commits;
+	uint32_t discards;
+} IoT_Shadow_Diff_Stats_t;
+
+typedef struct {
+	jsonStruct_t *pStruct;
+	bool isAcked;         ///< acked holds the value last accepted
+	bool isPending;       ///< pending holds the value in the document in flight
+	char acked[AWS_IOT_SHADOW_DIFF_MAX_VALUE_LEN];
+	char pending[AWS_IOT_SHADOW_DIFF_MAX_VALUE_LEN];
+} IoT_Shadow_Diff_Attribute_t;
+
+/**
+ * @brief Diff set state
+ *
+ * Allocated by the application, one per thing and section.
+ */
+typedef struct {
+	IoT_Shadow_Diff_Section_t section;
+	IoT_Shadow_Diff_Attribute_t attributes[AWS_IOT_SHADOW_DIFF_MAX_ATTRIBUTES];
+	uint8_t attributeCount;
+	bool isInFlight;
+	jsmn_parser parser;
+	jsmntok_t currentTokens[AWS_IOT_SHADOW_DIFF_MAX_TOKENS];
+	jsmntok_t ackedTokens[AWS_IOT_SHADOW_DIFF_MAX_TOKENS];
+	IoT_Shadow_Diff_Stats_t stats;
+} AWS_IoT_Shadow_Diff_t;
+
+/**
+ * @brief Initialize a diff set with no attribute and no snapshot
+ *
+ * @param pDiff Diff set state
+ * @param section Section the patch is written in
+ */
+IoT_Error_t aws_iot_shadow_diff_init(AWS_IoT_Shadow_Diff_t *pDiff, IoT_Shadow_Diff_Section_t section);
+
+/**
+ * @brief Track an attribute
+ *
+ * @param pDiff Diff set state
+ * @param pStruct Attribute, its value is read by aws_iot_shadow_diff_add_patch(). Must stay valid.
+ * @return SUCCESS, or MAX_SIZE_ERROR if AWS_IOT_SHADOW_DIFF_MAX_ATTRIBUTES are already tracked
+ */
+IoT_Error_t aws_iot_shadow_diff_add(AWS_IoT_Shadow_Diff_t *pDiff, jsonStruct_t *pStruct);
+
+/**
+ * @brief Write the changed attributes into a shadow document
+ *
+ * Used like aws_iot_shadow_add_reported(): between
+ * aws_iot_shadow_init_json_document() and aws_iot_finalize_json_document().
+ * Nothing is written when nothing changed.
+ *
+ * @param pDiff Diff set state
+ * @param pJsonDocument Document being built
+ * @param maxSizeOfJsonDocument Size of the document buffer
+ * @param pCount Number of attributes written
+ * @return SUCCESS, SHADOW_DIFF_IN_FLIGHT_ERROR, or SHADOW_JSON_BUFFER_TRUNCATED with the document
+ *         left as it was
+ */
+IoT_Error_t aws_iot_shadow_diff_add_patch(AWS_IoT_Shadow_Diff_t *pDiff, char *pJsonDocument,
+										  size_t maxSizeOfJsonDocument, uint8_t *pCount);
+
+/**
+ * @brief The document in flight was accepted, its values become the snapshot
+ */
+void aws_iot_shadow_diff_commit(AWS_IoT_Shadow_Diff_t *pDiff);
+
+/**
+ * @brief The document in flight was rejected or timed out, its values are written again next time
+ */
+void aws_iot_shadow_diff_discard(AWS_IoT_Shadow_Diff_t *pDiff);
+
+/**
+ * @brief Forget the snapshot, every attribute is written whole next time
+ *
+ * E.g. after the shadow was deleted, or changed by another writer.
+ */
+void aws_iot_shadow_diff_reset(AWS_IoT_Shadow_Diff_t *pDiff);
+
+/**
+ * @brief Copy the diff set counters
+ */
+void aws_iot_shadow_diff_get_stats(const AWS_IoT_Shadow_Diff_t *pDiff, IoT_Shadow_Diff_Stats_t *pStats);
+
+#ifdef AWS_IOT_SHADOW_DIFF_BENCHMARK
+/**
+ * @brief Compare merge-patch documents with documents holding every attribute
+ *
+ * Replays a sequence of sensor readings, settings changes and nested
+ * configuration edits, builds both documents for each step and prints
+ * their sizes and build times.
+ *
+ * @param steps Number of readings replayed
+ */
+void aws_iot_shadow_diff_benchmark(uint32_t steps);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AWS_IOT_SDK_SRC_IOT_SHADOW_DIFF_H_ */
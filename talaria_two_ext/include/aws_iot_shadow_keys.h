@@ -0,0 +1,122 @@
+/**
+  *****************************************************************************
+  * @file   aws_iot_shadow_keys.h
+  *
+  *****************************************************************************
+  * @attention
+  *
+  *
+  *  Copyright (c) 2022, InnoPhase, Inc.
+  *
+  *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  *  POSSIBILITY OF SUCH DAMAGE.
+  *
+  *****************************************************************************
+  */
+
+/**
+ * @file aws_iot_shadow_keys.h
+ * @brief Key lookup of shadow attributes
+ *
+ * Finding which attribute a key of a shadow document belongs to by
+ * comparing it with every registered key costs, for a document, the number
+ * of its keys times the number of attributes.
+ *
+ * A key index is built once, when the attributes are registered. It keeps
+ * them sorted by key length, then by key, and finds a key in
+ * log2(attributes) steps, most of them decided by the length alone. The key
+ * is given as a pointer and a length, so a jsmn token is looked up in place.
+ *
+ * Each attribute carries an id chosen by the application, usually its index
+ * in the application's attribute table, which the lookup returns with it.
+ */
+
+#ifndef AWS_IOT_SDK_SRC_IOT_SHADOW_KEYS_H_
+#define AWS_IOT_SDK_SRC_IOT_SHADOW_KEYS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "aws_iot_config.h"
+#include "aws_iot_error.h"
+#include "aws_iot_shadow_json_data.h"
+
+/** Attributes a key index can hold. */
+#ifndef AWS_IOT_SHADOW_KEYS_MAX_ATTRIBUTES
+#define AWS_IOT_SHADOW_KEYS_MAX_ATTRIBUTES 32
+#endif
+
+typedef struct {
+	jsonStruct_t *pStruct;
+	uint16_t keyLen;
+	uint8_t id;
+} IoT_Shadow_Key_t;
+
+/**
+ * @brief Key index state
+ *
+ * Allocated by the application.
+ */
+typedef struct {
+	IoT_Shadow_Key_t keys[AWS_IOT_SHADOW_KEYS_MAX_ATTRIBUTES];  ///< Sorted by keyLen, then key
+	uint8_t keyCount;
+} AWS_IoT_Shadow_Keys_t;
+
+/**
+ * @brief Initialize an empty key index
+ */
+IoT_Error_t aws_iot_shadow_keys_init(AWS_IoT_Shadow_Keys_t *pKeys);
+
+/**
+ * @brief Add an attribute
+ *
+ * @param pKeys Key index state
+ * @param pStruct Attribute, its pKey must stay valid
+ * @param id Returned with the attribute by aws_iot_shadow_keys_find()
+ * @return SUCCESS, FAILURE if the key is already in the index, or MAX_SIZE_ERROR if
+ *         AWS_IOT_SHADOW_KEYS_MAX_ATTRIBUTES are already added
+ */
+IoT_Error_t aws_iot_shadow_keys_add(AWS_IoT_Shadow_Keys_t *pKeys, jsonStruct_t *pStruct, uint8_t id);
+
+/**
+ * @brief Add the attributes of a table, with their index in the table as id
+ *
+ * @param pKeys Key index state
+ * @param pTable Attribute table
+ * @param count Number of attributes in pTable
+ * @param isDeltaOnly Add only the attributes with a delta callback
+ * @return SUCCESS, or the error of aws_iot_shadow_keys_add()
+ */
+IoT_Error_t aws_iot_shadow_keys_add_table(AWS_IoT_Shadow_Keys_t *pKeys, jsonStruct_t *pTable, uint8_t count,
+										  bool isDeltaOnly);
+
+/**
+ * @brief Find the attribute of a key
+ *
+ * @param pKeys Key index state
+ * @param pKey Key, not necessarily terminated
+ * @param keyLen Length of pKey
+ * @return The attribute and its id, NULL if the key is not in the index
+ */
+const IoT_Shadow_Key_t *aws_iot_shadow_keys_find(const AWS_IoT_Shadow_Keys_t *pKeys, const char *pKey,
+												 size_t keyLen);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AWS_IOT_SDK_SRC_IOT_SHADOW_KEYS_H_ */
@@ -0,0 +1,263 @@
+/**
+  *****************************************************************************
+  * @file   aws_iot_shadow_mirror.h
+  *
+  *****************************************************************************
+  * @attention
+  *
+  *
+  *  Copyright (c) 2022, InnoPhase, Inc.
+  *
+  *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  *  POSSIBILITY OF SUCH DAMAGE.
+  *
+  *****************************************************************************
+  */
+
+/**
+ * @file aws_iot_shadow_mirror.h
+ * @brief Local mirror of the shadow state, with version tracking
+ *
+ * A device that does not know what its shadow holds after a reconnect
+ * either gets the whole document, metadata included, or reports all its
+ * settings again to provoke the deltas it may have missed.
+ *
+ * The mirror keeps, for each tracked attribute, the reported and desired
+ * values last seen in the shadow, and the version of the shadow they
+ * belong to. It is fed the accepted responses of the updates and gets, and
+ * the deltas. Each shadow version is one change: while the versions seen
+ * follow each other, the mirror holds the shadow state. A version gap means
+ * a change the device did not see, and the mirror asks for a get.
+ *
+ * After a connect, aws_iot_shadow_mirror_sync() tells the least the device
+ * has to send:
+ *
+ *  - a get, when the version is not known or a gap was seen. The desired
+ *    values of the response that differ from the device values are applied
+ *    to them and passed to the callback of the attribute, as with a delta.
+ *  - an update with the attributes whose value differs from the reported
+ *    one in the mirror. Its response tells whether a change was missed.
+ *  - an update with one attribute, when no value changed and nothing tells
+ *    that the shadow did not change while offline.
+ *  - nothing, once a response confirmed the version, or right away when
+ *    the broker resumed the session and keeps the deltas.
+ *
+ * Values are compared as they are written in the documents: floats and
+ * doubles by their "%f" text, booleans by truth, strings by content, other
+ * types byte for byte.
+ *
+ * The mirror can be persisted to a file, so that a device that reboots
+ * starts from the version it last saw. It is saved by
+ * aws_iot_shadow_mirror_poll() at most once per save interval, and by
+ * aws_iot_shadow_mirror_save(), with aws_iot_file_replace() so that a reset
+ * during a save leaves the previous file or the new one.
+ *
+ * All calls must be made from the thread that yields the client.
+ */
+
+#ifndef AWS_IOT_SDK_SRC_IOT_SHADOW_MIRROR_H_
+#define AWS_IOT_SDK_SRC_IOT_SHADOW_MIRROR_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "aws_iot_config.h"
+#include "aws_iot_file_utils.h"
+#include "aws_iot_json_utils.h"
+#include "aws_iot_shadow_interface.h"
+
+/** Attributes a mirror can track. */
+#ifndef AWS_IOT_SHADOW_MIRROR_MAX_ATTRIBUTES
+#define AWS_IOT_SHADOW_MIRROR_MAX_ATTRIBUTES 8
+#endif
+
+/** Largest value kept, the dataLength of a tracked attribute, string terminator included. */
+#ifndef AWS_IOT_SHADOW_MIRROR_MAX_VALUE_LEN
+#define AWS_IOT_SHADOW_MIRROR_MAX_VALUE_LEN 16
+#endif
+
+/** Longest file path. */
+#ifndef AWS_IOT_SHADOW_MIRROR_MAX_PATH_LEN
+#define AWS_IOT_SHADOW_MIRROR_MAX_PATH_LEN AWS_IOT_FILE_MAX_PATH_LEN
+#endif
+
+/** Default shortest time between two saves of the file. */
+#ifndef AWS_IOT_SHADOW_MIRROR_SAVE_INTERVAL_MS
+#define AWS_IOT_SHADOW_MIRROR_SAVE_INTERVAL_MS 60000
+#endif
+
+/** Size of the file image: the header, then one record per attribute */
+#define AWS_IOT_SHADOW_MIRROR_HEADER_LEN 12
+#define AWS_IOT_SHADOW_MIRROR_RECORD_LEN (6 + 2 * AWS_IOT_SHADOW_MIRROR_MAX_VALUE_LEN)
+#define AWS_IOT_SHADOW_MIRROR_IMAGE_LEN \
+	(AWS_IOT_SHADOW_MIRROR_HEADER_LEN + AWS_IOT_SHADOW_MIRROR_MAX_ATTRIBUTES * AWS_IOT_SHADOW_MIRROR_RECORD_LEN)
+
+/**
+ * @brief Mirror parameters
+ */
+typedef struct {
+	const char *pFilePath;      ///< File the mirror is saved to, e.g. MOUNT_PATH "aws_shadow". NULL for none.
+	uint32_t saveInterval_ms;   ///< Shortest time between two saves by aws_iot_shadow_mirror_poll()
+} IoT_Shadow_Mirror_Params_t;
+
+extern const IoT_Shadow_Mirror_Params_t iotShadowMirrorParamsDefault;
+
+/**
+ * @brief What the device has to send to bring the mirror in sync with the shadow
+ */
+typedef enum {
+	IOT_SHADOW_MIRROR_SYNC_NONE = 0, ///< In sync
+	IOT_SHADOW_MIRROR_SYNC_WAIT,     ///< A get is in flight
+	IOT_SHADOW_MIRROR_SYNC_UPDATE,   ///< Report the attributes selected
+	IOT_SHADOW_MIRROR_SYNC_GET,      ///< Get the shadow document
+} IoT_Shadow_Mirror_Sync_t;
+
+/**
+ * @brief Mirror counters
+ */
+typedef struct {
+	uint32_t gets;        ///< Gets asked by aws_iot_shadow_mirror_sync()
+	uint32_t updates;     ///< Updates of changed values asked by aws_iot_shadow_mirror_sync()
+	uint32_t probes;      ///< Updates of one unchanged value asked by aws_iot_shadow_mirror_sync()
+	uint32_t gaps;        ///< Versions seen after a version missed
+	uint32_t stale;       ///< Responses and deltas older than the mirror, not applied
+	uint32_t applied;     ///< Desired values of a get applied to the device values
+	uint32_t saves;
+	uint32_t restored;    ///< Attributes restored from the file
+} IoT_Shadow_Mirror_Stats_t;
+
+typedef struct {
+	jsonStruct_t *pStruct;
+	uint32_t keyHash;
+	bool isReportedKnown;
+	bool isDesiredKnown;        ///< False also when the shadow has no desired value
+	uint8_t reported[AWS_IOT_SHADOW_MIRROR_MAX_VALUE_LEN];
+	uint8_t desired[AWS_IOT_SHADOW_MIRROR_MAX_VALUE_LEN];
+} IoT_Shadow_Mirror_Attribute_t;
+
+/**
+ * @brief Mirror state
+ *
+ * Allocated by the application, one per thing.
+ */
+typedef struct {
+	IoT_Shadow_Mirror_Params_t params;
+	IoT_Shadow_Mirror_Attribute_t attributes[AWS_IOT_SHADOW_MIRROR_MAX_ATTRIBUTES];
+	uint8_t attributeCount;
+	bool isVersionKnown;
+	uint32_t version;           ///< Version of the shadow the values belong to
+	bool isGap;                 ///< A version was missed, the values may be out of date
+	bool isConfirmed;           ///< The version was checked since the last connect
+	bool isGetInFlight;
+	bool isDirty;               ///< Changed since the last save
+	uint32_t lastSave_ms;
+	unsigned char image[AWS_IOT_SHADOW_MIRROR_IMAGE_LEN];
+	uint16_t loadedLen;         ///< Bytes of image loaded from the file, 0 if none
+	jsmn_parser parser;
+	jsmntok_t tokens[MAX_JSON_TOKEN_EXPECTED];
+	IoT_Shadow_Mirror_Stats_t stats;
+} AWS_IoT_Shadow_Mirror_t;
+
+/**
+ * @brief Initialize a mirror, loading its file if there is one
+ *
+ * @param pMirror Mirror state
+ * @param pParams Parameters, NULL selects the defaults
+ * @return SUCCESS, or MAX_SIZE_ERROR if the file path is too long. A missing or invalid file is not an error.
+ */
+IoT_Error_t aws_iot_shadow_mirror_init(AWS_IoT_Shadow_Mirror_t *pMirror, const IoT_Shadow_Mirror_Params_t *pParams);
+
+/**
+ * @brief Track an attribute
+ *
+ * Its values are restored from the file when it was saved with the same
+ * key. Adding an attribute the file does not hold makes the version unknown.
+ *
+ * @param pMirror Mirror state
+ * @param pStruct Attribute, pData holds the device value. Must stay valid.
+ * @return SUCCESS, MAX_SIZE_ERROR if AWS_IOT_SHADOW_MIRROR_MAX_ATTRIBUTES are already tracked or
+ *         the value is larger than AWS_IOT_SHADOW_MIRROR_MAX_VALUE_LEN, or FAILURE for a SHADOW_JSON_OBJECT
+ */
+IoT_Error_t aws_iot_shadow_mirror_add(AWS_IoT_Shadow_Mirror_t *pMirror, jsonStruct_t *pStruct);
+
+/**
+ * @brief Start a new sync, call it after each connect
+ *
+ * @param pMirror Mirror state
+ * @param isSessionResumed The broker kept the session, and delivers the deltas sent while offline
+ */
+void aws_iot_shadow_mirror_connected(AWS_IoT_Shadow_Mirror_t *pMirror, bool isSessionResumed);
+
+/**
+ * @brief Tell what to send to bring the mirror in sync with the shadow
+ *
+ * Call it after a connect, and again after each response until it returns
+ * IOT_SHADOW_MIRROR_SYNC_NONE. Feed the responses to
+ * aws_iot_shadow_mirror_on_response(), and a SHADOW_ACK_TIMEOUT for a get
+ * that could not be sent.
+ *
+ * @param pMirror Mirror state
+ * @param pSelected Filled with the attributes to report for IOT_SHADOW_MIRROR_SYNC_UPDATE
+ * @param maxSelected Size of pSelected
+ * @param pSelectedCount Number of attributes selected
+ * @return What to send
+ */
+IoT_Shadow_Mirror_Sync_t aws_iot_shadow_mirror_sync(AWS_IoT_Shadow_Mirror_t *pMirror, jsonStruct_t **pSelected,
+													uint8_t maxSelected, uint8_t *pSelectedCount);
+
+/**
+ * @brief Apply the response of a shadow request
+ *
+ * Takes the arguments of an fpActionCallback_t. A get answered with code
+ * 404 is a shadow that does not exist.
+ */
+void aws_iot_shadow_mirror_on_response(AWS_IoT_Shadow_Mirror_t *pMirror, ShadowActions_t action,
+									   Shadow_Ack_Status_t status, const char *pReceivedJsonDocument);
+
+/**
+ * @brief Apply a delta, from the delta callback of an attribute
+ *
+ * @param pMirror Mirror state
+ * @param pStruct Attribute, pData holds the desired value
+ * @param version Version of the delta, e.g. AWS_IoT_Shadow_Demux_t.deltaVersion. 0 if not known, which
+ *                makes the version of the mirror unknown unless the mirror already holds the value.
+ */
+void aws_iot_shadow_mirror_on_delta(AWS_IoT_Shadow_Mirror_t *pMirror, jsonStruct_t *pStruct, uint32_t version);
+
+/**
+ * @brief Save the mirror if it changed and the save interval is over
+ *
+ * @param pMirror Mirror state
+ * @return SUCCESS or the error of the save, tried again after the save interval
+ */
+IoT_Error_t aws_iot_shadow_mirror_poll(AWS_IoT_Shadow_Mirror_t *pMirror);
+
+/**
+ * @brief Save the mirror now if it changed
+ */
+IoT_Error_t aws_iot_shadow_mirror_save(AWS_IoT_Shadow_Mirror_t *pMirror);
+
+/**
+ * @brief Copy the mirror counters
+ */
+void aws_iot_shadow_mirror_get_stats(const AWS_IoT_Shadow_Mirror_t *pMirror, IoT_Shadow_Mirror_Stats_t *pStats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AWS_IOT_SDK_SRC_IOT_SHADOW_MIRROR_H_ */
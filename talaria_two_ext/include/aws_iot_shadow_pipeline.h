@@ -0,0 +1,204 @@
+/**
+  *****************************************************************************
+  * @file   aws_iot_shadow_pipeline.h
+  *
+  *****************************************************************************
+  * @attention
+  *
+  *
+  *  Copyright (c) 2022, InnoPhase, Inc.
+  *
+  *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  *  POSSIBILITY OF SUCH DAMAGE.
+  *
+  *****************************************************************************
+  */
+
+/**
+ * @file aws_iot_shadow_pipeline.h
+ * @brief Pipelined shadow updates
+ *
+ * The shadow client matches each response to its request by clientToken,
+ * with MAX_ACKS_TO_COMEIN_AT_ANY_GIVEN_TIME requests waiting at the same
+ * time, but an application that waits for the response of an update before
+ * sending the next one gets one update per round-trip.
+ *
+ * The pipeline sends updates without waiting, up to a configured depth, and
+ * calls the callback given with each update when its response comes. The
+ * document is copied, the caller's buffer can be reused at once.
+ *
+ * Updates in flight together may be applied by the shadow service in
+ * another order than they were sent. The version of the shadow in each
+ * accepted response tells the order they were applied in. When an update
+ * was applied after one sent later, its values may have overwritten the
+ * later ones, and the later document is sent again: the update sent last
+ * always wins, whatever the order of the responses. Updates that timed out
+ * have no known version and are not taken into account.
+ *
+ * Updates are sent with aws_iot_shadow_update(), or through a shadow
+ * demultiplexer (aws_iot_shadow_demux.h) when one is given in the
+ * parameters. Callbacks run from the yield of the client.
+ */
+
+#ifndef AWS_IOT_SDK_SRC_IOT_SHADOW_PIPELINE_H_
+#define AWS_IOT_SDK_SRC_IOT_SHADOW_PIPELINE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "aws_iot_config.h"
+#include "aws_iot_json_utils.h"
+#include "aws_iot_shadow_interface.h"
+#include "aws_iot_shadow_demux.h"
+
+/** Most updates in flight at the same time. Each one keeps a copy of its document. */
+#ifndef AWS_IOT_SHADOW_PIPELINE_MAX_DEPTH
+#define AWS_IOT_SHADOW_PIPELINE_MAX_DEPTH 4
+#endif
+
+#if AWS_IOT_SHADOW_PIPELINE_MAX_DEPTH > MAX_ACKS_TO_COMEIN_AT_ANY_GIVEN_TIME
+#error "AWS_IOT_SHADOW_PIPELINE_MAX_DEPTH must not be above MAX_ACKS_TO_COMEIN_AT_ANY_GIVEN_TIME"
+#endif
+
+/** Largest update document, clientToken included. */
+#ifndef AWS_IOT_SHADOW_PIPELINE_MAX_DOCUMENT_LEN
+#define AWS_IOT_SHADOW_PIPELINE_MAX_DOCUMENT_LEN AWS_IOT_MQTT_TX_BUF_LEN
+#endif
+
+/** Returned by aws_iot_shadow_pipeline_update() when the pipeline is full */
+#define SHADOW_PIPELINE_FULL_ERROR MQTT_CLIENT_NOT_IDLE_ERROR
+
+/**
+ * @brief Pipeline parameters
+ */
+typedef struct {
+	uint8_t depth;                  ///< Updates in flight at the same time, at most AWS_IOT_SHADOW_PIPELINE_MAX_DEPTH
+	AWS_IoT_Shadow_Demux_t *pDemux; ///< Send through this demultiplexer, NULL for aws_iot_shadow_update()
+} IoT_Shadow_Pipeline_Params_t;
+
+extern const IoT_Shadow_Pipeline_Params_t iotShadowPipelineParamsDefault;
+
+/**
+ * @brief Pipeline counters
+ */
+typedef struct {
+	uint32_t sent;
+	uint32_t accepted;
+	uint32_t rejected;
+	uint32_t timeouts;
+	uint32_t full;        ///< Updates refused with SHADOW_PIPELINE_FULL_ERROR
+	uint32_t reordered;   ///< Accepted updates applied after an update sent later
+	uint32_t reapplied;   ///< Documents sent again so that the last update sent wins
+	uint32_t noVersion;   ///< Accepted responses without a version
+	uint8_t maxInFlight;
+} IoT_Shadow_Pipeline_Stats_t;
+
+typedef enum {
+	IOT_SHADOW_PIPELINE_FREE = 0,
+	IOT_SHADOW_PIPELINE_IN_FLIGHT,
+	IOT_SHADOW_PIPELINE_REAPPLY,    ///< To be sent again by aws_iot_shadow_pipeline_poll()
+	IOT_SHADOW_PIPELINE_DONE,       ///< Kept until the updates sent before it are done
+} IoT_Shadow_Pipeline_Slot_State_t;
+
+typedef struct {
+	struct _AWS_IoT_Shadow_Pipeline *pPipeline;
+	IoT_Shadow_Pipeline_Slot_State_t state;
+	uint32_t sequence;          ///< Order the update was sent in
+	bool isVersionKnown;
+	uint32_t version;           ///< Version of the shadow made by the update, once accepted
+	fpActionCallback_t callback;
+	void *pCallbackContext;
+	uint8_t timeout_seconds;
+	char document[AWS_IOT_SHADOW_PIPELINE_MAX_DOCUMENT_LEN];
+} IoT_Shadow_Pipeline_Slot_t;
+
+/**
+ * @brief Pipeline state
+ *
+ * Allocated by the application, one per thing.
+ */
+typedef struct _AWS_IoT_Shadow_Pipeline {
+	AWS_IoT_Client *pClient;
+	const char *pThingName;
+	IoT_Shadow_Pipeline_Params_t params;
+#ifdef _ENABLE_THREAD_SUPPORT_
+	IoT_Mutex_t lock;
+#endif
+	IoT_Shadow_Pipeline_Slot_t slots[AWS_IOT_SHADOW_PIPELINE_MAX_DEPTH];
+	uint32_t nextSequence;
+	uint32_t retiredVersion;    ///< Highest version of the accepted updates no longer kept
+	jsmn_parser parser;
+	jsmntok_t tokens[MAX_JSON_TOKEN_EXPECTED];
+	IoT_Shadow_Pipeline_Stats_t stats;
+} AWS_IoT_Shadow_Pipeline_t;
+
+/**
+ * @brief Initialize a pipeline
+ *
+ * @param pPipeline Pipeline state
+ * @param pClient Shadow client, connected or not
+ * @param pThingName Thing name, not copied. Unused with a demultiplexer.
+ * @param pParams Parameters, NULL selects the defaults
+ * @return An IoT Error Type defining successful/failed initialization
+ */
+IoT_Error_t aws_iot_shadow_pipeline_init(AWS_IoT_Shadow_Pipeline_t *pPipeline, AWS_IoT_Client *pClient,
+										 const char *pThingName, const IoT_Shadow_Pipeline_Params_t *pParams);
+
+/**
+ * @brief Updates in flight are dropped without callback
+ */
+IoT_Error_t aws_iot_shadow_pipeline_deinit(AWS_IoT_Shadow_Pipeline_t *pPipeline);
+
+/**
+ * @brief Send a shadow update without waiting for the response of the previous ones
+ *
+ * @param pPipeline Pipeline state
+ * @param pJsonString Update document with a clientToken, as finalized by aws_iot_finalize_json_document()
+ * @param callback Called with the response, or SHADOW_ACK_TIMEOUT. May be NULL.
+ * @param pContextData Passed back to callback
+ * @param timeout_seconds Time to wait for the response
+ * @return SUCCESS, SHADOW_PIPELINE_FULL_ERROR, MAX_SIZE_ERROR or the error of the send
+ */
+IoT_Error_t aws_iot_shadow_pipeline_update(AWS_IoT_Shadow_Pipeline_t *pPipeline, const char *pJsonString,
+										   fpActionCallback_t callback, void *pContextData, uint8_t timeout_seconds);
+
+/**
+ * @brief Send again the documents overwritten by an update sent before them
+ *
+ * Call it after each yield.
+ *
+ * @param pPipeline Pipeline state
+ * @return SUCCESS or the error of the send, tried again at the next call
+ */
+IoT_Error_t aws_iot_shadow_pipeline_poll(AWS_IoT_Shadow_Pipeline_t *pPipeline);
+
+/**
+ * @brief Updates waiting for their response
+ */
+uint8_t aws_iot_shadow_pipeline_in_flight(AWS_IoT_Shadow_Pipeline_t *pPipeline);
+
+/**
+ * @brief Copy the pipeline counters
+ */
+void aws_iot_shadow_pipeline_get_stats(const AWS_IoT_Shadow_Pipeline_t *pPipeline,
+									   IoT_Shadow_Pipeline_Stats_t *pStats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AWS_IOT_SDK_SRC_IOT_SHADOW_PIPELINE_H_ */
@@ -0,0 +1,165 @@
+/**
+  *****************************************************************************
+  * @file   aws_iot_shadow_report.h
+  *
+  *****************************************************************************
+  * @attention
+  *
+  *
+  *  Copyright (c) 2022, InnoPhase, Inc.
+  *
+  *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  *  POSSIBILITY OF SUCH DAMAGE.
+  *
+  *****************************************************************************
+  */
+
+/**
+ * @file aws_iot_shadow_report.h
+ * @brief Change-driven reporting of shadow attributes
+ *
+ * A device that reports every reading at a fixed period sends mostly
+ * values the shadow already has. The reporter keeps, for each attribute,
+ * the value last reported and a policy, and selects at each reading only
+ * the attributes worth a report:
+ *
+ *  - the first value, and any value after aws_iot_shadow_report_force(),
+ *  - a value that moved from the last reported one by the deadband, the
+ *    larger of an absolute change and a fraction of the last value,
+ *  - the current value after maxSilence_ms without report, as a heartbeat
+ *    telling the cloud the device and its sensor are alive.
+ *
+ * A change is held back until minInterval_ms after the last report of the
+ * attribute. A value is taken as reported once selected: when the update
+ * carrying it is not sent, rejected or times out, the application calls
+ * aws_iot_shadow_report_force() so that the next reading reports it again.
+ *
+ * Numbers and booleans are compared by value, strings by a hash of their
+ * content. A SHADOW_JSON_OBJECT attribute has no deadband and is selected
+ * at every reading.
+ */
+
+#ifndef AWS_IOT_SDK_SRC_IOT_SHADOW_REPORT_H_
+#define AWS_IOT_SDK_SRC_IOT_SHADOW_REPORT_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "aws_iot_config.h"
+#include "aws_iot_error.h"
+#include "aws_iot_shadow_json_data.h"
+
+/** Attributes a reporter can track. */
+#ifndef AWS_IOT_SHADOW_REPORT_MAX_ATTRIBUTES
+#define AWS_IOT_SHADOW_REPORT_MAX_ATTRIBUTES 8
+#endif
+
+/**
+ * @brief Reporting policy of an attribute
+ *
+ * All zero reports every change.
+ */
+typedef struct {
+	float absoluteDeadband;   ///< Smallest change reported
+	float relativeDeadband;   ///< Smallest change reported, as a fraction of the last reported value
+	uint32_t minInterval_ms;  ///< Shortest time between two reports of a change
+	uint32_t maxSilence_ms;   ///< Time after which the value is reported even if unchanged, 0 for never
+} IoT_Shadow_Report_Policy_t;
+
+extern const IoT_Shadow_Report_Policy_t iotShadowReportPolicyDefault;
+
+/**
+ * @brief Reporter counters
+ */
+typedef struct {
+	uint32_t checked;     ///< Attribute values looked at by aws_iot_shadow_report_select()
+	uint32_t changed;     ///< Selected for a change beyond the deadband
+	uint32_t heartbeats;  ///< Selected after maxSilence_ms without report
+	uint32_t forced;      ///< Selected after aws_iot_shadow_report_force(), first values included
+	uint32_t held;        ///< Changes held back by minInterval_ms
+	uint32_t suppressed;  ///< Values within the deadband
+} IoT_Shadow_Report_Stats_t;
+
+typedef struct {
+	jsonStruct_t *pStruct;
+	IoT_Shadow_Report_Policy_t policy;
+	bool isForced;           ///< Selected at the next reading whatever its value
+	double lastValue;        ///< Numbers and booleans
+	uint32_t lastHash;       ///< Strings
+	uint32_t lastReport_ms;
+} IoT_Shadow_Report_Attribute_t;
+
+/**
+ * @brief Reporter state
+ *
+ * Allocated by the application.
+ */
+typedef struct {
+	IoT_Shadow_Report_Attribute_t attributes[AWS_IOT_SHADOW_REPORT_MAX_ATTRIBUTES];
+	uint8_t attributeCount;
+	IoT_Shadow_Report_Stats_t stats;
+} AWS_IoT_Shadow_Reporter_t;
+
+/**
+ * @brief Initialize a reporter with no attribute
+ */
+IoT_Error_t aws_iot_shadow_report_init(AWS_IoT_Shadow_Reporter_t *pReporter);
+
+/**
+ * @brief Track an attribute
+ *
+ * @param pReporter Reporter state
+ * @param pStruct Attribute, its value is read by aws_iot_shadow_report_select(). Must stay valid.
+ * @param pPolicy Reporting policy, copied. NULL reports every change.
+ * @return SUCCESS, or MAX_SIZE_ERROR if AWS_IOT_SHADOW_REPORT_MAX_ATTRIBUTES are already tracked
+ */
+IoT_Error_t aws_iot_shadow_report_add(AWS_IoT_Shadow_Reporter_t *pReporter, jsonStruct_t *pStruct,
+									  const IoT_Shadow_Report_Policy_t *pPolicy);
+
+/**
+ * @brief Select an attribute at the next reading, whatever its value
+ *
+ * @param pReporter Reporter state
+ * @param pStruct Attribute, NULL for all of them
+ * @return SUCCESS, or FAILURE if the attribute is not tracked
+ */
+IoT_Error_t aws_iot_shadow_report_force(AWS_IoT_Shadow_Reporter_t *pReporter, jsonStruct_t *pStruct);
+
+/**
+ * @brief Select the attributes to report from their current values
+ *
+ * Call it after updating the values. The selected values are taken as
+ * reported, force them again if their update is not accepted.
+ *
+ * @param pReporter Reporter state
+ * @param pSelected Filled with the selected attributes, in the order they were added
+ * @param maxSelected Size of pSelected
+ * @return Number of attributes selected, 0 if nothing needs a report
+ */
+uint8_t aws_iot_shadow_report_select(AWS_IoT_Shadow_Reporter_t *pReporter, jsonStruct_t **pSelected,
+									 uint8_t maxSelected);
+
+/**
+ * @brief Copy the reporter counters
+ */
+void aws_iot_shadow_report_get_stats(const AWS_IoT_Shadow_Reporter_t *pReporter, IoT_Shadow_Report_Stats_t *pStats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AWS_IOT_SDK_SRC_IOT_SHADOW_REPORT_H_ */
@@ -0,0 +1,162 @@
+/**
+  *****************************************************************************
+  * @file   aws_iot_thing_topics.h
+  *
+  *****************************************************************************
+  * @attention
+  *
+  *
+  *  Copyright (c) 2022, InnoPhase, Inc.
+  *
+  *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  *  POSSIBILITY OF SUCH DAMAGE.
+  *
+  *****************************************************************************
+  */
+
+/**
+ * @file aws_iot_thing_topics.h
+ * @brief Shadow and jobs topics of a thing, built once
+ *
+ * The shadow client of the SDK formats the topics of a request with
+ * snprintf into static buffers when the request is made, and the jobs
+ * client formats the topic of every jobs request again, each time reading
+ * the thing name and taking its length.
+ *
+ * The topic table holds the thing name and every shadow and jobs topic of
+ * the thing, with their lengths, built once when the thing is set up. The
+ * publish and subscribe paths take the topic from the table, and the thing
+ * name kept in it is the one the shadow modules and the callbacks are
+ * given. The topics of a job are the only ones built per request, by
+ * aws_iot_thing_topics_job(), from the jobs prefix of the table.
+ *
+ * A table built with a shadow name holds the topics of that named shadow,
+ *
+ *     $aws/things/<thingName>/shadow/name/<shadowName>/...
+ *
+ * in place of the classic ones. The jobs topics are those of the thing in
+ * both cases.
+ */
+
+#ifndef AWS_IOT_SDK_SRC_IOT_THING_TOPICS_H_
+#define AWS_IOT_SDK_SRC_IOT_THING_TOPICS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "aws_iot_config.h"
+#include "aws_iot_error.h"
+
+/** Longest shadow name of a named shadow table, the AWS IoT limit. */
+#ifndef AWS_IOT_THING_TOPICS_MAX_SHADOW_NAME
+#define AWS_IOT_THING_TOPICS_MAX_SHADOW_NAME 64
+#endif
+
+typedef enum {
+	/* shadow requests */
+	IOT_THING_TOPIC_SHADOW_UPDATE,
+	IOT_THING_TOPIC_SHADOW_GET,
+	IOT_THING_TOPIC_SHADOW_DELETE,
+	/* shadow responses */
+	IOT_THING_TOPIC_SHADOW_UPDATE_ACCEPTED,
+	IOT_THING_TOPIC_SHADOW_UPDATE_REJECTED,
+	IOT_THING_TOPIC_SHADOW_GET_ACCEPTED,
+	IOT_THING_TOPIC_SHADOW_GET_REJECTED,
+	IOT_THING_TOPIC_SHADOW_DELETE_ACCEPTED,
+	IOT_THING_TOPIC_SHADOW_DELETE_REJECTED,
+	IOT_THING_TOPIC_SHADOW_UPDATE_DELTA,
+	IOT_THING_TOPIC_SHADOW_UPDATE_DOCUMENTS,
+	IOT_THING_TOPIC_SHADOW_ALL,             ///< shadow/+/+, the responses of the shadow
+	/* jobs */
+	IOT_THING_TOPIC_JOBS_NOTIFY,
+	IOT_THING_TOPIC_JOBS_NOTIFY_NEXT,
+	IOT_THING_TOPIC_JOBS_GET,
+	IOT_THING_TOPIC_JOBS_GET_ALL,           ///< jobs/get/+
+	IOT_THING_TOPIC_JOBS_START_NEXT,
+	IOT_THING_TOPIC_JOBS_START_NEXT_ALL,    ///< jobs/start-next/+
+	IOT_THING_TOPIC_JOBS_DESCRIBE_NEXT,     ///< jobs/$next/get
+	IOT_THING_TOPIC_JOBS_DESCRIBE_NEXT_ALL, ///< jobs/$next/get/+
+	IOT_THING_TOPIC_JOBS_UPDATE_ACCEPTED_ALL, ///< jobs/+/update/accepted
+	IOT_THING_TOPIC_JOBS_UPDATE_REJECTED_ALL, ///< jobs/+/update/rejected
+	IOT_THING_TOPIC_COUNT
+} IoT_Thing_Topic_Id_t;
+
+#define IOT_THING_TOPIC_SHADOW_COUNT (IOT_THING_TOPIC_JOBS_NOTIFY)
+#define IOT_THING_TOPIC_JOBS_COUNT   (IOT_THING_TOPIC_COUNT - IOT_THING_TOPIC_JOBS_NOTIFY)
+
+/** Total length of the topic suffixes, after shadow/ and jobs/, and of their terminations. */
+#define AWS_IOT_THING_TOPICS_SUFFIX_LENGTH 256
+
+/** Room for the topics of the longest thing and shadow names. */
+#define AWS_IOT_THING_TOPICS_POOL_LENGTH                                                              \
+	(IOT_THING_TOPIC_SHADOW_COUNT *                                                                   \
+		 (sizeof("$aws/things//shadow/name//") - 1 + MAX_SIZE_OF_THING_NAME + AWS_IOT_THING_TOPICS_MAX_SHADOW_NAME) + \
+	 IOT_THING_TOPIC_JOBS_COUNT * (sizeof("$aws/things//jobs/") - 1 + MAX_SIZE_OF_THING_NAME) +         \
+	 AWS_IOT_THING_TOPICS_SUFFIX_LENGTH)
+
+typedef struct {
+	const char *pTopic;  ///< Terminated
+	uint16_t topicLen;
+} IoT_Thing_Topic_t;
+
+/**
+ * @brief Topic table state
+ *
+ * Allocated by the application, one per thing and per named shadow. The
+ * fields are read directly, e.g. pTopics->topics[IOT_THING_TOPIC_SHADOW_UPDATE].
+ */
+typedef struct {
+	char thingName[MAX_SIZE_OF_THING_NAME + 1];
+	uint16_t thingNameLen;
+	char shadowName[AWS_IOT_THING_TOPICS_MAX_SHADOW_NAME + 1];  ///< Empty for the classic shadow
+	uint16_t jobsPrefixLen;  ///< Length of $aws/things/<thingName>/jobs/
+	IoT_Thing_Topic_t topics[IOT_THING_TOPIC_COUNT];
+	char pool[AWS_IOT_THING_TOPICS_POOL_LENGTH];
+} AWS_IoT_Thing_Topics_t;
+
+/**
+ * @brief Build the topics of a thing
+ *
+ * @param pTopics Topic table state
+ * @param pThingName Thing name, copied
+ * @param pShadowName Shadow name, copied. NULL selects the classic shadow.
+ * @return SUCCESS, MAX_SIZE_ERROR if a name is empty or longer than MAX_SIZE_OF_THING_NAME or
+ *         AWS_IOT_THING_TOPICS_MAX_SHADOW_NAME, or FAILURE if a name holds a topic separator
+ *         or wildcard
+ */
+IoT_Error_t aws_iot_thing_topics_init(AWS_IoT_Thing_Topics_t *pTopics, const char *pThingName,
+									  const char *pShadowName);
+
+/**
+ * @brief Build the topic of a request on a job, $aws/things/<thingName>/jobs/<jobId>/<pAction>
+ *
+ * @param pTopics Topic table state
+ * @param pJobId Job id, e.g. from the notify-next document
+ * @param pAction "update" or "get"
+ * @param pBuffer Receives the terminated topic
+ * @param bufferSize Size of pBuffer, MAX_JOB_TOPIC_LENGTH_BYTES holds any topic
+ * @param pTopicLen Receives the length of the topic
+ * @return SUCCESS, or MAX_SIZE_ERROR if the topic does not fit
+ */
+IoT_Error_t aws_iot_thing_topics_job(const AWS_IoT_Thing_Topics_t *pTopics, const char *pJobId, const char *pAction,
+									 char *pBuffer, size_t bufferSize, uint16_t *pTopicLen);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AWS_IOT_SDK_SRC_IOT_THING_TOPICS_H_ */
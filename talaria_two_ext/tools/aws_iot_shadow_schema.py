@@ -0,0 +1,303 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2022, InnoPhase, Inc.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+# AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+# IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+# ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+# LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+# CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+# SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+# INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+# CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+# ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+# POSSIBILITY OF SUCH DAMAGE.
+#
+"""Generate the shadow attribute code of an application from its schema.
+
+    aws_iot_shadow_schema.py <schema.json> <output base>
+
+writes <output base>.h and <output base>.c with, from one description of the
+attributes:
+
+ - the attribute enum, its last value being the attribute count,
+ - the struct holding the attribute values and its instance,
+ - the jsonStruct_t table, in enum order,
+ - <prefix>_add_reported() and <prefix>_add_desired(), which write a set of
+   attributes into a shadow document like aws_iot_shadow_add_reported(),
+   each attribute with its own format,
+ - <prefix>_parsers[], one parser per attribute, in enum order.
+
+Schema:
+
+    {
+        "prefix": "inp301x_shadow",
+        "enum": "e_inp301x_aws_shadow_attributes_t",
+        "enumPrefix": "AWS_SHADOW_ATTRIBUTE_",
+        "count": "AWS_SHADOW_ATTRIBUTES_MAX_COUNT",
+        "struct": "inp301x_aws_shadow_params_t",
+        "params": "inp301x_shadow_params",
+        "table": "inp301x_shadow_attributes",
+        "attributes": [
+            {"key": "temperature", "field": "temperature", "type": "float"},
+            {"key": "sensorSwitch", "field": "sensorOn", "type": "bool",
+             "delta": "process_shadow_delta_callback"},
+            {"key": "firmware", "field": "firmware", "type": "string", "size": 16}
+        ]
+    }
+
+The enum name of an attribute is enumPrefix followed by its key in upper
+snake case, unless given as "name". "delta" names the delta callback of the
+attribute, declared by the generated header. Types: int8, int16, int32,
+uint8, uint16, uint32, float, double, bool and string, which needs "size".
+"""
+
+import json
+import os
+import re
+import sys
+
+# C type, SHADOW_JSON_ type, printf format and argument cast, SDK parser
+TYPES = {
+    'int8': ('int8_t', 'SHADOW_JSON_INT8', '%hhi', '', 'parseInteger8Value'),
+    'int16': ('int16_t', 'SHADOW_JSON_INT16', '%hi', '', 'parseInteger16Value'),
+    'int32': ('int32_t', 'SHADOW_JSON_INT32', '%i', '(int) ', 'parseInteger32Value'),
+    'uint8': ('uint8_t', 'SHADOW_JSON_UINT8', '%hhu', '', 'parseUnsignedInteger8Value'),
+    'uint16': ('uint16_t', 'SHADOW_JSON_UINT16', '%hu', '', 'parseUnsignedInteger16Value'),
+    'uint32': ('uint32_t', 'SHADOW_JSON_UINT32', '%u', '(unsigned) ', 'parseUnsignedInteger32Value'),
+    'float': ('float', 'SHADOW_JSON_FLOAT', '%f', '(double) ', 'parseFloatValue'),
+    'double': ('double', 'SHADOW_JSON_DOUBLE', '%f', '', 'parseDoubleValue'),
+    'bool': ('bool', 'SHADOW_JSON_BOOL', '%s', '', 'parseBooleanValue'),
+    'string': ('char', 'SHADOW_JSON_STRING', '\\"%s\\"', '', 'parseStringValue'),
+}
+
+LICENSE = """/**
+  *****************************************************************************
+  * @file   {name}
+  *
+  *****************************************************************************
+  * @attention
+  *
+  *
+  *  Copyright (c) 2022, InnoPhase, Inc.
+  *
+  *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  *  POSSIBILITY OF SUCH DAMAGE.
+  *
+  *****************************************************************************
+  */
+
+/* Generated by talaria_two_ext/tools/aws_iot_shadow_schema.py from {schema}, do not edit. */
+"""
+
+
+def fail(message):
+    sys.stderr.write('aws_iot_shadow_schema: %s\n' % message)
+    sys.exit(1)
+
+
+def upper_snake(key):
+    return re.sub(r'([a-z0-9])([A-Z])', r'\1_\2', key).upper()
+
+
+def load(path):
+    with open(path) as f:
+        schema = json.load(f)
+    for name in ('prefix', 'enum', 'enumPrefix', 'count', 'struct', 'params', 'table', 'attributes'):
+        if name not in schema:
+            fail('%s: no "%s"' % (path, name))
+    if not schema['attributes'] or len(schema['attributes']) > 32:
+        fail('%s: 1 to 32 attributes' % path)
+    keys = set()
+    for a in schema['attributes']:
+        if a.get('type') not in TYPES:
+            fail('%s: attribute %s: unknown type %s' % (path, a.get('key'), a.get('type')))
+        if 'string' == a['type'] and 0 >= int(a.get('size', 0)):
+            fail('%s: attribute %s: string without size' % (path, a['key']))
+        if a['key'] in keys:
+            fail('%s: attribute %s twice' % (path, a['key']))
+        keys.add(a['key'])
+        a.setdefault('field', a['key'])
+        a['name'] = schema['enumPrefix'] + a.get('name', upper_snake(a['key']))
+    return schema
+
+
+def header(schema, name, guard):
+    attributes = schema['attributes']
+    prefix = schema['prefix']
+    out = [LICENSE.format(name=name, schema=schema['source']),
+           '#ifndef %s' % guard,
+           '#define %s' % guard,
+           '',
+           '#include <stdbool.h>',
+           '#include <stdint.h>',
+           '#include <stddef.h>',
+           '',
+           '#include "aws_iot_error.h"',
+           '#include "aws_iot_json_utils.h"',
+           '#include "aws_iot_shadow_json_data.h"',
+           '',
+           'typedef enum',
+           '{']
+    out += ['    %s,' % a['name'] for a in attributes]
+    out += ['    %s,' % schema['count'],
+            '} %s;' % schema['enum'],
+            '',
+            '/* bit of an attribute in the attribute sets of %s_add_reported() and %s_add_desired() */' % (prefix, prefix),
+            '#define %s_BIT(attribute) (1UL << (attribute))' % prefix.upper(),
+            '',
+            'typedef struct',
+            '{']
+    width = max(len(TYPES[a['type']][0]) for a in attributes) + 1
+    for a in attributes:
+        ctype = TYPES[a['type']][0]
+        size = '[%d]' % int(a['size']) if 'string' == a['type'] else ''
+        out.append('    %s%s;' % (ctype.ljust(width), a['field'] + size))
+    out += ['} %s;' % schema['struct'],
+            '',
+            '/* parses the value at pToken into its field of %s */' % schema['params'],
+            'typedef IoT_Error_t (*%s_parser_t)(const char *pJsonString, jsmntok_t *pToken);' % prefix,
+            '',
+            'extern %s %s;' % (schema['struct'], schema['params']),
+            'extern jsonStruct_t %s[%s];' % (schema['table'], schema['count']),
+            'extern const %s_parser_t %s_parsers[%s];' % (prefix, prefix, schema['count']),
+            '']
+    callbacks = sorted(set(a['delta'] for a in attributes if 'delta' in a))
+    for cb in callbacks:
+        out.append('void %s(const char *pJsonString, uint32_t JsonStringDataLen, jsonStruct_t *pContext);' % cb)
+    if callbacks:
+        out.append('')
+    for section in ('reported', 'desired'):
+        out += ['/**',
+                ' * Writes the attributes of a set into the \'%s\' section of a shadow document,' % section,
+                ' * like aws_iot_shadow_add_%s()' % section,
+                ' * @param attributes %s_BIT() of each attribute' % prefix.upper(),
+                ' * @return SUCCESS, or SHADOW_JSON_BUFFER_TRUNCATED with the document left as it was',
+                ' */',
+                'IoT_Error_t %s_add_%s(char *pJsonDocument, size_t maxSizeOfJsonDocument, uint32_t attributes);'
+                % (prefix, section),
+                '']
+    out += ['#endif', '']
+    return '\n'.join(out)
+
+
+def source(schema, name, header_name):
+    attributes = schema['attributes']
+    prefix = schema['prefix']
+    params = schema['params']
+    out = [LICENSE.format(name=name, schema=schema['source']),
+           '#include <stdio.h>',
+           '#include <string.h>',
+           '',
+           '#include "%s"' % header_name,
+           '',
+           '%s %s;' % (schema['struct'], params),
+           '',
+           'jsonStruct_t %s[%s] = {' % (schema['table'], schema['count'])]
+    for a in attributes:
+        ctype, jtype = TYPES[a['type']][0:2]
+        data = ('%s.%s' if 'string' == a['type'] else '&(%s.%s)') % (params, a['field'])
+        size = 'sizeof(%s.%s)' % (params, a['field'])
+        out.append('    [%s] = {"%s", %s, %s, %s, %s},' % (a['name'], a['key'], data, size, jtype, a.get('delta', 'NULL')))
+    out += ['};', '']
+
+    for a in attributes:
+        parser = TYPES[a['type']][4]
+        if 'string' == a['type']:
+            call = '%s(%s.%s, sizeof(%s.%s), pJsonString, pToken)' % (parser, params, a['field'], params, a['field'])
+        else:
+            call = '%s(&(%s.%s), pJsonString, pToken)' % (parser, params, a['field'])
+        out += ['static IoT_Error_t %s_parse_%s(const char *pJsonString, jsmntok_t *pToken)' % (prefix, a['key']),
+                '{',
+                '    return %s;' % call,
+                '}',
+                '']
+    out.append('const %s_parser_t %s_parsers[%s] = {' % (prefix, prefix, schema['count']))
+    out += ['    [%s] = %s_parse_%s,' % (a['name'], prefix, a['key']) for a in attributes]
+    out += ['};', '']
+
+    out += ['/* Writes the attributes of a set, each followed by a comma, closes the section with the last one */',
+            'static IoT_Error_t %s_add_section(char *pJsonDocument, size_t maxSizeOfJsonDocument,' % prefix,
+            '        const char *pSection, uint32_t attributes)',
+            '{',
+            '    size_t start = strlen(pJsonDocument);',
+            '    size_t len = start;',
+            '    int written;',
+            '',
+            '    attributes &= 0x%XUL;' % ((1 << len(attributes)) - 1),
+            '    if (0 == attributes) {',
+            '        return SUCCESS;',
+            '    }',
+            '',
+            '    written = snprintf(&(pJsonDocument[len]), maxSizeOfJsonDocument - len, "\\"%s\\":{", pSection);',
+            '    if (0 > written || maxSizeOfJsonDocument - len <= (size_t) written) {',
+            '        goto truncated;',
+            '    }',
+            '    len += (size_t) written;',
+            '']
+    for a in attributes:
+        fmt, cast = TYPES[a['type']][2:4]
+        value = '%s.%s' % (params, a['field'])
+        if 'bool' == a['type']:
+            value = '%s ? "true" : "false"' % value
+        out += ['    if (0 != (attributes & %s_BIT(%s))) {' % (prefix.upper(), a['name']),
+                '        written = snprintf(&(pJsonDocument[len]), maxSizeOfJsonDocument - len,',
+                '                "\\"%s\\":%s,", %s%s);' % (a['key'], fmt, cast, value),
+                '        if (0 > written || maxSizeOfJsonDocument - len <= (size_t) written) {',
+                '            goto truncated;',
+                '        }',
+                '        len += (size_t) written;',
+                '    }']
+    out += ['',
+            '    if (maxSizeOfJsonDocument - len <= 1) {',
+            '        goto truncated;',
+            '    }',
+            '    pJsonDocument[len - 1] = \'}\';',
+            '    pJsonDocument[len] = \',\';',
+            '    pJsonDocument[len + 1] = \'\\0\';',
+            '    return SUCCESS;',
+            '',
+            'truncated:',
+            '    pJsonDocument[start] = \'\\0\';',
+            '    return SHADOW_JSON_BUFFER_TRUNCATED;',
+            '}',
+            '']
+    for section in ('reported', 'desired'):
+        out += ['IoT_Error_t %s_add_%s(char *pJsonDocument, size_t maxSizeOfJsonDocument, uint32_t attributes)'
+                % (prefix, section),
+                '{',
+                '    return %s_add_section(pJsonDocument, maxSizeOfJsonDocument, "%s", attributes);' % (prefix, section),
+                '}',
+                '']
+    return '\n'.join(out)
+
+
+def write(path, text):
+    with open(path, 'w') as f:
+        f.write(text)
+
+
+def main():
+    if 3 != len(sys.argv):
+        fail('usage: aws_iot_shadow_schema.py <schema.json> <output base>')
+    schema = load(sys.argv[1])
+    schema['source'] = os.path.basename(sys.argv[1])
+    base = sys.argv[2]
+    header_name = os.path.basename(base) + '.h'
+    guard = re.sub(r'[^A-Za-z0-9]', '_', header_name).upper()
+    write(base + '.h', header(schema, header_name, guard))
+    write(base + '.c', source(schema, os.path.basename(base) + '.c', header_name))
+
+
+if __name__ == '__main__':
+    main()
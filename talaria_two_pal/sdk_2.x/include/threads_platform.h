@@ -22,6 +22,9 @@ extern "C" {
 #endif
 
 #include <kernel/os.h>
+
+#include "aws_iot_error.h"
+
 /**
  * @brief Mutex Type
  *
@@ -32,6 +35,50 @@ typedef struct _IoT_Mutex_t {
 struct os_semaphore  lock;
 }IoT_Mutex_t;
 
+/**
+ * @brief Thread Type
+ *
+ * definition of the Thread struct. Platform specific
+ *
+ */
+typedef struct _IoT_Thread_t {
+struct os_thread *handle;
+void (*entry)(void *);
+void *arg;
+}IoT_Thread_t;
+
+/**
+ * @brief Semaphore Type
+ *
+ * Counting semaphore, posted by any thread. Platform specific
+ *
+ */
+typedef struct _IoT_Semaphore_t {
+struct os_semaphore sem;
+}IoT_Semaphore_t;
+
+/**
+ * @brief Default priority for threads created through aws_iot_thread_create()
+ */
+#define IOT_THREAD_DEFAULT_PRIORITY 1
+
+/**
+ * @brief Thread entry point
+ *
+ * The entry function must not return while the thread is in use. It should
+ * call aws_iot_thread_exit() once it has finished its work.
+ */
+typedef void (*IoT_Thread_Entry_t)(void *pArg);
+
+IoT_Error_t aws_iot_thread_create(IoT_Thread_t *pThread, const char *pName, IoT_Thread_Entry_t entry,
+								  void *pArg, uint32_t stackSize, uint32_t priority);
+void aws_iot_thread_exit(IoT_Thread_t *pThread);
+
+IoT_Error_t aws_iot_thread_sem_init(IoT_Semaphore_t *pSem);
+void aws_iot_thread_sem_wait(IoT_Semaphore_t *pSem);
+void aws_iot_thread_sem_post(IoT_Semaphore_t *pSem);
+void aws_iot_thread_sem_destroy(IoT_Semaphore_t *pSem);
+
 #ifdef __cplusplus
 }
 #endif
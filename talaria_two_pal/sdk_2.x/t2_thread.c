@@ -93,6 +93,85 @@ IoT_Error_t aws_iot_thread_mutex_destroy(IoT_Mutex_t *pMutex) {
 	return SUCCESS;
 }
 
+static void *_aws_iot_thread_entry(void *arg) {
+	IoT_Thread_t *pThread = (IoT_Thread_t *) arg;
+
+	pThread->entry(pThread->arg);
+	return NULL;
+}
+
+/**
+ * @brief Create a thread
+ *
+ * Call this function to create a thread running the provided entry function.
+ * The IoT_Thread_t must stay valid for as long as the thread is running.
+ *
+ * @param IoT_Thread_t - pointer to the thread to be created
+ * @param pName - name of the thread, used for debugging only
+ * @param entry - function run by the thread
+ * @param pArg - argument passed to the entry function
+ * @param stackSize - stack size of the thread in bytes
+ * @param priority - platform specific priority of the thread
+ * @return IoT_Error_t - error code indicating result of operation
+ */
+IoT_Error_t aws_iot_thread_create(IoT_Thread_t *pThread, const char *pName, IoT_Thread_Entry_t entry,
+								  void *pArg, uint32_t stackSize, uint32_t priority) {
+	pThread->entry = entry;
+	pThread->arg = pArg;
+	pThread->handle = os_create_thread(pName, _aws_iot_thread_entry, (os_threadarg_t) pThread, priority, stackSize);
+
+	return (NULL != pThread->handle) ? SUCCESS : FAILURE;
+}
+
+/**
+ * @brief Exit the calling thread
+ *
+ * Call this function as the last statement of a thread entry function
+ *
+ * @param IoT_Thread_t - pointer to the thread that is exiting
+ */
+void aws_iot_thread_exit(IoT_Thread_t *pThread) {
+	/* returning from the entry function terminates the thread */
+	pThread->handle = NULL;
+}
+
+/**
+ * @brief Initialize the provided semaphore, with a count of 0
+ *
+ * @param IoT_Semaphore_t - pointer to the semaphore to be initialized
+ * @return IoT_Error_t - error code indicating result of operation
+ */
+IoT_Error_t aws_iot_thread_sem_init(IoT_Semaphore_t *pSem) {
+	os_sem_init(&(pSem->sem), 0);
+	return SUCCESS;
+}
+
+/**
+ * @brief Wait until the provided semaphore is posted
+ *
+ * @param IoT_Semaphore_t - pointer to the semaphore to wait on
+ */
+void aws_iot_thread_sem_wait(IoT_Semaphore_t *pSem) {
+	os_sem_wait(&(pSem->sem));
+}
+
+/**
+ * @brief Post the provided semaphore
+ *
+ * @param IoT_Semaphore_t - pointer to the semaphore to be posted
+ */
+void aws_iot_thread_sem_post(IoT_Semaphore_t *pSem) {
+	os_sem_post(&(pSem->sem));
+}
+
+/**
+ * @brief Destroy the provided semaphore
+ *
+ * @param IoT_Semaphore_t - pointer to the semaphore to be destroyed
+ */
+void aws_iot_thread_sem_destroy(IoT_Semaphore_t *pSem) {
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,48 @@
+/**
+  *****************************************************************************
+  * @file   memory_platform.h
+  *
+  *****************************************************************************
+  * @attention
+  *
+  *
+  *  Copyright (c) 2022, InnoPhase, Inc.
+  *
+  *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  *  POSSIBILITY OF SUCH DAMAGE.
+  *
+  *****************************************************************************
+  */
+
+#ifndef IOTSDKC_MEMORY_PLATFORM_H_
+#define IOTSDKC_MEMORY_PLATFORM_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "osal.h"
+
+/**
+ * @brief Heap allocation used by code shared between the sdk_2.x and sdk_3.x ports
+ *
+ * Buffers returned by the Talaria file system utilities (utils_file_get())
+ * must be released with aws_iot_platform_free().
+ */
+#define aws_iot_platform_malloc(size) osal_alloc(size)
+#define aws_iot_platform_free(ptr) osal_free(ptr)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* IOTSDKC_MEMORY_PLATFORM_H_ */
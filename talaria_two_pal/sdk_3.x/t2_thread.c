@@ -98,6 +98,82 @@ IoT_Error_t aws_iot_thread_mutex_destroy(IoT_Mutex_t *pMutex) {
     return SUCCESS;
 }
 
+/**
+ * @brief Create a thread
+ *
+ * Call this function to create a thread running the provided entry function.
+ * The IoT_Thread_t must stay valid for as long as the thread is running.
+ *
+ * @param IoT_Thread_t - pointer to the thread to be created
+ * @param pName - name of the thread, used for debugging only
+ * @param entry - function run by the thread
+ * @param pArg - argument passed to the entry function
+ * @param stackSize - stack size of the thread in bytes
+ * @param priority - platform specific priority of the thread
+ * @return IoT_Error_t - error code indicating result of operation
+ */
+IoT_Error_t aws_iot_thread_create(IoT_Thread_t *pThread, const char *pName, IoT_Thread_Entry_t entry,
+								  void *pArg, uint32_t stackSize, uint32_t priority) {
+    if (pdPASS != xTaskCreate(entry, pName, stackSize / sizeof(StackType_t), pArg, priority, &(pThread->handle))) {
+        pThread->handle = NULL;
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+/**
+ * @brief Exit the calling thread
+ *
+ * Call this function as the last statement of a thread entry function
+ *
+ * @param IoT_Thread_t - pointer to the thread that is exiting
+ */
+void aws_iot_thread_exit(IoT_Thread_t *pThread) {
+    pThread->handle = NULL;
+    vTaskDelete(NULL);
+}
+
+/**
+ * @brief Initialize the provided semaphore, with a count of 0
+ *
+ * @param IoT_Semaphore_t - pointer to the semaphore to be initialized
+ * @return IoT_Error_t - error code indicating result of operation
+ */
+IoT_Error_t aws_iot_thread_sem_init(IoT_Semaphore_t *pSem) {
+    pSem->semaphore = xSemaphoreCreateCounting(UINT32_MAX, 0);
+    if (NULL == pSem->semaphore) {
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+/**
+ * @brief Wait until the provided semaphore is posted
+ *
+ * @param IoT_Semaphore_t - pointer to the semaphore to wait on
+ */
+void aws_iot_thread_sem_wait(IoT_Semaphore_t *pSem) {
+    (void) xSemaphoreTake(pSem->semaphore, portMAX_DELAY);
+}
+
+/**
+ * @brief Post the provided semaphore
+ *
+ * @param IoT_Semaphore_t - pointer to the semaphore to be posted
+ */
+void aws_iot_thread_sem_post(IoT_Semaphore_t *pSem) {
+    (void) xSemaphoreGive(pSem->semaphore);
+}
+
+/**
+ * @brief Destroy the provided semaphore
+ *
+ * @param IoT_Semaphore_t - pointer to the semaphore to be destroyed
+ */
+void aws_iot_thread_sem_destroy(IoT_Semaphore_t *pSem) {
+    vSemaphoreDelete(pSem->semaphore);
+}
+
 #ifdef __cplusplus
 }
 #endif